@@ -0,0 +1,96 @@
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HFP_DSP_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HFP_DSP_SSE2
+#endif
+
+#include "hfp_dsp.h"
+
+void hfp_dsp_downmix(const int16_t *in, int channels, int16_t *out, unsigned int frames)
+{
+	unsigned int i = 0;
+
+	if (channels == 1) {
+		memcpy(out, in, frames * sizeof(int16_t));
+		return;
+	}
+
+	if (channels == 2) {
+#if defined(HFP_DSP_NEON)
+		for (; i + 8 <= frames; i += 8) {
+			int16x8x2_t lr = vld2q_s16(in + 2 * i);
+			vst1q_s16(out + i, vhaddq_s16(lr.val[0], lr.val[1]));
+		}
+#elif defined(HFP_DSP_SSE2)
+		const __m128i one = _mm_set1_epi16(1);
+
+		for (; i + 8 <= frames; i += 8) {
+			/* l + r of each frame in 32 bits, halved, packed back */
+			__m128i lo = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(in + 2 * i)), one);
+			__m128i hi = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(in + 2 * i + 8)), one);
+			_mm_storeu_si128((__m128i *)(out + i),
+					_mm_packs_epi32(_mm_srai_epi32(lo, 1), _mm_srai_epi32(hi, 1)));
+		}
+#endif
+		for (; i < frames; i++)
+			out[i] = (in[2 * i] + in[2 * i + 1]) >> 1;
+		return;
+	}
+
+	for (; i < frames; i++) {
+		int sum = 0;
+
+		for (int c = 0; c < channels; c++)
+			sum += in[i * channels + c];
+		out[i] = sum / channels;
+	}
+}
+
+void hfp_dsp_upmix(const int16_t *in, int16_t *out, int channels, unsigned int frames)
+{
+	unsigned int i = 0;
+
+	if (channels == 1) {
+		memcpy(out, in, frames * sizeof(int16_t));
+		return;
+	}
+
+	if (channels == 2) {
+#if defined(HFP_DSP_NEON)
+		for (; i + 8 <= frames; i += 8) {
+			int16x8x2_t lr;
+
+			lr.val[0] = lr.val[1] = vld1q_s16(in + i);
+			vst2q_s16(out + 2 * i, lr);
+		}
+#elif defined(HFP_DSP_SSE2)
+		for (; i + 8 <= frames; i += 8) {
+			__m128i m = _mm_loadu_si128((const __m128i *)(in + i));
+			_mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi16(m, m));
+			_mm_storeu_si128((__m128i *)(out + 2 * i + 8), _mm_unpackhi_epi16(m, m));
+		}
+#endif
+		for (; i < frames; i++)
+			out[2 * i] = out[2 * i + 1] = in[i];
+		return;
+	}
+
+	for (; i < frames; i++)
+		for (int c = 0; c < channels; c++)
+			out[i * channels + c] = in[i];
+}
+
+const char *hfp_dsp_simd(void)
+{
+#if defined(HFP_DSP_NEON)
+	return "neon";
+#elif defined(HFP_DSP_SSE2)
+	return "sse2";
+#else
+	return "c";
+#endif
+}
@@ -0,0 +1,29 @@
+#ifndef __DEVICEIO_BA_HFP_DSP__
+#define __DEVICEIO_BA_HFP_DSP__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Channel conversion for the call audio, which is mono speech whatever
+ * the PCMs at either end want. Interleaved S16; NEON or SSE2 for the
+ * stereo cases where the compiler has them, plain C for the rest.
+ */
+
+/* average channels of every in frame into one out sample */
+void hfp_dsp_downmix(const int16_t *in, int channels, int16_t *out, unsigned int frames);
+
+/* copy every in sample into all channels of an out frame */
+void hfp_dsp_upmix(const int16_t *in, int16_t *out, int channels, unsigned int frames);
+
+/* "neon", "sse2" or "c" */
+const char *hfp_dsp_simd(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DEVICEIO_BA_HFP_DSP__ */
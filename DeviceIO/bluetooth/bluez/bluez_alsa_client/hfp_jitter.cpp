@@ -0,0 +1,204 @@
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HFP_JITTER_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HFP_JITTER_SSE2
+#endif
+
+#include "hfp_jitter.h"
+
+/* ratio per frame of error, and per frame second of it */
+#define HFP_JITTER_KP			1.5e-5
+#define HFP_JITTER_KI			4e-7
+/* how much of each new fill reading goes into the level */
+#define HFP_JITTER_SMOOTH		0.1
+
+void hfp_jitter_init(hfp_jitter_t *jb, int channels, unsigned int in_rate, unsigned int out_rate,
+		unsigned int period, unsigned int buffer)
+{
+	memset(jb, 0, sizeof(*jb));
+	jb->channels = channels > 8 ? 8 : channels;
+	jb->rate = in_rate;
+	jb->period = period;
+	jb->step = (double)in_rate / out_rate;
+	jb->ratio = jb->step;
+
+	jb->min_target = period + period / 4;
+	jb->max_target = buffer > 2 * period ? buffer - period : period * 2;
+	jb->target = period * 2;
+	if (jb->target > jb->max_target)
+		jb->target = jb->max_target;
+	jb->level = jb->target;
+	jb->low = LONG_MAX;
+}
+
+#if defined(HFP_JITTER_NEON) || defined(HFP_JITTER_SSE2)
+/*
+ * Four mono outputs at a time, for as long as they all fall inside x:
+ * offsets from the first position in float, each sample pair fetched
+ * in one 32 bit load, weighed in Q14 and summed in 32 bits.
+ */
+static unsigned int resample_mono(const int16_t *x, unsigned int x_frames, double *pos, double ratio,
+		int16_t *out, unsigned int out_frames)
+{
+	const float r = (float)ratio;
+	unsigned int produced = 0, j;
+	double p = *pos;
+	int32_t idx[4];
+	uint32_t pair[4];
+
+	while (produced + 4 <= out_frames && p + 3 * ratio + 2 < x_frames) {
+		j = (unsigned int)p;
+#if defined(HFP_JITTER_NEON)
+		static const float steps[4] = { 0, 1, 2, 3 };
+		float32x4_t o = vmlaq_n_f32(vdupq_n_f32((float)(p - j)), vld1q_f32(steps), r);
+		int32x4_t io = vcvtq_s32_f32(o);
+		int32x4_t w = vcvtq_s32_f32(vmlaq_n_f32(vdupq_n_f32(0.5f), vsubq_f32(o, vcvtq_f32_s32(io)), 16384.0f));
+		int32x4_t wp = vorrq_s32(vsubq_s32(vdupq_n_s32(16384), w), vshlq_n_s32(w, 16));
+		int32x4_t lo, hi;
+
+		vst1q_s32(idx, io);
+		for (int k = 0; k < 4; k++)
+			memcpy(&pair[k], x + j + idx[k], sizeof(pair[k]));
+		int16x8_t xx = vreinterpretq_s16_u32(vld1q_u32(pair));
+		int16x8_t ww = vreinterpretq_s16_s32(wp);
+		lo = vmull_s16(vget_low_s16(xx), vget_low_s16(ww));
+		hi = vmull_s16(vget_high_s16(xx), vget_high_s16(ww));
+		lo = vcombine_s32(vpadd_s32(vget_low_s32(lo), vget_high_s32(lo)),
+				vpadd_s32(vget_low_s32(hi), vget_high_s32(hi)));
+		vst1_s16(out + produced, vmovn_s32(vrshrq_n_s32(lo, 14)));
+#else
+		__m128 o = _mm_add_ps(_mm_set1_ps((float)(p - j)), _mm_mul_ps(_mm_set_ps(3, 2, 1, 0), _mm_set1_ps(r)));
+		__m128i io = _mm_cvttps_epi32(o);
+		__m128i w = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(o, _mm_cvtepi32_ps(io)),
+				_mm_set1_ps(16384.0f)), _mm_set1_ps(0.5f)));
+		__m128i wp = _mm_or_si128(_mm_sub_epi32(_mm_set1_epi32(16384), w), _mm_slli_epi32(w, 16));
+		__m128i sum;
+
+		_mm_storeu_si128((__m128i *)idx, io);
+		for (int k = 0; k < 4; k++)
+			memcpy(&pair[k], x + j + idx[k], sizeof(pair[k]));
+		sum = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)pair), wp);
+		sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(8192)), 14);
+		_mm_storel_epi64((__m128i *)(out + produced), _mm_packs_epi32(sum, sum));
+#endif
+		produced += 4;
+		p += 4 * ratio;
+	}
+
+	*pos = p;
+	return produced;
+}
+#endif
+
+unsigned int hfp_jitter_resample(hfp_jitter_t *jb, const int16_t *in, unsigned int in_frames,
+		unsigned int *consumed, int16_t *out, unsigned int out_frames)
+{
+	const int ch = jb->channels;
+	const int16_t *x0, *x1;
+	unsigned int produced = 0, j;
+	double p = jb->pos, t;
+
+	/* jb->prev sits at position 0, in[k] at k + 1 */
+	while (produced < out_frames) {
+		j = (unsigned int)p;
+		if (j + 1 > in_frames)
+			break;
+#if defined(HFP_JITTER_NEON) || defined(HFP_JITTER_SSE2)
+		/* past prev, in - 1 is the whole input at the same positions */
+		if (ch == 1 && j > 0) {
+			unsigned int n = resample_mono(in - 1, in_frames + 1, &p, jb->ratio,
+					out + produced, out_frames - produced);
+			produced += n;
+			if (n > 0)
+				continue;
+		}
+#endif
+		x0 = j == 0 ? jb->prev : in + (j - 1) * ch;
+		x1 = in + j * ch;
+		t = p - j;
+		for (int c = 0; c < ch; c++)
+			out[produced * ch + c] = (int16_t)lrint(x0[c] + (x1[c] - x0[c]) * t);
+		produced++;
+		p += jb->ratio;
+	}
+
+	j = (unsigned int)p;
+	if (j > in_frames)
+		j = in_frames;
+	if (j > 0)
+		memcpy(jb->prev, in + (j - 1) * ch, ch * sizeof(int16_t));
+	jb->pos = p - j;
+	*consumed = j;
+
+	return produced;
+}
+
+static void target_raise(hfp_jitter_t *jb)
+{
+	jb->target += jb->period / 2;
+	if (jb->target > jb->max_target)
+		jb->target = jb->max_target;
+	jb->window = 0;
+	jb->low = LONG_MAX;
+}
+
+void hfp_jitter_update(hfp_jitter_t *jb, long fill_before, long fill_after, unsigned int consumed)
+{
+	double err, corr, limit = HFP_JITTER_MAX_PPM * 1e-6;
+
+	/* the first write goes into an empty buffer, that says nothing yet */
+	if (!jb->primed) {
+		jb->primed = 1;
+		fill_before = (long)jb->level;
+	}
+
+	/* adapt the target to how close to dry the buffer gets */
+	if (fill_before < jb->low)
+		jb->low = fill_before;
+	jb->window += consumed;
+	if (fill_before < (long)jb->period / 4) {
+		/* one step at a time: wait for the level to get to the last one */
+		if (jb->level > jb->target - jb->period / 4)
+			target_raise(jb);
+	} else if (jb->window >= HFP_JITTER_WINDOW_S * jb->rate) {
+		/* only if it would still have stayed half a period clear */
+		if (jb->low - (long)jb->period / 4 > (long)jb->period / 2 &&
+				jb->target - jb->period / 4 >= jb->min_target)
+			jb->target -= jb->period / 4;
+		jb->window = 0;
+		jb->low = LONG_MAX;
+	}
+
+	/* too full: take more input for each frame out, and the other way round */
+	jb->level += (fill_after - jb->level) * HFP_JITTER_SMOOTH;
+	err = jb->level - jb->target;
+	jb->integral += err * consumed / jb->rate;
+	if (jb->integral * HFP_JITTER_KI > limit)
+		jb->integral = limit / HFP_JITTER_KI;
+	else if (jb->integral * HFP_JITTER_KI < -limit)
+		jb->integral = -limit / HFP_JITTER_KI;
+
+	corr = HFP_JITTER_KP * err + HFP_JITTER_KI * jb->integral;
+	if (corr > limit)
+		corr = limit;
+	else if (corr < -limit)
+		corr = -limit;
+	jb->ratio = jb->step * (1.0 + corr);
+}
+
+void hfp_jitter_underrun(hfp_jitter_t *jb)
+{
+	target_raise(jb);
+}
+
+int hfp_jitter_ppm(const hfp_jitter_t *jb)
+{
+	/* the integral is the drift, the rest is steering back to the target */
+	return (int)lrint(HFP_JITTER_KI * jb->integral * 1e6);
+}
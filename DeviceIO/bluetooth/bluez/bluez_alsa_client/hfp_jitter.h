@@ -0,0 +1,78 @@
+#ifndef __DEVICEIO_BA_HFP_JITTER__
+#define __DEVICEIO_BA_HFP_JITTER__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* how far the resampler may stretch, 5000 ppm is far beyond any crystal */
+#define HFP_JITTER_MAX_PPM		5000
+/* seconds of calm before the target may come down */
+#define HFP_JITTER_WINDOW_S		20
+
+/*
+ * Drift compensation for one direction of the call audio. The playback
+ * fill, taken right after each write, is the jitter buffer: a PI loop
+ * steers it to a target by stretching the stream with a linear
+ * interpolating resampler, so two clocks that don't quite agree never
+ * build up to an xrun. The target starts at two periods, goes up half a
+ * period every time the buffer nearly runs dry and comes down a quarter
+ * when it has stayed well clear for HFP_JITTER_WINDOW_S.
+ *
+ * The same resampler takes the stream from one nominal rate to another,
+ * the drift is a few ppm on top of that step.
+ *
+ * Interleaved S16 frames; everything is counted in frames, time too, so
+ * it runs the same on virtual clocks. Mono runs through NEON or SSE2
+ * where the compiler has them.
+ */
+typedef struct {
+	int channels;
+	unsigned int rate;			// input
+	unsigned int period;		// output, so are buffer and the fill
+	double step;				// input frames per output frame, nominal
+	unsigned int min_target, max_target;
+
+	/* resampler: input frames per output frame, and where in the input we are */
+	double ratio;
+	double pos;
+	int16_t prev[8];
+
+	/* control */
+	int primed;
+	double target;
+	double level;
+	double integral;
+	unsigned int window;		// input frames since the target last moved
+	long low;					// lowest fill before a write in this window
+} hfp_jitter_t;
+
+void hfp_jitter_init(hfp_jitter_t *jb, int channels, unsigned int in_rate, unsigned int out_rate,
+		unsigned int period, unsigned int buffer);
+
+/*
+ * Resample in into out until either runs out. Returns the frames put in
+ * out, *consumed the frames of in used up.
+ */
+unsigned int hfp_jitter_resample(hfp_jitter_t *jb, const int16_t *in, unsigned int in_frames,
+		unsigned int *consumed, int16_t *out, unsigned int out_frames);
+
+/*
+ * After a write: the playback fill before and after it, and the input
+ * frames the write consumed.
+ */
+void hfp_jitter_update(hfp_jitter_t *jb, long fill_before, long fill_after, unsigned int consumed);
+
+/* playback ran dry */
+void hfp_jitter_underrun(hfp_jitter_t *jb);
+
+/* the drift it has settled on, in ppm; > 0 means input runs fast */
+int hfp_jitter_ppm(const hfp_jitter_t *jb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DEVICEIO_BA_HFP_JITTER__ */
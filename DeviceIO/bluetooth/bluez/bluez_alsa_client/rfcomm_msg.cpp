@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 
 #include <alsa/asoundlib.h>
 #include <sys/time.h>
@@ -10,6 +13,8 @@
 
 #include "../a2dp_source/a2dp_masterctrl.h"
 #include "rfcomm_msg.h"
+#include "hfp_jitter.h"
+#include "hfp_dsp.h"
 #include "slog.h"
 
 typedef struct {
@@ -33,6 +38,7 @@ typedef struct {
 	bool is_send_audio_open;
 	bool is_incoming_call;
 	int dev_platform;
+	int sco_codec; //as the AG last selected it, cvsd until it does
 } rfcomm_control_t;
 
 static rfcomm_control_t g_rfcomm_control = {
@@ -41,6 +47,7 @@ static rfcomm_control_t g_rfcomm_control = {
 	false,
 	false,
 	DEV_PLATFORM_UNKNOWN,
+	BT_SCO_CODEC_CVSD,
 };
 
 static rfcomm_handler_t g_rfcomm_handler = {
@@ -143,6 +150,7 @@ static void process_bcs_msg(char *msg)
 	else if(strstr(msg, "2"))
 		codec_type = BT_SCO_CODEC_MSBC;
 
+	g_rfcomm_control.sco_codec = codec_type;
 	rfcomm_hfp_send_event(RK_BT_HFP_BCS_EVT, &codec_type);
 
 	if(g_rfcomm_control.dev_platform == DEV_PLATFORM_IOS && g_rfcomm_control.is_incoming_call) {
@@ -253,34 +261,88 @@ void rfcomm_hfp_hf_regist_cb(RK_BT_HFP_CALLBACK cb)
  * Audio path config api
  ***********************************************************/
 
-static int g_audio_path_valid_flag = 0;
-static snd_pcm_t *local_play_pcm, *local_record_pcm;
-static snd_pcm_t *bt_play_pcm, *bt_record_pcm;
-pthread_t g_playback_tid = 0, g_capture_tid = 0;
+
+/*
+ * One thread bridges both directions of the call audio: local mic to bt
+ * (uplink) and bt to the local speaker (downlink). It polls the capture
+ * end of a direction until a period is there, or its playback end while
+ * that has no room, so a stalled side only holds up its own direction.
+ * Ends that allow mmap access are read or written in place, the data
+ * goes straight from one ring buffer into the other.
+ *
+ * The bt and codec clocks never quite agree, so each direction runs
+ * through a jitter buffer (hfp_jitter.h) on the way: it keeps the
+ * playback fill at a small target by resampling a little faster or
+ * slower, instead of letting the difference pile up into an xrun.
+ *
+ * Speech is mono: the bt side runs at 8 kHz for CVSD and 16 kHz for
+ * mSBC, every end is asked for one channel at that rate and takes what
+ * it can get. In between the bridge works in mono, downmixing and
+ * upmixing (hfp_dsp.h) only for ends that insist on more channels, and
+ * the jitter buffer's resampler covers an end at a different rate.
+ */
+
+#define HFP_PCM_MAX_POLLFDS		4
+#define HFP_BOUNCE_FRAMES		1024		// for ends with no mmap access
+#define HFP_START_PERIODS		2			// playback starts this full, the jitter target
+#define HFP_RATE_CVSD			8000
+#define HFP_RATE_MSBC			16000
 
 typedef struct _setup_pcm_param {
-	unsigned char channel;
-	unsigned int samplerate;
+	unsigned int channel;		// wanted, and what the device settled on
+	unsigned int samplerate;	// likewise
 	unsigned int buffer_time;
 	unsigned int period_time;
 	snd_pcm_uframes_t start_threshold;
+	unsigned int start_periods;	// instead of start_threshold, if set
 	snd_pcm_format_t format;
 } setup_pcm_param;
 
-static int set_hw_params(snd_pcm_t *pcm, setup_pcm_param *param, char **msg)
+typedef struct {
+	const char *name;
+	snd_pcm_t *pcm;
+	bool mmap;
+	unsigned int rate;
+	unsigned int channels;
+	size_t frame_bytes;
+	snd_pcm_uframes_t buffer_size;
+	snd_pcm_uframes_t period_size;
+	snd_pcm_uframes_t start_threshold;
+} hfp_pcm_t;
+
+typedef struct {
+	hfp_pcm_t capture;
+	hfp_pcm_t playback;
+	bool wait_playback;			// a period is waiting, for room on playback
+	int16_t *in;				// read from an rw capture end, not resampled yet
+	snd_pcm_uframes_t in_frames;
+	int16_t *out;				// resampled, for an rw playback end
+	int16_t *mono_in;			// capture downmixed, for a capture end with more channels
+	int16_t *mono_out;			// resampled, to upmix for a playback end with more channels
+	hfp_jitter_t jitter;
+	RK_BT_HFP_AUDIO_STATS stats;
+} hfp_path_t;
+
+static int g_audio_path_valid_flag = 0;
+static hfp_path_t g_uplink = { { "LocalCaputure" }, { "BtPlayback" } };
+static hfp_path_t g_downlink = { { "BtCaputure" }, { "LocalPlayback" } };
+static pthread_t g_bridge_tid = 0;
+static int g_bridge_wake[2] = { -1, -1 };
+static pthread_mutex_t g_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int set_hw_params(snd_pcm_t *pcm, setup_pcm_param *param, snd_pcm_access_t access, char **msg)
 {
-	const snd_pcm_access_t access = SND_PCM_ACCESS_RW_INTERLEAVED;
 	snd_pcm_format_t format;
 	snd_pcm_hw_params_t *params;
-	int channels, rate;
+	unsigned int *channels, *rate;
 	unsigned int *buffer_time;
 	unsigned int *period_time;
 	char buf[256];
 	int dir;
 	int err;
 
-	channels = param->channel;
-	rate = param->samplerate;
+	channels = &(param->channel);
+	rate = &(param->samplerate);
 	buffer_time = &(param->buffer_time);
 	period_time = &(param->period_time);
 	format = param->format;
@@ -299,12 +361,12 @@ static int set_hw_params(snd_pcm_t *pcm, setup_pcm_param *param, char **msg)
 		snprintf(buf, sizeof(buf), "Set format: %s: %s", snd_strerror(err), snd_pcm_format_name(format));
 		goto fail;
 	}
-	if ((err = snd_pcm_hw_params_set_channels(pcm, params, channels)) != 0) {
-		snprintf(buf, sizeof(buf), "Set channels: %s: %d", snd_strerror(err), channels);
+	if ((err = snd_pcm_hw_params_set_channels_near(pcm, params, channels)) != 0) {
+		snprintf(buf, sizeof(buf), "Set channels: %s: %u", snd_strerror(err), *channels);
 		goto fail;
 	}
-	if ((err = snd_pcm_hw_params_set_rate(pcm, params, rate, 0)) != 0) {
-		snprintf(buf, sizeof(buf), "Set sampling rate: %s: %d", snd_strerror(err), rate);
+	if ((err = snd_pcm_hw_params_set_rate_near(pcm, params, rate, 0)) != 0) {
+		snprintf(buf, sizeof(buf), "Set sampling rate: %s: %u", snd_strerror(err), *rate);
 		goto fail;
 	}
 	if ((err = snd_pcm_hw_params_set_buffer_time_near(pcm, params, buffer_time, &dir)) != 0) {
@@ -328,11 +390,10 @@ fail:
 	return err;
 }
 
-static int set_sw_params(snd_pcm_t *pcm, snd_pcm_uframes_t buffer_size,
-		snd_pcm_uframes_t period_size, snd_pcm_uframes_t start_threshold, char **msg)
+static int set_sw_params(snd_pcm_t *pcm, snd_pcm_uframes_t period_size,
+		snd_pcm_uframes_t threshold, char **msg)
 {
 	snd_pcm_sw_params_t *params;
-	snd_pcm_uframes_t threshold;
 	char buf[256];
 	int err;
 
@@ -343,11 +404,6 @@ static int set_sw_params(snd_pcm_t *pcm, snd_pcm_uframes_t buffer_size,
 		goto fail;
 	}
 
-	/* start the transfer when the buffer is full (or almost full) */
-	if (start_threshold == 0)
-		threshold = (buffer_size / period_size) * period_size;
-	else
-		threshold = start_threshold;
 	if ((err = snd_pcm_sw_params_set_start_threshold(pcm, params, threshold)) != 0) {
 		snprintf(buf, sizeof(buf), "Set start threshold: %s: %lu", snd_strerror(err), threshold);
 		goto fail;
@@ -372,39 +428,59 @@ fail:
 	return err;
 }
 
-static int setup_pcm_handle(char *name, snd_pcm_t *pcm, setup_pcm_param *param)
+static int setup_pcm_handle(hfp_pcm_t *end, setup_pcm_param *param)
 {
+	setup_pcm_param want = *param;
 	char *msg = NULL;
 	int err = 0;
-	snd_pcm_uframes_t buffer_size, period_size;
 
-	if ((err = set_hw_params(pcm, param, &msg)) != 0) {
-		pr_info("Couldn't set %s HW parameters: %s", name, msg);
-		goto dofail;
+	/* mmap where the device has it, plain reads and writes otherwise */
+	end->mmap = true;
+	if ((err = set_hw_params(end->pcm, param, SND_PCM_ACCESS_MMAP_INTERLEAVED, &msg)) != 0) {
+		free(msg);
+		msg = NULL;
+		*param = want;
+		end->mmap = false;
+		if ((err = set_hw_params(end->pcm, param, SND_PCM_ACCESS_RW_INTERLEAVED, &msg)) != 0) {
+			pr_info("Couldn't set %s HW parameters: %s", end->name, msg);
+			goto dofail;
+		}
 	}
 
-	if ((err = snd_pcm_get_params(pcm, &buffer_size, &period_size)) != 0) {
-		pr_info("Couldn't get %s PCM parameters: %s", name, snd_strerror(err));
+	if ((err = snd_pcm_get_params(end->pcm, &end->buffer_size, &end->period_size)) != 0) {
+		pr_info("Couldn't get %s PCM parameters: %s", end->name, snd_strerror(err));
 		goto dofail;
 	}
+	end->rate = param->samplerate;
+	end->channels = param->channel;
+	end->frame_bytes = snd_pcm_frames_to_bytes(end->pcm, 1);
+
+	/* start the transfer when the buffer is full (or almost full) */
+	if (param->start_periods)
+		end->start_threshold = param->start_periods * end->period_size;
+	else if (param->start_threshold == 0)
+		end->start_threshold = (end->buffer_size / end->period_size) * end->period_size;
+	else
+		end->start_threshold = param->start_threshold;
 
 	pr_info("Used configuration for %s:\n"
+			"  PCM access: %s\n"
 			"  PCM buffer time: %u us (%zu bytes)\n"
 			"  PCM period time: %u us (%zu bytes)\n"
 			"  Sampling rate: %u Hz\n"
 			"  Channels: %u\n"
 			"  StartThreshold: %lu\n",
-			name,
-			param->buffer_time, snd_pcm_frames_to_bytes(pcm, buffer_size),
-			param->period_time, snd_pcm_frames_to_bytes(pcm, period_size),
-			param->samplerate, param->channel, param->start_threshold);
+			end->name, end->mmap ? "mmap" : "rw",
+			param->buffer_time, snd_pcm_frames_to_bytes(end->pcm, end->buffer_size),
+			param->period_time, snd_pcm_frames_to_bytes(end->pcm, end->period_size),
+			param->samplerate, param->channel, end->start_threshold);
 
-	if ((err = set_sw_params(pcm, buffer_size, period_size, param->start_threshold, &msg)) != 0) {
+	if ((err = set_sw_params(end->pcm, end->period_size, end->start_threshold, &msg)) != 0) {
 		pr_info("Couldn't set SW parameters: %s", msg);
 		goto dofail;
 	}
 
-	if ((err = snd_pcm_prepare(pcm)) != 0) {
+	if ((err = snd_pcm_prepare(end->pcm)) != 0) {
 		pr_info("Couldn't prepare PCM: %s", snd_strerror(err));
 		goto dofail;
 	}
@@ -417,211 +493,362 @@ dofail:
 	return -1;
 }
 
-static void *thread_record_start(void *arg)
+static int open_pcm_handle(hfp_pcm_t *end, const char *device, snd_pcm_stream_t stream,
+		setup_pcm_param *param)
 {
-	snd_pcm_uframes_t buffer_size = 0, period_size = 0;
-	int period_bytes = 0;
-	char *buffer = NULL;
-	int ret = 0;
+	int err;
 
-	snd_pcm_get_params(bt_play_pcm, &buffer_size, &period_size);
-	period_bytes = snd_pcm_frames_to_bytes(bt_play_pcm, buffer_size);
-	buffer = (char *)malloc(period_bytes);
-	if (!buffer) {
-		pr_info("ERROR:%s no space left!\n", __func__);
-		return NULL;
+	if ((err = snd_pcm_open(&end->pcm, device, stream, SND_PCM_NONBLOCK)) != 0) {
+		pr_info("Couldn't open %s PCM %s: %s", end->name, device, snd_strerror(err));
+		end->pcm = NULL;
+		return err;
+	}
+	if ((err = setup_pcm_handle(end, param)) != 0) {
+		pr_info("Set up %s audio path failed!\n", end->name);
+		return err;
 	}
-	memset(buffer, 0, period_size);
 
-	pr_info("#%s start... period_bytes = %d\n", __func__, period_bytes);
+	return 0;
+}
 
-	while (g_audio_path_valid_flag) {
-		memset(buffer, 0, period_bytes);
-		ret = snd_pcm_readi(local_record_pcm, buffer , period_size);
-		if (ret < 0) {
-			if (ret == -EPIPE) {
-				pr_info( "Xrun occurred: LocalCaputure\n");
-				snd_pcm_prepare(local_record_pcm);
-			} else {
-				pr_info("ERROR: %s read frame error=%d\n", __func__, ret);
-				return NULL;
-			}
-		}
+static void close_pcm_handle(hfp_pcm_t *end)
+{
+	if (end->pcm)
+		snd_pcm_close(end->pcm);
+	end->pcm = NULL;
+}
 
-		ret = snd_pcm_writei(bt_play_pcm, buffer, period_size);
-		if (ret < 0) {
-			if (ret == -EPIPE) {
-				pr_info( "Xrun occurred: BtPlayback\n");
-				snd_pcm_prepare(bt_play_pcm);
-			} else {
-				pr_info("ERROR: %s write frame error=%d\n", __func__, ret);
-				return NULL;
-			}
-		}
+/* xruns are counted and got over, anything else ends the bridge */
+static int pcm_recover(hfp_path_t *path, hfp_pcm_t *end, int err)
+{
+	if (err == -EPIPE) {
+		pr_info("Xrun occurred: %s\n", end->name);
+		if (end == &path->playback)
+			hfp_jitter_underrun(&path->jitter);
+		pthread_mutex_lock(&g_stats_lock);
+		if (end == &path->capture)
+			path->stats.capture_xruns++;
+		else
+			path->stats.playback_xruns++;
+		pthread_mutex_unlock(&g_stats_lock);
 	}
 
-	pr_info("#%s end... \n", __func__);
+	if ((err = snd_pcm_recover(end->pcm, err, 1)) < 0) {
+		pr_err("ERROR: %s can't recover: %s\n", end->name, snd_strerror(err));
+		return err;
+	}
+	if (end == &path->capture)
+		snd_pcm_start(end->pcm);
 
-	snd_pcm_close(local_record_pcm);
-	snd_pcm_close(bt_play_pcm);
-	local_record_pcm = NULL;
-	bt_play_pcm = NULL;
-	free(buffer);
+	return 0;
+}
 
-	return NULL;
+/*
+ * Mapped transfers don't start a stream by themselves, and one that is
+ * short of its threshold without room for a period never would.
+ */
+static void pcm_kick(hfp_pcm_t *end, snd_pcm_sframes_t avail)
+{
+	if (snd_pcm_state(end->pcm) == SND_PCM_STATE_PREPARED &&
+			(end->buffer_size - avail >= end->start_threshold || (snd_pcm_uframes_t)avail < end->period_size))
+		snd_pcm_start(end->pcm);
 }
 
-static void *thread_playback_start(void *arg)
+static char *area_ptr(const snd_pcm_channel_area_t *areas, snd_pcm_uframes_t offset)
 {
-	snd_pcm_uframes_t buffer_size = 0, period_size = 0;
-	int period_bytes = 0;
-	char *buffer = NULL;
-	int ret = 0;
+	return (char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+}
 
-	snd_pcm_get_params(local_play_pcm, &buffer_size, &period_size);
-	period_bytes = snd_pcm_frames_to_bytes(local_play_pcm, buffer_size);
-	buffer = (char *)malloc(period_bytes);
-	if (!buffer) {
-		pr_info("ERROR:%s no space left!\n", __func__);
-		return NULL;
+/* move what capture has, resampled, as far as playback takes it */
+static int path_move(hfp_path_t *path)
+{
+	hfp_pcm_t *cap = &path->capture, *play = &path->playback;
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t cap_off = 0, play_off = 0, cap_left, play_left, n_in, n_out;
+	snd_pcm_sframes_t cap_avail, play_avail, got, delay, fill;
+	snd_pcm_sframes_t consumed = 0, produced = 0, pending = path->in_frames;
+	unsigned int used, made;
+	int16_t *src, *dst, *res;
+	int err;
+
+	if ((cap_avail = snd_pcm_avail_update(cap->pcm)) < 0)
+		return pcm_recover(path, cap, cap_avail);
+	if ((play_avail = snd_pcm_avail_update(play->pcm)) < 0)
+		return pcm_recover(path, play, play_avail);
+
+	path->wait_playback = false;
+	if ((snd_pcm_uframes_t)cap_avail < cap->period_size)
+		return 0;
+	if ((snd_pcm_uframes_t)play_avail < play->period_size) {
+		path->wait_playback = true;
+		return 0;
 	}
-	memset(buffer, 0, period_size);
 
-	pr_info("#%s start... period_bytes = %d\n", __func__, period_bytes);
+	cap_left = cap_avail;
+	play_left = play_avail;
+	while ((cap_left > 0 || path->in_frames > 0) && play_left > 0) {
+		if (cap->mmap) {
+			n_in = cap_left;
+			if ((err = snd_pcm_mmap_begin(cap->pcm, &areas, &cap_off, &n_in)) < 0)
+				return pcm_recover(path, cap, err);
+			src = (int16_t *)area_ptr(areas, cap_off);
+		} else {
+			n_in = HFP_BOUNCE_FRAMES - path->in_frames;
+			if (n_in > cap_left)
+				n_in = cap_left;
+			if (n_in > 0) {
+				if ((got = snd_pcm_readi(cap->pcm, (char *)path->in + path->in_frames * cap->frame_bytes, n_in)) < 0)
+					return pcm_recover(path, cap, got);
+				cap_left -= got;
+				path->in_frames += got;
+			}
+			src = path->in;
+			n_in = path->in_frames;
+		}
+		if (cap->channels > 1) {
+			if (n_in > HFP_BOUNCE_FRAMES)
+				n_in = HFP_BOUNCE_FRAMES;
+			hfp_dsp_downmix(src, cap->channels, path->mono_in, n_in);
+			src = path->mono_in;
+		}
+
+		n_out = play_left;
+		if (play->mmap) {
+			if ((err = snd_pcm_mmap_begin(play->pcm, &areas, &play_off, &n_out)) < 0)
+				return pcm_recover(path, play, err);
+			dst = (int16_t *)area_ptr(areas, play_off);
+		} else {
+			if (n_out > HFP_BOUNCE_FRAMES)
+				n_out = HFP_BOUNCE_FRAMES;
+			dst = path->out;
+		}
+		res = dst;
+		if (play->channels > 1) {
+			if (n_out > HFP_BOUNCE_FRAMES)
+				n_out = HFP_BOUNCE_FRAMES;
+			res = path->mono_out;
+		}
+
+		made = hfp_jitter_resample(&path->jitter, src, n_in, &used, res, n_out);
+		if (play->channels > 1)
+			hfp_dsp_upmix(res, dst, play->channels, made);
+
+		if (cap->mmap) {
+			if ((err = snd_pcm_mmap_commit(cap->pcm, cap_off, used)) < 0)
+				return pcm_recover(path, cap, err);
+			cap_left -= used;
+		} else {
+			path->in_frames -= used;
+			memmove(path->in, (char *)path->in + used * cap->frame_bytes, path->in_frames * cap->frame_bytes);
+		}
+		if (play->mmap) {
+			if ((err = snd_pcm_mmap_commit(play->pcm, play_off, made)) < 0)
+				return pcm_recover(path, play, err);
+		} else if (made > 0 && (got = snd_pcm_writei(play->pcm, path->out, made)) < 0) {
+			return pcm_recover(path, play, got);
+		}
+		play_left -= made;
+
+		consumed += used;
+		produced += made;
+		if (used == 0 && made == 0)
+			break;
+	}
+	pcm_kick(play, play_left);
+
+	fill = play->buffer_size - play_avail;
+	hfp_jitter_update(&path->jitter, fill, fill + produced, consumed);
+
+	/* the oldest frame moved: captured cap_avail frames ago, out once playback gets through delay */
+	if (snd_pcm_delay(play->pcm, &delay) < 0)
+		delay = play->buffer_size - play_left;
+	pthread_mutex_lock(&g_stats_lock);
+	path->stats.frames += consumed;
+	path->stats.latency_us = (unsigned long long)(pending + cap_avail) * 1000000 / cap->rate +
+			(long long)(delay - produced) * 1000000 / play->rate;
+	if (path->stats.latency_us > path->stats.max_latency_us)
+		path->stats.max_latency_us = path->stats.latency_us;
+	path->stats.jitter_target_us = (unsigned long long)path->jitter.target * 1000000 / play->rate;
+	path->stats.drift_ppm = hfp_jitter_ppm(&path->jitter);
+	pthread_mutex_unlock(&g_stats_lock);
+
+	return 0;
+}
+
+static void *thread_audio_bridge(void *arg)
+{
+	struct pollfd pfds[1 + 2 * HFP_PCM_MAX_POLLFDS];
+	hfp_path_t *paths[] = { &g_uplink, &g_downlink };
+	struct timespec wall[2], cpu[2];
+	int first[2], count[2];
+	unsigned short revents;
+	hfp_pcm_t *end;
+	char buf[16];
+	int nfds, i;
+
+	pr_info("#%s start...\n", __func__);
+	clock_gettime(CLOCK_MONOTONIC, &wall[0]);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu[0]);
+
+	snd_pcm_start(g_uplink.capture.pcm);
+	snd_pcm_start(g_downlink.capture.pcm);
 
 	while (g_audio_path_valid_flag) {
-		memset(buffer, 0, period_bytes);
-		ret = snd_pcm_readi(bt_record_pcm, buffer , period_size);
-		if (ret < 0) {
-			if (ret == -EPIPE) {
-				pr_info( "Xrun occurred: BtCaputure\n");
-				snd_pcm_prepare(bt_record_pcm);
-			} else {
-				pr_info("ERROR: %s read frame error=%d\n", __func__, ret);
-				return NULL;
-			}
+		pfds[0].fd = g_bridge_wake[0];
+		pfds[0].events = POLLIN;
+		nfds = 1;
+		for (i = 0; i < 2; i++) {
+			end = paths[i]->wait_playback ? &paths[i]->playback : &paths[i]->capture;
+			first[i] = nfds;
+			count[i] = snd_pcm_poll_descriptors(end->pcm, pfds + nfds, HFP_PCM_MAX_POLLFDS);
+			if (count[i] < 0)
+				count[i] = 0;
+			nfds += count[i];
 		}
 
-		ret = snd_pcm_writei(local_play_pcm, buffer, period_size);
-		if (ret < 0) {
-			if (ret == -EPIPE) {
-				pr_info( "Xrun occurred: LocalPlayback\n");
-				snd_pcm_prepare(local_play_pcm);
-			} else {
-				pr_info("ERROR: %s write frame error=%d\n", __func__, ret);
-				return NULL;
+		if (poll(pfds, nfds, 1000) < 0 && errno != EINTR) {
+			pr_err("ERROR: %s poll failed: %s\n", __func__, strerror(errno));
+			break;
+		}
+		if (pfds[0].revents & POLLIN)
+			while (read(g_bridge_wake[0], buf, sizeof(buf)) > 0);
+
+		for (i = 0; i < 2; i++) {
+			end = paths[i]->wait_playback ? &paths[i]->playback : &paths[i]->capture;
+			if (snd_pcm_poll_descriptors_revents(end->pcm, pfds + first[i], count[i], &revents) < 0 ||
+					!(revents & (POLLIN | POLLOUT | POLLERR)))
+				continue;
+			if (path_move(paths[i]) < 0) {
+				pr_err("ERROR: %s stops on %s\n", __func__, end->name);
+				goto out;
 			}
 		}
 	}
 
-	pr_info("#%s end...\n", __func__);
+out:
+	clock_gettime(CLOCK_MONOTONIC, &wall[1]);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu[1]);
+	pr_info("#%s end, %.1f ms cpu per call minute...\n", __func__,
+			((cpu[1].tv_sec - cpu[0].tv_sec) * 1e3 + (cpu[1].tv_nsec - cpu[0].tv_nsec) / 1e6) * 60 /
+			((wall[1].tv_sec - wall[0].tv_sec) + (wall[1].tv_nsec - wall[0].tv_nsec) / 1e9 + 1e-9));
+	return NULL;
+}
 
-	snd_pcm_close(local_play_pcm);
-	snd_pcm_close(bt_record_pcm);
-	local_play_pcm = NULL;
-	bt_record_pcm = NULL;
-	free(buffer);
+static void close_audio_path(void)
+{
+	hfp_path_t *paths[] = { &g_uplink, &g_downlink };
 
-	return NULL;
+	for (int i = 0; i < 2; i++) {
+		close_pcm_handle(&paths[i]->capture);
+		close_pcm_handle(&paths[i]->playback);
+		free(paths[i]->in);
+		free(paths[i]->out);
+		free(paths[i]->mono_in);
+		free(paths[i]->mono_out);
+		paths[i]->in = paths[i]->out = NULL;
+		paths[i]->mono_in = paths[i]->mono_out = NULL;
+	}
+
+	if (g_bridge_wake[0] >= 0) {
+		close(g_bridge_wake[0]);
+		close(g_bridge_wake[1]);
+		g_bridge_wake[0] = g_bridge_wake[1] = -1;
+	}
 }
 
 int rfcomm_hfp_open_audio_path()
 {
-	int err;
 	setup_pcm_param pcm_param;
+	unsigned int bt_rate;
 
 	if (g_audio_path_valid_flag) {
 		pr_info("WARNING: Hfp audio path has already be opened!\n");
 		return 0;
 	}
 
+	bt_rate = g_rfcomm_control.sco_codec == BT_SCO_CODEC_MSBC ? HFP_RATE_MSBC : HFP_RATE_CVSD;
+	pcm_param.format = SND_PCM_FORMAT_S16_LE;
+
 	/* Open and setup LocalPlayback audio handle */
-	if ((err = snd_pcm_open(&local_play_pcm, "default", SND_PCM_STREAM_PLAYBACK, 0)) != 0) {
-		pr_info("Couldn't open local playback PCM: %s", snd_strerror(err));
-		goto fail;
-	}
-	pcm_param.channel = 2;
-	pcm_param.samplerate = 8000;
+	pcm_param.channel = 1;
+	pcm_param.samplerate = bt_rate;
 	pcm_param.buffer_time = 100000;
 	pcm_param.period_time = 20000;
-	pcm_param.format = SND_PCM_FORMAT_S16_LE;
-	pcm_param.start_threshold = 0; //default
-	if ((err = setup_pcm_handle("LocalPlayback", local_play_pcm, &pcm_param)) != 0) {
-		pr_info("Set up Local Playback audio path failed!\n");
+	pcm_param.start_periods = HFP_START_PERIODS;
+	if (open_pcm_handle(&g_downlink.playback, "default", SND_PCM_STREAM_PLAYBACK, &pcm_param) != 0)
 		goto fail;
-	}
 
 	/* Open and setup LocalCaputure audio handle */
-	if ((err = snd_pcm_open(&local_record_pcm, "2mic_loopback", SND_PCM_STREAM_CAPTURE, 0)) != 0) {
-		pr_info("Couldn't open local capture PCM: %s", snd_strerror(err));
-		goto fail;
-	}
-	pcm_param.channel = 2;
-	pcm_param.samplerate = 8000;
+	pcm_param.channel = 1;
+	pcm_param.samplerate = bt_rate;
 	pcm_param.buffer_time = 400000;
 	pcm_param.period_time = 20000;
-	pcm_param.format = SND_PCM_FORMAT_S16_LE;
 	pcm_param.start_threshold = 1;
-	if ((err = setup_pcm_handle("LocalCaputure", local_record_pcm, &pcm_param)) != 0) {
-		pr_info("Set up Local Caputure audio path failed!\n");
+	pcm_param.start_periods = 0;
+	if (open_pcm_handle(&g_uplink.capture, "2mic_loopback", SND_PCM_STREAM_CAPTURE, &pcm_param) != 0)
 		goto fail;
-	}
 
 	/* Open and setup BtPlayback audio handle */
-	if ((err = snd_pcm_open(&bt_play_pcm, "hw:1,0", SND_PCM_STREAM_PLAYBACK, 0)) != 0) {
-		pr_info("Couldn't open bt playback PCM: %s", snd_strerror(err));
-		goto fail;
-	}
-	pcm_param.channel = 2;
-	pcm_param.samplerate = 8000;
+	pcm_param.channel = 1;
+	pcm_param.samplerate = bt_rate;
 	pcm_param.buffer_time = 100000;
 	pcm_param.period_time = 20000;
-	pcm_param.format = SND_PCM_FORMAT_S16_LE;
-	pcm_param.start_threshold = 0;
-	if ((err = setup_pcm_handle("BtPlayback", bt_play_pcm, &pcm_param)) != 0) {
-		pr_info("Set up Bt Playback audio path failed!\n");
+	pcm_param.start_periods = HFP_START_PERIODS;
+	if (open_pcm_handle(&g_uplink.playback, "hw:1,0", SND_PCM_STREAM_PLAYBACK, &pcm_param) != 0)
 		goto fail;
-	}
 
 	/* Open and setup BtCaputure audio handle */
-	if ((err = snd_pcm_open(&bt_record_pcm, "hw:1,0", SND_PCM_STREAM_CAPTURE, 0)) != 0) {
-		pr_info("Couldn't open bt capture PCM: %s", snd_strerror(err));
-		goto fail;
-	}
-	pcm_param.channel = 2;
-	pcm_param.samplerate = 8000;
+	pcm_param.channel = 1;
+	pcm_param.samplerate = bt_rate;
 	pcm_param.buffer_time = 400000;
 	pcm_param.period_time = 20000;
-	pcm_param.format = SND_PCM_FORMAT_S16_LE;
 	pcm_param.start_threshold = 1;
-	if ((err = setup_pcm_handle("BtCaputure", bt_record_pcm, &pcm_param)) != 0) {
-		pr_info("Set up Bt Caputure audio path failed!\n");
+	pcm_param.start_periods = 0;
+	if (open_pcm_handle(&g_downlink.capture, "hw:1,0", SND_PCM_STREAM_CAPTURE, &pcm_param) != 0)
+		goto fail;
+
+	for (int i = 0; i < 2; i++) {
+		hfp_path_t *path = i ? &g_downlink : &g_uplink;
+		hfp_pcm_t *cap = &path->capture, *play = &path->playback;
+
+		path->wait_playback = false;
+		memset(&path->stats, 0, sizeof(path->stats));
+		hfp_jitter_init(&path->jitter, 1, cap->rate, play->rate, play->period_size, play->buffer_size);
+		path->in_frames = 0;
+		if (!cap->mmap)
+			path->in = (int16_t *)malloc(HFP_BOUNCE_FRAMES * cap->frame_bytes);
+		if (!play->mmap)
+			path->out = (int16_t *)malloc(HFP_BOUNCE_FRAMES * play->frame_bytes);
+		if (cap->channels > 1)
+			path->mono_in = (int16_t *)malloc(HFP_BOUNCE_FRAMES * sizeof(int16_t));
+		if (play->channels > 1)
+			path->mono_out = (int16_t *)malloc(HFP_BOUNCE_FRAMES * sizeof(int16_t));
+		if ((!cap->mmap && !path->in) || (!play->mmap && !path->out) ||
+				(cap->channels > 1 && !path->mono_in) || (play->channels > 1 && !path->mono_out)) {
+			pr_info("ERROR:%s no space left!\n", __func__);
+			goto fail;
+		}
+		pr_info("%s: %s %u Hz %uch -> %s %u Hz %uch, mono in between (%s)\n", __func__,
+				cap->name, cap->rate, cap->channels, play->name, play->rate, play->channels, hfp_dsp_simd());
+	}
+
+	if (pipe2(g_bridge_wake, O_NONBLOCK | O_CLOEXEC) < 0) {
+		pr_info("ERROR:%s create pipe failed!\n", __func__);
 		goto fail;
 	}
 
 	g_audio_path_valid_flag = 1;
-	/* Create a thread to listen for Bluezalsa hfp-hf status. */
-	pthread_create(&g_playback_tid, NULL, thread_playback_start, NULL);
-	/* Create a thread to listen for Bluezalsa hfp-hf status. */
-	pthread_create(&g_capture_tid, NULL, thread_record_start, NULL);
+	if (pthread_create(&g_bridge_tid, NULL, thread_audio_bridge, NULL)) {
+		pr_info("ERROR:%s create audio bridge thread failed!\n", __func__);
+		g_audio_path_valid_flag = 0;
+		goto fail;
+	}
+	pthread_setname_np(g_bridge_tid, "hfp_audio");
 
 	return 0;
 
 fail:
-	if (local_play_pcm)
-		snd_pcm_close(local_play_pcm);
-	if (local_record_pcm)
-		snd_pcm_close(local_record_pcm);
-	if (bt_play_pcm)
-		snd_pcm_close(bt_play_pcm);
-	if (bt_record_pcm)
-		snd_pcm_close(bt_record_pcm);
-
-	local_play_pcm = NULL;
-	local_record_pcm = NULL;
-	bt_play_pcm = NULL;
-	bt_record_pcm = NULL;
-
+	close_audio_path();
 	g_audio_path_valid_flag = 0;
 
 	return -1;
@@ -629,15 +856,27 @@ fail:
 
 int rfcomm_hfp_close_audio_path()
 {
-	void *status;
-
 	pr_info("#%s is called! flag=%d\n", __func__, g_audio_path_valid_flag);
 
 	if (g_audio_path_valid_flag) {
 		g_audio_path_valid_flag = 0;
-		pthread_join(g_playback_tid, &status);
-		pthread_join(g_capture_tid, &status);
+		if (write(g_bridge_wake[1], "", 1) < 0)
+			pr_err("%s: wake audio bridge failed\n", __func__);
+		pthread_join(g_bridge_tid, NULL);
+		close_audio_path();
 	}
 
 	return 0;
 }
+
+int rfcomm_hfp_get_audio_stats(RK_BT_HFP_AUDIO_STATS *uplink, RK_BT_HFP_AUDIO_STATS *downlink)
+{
+	pthread_mutex_lock(&g_stats_lock);
+	if (uplink)
+		*uplink = g_uplink.stats;
+	if (downlink)
+		*downlink = g_downlink.stats;
+	pthread_mutex_unlock(&g_stats_lock);
+
+	return 0;
+}
@@ -13,6 +13,7 @@ void rfcomm_hfp_hf_regist_cb(RK_BT_HFP_CALLBACK cb);
 void rfcomm_hfp_send_event(RK_BT_HFP_EVENT event, void *data);
 int rfcomm_hfp_open_audio_path();
 int rfcomm_hfp_close_audio_path();
+int rfcomm_hfp_get_audio_stats(RK_BT_HFP_AUDIO_STATS *uplink, RK_BT_HFP_AUDIO_STATS *downlink);
 
 #ifdef __cplusplus
 }
@@ -659,6 +659,12 @@ int rk_bt_source_vol_down()
 	return 0;
 }
 
+int rk_bt_source_get_tx_stats(RK_BT_SOURCE_TX_STATS *stats)
+{
+	pr_info("bluez don't support %s\n", __func__);
+	return -1;
+}
+
 /*****************************************************************
  *            Rockchip bluetooth sink api                        *
  *****************************************************************/
@@ -1071,6 +1077,19 @@ void rk_bt_sink_set_alsa_device(char *alsa_dev)
 	pr_info("bluez don't support %s\n", __func__);
 }
 
+int rk_bt_sink_set_buffer_latency(int ms)
+{
+	/* bluez-alsa does the playback buffering */
+	pr_info("bluez don't support %s\n", __func__);
+	return -1;
+}
+
+int rk_bt_sink_get_buffer_stats(RK_BT_SINK_BUFFER_STATS *stats)
+{
+	pr_info("bluez don't support %s\n", __func__);
+	return -1;
+}
+
 /*****************************************************************
  *            Rockchip bluetooth spp api                         *
  *****************************************************************/
@@ -1773,6 +1792,11 @@ int rk_bt_hfp_disconnect()
 	return disconnect_current_devices();
 }
 
+int rk_bt_hfp_get_audio_stats(RK_BT_HFP_AUDIO_STATS *uplink, RK_BT_HFP_AUDIO_STATS *downlink)
+{
+	return rfcomm_hfp_get_audio_stats(uplink, downlink);
+}
+
 /*****************************************************************
  *            Rockchip bluetooth obex api                        *
  *****************************************************************/
@@ -0,0 +1,222 @@
+/*****************************************************************************
+ **
+ **  Name:           av_tx_flow.c
+ **
+ **  Description:    A2DP source transmit flow control
+ **
+ **  Copyright (c) 2019, Rockchip Corp., All Rights Reserved.
+ **  Rockchip Bluetooth Core. Proprietary and confidential.
+ **
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "av_tx_flow.h"
+
+#define AV_TX_FLOW_US   1000000LL
+
+static unsigned long long av_tx_flow_chunk_us(const av_tx_flow_t *flow)
+{
+    return flow->chunk * AV_TX_FLOW_US / flow->bytes_per_sec;
+}
+
+static void av_tx_flow_earn(av_tx_flow_t *flow, unsigned long long now_us)
+{
+    if (now_us > flow->last_us) {
+        flow->credit += (long long)(now_us - flow->last_us) * flow->bytes_per_sec *
+            AV_TX_FLOW_CATCHUP_PCT / 100;
+        if (flow->credit > flow->max_credit)
+            flow->credit = flow->max_credit;
+    }
+    flow->last_us = now_us;
+}
+
+/* a full chunk, or the whole frames of a tail the socket left quiet */
+static unsigned int av_tx_flow_ready(const av_tx_flow_t *flow, unsigned long long now_us)
+{
+    if (flow->used >= flow->chunk)
+        return flow->chunk;
+    if (now_us - flow->last_in_us >= av_tx_flow_chunk_us(flow))
+        return flow->used - flow->used % flow->frame_bytes;
+    return 0;
+}
+
+static void av_tx_flow_consume(av_tx_flow_t *flow)
+{
+    flow->rd = (flow->rd + flow->out) % flow->size;
+    flow->used -= flow->out;
+    flow->credit -= (long long)flow->out * AV_TX_FLOW_US;
+    flow->out = 0;
+}
+
+int av_tx_flow_init(av_tx_flow_t *flow, unsigned int chunk, unsigned int frame_bytes,
+        unsigned int bytes_per_sec)
+{
+    memset(flow, 0, sizeof(*flow));
+    if (!chunk || !frame_bytes || !bytes_per_sec || chunk % frame_bytes)
+        return -1;
+
+    flow->size = chunk * AV_TX_FLOW_CHUNKS;
+    flow->local = (uint8_t *)malloc(flow->size);
+    flow->bounce = (uint8_t *)malloc(chunk);
+    if (!flow->local || !flow->bounce) {
+        av_tx_flow_free(flow);
+        return -1;
+    }
+
+    flow->ring = flow->local;
+    flow->chunk = chunk;
+    flow->frame_bytes = frame_bytes;
+    flow->bytes_per_sec = bytes_per_sec;
+    flow->hold_us = flow->size * AV_TX_FLOW_US / bytes_per_sec;
+    flow->max_credit = (long long)chunk * AV_TX_FLOW_BURST_CHUNKS * AV_TX_FLOW_US;
+    return 0;
+}
+
+void av_tx_flow_free(av_tx_flow_t *flow)
+{
+    free(flow->local);
+    free(flow->bounce);
+    flow->ring = flow->local = flow->bounce = NULL;
+}
+
+void av_tx_flow_reset(av_tx_flow_t *flow, unsigned long long now_us)
+{
+    flow->rd = flow->used = flow->out = 0;
+    flow->credit = flow->max_credit;
+    flow->last_us = flow->last_in_us = flow->last_sent_us = now_us;
+    flow->max_used = flow->refused = flow->dropped_frames = 0;
+    flow->sent_bytes = 0;
+}
+
+void av_tx_flow_resume(av_tx_flow_t *flow, unsigned long long now_us)
+{
+    flow->credit = flow->max_credit;
+    flow->last_us = flow->last_sent_us = now_us;
+}
+
+int av_tx_flow_attach(av_tx_flow_t *flow, uint8_t *ring, unsigned int size, unsigned int rd,
+        unsigned int used, unsigned long long now_us)
+{
+    if (!flow->local || size < flow->chunk * 2 || rd >= size || used > size)
+        return -1;
+
+    flow->ring = ring;
+    flow->size = size;
+    flow->hold_us = (unsigned long long)size * AV_TX_FLOW_US / flow->bytes_per_sec;
+    flow->rd = rd;
+    flow->used = flow->max_used = used;
+    flow->out = 0;
+    flow->last_in_us = now_us;
+    return 0;
+}
+
+void av_tx_flow_detach(av_tx_flow_t *flow, unsigned long long now_us)
+{
+    if (flow->ring == flow->local)
+        return;
+
+    flow->ring = flow->local;
+    flow->size = flow->chunk * AV_TX_FLOW_CHUNKS;
+    flow->hold_us = (unsigned long long)flow->size * AV_TX_FLOW_US / flow->bytes_per_sec;
+    flow->rd = flow->used = flow->out = 0;
+    flow->last_in_us = now_us;
+}
+
+unsigned int av_tx_flow_space(av_tx_flow_t *flow, uint8_t **p)
+{
+    unsigned int wr = (flow->rd + flow->used) % flow->size;
+    unsigned int space = flow->size - flow->used;
+
+    *p = flow->ring + wr;
+    return space < flow->size - wr ? space : flow->size - wr;
+}
+
+void av_tx_flow_produced(av_tx_flow_t *flow, unsigned int len, unsigned long long now_us)
+{
+    flow->used += len;
+    if (flow->used > flow->max_used)
+        flow->max_used = flow->used;
+    flow->last_in_us = now_us;
+}
+
+long av_tx_flow_wait_us(av_tx_flow_t *flow, unsigned long long now_us)
+{
+    unsigned int len;
+    long long need;
+
+    if (!flow->used)
+        return -1;
+
+    av_tx_flow_earn(flow, now_us);
+    len = av_tx_flow_ready(flow, now_us);
+    if (!len) {
+        if (flow->used >= flow->frame_bytes)
+            return av_tx_flow_chunk_us(flow) - (now_us - flow->last_in_us);
+        return -1;
+    }
+
+    need = (long long)len * AV_TX_FLOW_US;
+    if (flow->credit >= need)
+        return 0;
+    return (need - flow->credit) * 100 / ((long long)flow->bytes_per_sec * AV_TX_FLOW_CATCHUP_PCT) + 1;
+}
+
+const uint8_t *av_tx_flow_chunk(av_tx_flow_t *flow, unsigned int *len)
+{
+    unsigned int first;
+
+    flow->out = flow->used < flow->chunk ? flow->used - flow->used % flow->frame_bytes : flow->chunk;
+    *len = flow->out;
+    if (flow->rd + flow->out <= flow->size)
+        return flow->ring + flow->rd;
+
+    first = flow->size - flow->rd;
+    memcpy(flow->bounce, flow->ring + flow->rd, first);
+    memcpy(flow->bounce + first, flow->ring, flow->out - first);
+    return flow->bounce;
+}
+
+void av_tx_flow_sent(av_tx_flow_t *flow, unsigned long long now_us)
+{
+    flow->sent_bytes += flow->out;
+    flow->last_sent_us = now_us;
+    av_tx_flow_consume(flow);
+}
+
+void av_tx_flow_refused(av_tx_flow_t *flow, unsigned long long now_us)
+{
+    flow->refused++;
+
+    /* nothing taken for longer than the ring holds: this audio is stale */
+    if (now_us - flow->last_sent_us > flow->hold_us) {
+        flow->dropped_frames += flow->out / flow->frame_bytes;
+        av_tx_flow_consume(flow);
+        return;
+    }
+
+    /* try again in a chunk time, keeping the chunk */
+    flow->credit = 0;
+    flow->out = 0;
+}
+
+void av_tx_flow_get_stats(const av_tx_flow_t *flow, RK_BT_SOURCE_TX_STATS *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!flow->bytes_per_sec)
+        return;
+
+    stats->queued_ms = (unsigned long long)flow->used * 1000 / flow->bytes_per_sec;
+    stats->max_queued_ms = (unsigned long long)flow->max_used * 1000 / flow->bytes_per_sec;
+    stats->refused = flow->refused;
+    stats->dropped_frames = flow->dropped_frames;
+    stats->sent_bytes = flow->sent_bytes;
+}
+
+unsigned long long av_tx_flow_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * AV_TX_FLOW_US + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,106 @@
+/*****************************************************************************
+ **
+ **  Name:           av_tx_flow.h
+ **
+ **  Description:    A2DP source transmit flow control
+ **
+ **  Copyright (c) 2019, Rockchip Corp., All Rights Reserved.
+ **  Rockchip Bluetooth Core. Proprietary and confidential.
+ **
+ *****************************************************************************/
+#ifndef AV_TX_FLOW_H
+#define AV_TX_FLOW_H
+
+#include <stdint.h>
+#include "DeviceIo/RkBtSource.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Staging between the pcm socket and the uipc channel to the bsa server.
+ * The socket is only read into free ring space, so a producer that runs
+ * ahead blocks in its own send. Chunks go to uipc against credits earned
+ * a little faster than the stream rate, so a backlog left by a stall is
+ * worked off, with a short burst allowed; a send the server has
+ * no buffer for costs all credits, so the next try is a chunk time later
+ * instead of the stream being paused. When the server has taken nothing
+ * for longer than the ring holds, refused chunks are dropped whole at the
+ * stream rate, which keeps the producer moving and the audio fresh.
+ *
+ * Everything runs in the one tx thread; times are CLOCK_MONOTONIC us.
+ */
+
+#define AV_TX_FLOW_CHUNKS           8       /* ring size, in uipc chunks */
+#define AV_TX_FLOW_BURST_CHUNKS     3       /* credits banked at most */
+#define AV_TX_FLOW_CATCHUP_PCT      125     /* credit rate over the stream rate */
+
+typedef struct {
+    uint8_t *ring;
+    uint8_t *local;                 /* our own ring, when none is attached */
+    uint8_t *bounce;                /* a chunk that wraps the ring */
+    unsigned int size;
+    unsigned int rd;
+    unsigned int used;
+    unsigned int out;               /* length of the chunk handed out */
+    unsigned int chunk;
+    unsigned int frame_bytes;
+    unsigned int bytes_per_sec;
+    unsigned int hold_us;           /* server silence before refused chunks drop */
+    long long credit;               /* bytes * 1000000 */
+    long long max_credit;
+    unsigned long long last_us;
+    unsigned long long last_in_us;
+    unsigned long long last_sent_us;
+
+    unsigned int max_used;
+    unsigned int refused;
+    unsigned int dropped_frames;
+    unsigned long long sent_bytes;
+} av_tx_flow_t;
+
+int av_tx_flow_init(av_tx_flow_t *flow, unsigned int chunk, unsigned int frame_bytes,
+        unsigned int bytes_per_sec);
+void av_tx_flow_free(av_tx_flow_t *flow);
+
+/* empty the ring, clear the counters and bank a full burst, at each stream start */
+void av_tx_flow_reset(av_tx_flow_t *flow, unsigned long long now_us);
+
+/* bank a full burst again and restart the stall clock, keeping the ring */
+void av_tx_flow_resume(av_tx_flow_t *flow, unsigned long long now_us);
+
+/*
+ * Stage in a ring the producer writes into itself, size bytes with the
+ * oldest unsent byte at rd, instead of copying into our own; detach goes
+ * back to our own ring, empty.
+ */
+int av_tx_flow_attach(av_tx_flow_t *flow, uint8_t *ring, unsigned int size, unsigned int rd,
+        unsigned int used, unsigned long long now_us);
+void av_tx_flow_detach(av_tx_flow_t *flow, unsigned long long now_us);
+
+/* contiguous free space for the socket to be read into, then commit it */
+unsigned int av_tx_flow_space(av_tx_flow_t *flow, uint8_t **p);
+void av_tx_flow_produced(av_tx_flow_t *flow, unsigned int len, unsigned long long now_us);
+
+/*
+ * 0 when a chunk can go to uipc now, else the us until credits allow it,
+ * or -1 with nothing to send. A short tail goes once the socket has been
+ * quiet for a chunk time.
+ */
+long av_tx_flow_wait_us(av_tx_flow_t *flow, unsigned long long now_us);
+
+/* the chunk to send, valid until sent or refused */
+const uint8_t *av_tx_flow_chunk(av_tx_flow_t *flow, unsigned int *len);
+void av_tx_flow_sent(av_tx_flow_t *flow, unsigned long long now_us);
+void av_tx_flow_refused(av_tx_flow_t *flow, unsigned long long now_us);
+
+void av_tx_flow_get_stats(const av_tx_flow_t *flow, RK_BT_SOURCE_TX_STATS *stats);
+
+unsigned long long av_tx_flow_now_us(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
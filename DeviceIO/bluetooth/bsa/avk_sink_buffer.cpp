@@ -0,0 +1,456 @@
+/*****************************************************************************
+ **
+ **  Name:           avk_sink_buffer.c
+ **
+ **  Description:    A2DP sink playback buffer
+ **
+ **  Copyright (c) 2019, Rockchip Corp., All Rights Reserved.
+ **  Rockchip Bluetooth Core. Proprietary and confidential.
+ **
+ *****************************************************************************/
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "bsa_api.h"
+#include "app_utils.h"
+#include "avk_sink_buffer.h"
+
+/* power of two so the byte counters wrap with it, 1.3 s of 48 kHz stereo */
+#define AVK_SINK_RING_SIZE          (1 << 18)
+#define AVK_SINK_RING_MASK          (AVK_SINK_RING_SIZE - 1)
+/* burst room on top of twice the target before packets are dropped */
+#define AVK_SINK_BURST_MS           100
+/* the device buffer, the ring in front of it does the real buffering */
+#define AVK_SINK_ALSA_LATENCY_US    100000
+#define AVK_SINK_FADE_MS            5
+/* silence played after the stream stops before the pcm is stopped too */
+#define AVK_SINK_IDLE_MS            1000
+/* how long the latency has to stay above the target before it is cut back */
+#define AVK_SINK_TRIM_MS            2000
+#define AVK_SINK_PRIME_POLL_US      5000
+
+typedef struct {
+    pthread_mutex_t lock;           /* start and stop, never the data path */
+    snd_pcm_t *handle;
+    pthread_t tid;
+    snd_pcm_format_t format;
+    unsigned int channels;
+    unsigned int rate;
+    unsigned int frame_bytes;
+    snd_pcm_uframes_t buffer_size;
+    snd_pcm_uframes_t period_size;
+    UINT8 *silence;
+    int16_t last[2];                /* last frame played, where the fade out starts */
+    int running;
+
+    /* between the uipc callback and the writer, all through atomics */
+    int open;
+    int writers;
+    unsigned int head;              /* bytes queued, moved by the callback only */
+    unsigned int tail;              /* bytes played, moved by the writer only */
+    unsigned int target_ms;
+
+    unsigned int packets;
+    unsigned int dropped;
+    unsigned int underruns;
+    unsigned int max_fill;
+    unsigned int alsa_delay;
+} tAVK_SINK_BUFFER;
+
+static tAVK_SINK_BUFFER avk_sink = {
+    PTHREAD_MUTEX_INITIALIZER,
+};
+static unsigned int avk_sink_target_ms = AVK_SINK_DEFAULT_LATENCY_MS;
+static UINT8 avk_sink_ring[AVK_SINK_RING_SIZE];
+
+static unsigned int avk_sink_ms_to_frames(unsigned int ms)
+{
+    return (unsigned long long)ms * avk_sink.rate / 1000;
+}
+
+static unsigned int avk_sink_frames_to_ms(unsigned int frames)
+{
+    return avk_sink.rate ? (unsigned long long)frames * 1000 / avk_sink.rate : 0;
+}
+
+static unsigned int avk_sink_fill(void)
+{
+    unsigned int head = __atomic_load_n(&avk_sink.head, __ATOMIC_ACQUIRE);
+
+    return (head - avk_sink.tail) / avk_sink.frame_bytes;
+}
+
+static int16_t *avk_sink_frame(unsigned int pos)
+{
+    return (int16_t *)(avk_sink_ring + (pos & AVK_SINK_RING_MASK));
+}
+
+/* ramp the frames queued from byte pos up from silence */
+static void avk_sink_fade_in(unsigned int pos, unsigned int frames)
+{
+    unsigned int fade = avk_sink_ms_to_frames(AVK_SINK_FADE_MS);
+    int16_t *p;
+
+    if (avk_sink.format != SND_PCM_FORMAT_S16_LE)
+        return;
+
+    for (unsigned int i = 0; i < frames && i < fade; i++) {
+        p = avk_sink_frame(pos + i * avk_sink.frame_bytes);
+        for (unsigned int c = 0; c < avk_sink.channels; c++)
+            p[c] = p[c] * (int)i / (int)fade;
+    }
+}
+
+/* a period of silence, ramped down from the last frame played */
+static void avk_sink_conceal(unsigned int frames)
+{
+    int16_t *p = (int16_t *)avk_sink.silence;
+    unsigned int fade = avk_sink_ms_to_frames(AVK_SINK_FADE_MS);
+
+    if (avk_sink.format != SND_PCM_FORMAT_S16_LE) {
+        memset(avk_sink.silence, 0x80, frames * avk_sink.frame_bytes);
+        return;
+    }
+
+    memset(avk_sink.silence, 0, frames * avk_sink.frame_bytes);
+    for (unsigned int i = 0; i < frames && i < fade; i++)
+        for (unsigned int c = 0; c < avk_sink.channels; c++)
+            p[i * avk_sink.channels + c] = avk_sink.last[c] * (int)(fade - i) / (int)fade;
+    memset(avk_sink.last, 0, sizeof(avk_sink.last));
+}
+
+static void avk_sink_keep_last(const UINT8 *data, unsigned int frames)
+{
+    if (avk_sink.format == SND_PCM_FORMAT_S16_LE && frames)
+        memcpy(avk_sink.last, data + (frames - 1) * avk_sink.frame_bytes, avk_sink.frame_bytes);
+}
+
+/*
+ * Skip frames near the head of the queue, after a device stall left more
+ * standing in the ring than the target asks for. The frames played before
+ * the cut fade out and the ones after it fade in.
+ */
+static void avk_sink_trim(unsigned int frames)
+{
+    unsigned int fill = avk_sink_fill();
+    unsigned int fade = avk_sink_ms_to_frames(AVK_SINK_FADE_MS);
+    unsigned int fb = avk_sink.frame_bytes;
+    unsigned int tail = avk_sink.tail;
+    int16_t *src, *dst;
+
+    if (fill < 2 * fade || frames < fade)
+        return;
+    if (frames > fill - 2 * fade)
+        frames = fill - 2 * fade;
+
+    /* the fade out goes where the last skipped frames were */
+    if (avk_sink.format == SND_PCM_FORMAT_S16_LE) {
+        for (unsigned int i = 0; i < fade; i++) {
+            src = avk_sink_frame(tail + i * fb);
+            dst = avk_sink_frame(tail + (frames + i) * fb);
+            for (unsigned int c = 0; c < avk_sink.channels; c++)
+                dst[c] = src[c] * (int)(fade - i) / (int)fade;
+        }
+    }
+    avk_sink_fade_in(tail + (frames + fade) * fb, fill - frames - fade);
+    __atomic_store_n(&avk_sink.tail, tail + frames * fb, __ATOMIC_RELEASE);
+
+    APP_DEBUG1("a2dp sink buffer: trim %u ms", avk_sink_frames_to_ms(frames));
+}
+
+static void *avk_sink_writer(void *arg)
+{
+    snd_pcm_t *handle = avk_sink.handle;
+    unsigned int period = avk_sink.period_size;
+    unsigned int wait_ms = avk_sink_frames_to_ms(period) * 2 + 1;
+    unsigned int fill, target, n, idle = 0;
+    unsigned int queued, window = 0, window_min = ~0u;
+    snd_pcm_sframes_t avail, ret;
+    bool started = false, refilling = true;
+    UINT8 *p;
+
+    while (__atomic_load_n(&avk_sink.running, __ATOMIC_ACQUIRE)) {
+        target = avk_sink_ms_to_frames(__atomic_load_n(&avk_sink.target_ms, __ATOMIC_RELAXED));
+        fill = avk_sink_fill();
+
+        /* nothing goes to the device until the ring holds the target */
+        if (!started && fill < target) {
+            usleep(AVK_SINK_PRIME_POLL_US);
+            continue;
+        }
+
+        avail = snd_pcm_avail_update(handle);
+        if (avail < 0) {
+            if (avail == -EPIPE)
+                __atomic_add_fetch(&avk_sink.underruns, 1, __ATOMIC_RELAXED);
+            APP_DEBUG1("ALSA: %s, restart", snd_strerror(avail));
+            if (snd_pcm_recover(handle, avail, 1) < 0)
+                snd_pcm_prepare(handle);
+            started = false;
+            refilling = true;
+            window = 0;
+            window_min = ~0u;
+            continue;
+        }
+        if (started && (snd_pcm_uframes_t)avail < period) {
+            snd_pcm_wait(handle, wait_ms);
+            continue;
+        }
+        __atomic_store_n(&avk_sink.alsa_delay, avk_sink.buffer_size - avail, __ATOMIC_RELAXED);
+
+        if (refilling && fill >= target) {
+            refilling = false;
+            idle = 0;
+            avk_sink_fade_in(avk_sink.tail, fill);
+        }
+
+        if (!refilling && fill) {
+            n = (AVK_SINK_RING_SIZE - (avk_sink.tail & AVK_SINK_RING_MASK)) / avk_sink.frame_bytes;
+            if (n > fill)
+                n = fill;
+            if (n > (unsigned int)avail)
+                n = avail;
+            p = avk_sink_ring + (avk_sink.tail & AVK_SINK_RING_MASK);
+
+            ret = snd_pcm_writei(handle, p, n);
+            if (ret == -EAGAIN)
+                continue;
+            if (ret < 0) {
+                APP_DEBUG1("ALSA: snd_pcm_writei err %d (%s)", (int)ret, snd_strerror(ret));
+                if (snd_pcm_recover(handle, ret, 1) < 0)
+                    snd_pcm_prepare(handle);
+                started = false;
+                refilling = true;
+                window = 0;
+                window_min = ~0u;
+                continue;
+            }
+            avk_sink_keep_last(p, ret);
+            __atomic_store_n(&avk_sink.tail, avk_sink.tail + ret * avk_sink.frame_bytes, __ATOMIC_RELEASE);
+
+            /* the low point over a while is what the jitter doesn't need */
+            queued = fill + avk_sink.buffer_size - avail;
+            if (queued < window_min)
+                window_min = queued;
+            window += ret;
+            if (window >= avk_sink_ms_to_frames(AVK_SINK_TRIM_MS)) {
+                if (window_min > target + period)
+                    avk_sink_trim(window_min - target);
+                window = 0;
+                window_min = ~0u;
+            }
+
+            if (!started) {
+                if (snd_pcm_state(handle) == SND_PCM_STATE_PREPARED)
+                    snd_pcm_start(handle);
+                started = true;
+            }
+            continue;
+        }
+
+        /* the device still has a period to play, give the stream a moment */
+        if (avk_sink.buffer_size - avail > period) {
+            usleep(avk_sink_frames_to_ms(period) * 1000 / 4);
+            continue;
+        }
+
+        /* it's about to run dry: keep it fed with silence until refilled */
+        if (!refilling) {
+            __atomic_add_fetch(&avk_sink.underruns, 1, __ATOMIC_RELAXED);
+            refilling = true;
+            window = 0;
+            window_min = ~0u;
+        }
+        n = period < (unsigned int)avail ? period : avail;
+        avk_sink_conceal(n);
+        ret = snd_pcm_writei(handle, avk_sink.silence, n);
+        if (ret > 0)
+            idle += ret;
+
+        /* a paused stream, let the device stop until it comes back */
+        if (idle >= avk_sink_ms_to_frames(AVK_SINK_IDLE_MS)) {
+            APP_DEBUG0("a2dp stream idle, stop pcm");
+            snd_pcm_drop(handle);
+            snd_pcm_prepare(handle);
+            __atomic_store_n(&avk_sink.alsa_delay, 0, __ATOMIC_RELAXED);
+            started = false;
+            idle = 0;
+        }
+    }
+
+    return NULL;
+}
+
+static void avk_sink_stop_locked(void)
+{
+    if (!avk_sink.handle)
+        return;
+
+    /* no new packets in, then wait out the ones being copied */
+    __atomic_store_n(&avk_sink.open, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&avk_sink.writers, __ATOMIC_SEQ_CST))
+        sched_yield();
+
+    __atomic_store_n(&avk_sink.running, 0, __ATOMIC_RELEASE);
+    pthread_join(avk_sink.tid, NULL);
+
+    APP_DEBUG1("a2dp sink buffer: %u packets, %u dropped, %u underruns, max fill %u ms",
+            avk_sink.packets, avk_sink.dropped, avk_sink.underruns,
+            avk_sink_frames_to_ms(avk_sink.max_fill));
+
+    snd_pcm_close(avk_sink.handle);
+    avk_sink.handle = NULL;
+    free(avk_sink.silence);
+    avk_sink.silence = NULL;
+}
+
+int avk_sink_buffer_start(const char *device, snd_pcm_format_t format,
+        unsigned int channels, unsigned int rate)
+{
+    snd_pcm_t *handle;
+    int status;
+
+    if (channels < 1 || channels > 2 || !rate) {
+        APP_ERROR1("unsupported stream: %u channels, %u Hz", channels, rate);
+        return -1;
+    }
+
+    pthread_mutex_lock(&avk_sink.lock);
+    avk_sink_stop_locked();
+
+    /* the writer waits in snd_pcm_wait, so the pcm itself never blocks */
+    status = snd_pcm_open(&handle, device, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+    if (status < 0) {
+        APP_ERROR1("snd_pcm_open failed: %s", snd_strerror(status));
+        goto fail;
+    }
+
+    status = snd_pcm_set_params(handle, format, SND_PCM_ACCESS_RW_INTERLEAVED,
+            channels, rate, 1, AVK_SINK_ALSA_LATENCY_US);
+    if (status < 0) {
+        APP_ERROR1("snd_pcm_set_params failed: %s", snd_strerror(status));
+        snd_pcm_close(handle);
+        goto fail;
+    }
+
+    avk_sink.handle = handle;
+    avk_sink.format = format;
+    avk_sink.channels = channels;
+    avk_sink.rate = rate;
+    avk_sink.frame_bytes = channels * (format == SND_PCM_FORMAT_U8 ? 1 : 2);
+    snd_pcm_get_params(handle, &avk_sink.buffer_size, &avk_sink.period_size);
+    avk_sink.silence = (UINT8 *)malloc(avk_sink.period_size * avk_sink.frame_bytes);
+    memset(avk_sink.last, 0, sizeof(avk_sink.last));
+    avk_sink.head = avk_sink.tail = 0;
+    avk_sink.target_ms = avk_sink_target_ms;
+    avk_sink.packets = avk_sink.dropped = avk_sink.underruns = 0;
+    avk_sink.max_fill = avk_sink.alsa_delay = 0;
+    avk_sink.running = 1;
+
+    if (!avk_sink.silence || pthread_create(&avk_sink.tid, NULL, avk_sink_writer, NULL)) {
+        APP_ERROR0("start a2dp sink writer failed");
+        snd_pcm_close(handle);
+        avk_sink.handle = NULL;
+        free(avk_sink.silence);
+        avk_sink.silence = NULL;
+        goto fail;
+    }
+
+    __atomic_store_n(&avk_sink.open, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&avk_sink.lock);
+
+    APP_DEBUG1("a2dp sink buffer: %u Hz, %u channels, period %lu, buffer %lu, target %u ms",
+            rate, channels, avk_sink.period_size, avk_sink.buffer_size, avk_sink.target_ms);
+    return 0;
+
+fail:
+    pthread_mutex_unlock(&avk_sink.lock);
+    return -1;
+}
+
+void avk_sink_buffer_stop(void)
+{
+    pthread_mutex_lock(&avk_sink.lock);
+    avk_sink_stop_locked();
+    pthread_mutex_unlock(&avk_sink.lock);
+}
+
+int avk_sink_buffer_write(const void *data, unsigned int len)
+{
+    unsigned int head, used, limit, off, n;
+    int ret = -1;
+
+    __atomic_add_fetch(&avk_sink.writers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&avk_sink.open, __ATOMIC_SEQ_CST))
+        goto out;
+
+    len -= len % avk_sink.frame_bytes;
+    head = avk_sink.head;
+    used = head - __atomic_load_n(&avk_sink.tail, __ATOMIC_ACQUIRE);
+    limit = avk_sink_ms_to_frames(2 * __atomic_load_n(&avk_sink.target_ms, __ATOMIC_RELAXED) +
+            AVK_SINK_BURST_MS) * avk_sink.frame_bytes;
+    if (limit > AVK_SINK_RING_SIZE)
+        limit = AVK_SINK_RING_SIZE;
+
+    __atomic_add_fetch(&avk_sink.packets, 1, __ATOMIC_RELAXED);
+    if (used + len > limit) {
+        __atomic_add_fetch(&avk_sink.dropped, 1, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    off = head & AVK_SINK_RING_MASK;
+    n = len < AVK_SINK_RING_SIZE - off ? len : AVK_SINK_RING_SIZE - off;
+    memcpy(avk_sink_ring + off, data, n);
+    memcpy(avk_sink_ring, (const UINT8 *)data + n, len - n);
+    __atomic_store_n(&avk_sink.head, head + len, __ATOMIC_RELEASE);
+
+    if ((used + len) / avk_sink.frame_bytes > avk_sink.max_fill)
+        __atomic_store_n(&avk_sink.max_fill, (used + len) / avk_sink.frame_bytes, __ATOMIC_RELAXED);
+    ret = 0;
+
+out:
+    __atomic_sub_fetch(&avk_sink.writers, 1, __ATOMIC_SEQ_CST);
+    return ret;
+}
+
+int avk_sink_buffer_set_latency(unsigned int ms)
+{
+    if (ms < AVK_SINK_MIN_LATENCY_MS || ms > AVK_SINK_MAX_LATENCY_MS) {
+        APP_ERROR1("latency %u ms out of range (%d..%d)", ms,
+                AVK_SINK_MIN_LATENCY_MS, AVK_SINK_MAX_LATENCY_MS);
+        return -1;
+    }
+
+    /* kept for the next stream, and taken up by a running one right away */
+    avk_sink_target_ms = ms;
+    __atomic_store_n(&avk_sink.target_ms, ms, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int avk_sink_buffer_get_stats(RK_BT_SINK_BUFFER_STATS *stats)
+{
+    unsigned int fill;
+
+    if (!stats)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->target_ms = avk_sink_target_ms;
+
+    pthread_mutex_lock(&avk_sink.lock);
+    if (avk_sink.handle) {
+        fill = (__atomic_load_n(&avk_sink.head, __ATOMIC_ACQUIRE) -
+                __atomic_load_n(&avk_sink.tail, __ATOMIC_ACQUIRE)) / avk_sink.frame_bytes;
+        stats->fill_ms = avk_sink_frames_to_ms(fill);
+        stats->max_fill_ms = avk_sink_frames_to_ms(__atomic_load_n(&avk_sink.max_fill, __ATOMIC_RELAXED));
+        stats->latency_ms = stats->fill_ms +
+                avk_sink_frames_to_ms(__atomic_load_n(&avk_sink.alsa_delay, __ATOMIC_RELAXED));
+        stats->packets = __atomic_load_n(&avk_sink.packets, __ATOMIC_RELAXED);
+        stats->dropped = __atomic_load_n(&avk_sink.dropped, __ATOMIC_RELAXED);
+        stats->underruns = __atomic_load_n(&avk_sink.underruns, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&avk_sink.lock);
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+/*****************************************************************************
+ **
+ **  Name:           avk_sink_buffer.h
+ **
+ **  Description:    A2DP sink playback buffer
+ **
+ **  Copyright (c) 2019, Rockchip Corp., All Rights Reserved.
+ **  Rockchip Bluetooth Core. Proprietary and confidential.
+ **
+ *****************************************************************************/
+#ifndef AVK_SINK_BUFFER_H
+#define AVK_SINK_BUFFER_H
+
+#include "alsa/asoundlib.h"
+#include "DeviceIo/RkBtSink.h"
+
+/*
+ * Sits between the uipc audio callback and alsa. The callback only copies
+ * into a lock-free ring and never waits; a writer thread owns the pcm,
+ * holds the ring at the target latency and plays faded silence over the
+ * gaps when the stream runs dry.
+ */
+
+#define AVK_SINK_DEFAULT_LATENCY_MS     100
+#define AVK_SINK_MIN_LATENCY_MS         20
+#define AVK_SINK_MAX_LATENCY_MS         500
+
+/* open the pcm and start the writer; a running one is stopped first */
+int avk_sink_buffer_start(const char *device, snd_pcm_format_t format,
+        unsigned int channels, unsigned int rate);
+
+/* stop the writer and close the pcm, anything still queued is dropped */
+void avk_sink_buffer_stop(void);
+
+/* queue one packet from the uipc callback, dropped if the ring is full */
+int avk_sink_buffer_write(const void *data, unsigned int len);
+
+/* fill to reach before playing, at start and after an underrun */
+int avk_sink_buffer_set_latency(unsigned int ms);
+
+int avk_sink_buffer_get_stats(RK_BT_SINK_BUFFER_STATS *stats);
+
+#endif
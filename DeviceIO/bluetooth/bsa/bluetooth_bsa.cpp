@@ -29,6 +29,7 @@
 #include "app_pbc.h"
 #include "../bluetooth.h"
 #include "bluetooth_bsa.h"
+#include "avk_sink_buffer.h"
 #include "utility.h"
 
 #ifdef BROADCOM_BSA
@@ -884,6 +885,19 @@ void rk_bt_sink_set_alsa_device(char *alsa_dev)
     app_avk_set_alsa_device(alsa_dev);
 }
 
+int rk_bt_sink_set_buffer_latency(int ms)
+{
+    if (ms < 0)
+        return -1;
+
+    return avk_sink_buffer_set_latency(ms);
+}
+
+int rk_bt_sink_get_buffer_stats(RK_BT_SINK_BUFFER_STATS *stats)
+{
+    return avk_sink_buffer_get_stats(stats);
+}
+
 /******************************************/
 /***************** BLE ********************/
 /******************************************/
@@ -1465,6 +1479,11 @@ int rk_bt_source_vol_down()
     return app_av_vol_down();
 }
 
+int rk_bt_source_get_tx_stats(RK_BT_SOURCE_TX_STATS *stats)
+{
+    return app_av_get_tx_stats(stats);
+}
+
 /*****************************************************************
  *                     BLUETOOTH SPP API                         *
  *****************************************************************/
@@ -1640,6 +1659,13 @@ int rk_bt_hfp_disconnect()
     return app_hs_close_all();
 }
 
+int rk_bt_hfp_get_audio_stats(RK_BT_HFP_AUDIO_STATS *uplink, RK_BT_HFP_AUDIO_STATS *downlink)
+{
+    /* the bsa server moves the sco audio itself */
+    APP_DEBUG1("bsa don't support %s", __func__);
+    return -1;
+}
+
 /*****************************************************************
  *            Rockchip bluetooth obex api                        *
  *****************************************************************/
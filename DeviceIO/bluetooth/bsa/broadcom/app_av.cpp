@@ -19,6 +19,8 @@
 #include <unistd.h>
 /* for EINTR */
 #include <errno.h>
+/* for the tx stats lock */
+#include <pthread.h>
 
 #include "bsa_api.h"
 
@@ -41,6 +43,7 @@
 #include "app_dm.h"
 #include "app_av_file_info.h"
 #include "app_manager.h"
+#include "av_tx_flow.h"
 
 #ifdef PCM_ALSA
 #include "app_alsa.h"
@@ -154,6 +157,10 @@ const tBSA_AV_CODEC_INFO sec_caps =
 #define APP_AV_AUTOPLAY     APP_AV_PLAYTYPE_PCM_DATA
 static int app_uipc_pcm_tx_done = 0;
 static char app_av_sock_path[] = "/data/bsa/config/bsa_socket";
+static av_tx_flow_t app_av_tx_flow;
+/* what app_av_get_tx_stats() hands out, only the tx thread touches the flow */
+static RK_BT_SOURCE_TX_STATS app_av_tx_stats;
+static pthread_mutex_t app_av_tx_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* Play states (we use define instead of enum to allow Makefile to use them) */
 #define APP_AV_PLAYTYPE_TONE        0   /* Play tone */
@@ -3905,6 +3912,70 @@ BOOLEAN app_av_check_feeding(const tAPP_WAV_FILE_FORMAT *p_format)
     }
 }
 
+/*******************************************************************************
+ **
+ ** Function           app_av_tx_stats_publish
+ **
+ ** Description        Copy the counters of the tx flow out for other threads
+ **
+ ** Returns            void
+ **
+ *******************************************************************************/
+static void app_av_tx_stats_publish(void)
+{
+    RK_BT_SOURCE_TX_STATS stats;
+
+    av_tx_flow_get_stats(&app_av_tx_flow, &stats);
+
+    pthread_mutex_lock(&app_av_tx_stats_mutex);
+    app_av_tx_stats = stats;
+    pthread_mutex_unlock(&app_av_tx_stats_mutex);
+}
+
+/*******************************************************************************
+ **
+ ** Function           app_av_tx_flow_start
+ **
+ ** Description        Set the staging up for the stream that just started
+ **
+ ** Returns            0 if successful, -1 otherwise
+ **
+ *******************************************************************************/
+static int app_av_tx_flow_start(void)
+{
+    unsigned int frame_bytes = 4, bytes_per_sec = 48000 * 4, chunk;
+
+    if (app_av_cb.media_feeding.format == BSA_AV_CODEC_PCM &&
+        app_av_cb.media_feeding.cfg.pcm.sampling_freq &&
+        app_av_cb.media_feeding.cfg.pcm.num_channel &&
+        app_av_cb.media_feeding.cfg.pcm.bit_per_sample)
+    {
+        frame_bytes = app_av_cb.media_feeding.cfg.pcm.num_channel *
+            app_av_cb.media_feeding.cfg.pcm.bit_per_sample / 8;
+        bytes_per_sec = app_av_cb.media_feeding.cfg.pcm.sampling_freq * frame_bytes;
+    }
+
+    /* Whole frames per send, so that a dropped chunk never splits one */
+    chunk = app_av_cb.uipc_cfg.length - app_av_cb.uipc_cfg.length % frame_bytes;
+
+    if (app_av_tx_flow.chunk != chunk ||
+        app_av_tx_flow.frame_bytes != frame_bytes ||
+        app_av_tx_flow.bytes_per_sec != bytes_per_sec)
+    {
+        av_tx_flow_free(&app_av_tx_flow);
+        if (av_tx_flow_init(&app_av_tx_flow, chunk, frame_bytes, bytes_per_sec) < 0)
+        {
+            APP_ERROR1("av_tx_flow_init failed, chunk %u", chunk);
+            app_av_tx_stats_publish();
+            return -1;
+        }
+    }
+
+    av_tx_flow_reset(&app_av_tx_flow, av_tx_flow_now_us());
+    app_av_tx_stats_publish();
+    return 0;
+}
+
 /*******************************************************************************
  **
  ** Function           app_uipc_pcm_tx_thread
@@ -3921,11 +3992,16 @@ static void app_uipc_pcm_tx_thread(void)
     struct rk_socket_app socket_app;
     fd_set rfds;
     struct timeval tv;
-
-    tv.tv_sec = 0;
-    tv.tv_usec = 100000;/* 100ms */
+    const UINT8 *p_chunk;
+    UINT8 *p_space;
+    unsigned int len, space;
+    long wait_us;
+    struct rk_shm_ring shm_ring;
+    uint32_t shm_seen = 0, shm_tail = 0, head;
+    char byte;
 
     memset(&socket_app, 0, sizeof(struct rk_socket_app));
+    memset(&shm_ring, 0, sizeof(shm_ring));
     strcpy(socket_app.sock_path, app_av_sock_path);
 
     if ((RK_socket_server_setup(&socket_app)) < 0)
@@ -3935,6 +4011,8 @@ wait_conn:
     while(app_uipc_pcm_tx_done) {
         FD_ZERO(&rfds);
         FD_SET(socket_app.server_sockfd, &rfds);
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;/* 100ms */
 
         if (select(socket_app.server_sockfd + 1, &rfds, NULL, NULL, &tv) < 0) {
             APP_ERROR0("select server socket failed");
@@ -3947,7 +4025,14 @@ wait_conn:
         if (RK_socke_server_accpet(&socket_app) < 0)
             goto exit;
 
-        APP_DEBUG0("Socket server connected");
+        /* A client that has a shared ring for the pcm offers it straight away */
+        if (RK_socket_server_accept_ring(socket_app.client_sockfd, &shm_ring, 100) < 0) {
+            RK_socket_client_teardown(socket_app.client_sockfd);
+            continue;
+        }
+
+        APP_DEBUG1("Socket server connected%s", shm_ring.data ? ", pcm in shared ring" : "");
+        shm_seen = shm_tail = 0;
         break;
     }
 
@@ -3957,6 +4042,8 @@ wait_conn:
         while (app_av_cb.play_state != APP_AV_PLAY_STARTED) {
             if(app_av_status.status == BT_SOURCE_STATUS_DISCONNECTED) {
                 APP_DEBUG0("===== socket client disconnect, start the next connection =====");
+                av_tx_flow_detach(&app_av_tx_flow, av_tx_flow_now_us());
+                RK_shm_ring_teardown(&shm_ring);
                 RK_socket_client_teardown(socket_app.client_sockfd);
                 goto wait_conn;
             }
@@ -3969,54 +4056,114 @@ wait_conn:
             }
         }
         //APP_DEBUG0("Play started");
+        if (app_av_tx_flow_start() < 0) {
+            app_av_stop_current();
+        } else if (shm_ring.data) {
+            /* Stage in place whatever the client has written and we haven't sent */
+            shm_seen = RK_shm_ring_head(&shm_ring);
+            if (av_tx_flow_attach(&app_av_tx_flow, (UINT8 *)shm_ring.data, shm_ring.size,
+                    shm_tail & (shm_ring.size - 1), shm_seen - shm_tail, av_tx_flow_now_us()) < 0) {
+                APP_ERROR1("Shared ring of %u bytes too small, drop the client", shm_ring.size);
+                RK_shm_ring_teardown(&shm_ring);
+                RK_socket_client_teardown(socket_app.client_sockfd);
+                goto wait_conn;
+            }
+        }
 
-        do {
-            memset(app_av_cb.audio_buf, 0, APP_AV_MAX_AUDIO_BUF_MAX);
-            nb_bytes = RK_socket_recieve(socket_app.client_sockfd, (char *)app_av_cb.audio_buf, app_av_cb.uipc_cfg.length);
-            //APP_DEBUG1("nb_bytes: %d", nb_bytes);
-            if (nb_bytes <= 0) {
-                if(nb_bytes < 0) {
-                    APP_DEBUG0("No more samples -> stopping current");
-                    app_av_stop_current();
+        while (app_av_tx_flow.ring && (app_av_cb.play_state != APP_AV_PLAY_STOPPED) &&
+         (app_av_cb.play_state != APP_AV_PLAY_STOPPING)) {
+            wait_us = av_tx_flow_wait_us(&app_av_tx_flow, av_tx_flow_now_us());
+            if (wait_us == 0) {
+                p_chunk = av_tx_flow_chunk(&app_av_tx_flow, &len);
+
+                /* Send the samples to the AV channel */
+                if (UIPC_Send(app_av_cb.stream_uipc_channel, 0, (UINT8 *)p_chunk, len) == TRUE) {
+#if (defined(BSA_AV_DUMP_TX_DATA) && (BSA_AV_DUMP_TX_DATA == TRUE))
+                    APP_DUMP("A2DP Data", (UINT8 *)p_chunk, len);
+#endif
+                    av_tx_flow_sent(&app_av_tx_flow, av_tx_flow_now_us());
                 } else {
-                    //APP_DEBUG0("socket recieve 0 bytes");
+                    /* Server short of buffers: hold the chunk back a chunk time */
+                    if (!UIPC_Ioctl(app_av_cb.stream_uipc_channel, UIPC_READ_ERROR, &uipc_error) ||
+                        uipc_error != UIPC_ENOMEM)
+                        APP_ERROR0("UIPC_Send failed");
+                    av_tx_flow_refused(&app_av_tx_flow, av_tx_flow_now_us());
                 }
-            } else {
-                if(nb_bytes != app_av_cb.uipc_cfg.length)
-                    APP_DEBUG1("audio_buf size: %d, read size: %d", app_av_cb.uipc_cfg.length, nb_bytes);
 
-                /* Send the samples to the AV channel */
-                if (UIPC_Send(app_av_cb.stream_uipc_channel, 0, (UINT8 *) app_av_cb.audio_buf, nb_bytes) == FALSE) {
-                    if(UIPC_Ioctl(app_av_cb.stream_uipc_channel, UIPC_READ_ERROR, &uipc_error)) {
-                        if (uipc_error == UIPC_ENOMEM) {
-                            APP_DEBUG0("UIPC buffer full! Pause playing");
-                            app_av_pause();
-                            GKI_delay(3000);
-                            APP_DEBUG0("UIPC buffer full! Resume playing");
-                            app_av_resume();
-                        } else {
-                            APP_ERROR0("UIPC_Send failed");
-                        }
+                /* Hand the client back what has gone out or been dropped */
+                if (shm_ring.data) {
+                    shm_tail = shm_seen - app_av_tx_flow.used;
+                    RK_shm_ring_release(&shm_ring, shm_tail);
+                }
+            } else if (shm_ring.data) {
+                /* The client writes straight into the ring the chunks go out from */
+                head = RK_shm_ring_head(&shm_ring);
+                if (head == shm_seen && !RK_shm_ring_wait_data(&shm_ring, shm_seen)) {
+                    FD_ZERO(&rfds);
+                    FD_SET(shm_ring.data_fd, &rfds);
+                    FD_SET(socket_app.client_sockfd, &rfds);
+                    tv.tv_sec = 0;
+                    tv.tv_usec = wait_us < 0 ? 100000 : wait_us;
+
+                    status = select((shm_ring.data_fd > socket_app.client_sockfd ?
+                        shm_ring.data_fd : socket_app.client_sockfd) + 1, &rfds, NULL, NULL, &tv);
+                    if (status > 0 && FD_ISSET(socket_app.client_sockfd, &rfds) &&
+                        RK_socket_recieve(socket_app.client_sockfd, &byte, 1) <= 0) {
+                        /* Nothing but the hangup comes on the socket any more */
+                        APP_DEBUG0("===== socket client closed, wait for the next connection =====");
+                        av_tx_flow_detach(&app_av_tx_flow, av_tx_flow_now_us());
+                        RK_shm_ring_teardown(&shm_ring);
+                        RK_socket_client_teardown(socket_app.client_sockfd);
+                        goto wait_conn;
                     }
+                    head = RK_shm_ring_head(&shm_ring);
                 }
-#if (defined(BSA_AV_DUMP_TX_DATA) && (BSA_AV_DUMP_TX_DATA == TRUE))
-                APP_DUMP("A2DP Data", (UINT8 *) app_av_cb.audio_buf, nb_bytes);
-#endif
 
-                /* Check if stream paused */
-                if (app_av_cb.play_state == APP_AV_PLAY_PAUSED) {
-                    APP_DEBUG0("Pausing (wait mutex)");
-                    status = app_lock_mutex(&app_av_cb.app_stream_tx_mutex);
-                    if (status < 0) {
-                        APP_ERROR1("app_lock_mutex failed: %d", status);
-                        break;
+                if (head != shm_seen) {
+                    av_tx_flow_produced(&app_av_tx_flow, head - shm_seen, av_tx_flow_now_us());
+                    shm_seen = head;
+                }
+            } else {
+                /* Read only what the ring has room for, the client waits for the rest */
+                space = av_tx_flow_space(&app_av_tx_flow, &p_space);
+                FD_ZERO(&rfds);
+                if (space)
+                    FD_SET(socket_app.client_sockfd, &rfds);
+                tv.tv_sec = 0;
+                tv.tv_usec = wait_us < 0 ? 100000 : wait_us;
+
+                status = select(space ? socket_app.client_sockfd + 1 : 0, &rfds, NULL, NULL, &tv);
+                if (status > 0 && FD_ISSET(socket_app.client_sockfd, &rfds)) {
+                    nb_bytes = RK_socket_recieve(socket_app.client_sockfd, (char *)p_space, space);
+                    //APP_DEBUG1("nb_bytes: %d", nb_bytes);
+                    if (nb_bytes < 0) {
+                        APP_DEBUG0("No more samples -> stopping current");
+                        app_av_stop_current();
+                    } else if (nb_bytes == 0) {
+                        APP_DEBUG0("===== socket client closed, wait for the next connection =====");
+                        RK_socket_client_teardown(socket_app.client_sockfd);
+                        goto wait_conn;
+                    } else {
+                        av_tx_flow_produced(&app_av_tx_flow, nb_bytes, av_tx_flow_now_us());
                     }
+                }
+            }
 
-                    APP_DEBUG0("Un-pausing");
+            app_av_tx_stats_publish();
+
+            /* Check if stream paused */
+            if (app_av_cb.play_state == APP_AV_PLAY_PAUSED) {
+                APP_DEBUG0("Pausing (wait mutex)");
+                status = app_lock_mutex(&app_av_cb.app_stream_tx_mutex);
+                if (status < 0) {
+                    APP_ERROR1("app_lock_mutex failed: %d", status);
+                    break;
                 }
+
+                APP_DEBUG0("Un-pausing");
+                av_tx_flow_resume(&app_av_tx_flow, av_tx_flow_now_us());
             }
-        } while ((app_av_cb.play_state != APP_AV_PLAY_STOPPED) &&
-         (app_av_cb.play_state != APP_AV_PLAY_STOPPING));
+        }
 
         /* Wait until stop has completed (could have happened before) */
         while (app_av_cb.play_state != APP_AV_PLAY_STOPPED) GKI_delay(10);
@@ -4024,6 +4171,8 @@ wait_conn:
 
 exit:
     APP_DEBUG0("Exit app_uipc_pcm_tx_thread");
+    av_tx_flow_detach(&app_av_tx_flow, av_tx_flow_now_us());
+    RK_shm_ring_teardown(&shm_ring);
     RK_socket_server_teardown(&socket_app);
     pthread_exit(NULL);
 }
@@ -4388,6 +4537,27 @@ int app_av_deregister(int index)
     return 0;
 }
 
+/*******************************************************************************
+ **
+ ** Function           app_av_get_tx_stats
+ **
+ ** Description        Staging queue and drop counters of the pcm data stream
+ **
+ ** Returns            0 if successful, -1 otherwise
+ **
+ *******************************************************************************/
+int app_av_get_tx_stats(RK_BT_SOURCE_TX_STATS *stats)
+{
+    if (!stats)
+        return -1;
+
+    /* the tx thread may be setting the flow up again right now */
+    pthread_mutex_lock(&app_av_tx_stats_mutex);
+    *stats = app_av_tx_stats;
+    pthread_mutex_unlock(&app_av_tx_stats_mutex);
+    return 0;
+}
+
 /*******************************************************************************
  **
  ** Function         app_av_init
@@ -38,6 +38,9 @@
 #endif
 
 #include "app_avk.h"
+#ifdef PCM_ALSA
+#include "avk_sink_buffer.h"
+#endif
 /*
  * Defines
  */
@@ -88,9 +91,6 @@ tAPP_AVK_CB app_avk_cb;
 #ifdef PCM_ALSA
 //static const char *alsa_device = "default"; /* ALSA playback device */
 static char alsa_device[30]; /* ALSA playback device */
-#ifdef PCM_ALSA_OPEN_BLOCKING
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-#endif
 #endif /* PCM_ALSA */
 
 enum APP_AVK_PLAYSTATE {
@@ -391,50 +391,18 @@ static void app_avk_handle_start(tBSA_AVK_MSG *p_data, tAPP_AVK_CONNECTION *conn
             p_data->start_streaming.media_receiving.cfg.pcm.num_channel,
             p_data->start_streaming.media_receiving.cfg.pcm.bit_per_sample);
 #ifdef PCM_ALSA
-        /* If ALSA PCM driver was already open => close it */
-        if (app_avk_cb.alsa_handle != NULL)
-        {
-#ifdef PCM_ALSA_OPEN_BLOCKING
-            pthread_mutex_lock(&mutex);
-#endif
-            snd_pcm_close(app_avk_cb.alsa_handle);
-            app_avk_cb.alsa_handle = NULL;
-#ifdef PCM_ALSA_OPEN_BLOCKING
-            pthread_mutex_unlock(&mutex);
-#endif
-        }
-
-        /* Open ALSA driver */
+        /* Open ALSA driver, replacing the one of a previous stream */
         app_avk_set_alsa_device(NULL);
-#ifdef PCM_ALSA_OPEN_BLOCKING
-        /* Configure as blocking */
-        status = snd_pcm_open(&(app_avk_cb.alsa_handle), alsa_device,
-            SND_PCM_STREAM_PLAYBACK, 0);
-#else
-        status = snd_pcm_open(&(app_avk_cb.alsa_handle), alsa_device,
-            SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
-#endif
-        if (status < 0)
-        {
-            APP_ERROR1("snd_pcm_open failed: %s", snd_strerror(status));
-
-        }
+        if (connection->bit_per_sample == 8)
+            format = SND_PCM_FORMAT_U8;
         else
+            format = SND_PCM_FORMAT_S16_LE;
+        /* The writer thread owns it from here, the uipc callback only queues */
+        status = avk_sink_buffer_start(alsa_device, format,
+            connection->num_channel, connection->sample_rate);
+        if (status < 0)
         {
-            APP_DEBUG0("ALSA driver opened");
-            if (connection->bit_per_sample == 8)
-                format = SND_PCM_FORMAT_U8;
-            else
-                format = SND_PCM_FORMAT_S16_LE;
-            /* Configure ALSA driver with PCM parameters */
-            status = snd_pcm_set_params(app_avk_cb.alsa_handle, format,
-                SND_PCM_ACCESS_RW_INTERLEAVED, connection->num_channel,
-                connection->sample_rate, 1, 500000);/* 0.5sec */
-            if (status < 0)
-            {
-                APP_ERROR1("snd_pcm_set_params failed: %s", snd_strerror(status));
-                exit(1);
-            }
+            APP_ERROR0("a2dp sink buffer start failed");
         }
 #endif
     }
@@ -541,16 +509,9 @@ static void app_avk_cback(tBSA_AVK_EVT event, tBSA_AVK_MSG *p_data)
             }
         }
 
-        if(app_avk_cb.alsa_handle != NULL) {
-#ifdef PCM_ALSA_OPEN_BLOCKING
-            pthread_mutex_lock(&mutex);
-#endif
-            snd_pcm_close(app_avk_cb.alsa_handle);
-            app_avk_cb.alsa_handle = NULL;
-#ifdef PCM_ALSA_OPEN_BLOCKING
-            pthread_mutex_unlock(&mutex);
+#ifdef PCM_ALSA
+        avk_sink_buffer_stop();
 #endif
-        }
 
         app_avk_reset_connection(connection->bda_connected);
 
@@ -1318,10 +1279,6 @@ void app_avk_deregister(void)
 *******************************************************************************/
 static void app_avk_uipc_cback(BT_HDR *p_msg)
 {
-#ifdef PCM_ALSA
-    snd_pcm_sframes_t alsa_frames;
-    snd_pcm_sframes_t alsa_frames_to_send;
-#endif
     UINT8 *p_buffer;
     int dummy;
     tAPP_AVK_CONNECTION *connection = NULL;
@@ -1384,68 +1341,9 @@ static void app_avk_uipc_cback(BT_HDR *p_msg)
     }
 
 #ifdef PCM_ALSA
-    if (app_avk_cb.alsa_handle != NULL && p_buffer)
-    {
-        /* Compute number of PCM samples (contained in p_msg->len bytes) */
-        alsa_frames_to_send = p_msg->len / connection->num_channel;
-        if (connection->bit_per_sample == 16)
-            alsa_frames_to_send /= 2;
-
-#ifdef PCM_ALSA_OPEN_BLOCKING
-        while (alsa_frames_to_send > 0)
-        {
-            pthread_mutex_lock(&mutex);
-            if (!app_avk_cb.alsa_handle)
-            {
-                pthread_mutex_unlock(&mutex);
-                break;
-            }
-
-            alsa_frames = snd_pcm_writei(app_avk_cb.alsa_handle, p_buffer, alsa_frames_to_send);
-            if (alsa_frames < 0)
-            {
-                if (alsa_frames == -EPIPE)
-                {
-                    APP_DEBUG0("ALSA: underrun in frame");
-                    snd_pcm_prepare(app_avk_cb.alsa_handle);
-                    alsa_frames = 0;
-                }
-                else if (alsa_frames == -EBADFD)
-                {
-                    APP_DEBUG0("ALSA: retry");
-                    alsa_frames = 0;
-                }
-                else
-                {
-                    APP_DEBUG1("ALSA: snd_pcm_writei err %d (%s)", (int) alsa_frames, snd_strerror(alsa_frames));
-                    pthread_mutex_unlock(&mutex);
-                    break;
-                }
-            }
-
-            pthread_mutex_unlock(&mutex);
-            alsa_frames_to_send -= alsa_frames;
-        }
-        if (alsa_frames_to_send)
-            APP_DEBUG1("ALSA: short write (discarded %li)", alsa_frames_to_send);
-    }
-#else
-        alsa_frames = snd_pcm_writei(app_avk_cb.alsa_handle, p_buffer, alsa_frames_to_send);
-        if (alsa_frames < 0)
-        {
-            alsa_frames = snd_pcm_recover(app_avk_cb.alsa_handle, alsa_frames, 0);
-        }
-        if (alsa_frames < 0)
-        {
-            APP_DEBUG1("app_avk_uipc_cback snd_pcm_writei failed %s", snd_strerror(alsa_frames));
-        }
-        if (alsa_frames > 0 && alsa_frames < alsa_frames_to_send)
-            APP_DEBUG1("app_avk_uipc_cback Short write (expected %li, wrote %li)",
-                (long) alsa_frames_to_send, alsa_frames);
-    }
-    else
-        APP_DEBUG0("app_avk_uipc_cback snd_pcm_writei failed FINALLY !!");
-#endif /* PCM_ALSA_OPEN_BLOCKING */
+    /* Never blocks: when the ring is full the packet is dropped and counted */
+    if (p_buffer)
+        avk_sink_buffer_write(p_buffer, p_msg->len);
 #endif /* PCM_ALSA */
     GKI_freebuf(p_msg);
 }
@@ -3156,6 +3054,9 @@ void app_avk_stop()
 
     app_avk_deregister();
     app_avk_deinit();
+#ifdef PCM_ALSA
+    avk_sink_buffer_stop();
+#endif
 
     app_avk_state = RK_BT_SINK_STATE_IDLE;
     app_avk_send_state(RK_BT_SINK_STATE_IDLE);
@@ -669,6 +669,17 @@ void app_av_rc_addressed_player_change(UINT16 addr_player);
 *******************************************************************************/
 void app_av_rc_settings_change(UINT8 setting, UINT8 value);
 
+/*******************************************************************************
+ **
+ ** Function         app_av_get_tx_stats
+ **
+ ** Description      Staging queue and drop counters of the pcm data stream
+ **
+ ** Returns          0 if successful, -1 otherwise
+ **
+ *******************************************************************************/
+int app_av_get_tx_stats(RK_BT_SOURCE_TX_STATS *stats);
+
 /*******************************************************************************
  **
  ** Function         app_av_get_play_state
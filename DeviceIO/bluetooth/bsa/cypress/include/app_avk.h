@@ -87,9 +87,6 @@ typedef struct
     tUIPC_CH_ID uipc_audio_channel;
     int fd;
     UINT8 fd_codec_type;
-#ifdef PCM_ALSA
-    snd_pcm_t *alsa_handle;
-#endif
     UINT8 label;
     tAPP_AVK_CONNECTION connections[APP_AVK_MAX_CONNECTIONS];
     UINT8 volume;           /* system volume percentage used for absolute volume */
@@ -23,24 +23,6 @@
 
 namespace DeviceIOFramework {
 
-struct IcmpEchoReply {
-	int icmpSeq;
-	int icmpLen;
-	int ipTtl;
-	double rtt;
-	std::string fromAddr;
-	bool isReply;
-};
-
-struct PingResult {
-	int dataLen;
-	int nsend;
-	int nreceived;
-	char ip[32];
-	std::string error;
-	std::vector<IcmpEchoReply> icmpEchoReplys;
-};
-
 //config status
 enum notify_network_status_type {
 	ENetworkNone = 11,
@@ -78,12 +60,11 @@ enum operation_type {
 #define NETLINK_AUTO_CONFIG_TIMEOUT 20*60//10*60
 #define NETLINK_NETWORK_CONFIGURE_PING_COUNT 18
 
-#define PACKET_SIZE         4096
-#define MAX_WAIT_TIME       1;//5
-#define MAX_PACKETS_COUNT   4
 #define MAX_PING_INTERVAL   300
-#define PING_DEST_HOST1       "114.114.114.114"
-#define PING_DEST_HOST2       "8.8.8.8"
+/* while offline, rtnetlink events catch the recovery, so polling can relax too */
+#define MAX_OFFLINE_PING_INTERVAL   32
+/* link, address and route events come in bursts, check once they settle */
+#define NETLINK_EVENT_SETTLE_MS     300
 
 class NetLinkWrapper {
 public:
@@ -143,7 +124,7 @@ private:
 
 	static void destroy();
 
-	static void sigalrm_fn(int sig);
+	void on_network_config_timeout();
 
 	void init_network_config_timeout_alarm();
 	void start_network_config_timeout_alarm(int timeout);
@@ -153,16 +134,11 @@ private:
 	void stop_network_config();
 	void start_network_monitor();
 	static void *monitor_work_routine(void *arg);
+	void start_event_loop();
+	void schedule_check(int delay_ms);
+	bool handle_rtnetlink_event();
 	bool check_recovery_network_status();
 
-	unsigned short getChksum(unsigned short *addr,int len);
-	int packIcmp(int pack_no, struct icmp* icmp);
-	bool unpackIcmp(char *buf,int len, struct IcmpEchoReply *icmpEchoReply);
-	struct timeval timevalSub(struct timeval timeval1,struct timeval timval2);
-	bool getsockaddr(const char * hostOrIp, sockaddr_in* sockaddr);
-	bool sendPacket();
-	bool recvPacket(PingResult &pingResult);
-	bool ping(std::string host, int count, PingResult& pingResult);
 	bool ping_network(bool wakeupTrigger);
 
 	INetLinkWrapperCallback *m_callback;
@@ -197,18 +173,18 @@ private:
 	operation_type m_operation_type;
 	int m_stop_network_recovery;
 
-	char m_sendpacket[PACKET_SIZE];
-	char m_recvpacket[PACKET_SIZE];
-	int m_maxPacketSize;
-	int m_sockfd;
-	int m_datalen;
-	int m_nsend;
-	int m_nreceived;
-	int m_icmp_seq;
-	struct sockaddr_in m_dest_addr;
-	struct sockaddr_in m_from_addr;
-	pid_t m_pid;
 	pthread_mutex_t m_ping_lock;
+	/// seconds until the next connectivity check, doubled while nothing changes
+	int m_check_interval;
+
+	/// monitor thread: epoll over the config timeout, check timer and rtnetlink
+	std::once_flag m_loopOnce;
+	int m_epoll_fd;
+	int m_timeout_fd;
+	int m_check_fd;
+	int m_rtnl_fd;
+	bool m_monitoring;
+
 	bool wifi_link_state;
 	bool net_link_state;
 
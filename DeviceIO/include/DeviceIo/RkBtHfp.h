@@ -25,6 +25,17 @@ typedef enum {
 
 typedef int (*RK_BT_HFP_CALLBACK)(const char *bd_addr, RK_BT_HFP_EVENT event, void *data);
 
+/* one direction of the call audio, counted since the audio path opened */
+typedef struct {
+    unsigned int frames;                /* moved from capture to playback */
+    unsigned int capture_xruns;         /* capture overruns */
+    unsigned int playback_xruns;        /* playback underruns */
+    unsigned int latency_us;            /* capture to playback, as of the last transfer */
+    unsigned int max_latency_us;
+    unsigned int jitter_target_us;      /* playback fill the bridge steers to */
+    int drift_ppm;                      /* capture clock against playback clock */
+} RK_BT_HFP_AUDIO_STATS;
+
 void rk_bt_hfp_register_callback(RK_BT_HFP_CALLBACK cb);
 int rk_bt_hfp_sink_open(void);
 int rk_bt_hfp_open(void);
@@ -38,6 +49,8 @@ int rk_bt_hfp_set_volume(int volume);
 void rk_bt_hfp_enable_cvsd(void);
 void rk_bt_hfp_disable_cvsd(void);
 int rk_bt_hfp_disconnect(void);
+/* uplink is the local mic to bt, downlink bt to the local speaker */
+int rk_bt_hfp_get_audio_stats(RK_BT_HFP_AUDIO_STATS *uplink, RK_BT_HFP_AUDIO_STATS *downlink);
 
 #ifdef __cplusplus
 }
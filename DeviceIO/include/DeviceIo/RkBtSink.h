@@ -32,6 +32,16 @@ typedef void (*RK_BT_AVRCP_TRACK_CHANGE_CB)(const char *bd_addr, BtTrackInfo tra
 typedef void (*RK_BT_AVRCP_PLAY_POSITION_CB)(const char *bd_addr, int song_len, int song_pos);
 typedef void (*RK_BT_SINK_UNDERRUN_CB)(void);
 
+typedef struct {
+	unsigned int target_ms;		/* fill reached before playing */
+	unsigned int fill_ms;		/* queued ahead of the device */
+	unsigned int max_fill_ms;
+	unsigned int latency_ms;	/* fill plus what the device still holds */
+	unsigned int packets;
+	unsigned int dropped;		/* packets lost to a full buffer */
+	unsigned int underruns;		/* times silence was played over a gap */
+} RK_BT_SINK_BUFFER_STATS;
+
 int rk_bt_sink_register_callback(RK_BT_SINK_CALLBACK cb);
 void rk_bt_sink_register_underurn_callback(RK_BT_SINK_UNDERRUN_CB cb);
 int rk_bt_sink_register_volume_callback(RK_BT_SINK_VOLUME_CALLBACK cb);
@@ -56,6 +66,9 @@ int rk_bt_sink_get_default_dev_addr(char *addr, int len);
 int rk_bt_sink_get_play_status();
 bool rk_bt_sink_get_poschange();
 void rk_bt_sink_set_alsa_device(char *alsa_dev);
+/* playback buffering of the a2dp stream, where the sink does it itself */
+int rk_bt_sink_set_buffer_latency(int ms);
+int rk_bt_sink_get_buffer_stats(RK_BT_SINK_BUFFER_STATS *stats);
 
 #ifdef __cplusplus
 }
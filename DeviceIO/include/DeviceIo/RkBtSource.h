@@ -51,6 +51,14 @@ typedef enum {
 	BT_SOURCE_STATUS_CONNECTED,
 } RK_BT_SOURCE_STATUS;
 
+typedef struct {
+	unsigned int queued_ms;			/* staged pcm waiting for the stack */
+	unsigned int max_queued_ms;
+	unsigned int refused;			/* sends the stack had no buffer for */
+	unsigned int dropped_frames;	/* pcm frames given up after a long refusal */
+	unsigned long long sent_bytes;
+} RK_BT_SOURCE_TX_STATS;
+
 typedef void (*RK_BT_SOURCE_CALLBACK)(void *userdata, const char *bd_addr, const char *name, const RK_BT_SOURCE_EVENT event);
 
 int rk_bt_source_register_status_cb(void *userdata, RK_BT_SOURCE_CALLBACK cb);
@@ -71,6 +79,7 @@ int rk_bt_source_stop(void);
 int rk_bt_source_pause(void);
 int rk_bt_source_vol_up(void);
 int rk_bt_source_vol_down(void);
+int rk_bt_source_get_tx_stats(RK_BT_SOURCE_TX_STATS *stats);
 
 #ifdef __cplusplus
 }
@@ -5,6 +5,8 @@
 extern "C" {
 #endif
 
+/* volume as RK_audio_get_volume() returns it */
+typedef int (*RK_audio_volume_callback)(const int volume);
 
 void RK_audio_set_volume(int vol);
 int RK_audio_get_volume(void);
@@ -12,6 +14,13 @@ void RK_audio_mute(void);
 int RK_audio_unmute(void);
 int RK_audio_limit_max_volume(int vol);
 
+/*
+ * cb runs on the mixer thread for every change of the volume, made here
+ * or by any other process. The library follows the mixer through the
+ * same events, so RK_audio_get_volume() doesn't touch the driver either.
+ */
+int RK_audio_register_volume_callback(RK_audio_volume_callback cb);
+
 #ifdef __cplusplus
 }
 #endif
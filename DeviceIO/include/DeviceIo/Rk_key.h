@@ -15,6 +15,8 @@ typedef int (*RK_input_compose_press_callback)(const char* compose, const uint32
 typedef int (*RK_input_transaction_press_callback)(const char* trans, const uint32_t time);
 typedef int (*RK_input_multiple_press_callback)(const int key_code, const int times);
 
+/* where the event nodes are, "/dev/input" unless set before RK_input_init */
+int RK_input_set_dev_path(const char *path);
 int RK_input_init(RK_input_callback input_callback_cb);
 int RK_input_register_press_callback(RK_input_press_callback cb);
 int RK_input_register_long_press_callback(RK_input_long_press_callback cb, const uint32_t time, const int key_code);
@@ -25,6 +27,18 @@ int RK_input_register_transaction_press_callback(RK_input_transaction_press_call
 int RK_input_events_print(void);
 int RK_input_exit(void);
 
+/*
+ * Record every event the monitor reads, from all devices, to path. The
+ * file is text, one event per line after a "# rk_input_record 1" header:
+ *
+ *   <us since the first event> <type> <code> <value>
+ *
+ * timed by the kernel's event timestamps. test/rk_key_replay plays it
+ * back. Starting again replaces the file being written.
+ */
+int RK_input_record_start(const char *path);
+int RK_input_record_stop(void);
+
 
 #ifdef __cplusplus
 }
@@ -6,6 +6,7 @@
 #include <sys/un.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,6 +38,101 @@ int RK_socket_recieve(int sockfd, char *msg, int len);
 /*simple socket client, just send msg*/
 int RK_socket_udp_send(char *socket_path, char *msg, int len);
 
+/*
+ * pcm over a shared memory ring instead of through the stream socket.
+ * The client makes the ring (memfd sealed against resizing, power of two
+ * size) and offers it on the connected socket; a server that takes it
+ * reads the samples in place, the socket only tells either side the
+ * other one has gone. An offer without the seals is refused.
+ * head and tail count bytes and never wrap back, each end sleeps on an
+ * eventfd only after telling the other one it is about to.
+ */
+#define RK_SHM_RING_MIN_SIZE	(16 * 1024)
+#define RK_SHM_RING_MAX_SIZE	(4 * 1024 * 1024)
+
+struct rk_shm_ring {
+	struct rk_shm_ring_ctrl *ctrl;	/* head, tail and wait flags, shared */
+	char *data;				/* NULL: no ring, use the socket */
+	unsigned int size;
+	int memfd;
+	int data_fd;			/* eventfd, the server sleeps on it for data */
+	int space_fd;			/* eventfd, the client sleeps on it for room */
+	int sockfd;
+};
+
+/*client api: sockfd, the ring set up if the server took it*/
+int RK_socket_client_setup_ring(char *socket_path, unsigned int size, struct rk_shm_ring *ring);
+int RK_shm_ring_write(struct rk_shm_ring *ring, const char *msg, int len);
+
+/*server api: 1 the client's ring was taken, 0 a plain stream client*/
+int RK_socket_server_accept_ring(int client_sockfd, struct rk_shm_ring *ring, int timeout_ms);
+uint32_t RK_shm_ring_head(struct rk_shm_ring *ring);
+void RK_shm_ring_release(struct rk_shm_ring *ring, uint32_t tail);
+/*0: sleep on data_fd now, 1: head moved past seen meanwhile*/
+int RK_shm_ring_wait_data(struct rk_shm_ring *ring, uint32_t seen);
+
+void RK_shm_ring_teardown(struct rk_shm_ring *ring);
+
+/*
+ * Framed messages over SOCK_SEQPACKET. Every send arrives as one message,
+ * whole, so there is no length to prefix and no short read to finish, and
+ * a message may carry an fd along. One server takes any number of clients
+ * on a single epoll loop; batches go in one sendmmsg/recvmmsg call.
+ * Empty messages can't be told from a hangup and are not sent.
+ */
+#define RK_SOCKET_PACKET_MAX		(64 * 1024)	/* largest message the server takes */
+#define RK_SOCKET_PACKET_BATCH		16		/* messages per system call */
+#define RK_SOCKET_PACKET_CLIENTS	32
+
+struct rk_socket_packet {
+	char *data;
+	int size;			/* recv: room in data */
+	int len;			/* recv: -1 the message didn't fit and was dropped */
+	int fd;				/* -1: none; a received fd is the caller's to close */
+};
+
+typedef enum {
+	RK_SOCKET_PACKET_CONNECTED,
+	RK_SOCKET_PACKET_MESSAGE,
+	RK_SOCKET_PACKET_DISCONNECTED,
+} RK_SOCKET_PACKET_EVENT;
+
+struct rk_socket_packet_server;
+
+/* packet only with RK_SOCKET_PACKET_MESSAGE, valid until the callback returns */
+typedef void (*RK_socket_packet_callback)(struct rk_socket_packet_server *server, int client_fd,
+		RK_SOCKET_PACKET_EVENT event, struct rk_socket_packet *packet, void *userdata);
+
+struct rk_socket_packet_server {
+	int sockfd;
+	int epfd;
+	int clients[RK_SOCKET_PACKET_CLIENTS];	/* -1: free */
+	char *buf;				/* a batch of RK_SOCKET_PACKET_MAX messages */
+	char sock_path[108];
+	RK_socket_packet_callback callback;
+	void *userdata;
+};
+
+/*server api*/
+int RK_socket_packet_server_setup(struct rk_socket_packet_server *server, const char *socket_path,
+		RK_socket_packet_callback callback, void *userdata);
+/*one pass: accept, read a batch from each ready client, call back; events handled or -1*/
+int RK_socket_packet_server_poll(struct rk_socket_packet_server *server, int timeout_ms);
+/*hang up on a client, from the callback too*/
+void RK_socket_packet_server_close(struct rk_socket_packet_server *server, int client_fd);
+void RK_socket_packet_server_teardown(struct rk_socket_packet_server *server);
+
+/*client api, RK_socket_client_teardown closes it*/
+int RK_socket_packet_client_setup(const char *socket_path);
+
+/*common api: len or -1; recv 0 the peer has gone, -1 with EMSGSIZE the message didn't fit*/
+int RK_socket_packet_send(int sockfd, const char *msg, int len, int fd);
+int RK_socket_packet_recv(int sockfd, char *msg, int len, int *fd);
+/*how many went, or -1 if none did*/
+int RK_socket_packet_send_batch(int sockfd, struct rk_socket_packet *packets, int count);
+/*waits for one, takes what else is queued; how many came, 0 the peer has gone, -1*/
+int RK_socket_packet_recv_batch(int sockfd, struct rk_socket_packet *packets, int count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -55,6 +55,34 @@ typedef struct {
 	RK_WIFI_SAVED_INFO_s save_info[RK_WIFI_SAVED_INFO_MAX];
 } RK_WIFI_SAVED_INFO;
 
+typedef struct {
+	int time_ms;	/* (re)connect start to association, -1 if none yet */
+	int fast;		/* 1 when the single channel scan of the last AP did it */
+} RK_WIFI_CONNECT_TIME_s;
+
+#define RK_WIFI_BRINGUP_STEPS_MAX	8
+
+typedef struct {
+	char name[16];
+	int result;		/* 0 ok, negative errno if it failed or was skipped */
+	int start_ms;	/* since RK_wifi_enable(1) was called */
+	int time_ms;
+} RK_WIFI_BRINGUP_STEP_s;
+
+typedef struct {
+	int count;
+	int total_ms;
+	RK_WIFI_BRINGUP_STEP_s steps[RK_WIFI_BRINGUP_STEPS_MAX];
+} RK_WIFI_BRINGUP_TIME_s;
+
+typedef struct {
+	int start_ms;	/* RK_wifi_enable_ap() to the first beacon, -1 if the AP isn't up */
+	int how;		/* 0 hostapd started, 1 reconfigured in place, 2 already up as asked */
+} RK_WIFI_AP_TIME_s;
+
+/* a station joined (connected 1) or left (0) the softAP */
+typedef int(*RK_wifi_ap_sta_callback)(const char *mac, int connected);
+
 typedef int(*RK_wifi_state_callback)(RK_WIFI_RUNNING_State_e state, RK_WIFI_INFO_Connection_s *info);
 
 int RK_wifi_register_callback(RK_wifi_state_callback cb);
@@ -62,6 +90,10 @@ int RK_wifi_running_getState(RK_WIFI_RUNNING_State_e* pState);
 int RK_wifi_running_getConnectionInfo(RK_WIFI_INFO_Connection_s* pInfo);
 int RK_wifi_enable_ap(const char* ssid, const char* psk, const char* ip);
 int RK_wifi_disable_ap();
+int RK_wifi_register_ap_callback(RK_wifi_ap_sta_callback cb);
+int RK_wifi_get_ap_start_time(RK_WIFI_AP_TIME_s *pTime);
+/* use another hostapd control socket directory (e.g. a test double), NULL for the default */
+int RK_wifi_set_ap_ctrl_dir(const char *dir);
 int RK_wifi_enable(const int enable);
 int RK_wifi_scan(void);
 char* RK_wifi_scan_r(void);
@@ -83,6 +115,13 @@ int RK_wifi_cancel(void);
 int RK_wifi_getSavedInfo(RK_WIFI_SAVED_INFO *pSaveInfo);
 int RK_wifi_connect_with_ssid(const char* ssid);
 int RK_wifi_reset(void);
+/* use another wpa_supplicant control socket (e.g. a test double), NULL for the default */
+int RK_wifi_set_ctrl_path(const char *path);
+/* reconnect to the last good association, scanning only its channel first */
+int RK_wifi_fast_reconnect(void);
+int RK_wifi_get_connect_time(RK_WIFI_CONNECT_TIME_s *pTime);
+/* per-step timing of the last RK_wifi_enable(1) */
+int RK_wifi_get_bringup_time(RK_WIFI_BRINGUP_TIME_s *pTime);
 
 #ifdef __cplusplus
 }
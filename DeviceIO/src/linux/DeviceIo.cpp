@@ -31,6 +31,7 @@
 #include "rtc.h"
 #include "shell.h"
 #include "power.h"
+#include "softvol.h"
 #include "../../bluetooth/bluetooth.h"
 #include "DeviceIo/NetLinkWrapper.h"
 #include "DeviceIo/Rk_system.h"
@@ -48,8 +49,6 @@ namespace DeviceIOFramework {
 // #define AUDIO_MAX_VOLUME                100
 
 #define SOFTVOL /*should play a music before ctl the softvol*/
-#define SOFTVOL_CARD "default"
-#define SOFTVOL_ELEM "name='Master Playback Volume'"
 
 typedef struct {
     int     volume;
@@ -61,111 +60,21 @@ typedef struct {
 static user_volume_t    user_volume = {0, false};
 static pthread_mutex_t  user_volume_mutex;
 
-static int cset(char *value_string, int roflag)
-{
-    int err;
-    int ret = 0;
-    static snd_ctl_t *handle = NULL;
-    snd_ctl_elem_info_t *info;
-    snd_ctl_elem_id_t *id;
-    snd_ctl_elem_value_t *control;
-    snd_ctl_elem_info_alloca(&info);
-    snd_ctl_elem_id_alloca(&id);
-    snd_ctl_elem_value_alloca(&control);
-    char card[64] = SOFTVOL_CARD;
-    int keep_handle = 0;
-
-    if (snd_ctl_ascii_elem_id_parse(id, SOFTVOL_ELEM)) {
-        fprintf(stderr, "Wrong control identifier: %s\n", SOFTVOL_ELEM);
-        return -EINVAL;
-    }
-
-    if (handle == NULL &&
-        (err = snd_ctl_open(&handle, card, 0)) < 0) {
-        APP_ERROR("Control %s open error: %d\n", card, err);
-        return err;
-    }
-    snd_ctl_elem_info_set_id(info, id);
-    if ((err = snd_ctl_elem_info(handle, info)) < 0) {
-        APP_ERROR("Cannot find the given element from control %s\n", card);
-        if (! keep_handle) {
-            snd_ctl_close(handle);
-            handle = NULL;
-        }
-        return err;
-    }
-    snd_ctl_elem_info_get_id(info, id);     /* FIXME: Remove it when hctl find works ok !!! */
-    if (!roflag) {
-        snd_ctl_elem_value_set_id(control, id);
-        if ((err = snd_ctl_elem_read(handle, control)) < 0) {
-            APP_ERROR("Cannot read the given element from control %s\n", card);
-            if (! keep_handle) {
-                snd_ctl_close(handle);
-                handle = NULL;
-            }
-            return err;
-        }
-        err = snd_ctl_ascii_value_parse(handle, control, info, value_string);
-        if (err < 0) {
-            APP_ERROR("Control %s parse error: %d\n", card, err);
-            if (!keep_handle) {
-                snd_ctl_close(handle);
-                handle = NULL;
-            }
-            return  err;
-        }
-        if ((err = snd_ctl_elem_write(handle, control)) < 0) {
-            APP_ERROR("Control %s element write error: %d; errno: %d\n", card,
-                      err, errno);
-            if (!keep_handle) {
-                snd_ctl_close(handle);
-                handle = NULL;
-            }
-            return err;
-        } else {
-            APP_INFO("Control %s element write volume %s successfully\n", card,
-                     value_string);
-        }
-        system("alsactl store --file=/data/cfg/asound.state");
-    } else {
-        int vol_l, vol_r;
-        snd_ctl_elem_value_set_id(control, id);
-        if ((err = snd_ctl_elem_read(handle, control)) < 0) {
-            APP_ERROR("Cannot read the given element from control %s\n", card);
-            if (! keep_handle) {
-                snd_ctl_close(handle);
-                handle = NULL;
-            }
-            return err;
-        }
-        vol_l = snd_ctl_elem_value_get_integer(control, 0);
-        vol_r = snd_ctl_elem_value_get_integer(control, 1);
-        APP_ERROR("%s:  cget %d, %d!\n", __func__, vol_l, vol_r);
-        ret = (vol_l + vol_r) >> 1;
-    }
-
-    if (! keep_handle) {
-        snd_ctl_close(handle);
-        handle = NULL;
-    }
-    return ret;
-}
-
 static void softvol_set(int vol) {
     char value[128] = {0};
 
     sprintf(value, "%d%%", vol);
-    int ret = cset(value, 0);
+    int ret = softvol_ctl_set(value);
     int trytimes = 100;
     // try again, often fail first time
     while (ret && trytimes-- > 0) {
        usleep(100 * 1000);
-       ret = cset(value, 0);
+       ret = softvol_ctl_set(value);
     }
 }
 
 static int softvol_get() {
-    return cset(NULL, 1);
+    return softvol_ctl_get();
 }
 
 #ifndef SOFTVOL
@@ -378,6 +287,8 @@ DeviceIo::~DeviceIo() {
     power_deinit();
 #ifndef SOFTVOL
     mixer_exit();
+#else
+    softvol_ctl_close();
 #endif
     rk_led_exit();
     m_notify = nullptr;
@@ -1,6 +1,15 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* sendmmsg, recvmmsg */
+#endif
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 
 #include <DeviceIo/Rk_socket_app.h>
 
@@ -169,3 +178,730 @@ int RK_socket_udp_send(char *socket_path, char *msg, int len) {
 	close(sockfd);
 	return bytes;
 }
+
+#define RK_SHM_RING_MAGIC "RKPCMSHM"
+#define RK_SHM_RING_CTRL_SIZE 4096
+#define RK_SHM_RING_ACK_TIMEOUT_MS 1000
+
+/* older toolchain headers lack the memfd sealing bits */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+/* a peer must not be able to resize the ring under the other side's mapping */
+#define RK_SHM_RING_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+struct rk_shm_ring_ctrl {
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t reader_waiting;
+    uint32_t writer_waiting;
+};
+
+struct rk_shm_ring_offer {
+    char magic[8];
+    uint32_t size;
+    uint32_t reserved;
+};
+
+static void rk_shm_ring_reset(struct rk_shm_ring *ring)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->memfd = ring->data_fd = ring->space_fd = ring->sockfd = -1;
+}
+
+static void rk_shm_ring_close(struct rk_shm_ring *ring)
+{
+    if (ring->ctrl)
+        munmap(ring->ctrl, RK_SHM_RING_CTRL_SIZE + ring->size);
+    if (ring->memfd >= 0)
+        close(ring->memfd);
+    if (ring->data_fd >= 0)
+        close(ring->data_fd);
+    if (ring->space_fd >= 0)
+        close(ring->space_fd);
+    rk_shm_ring_reset(ring);
+}
+
+static int rk_shm_ring_size_ok(unsigned int size)
+{
+    return size >= RK_SHM_RING_MIN_SIZE && size <= RK_SHM_RING_MAX_SIZE && !(size & (size - 1));
+}
+
+static int rk_shm_ring_sealed(int memfd)
+{
+    int seals = fcntl(memfd, F_GET_SEALS);
+
+    return seals >= 0 && (seals & RK_SHM_RING_SEALS) == RK_SHM_RING_SEALS;
+}
+
+static int rk_shm_ring_map(struct rk_shm_ring *ring, unsigned int size)
+{
+    void *p;
+
+    p = mmap(NULL, RK_SHM_RING_CTRL_SIZE + size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+    if (p == MAP_FAILED) {
+        log_err("%s: mmap failed: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    ring->ctrl = (struct rk_shm_ring_ctrl *)p;
+    ring->data = (char *)p + RK_SHM_RING_CTRL_SIZE;
+    ring->size = size;
+    return 0;
+}
+
+static int rk_shm_ring_create(struct rk_shm_ring *ring, unsigned int size)
+{
+#ifdef __NR_memfd_create
+    ring->memfd = syscall(__NR_memfd_create, "rk_pcm_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+    if (ring->memfd < 0) {
+        log_warn("%s: memfd_create failed\n", __func__);
+        return -1;
+    }
+
+    if (ftruncate(ring->memfd, RK_SHM_RING_CTRL_SIZE + size) < 0 ||
+        fcntl(ring->memfd, F_ADD_SEALS, RK_SHM_RING_SEALS) < 0 || rk_shm_ring_map(ring, size) < 0)
+        goto fail;
+
+    ring->data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ring->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring->data_fd < 0 || ring->space_fd < 0)
+        goto fail;
+
+    ring->ctrl->size = size;
+    return 0;
+
+fail:
+    log_err("%s: %s\n", __func__, strerror(errno));
+    rk_shm_ring_close(ring);
+    return -1;
+}
+
+static int rk_shm_ring_offer(int sockfd, struct rk_shm_ring *ring)
+{
+    struct rk_shm_ring_offer offer;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    int fds[3] = { ring->memfd, ring->data_fd, ring->space_fd };
+    struct pollfd pfd;
+    int ack = -1;
+
+    memset(&offer, 0, sizeof(offer));
+    memcpy(offer.magic, RK_SHM_RING_MAGIC, sizeof(offer.magic));
+    offer.size = ring->size;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = &offer;
+    iov.iov_len = sizeof(offer);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(sockfd, &msg, 0) != sizeof(offer)) {
+        log_err("%s: sendmsg failed: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    /* a server that doesn't know the ring never answers */
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, RK_SHM_RING_ACK_TIMEOUT_MS) <= 0 ||
+        recv(sockfd, &ack, sizeof(ack), MSG_DONTWAIT) != sizeof(ack))
+        return -1;
+
+    return ack;
+}
+
+int RK_socket_client_setup_ring(char *socket_path, unsigned int size, struct rk_shm_ring *ring)
+{
+    int sockfd;
+
+    rk_shm_ring_reset(ring);
+
+    if ((sockfd = RK_socket_client_setup(socket_path)) < 0)
+        return -1;
+
+    if (!rk_shm_ring_size_ok(size)) {
+        log_err("%s: bad ring size %u, pcm goes through the socket\n", __func__, size);
+        return sockfd;
+    }
+
+    if (rk_shm_ring_create(ring, size) < 0)
+        return sockfd;
+
+    if (rk_shm_ring_offer(sockfd, ring) == 0) {
+        log_info("%s: %u bytes shared ring\n", __func__, size);
+        ring->sockfd = sockfd;
+        return sockfd;
+    }
+
+    /* the offer may be queued as pcm, start over on a clean connection */
+    log_warn("%s: ring refused, pcm goes through the socket\n", __func__);
+    rk_shm_ring_close(ring);
+    close(sockfd);
+    return RK_socket_client_setup(socket_path);
+}
+
+int RK_shm_ring_write(struct rk_shm_ring *ring, const char *msg, int len)
+{
+    struct rk_shm_ring_ctrl *ctrl = ring->ctrl;
+    struct pollfd pfd[2];
+    uint32_t head, tail, space, off, n, first;
+    uint64_t cnt = 1;
+    int done = 0;
+
+    if (!ring->data || len < 0)
+        return -1;
+
+    head = ctrl->head;
+    while (done < len) {
+        tail = __atomic_load_n(&ctrl->tail, __ATOMIC_ACQUIRE);
+        space = ring->size - (head - tail);
+        if (!space) {
+            /* say we are going to sleep, then look again before doing so */
+            read(ring->space_fd, &cnt, sizeof(cnt));
+            __atomic_store_n(&ctrl->writer_waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&ctrl->tail, __ATOMIC_SEQ_CST) != tail) {
+                __atomic_store_n(&ctrl->writer_waiting, 0, __ATOMIC_SEQ_CST);
+                continue;
+            }
+
+            pfd[0].fd = ring->space_fd;
+            pfd[0].events = POLLIN;
+            pfd[1].fd = ring->sockfd;
+            pfd[1].events = POLLIN;
+            if (poll(pfd, 2, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                log_err("%s: poll failed: %s\n", __func__, strerror(errno));
+                return done ? done : -1;
+            }
+
+            /* the server never writes after its answer: it has gone */
+            if (pfd[1].revents)
+                return done ? done : -1;
+            continue;
+        }
+
+        n = space < (uint32_t)(len - done) ? space : (uint32_t)(len - done);
+        off = head & (ring->size - 1);
+        first = n < ring->size - off ? n : ring->size - off;
+        memcpy(ring->data + off, msg + done, first);
+        memcpy(ring->data, msg + done + first, n - first);
+        head += n;
+        done += n;
+
+        __atomic_store_n(&ctrl->head, head, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ctrl->reader_waiting, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&ctrl->reader_waiting, 0, __ATOMIC_SEQ_CST)) {
+            cnt = 1;
+            write(ring->data_fd, &cnt, sizeof(cnt));
+        }
+    }
+
+    return done;
+}
+
+int RK_socket_server_accept_ring(int client_sockfd, struct rk_shm_ring *ring, int timeout_ms)
+{
+    struct rk_shm_ring_offer offer;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    int fds[3] = { -1, -1, -1 };
+    struct pollfd pfd;
+    struct stat st;
+    int ack = -1, i;
+
+    rk_shm_ring_reset(ring);
+
+    /* a ring client offers at once, anything else is pcm for the socket path */
+    pfd.fd = client_sockfd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return 0;
+    if (recv(client_sockfd, &offer, sizeof(offer), MSG_PEEK | MSG_DONTWAIT) != sizeof(offer) ||
+        memcmp(offer.magic, RK_SHM_RING_MAGIC, sizeof(offer.magic)))
+        return 0;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &offer;
+    iov.iov_len = sizeof(offer);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if (recvmsg(client_sockfd, &msg, MSG_CMSG_CLOEXEC) != sizeof(offer))
+        goto refuse;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(fds, CMSG_DATA(cmsg), cmsg->cmsg_len - CMSG_LEN(0) < sizeof(fds) ?
+               cmsg->cmsg_len - CMSG_LEN(0) : sizeof(fds));
+    ring->memfd = fds[0];
+    ring->data_fd = fds[1];
+    ring->space_fd = fds[2];
+
+    /* an unsealed ring could be truncated by the client and SIGBUS whoever reads it */
+    if (ring->memfd < 0 || ring->data_fd < 0 || ring->space_fd < 0 || !rk_shm_ring_size_ok(offer.size) ||
+        !rk_shm_ring_sealed(ring->memfd) ||
+        fstat(ring->memfd, &st) < 0 || st.st_size != RK_SHM_RING_CTRL_SIZE + offer.size ||
+        rk_shm_ring_map(ring, offer.size) < 0 || ring->ctrl->size != offer.size)
+        goto refuse;
+
+    /* the eventfds are only ever polled, never waited on in read */
+    for (i = 1; i < 3; i++)
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+
+    ack = 0;
+    if (send(client_sockfd, &ack, sizeof(ack), MSG_NOSIGNAL) != sizeof(ack))
+        goto refuse;
+
+    log_info("%s: %u bytes shared ring\n", __func__, offer.size);
+    ring->sockfd = client_sockfd;
+    return 1;
+
+refuse:
+    log_err("%s: bad ring offer\n", __func__);
+    ack = -1;
+    send(client_sockfd, &ack, sizeof(ack), MSG_NOSIGNAL | MSG_DONTWAIT);
+    rk_shm_ring_close(ring);
+    return -1;
+}
+
+uint32_t RK_shm_ring_head(struct rk_shm_ring *ring)
+{
+    return __atomic_load_n(&ring->ctrl->head, __ATOMIC_ACQUIRE);
+}
+
+void RK_shm_ring_release(struct rk_shm_ring *ring, uint32_t tail)
+{
+    uint64_t cnt = 1;
+
+    __atomic_store_n(&ring->ctrl->tail, tail, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->ctrl->writer_waiting, __ATOMIC_SEQ_CST) &&
+        __atomic_exchange_n(&ring->ctrl->writer_waiting, 0, __ATOMIC_SEQ_CST))
+        write(ring->space_fd, &cnt, sizeof(cnt));
+}
+
+int RK_shm_ring_wait_data(struct rk_shm_ring *ring, uint32_t seen)
+{
+    uint64_t cnt;
+
+    /* drop a wakeup left from a time we didn't sleep */
+    read(ring->data_fd, &cnt, sizeof(cnt));
+    __atomic_store_n(&ring->ctrl->reader_waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->ctrl->head, __ATOMIC_SEQ_CST) != seen) {
+        __atomic_store_n(&ring->ctrl->reader_waiting, 0, __ATOMIC_SEQ_CST);
+        return 1;
+    }
+    return 0;
+}
+
+void RK_shm_ring_teardown(struct rk_shm_ring *ring)
+{
+    if (!ring->data)
+        return;
+    rk_shm_ring_close(ring);
+}
+
+/* one message, its fd in cbuf if it has one */
+static void rk_socket_packet_msg(struct msghdr *msg, struct iovec *iov, char *cbuf, int cbuf_len,
+                                 char *data, int len, int fd)
+{
+    struct cmsghdr *cmsg;
+
+    memset(msg, 0, sizeof(*msg));
+    iov->iov_base = data;
+    iov->iov_len = len;
+    msg->msg_iov = iov;
+    msg->msg_iovlen = 1;
+    if (fd < 0)
+        return;
+
+    memset(cbuf, 0, cbuf_len);
+    msg->msg_control = cbuf;
+    msg->msg_controllen = CMSG_SPACE(sizeof(int));
+    cmsg = CMSG_FIRSTHDR(msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+}
+
+/* how many came, the first empty one being the hangup; -1 */
+static int rk_socket_packet_recvmmsg(int sockfd, struct rk_socket_packet *packets, int count, int flags)
+{
+    struct mmsghdr msgs[RK_SOCKET_PACKET_BATCH];
+    struct iovec iov[RK_SOCKET_PACKET_BATCH];
+    char cbuf[RK_SOCKET_PACKET_BATCH][CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+    struct rk_socket_packet *pkt;
+    int i, n;
+
+    if (count > RK_SOCKET_PACKET_BATCH)
+        count = RK_SOCKET_PACKET_BATCH;
+
+    for (i = 0; i < count; i++) {
+        rk_socket_packet_msg(&msgs[i].msg_hdr, &iov[i], NULL, 0, packets[i].data, packets[i].size, -1);
+        msgs[i].msg_hdr.msg_control = cbuf[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+        msgs[i].msg_len = 0;
+    }
+
+    n = recvmmsg(sockfd, msgs, count, flags | MSG_CMSG_CLOEXEC, NULL);
+    if (n <= 0)
+        return n < 0 ? -1 : 0;
+
+    for (i = 0; i < n; i++) {
+        pkt = &packets[i];
+        pkt->fd = -1;
+        cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))
+            memcpy(&pkt->fd, CMSG_DATA(cmsg), sizeof(int));
+
+        pkt->len = msgs[i].msg_len;
+        if (!pkt->len)
+            return i;
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            log_warn("%s: message longer than %d bytes dropped\n", __func__, pkt->size);
+            pkt->len = -1;
+            if (pkt->fd >= 0)
+                close(pkt->fd);
+            pkt->fd = -1;
+        }
+    }
+
+    return n;
+}
+
+int RK_socket_packet_send(int sockfd, const char *msg, int len, int fd)
+{
+    struct msghdr hdr;
+    struct iovec iov;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    int bytes;
+
+    if (sockfd < 0 || len <= 0) {
+        log_err("%s: invalid sockfd or length\n", __func__);
+        return -1;
+    }
+
+    rk_socket_packet_msg(&hdr, &iov, cbuf, sizeof(cbuf), (char *)msg, len, fd);
+    while ((bytes = sendmsg(sockfd, &hdr, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    if (bytes < 0)
+        log_err("%s: %s\n", __func__, strerror(errno));
+    return bytes;
+}
+
+int RK_socket_packet_recv(int sockfd, char *msg, int len, int *fd)
+{
+    struct rk_socket_packet pkt;
+    int n;
+
+    if (fd)
+        *fd = -1;
+    if (sockfd < 0) {
+        log_err("%s: invalid sockfd\n", __func__);
+        return -1;
+    }
+
+    pkt.data = msg;
+    pkt.size = len;
+    while ((n = rk_socket_packet_recvmmsg(sockfd, &pkt, 1, 0)) < 0 && errno == EINTR)
+        ;
+    if (n <= 0)
+        return n;
+
+    if (pkt.len < 0) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (fd)
+        *fd = pkt.fd;
+    else if (pkt.fd >= 0)
+        close(pkt.fd);
+    return pkt.len;
+}
+
+int RK_socket_packet_send_batch(int sockfd, struct rk_socket_packet *packets, int count)
+{
+    struct mmsghdr msgs[RK_SOCKET_PACKET_BATCH];
+    struct iovec iov[RK_SOCKET_PACKET_BATCH];
+    char cbuf[RK_SOCKET_PACKET_BATCH][CMSG_SPACE(sizeof(int))];
+    int done = 0, i, n;
+
+    if (sockfd < 0) {
+        log_err("%s: invalid sockfd\n", __func__);
+        return -1;
+    }
+
+    while (done < count) {
+        n = count - done < RK_SOCKET_PACKET_BATCH ? count - done : RK_SOCKET_PACKET_BATCH;
+        for (i = 0; i < n; i++) {
+            if (packets[done + i].len <= 0)
+                break;
+            rk_socket_packet_msg(&msgs[i].msg_hdr, &iov[i], cbuf[i], sizeof(cbuf[i]),
+                                 packets[done + i].data, packets[done + i].len, packets[done + i].fd);
+        }
+        if (!i) {
+            log_err("%s: empty message\n", __func__);
+            break;
+        }
+
+        n = sendmmsg(sockfd, msgs, i, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            log_err("%s: %s\n", __func__, strerror(errno));
+            break;
+        }
+        done += n;
+    }
+
+    return done ? done : -1;
+}
+
+int RK_socket_packet_recv_batch(int sockfd, struct rk_socket_packet *packets, int count)
+{
+    int n;
+
+    if (sockfd < 0 || count <= 0) {
+        log_err("%s: invalid sockfd or count\n", __func__);
+        return -1;
+    }
+
+    while ((n = rk_socket_packet_recvmmsg(sockfd, packets, count, MSG_WAITFORONE)) < 0 && errno == EINTR)
+        ;
+    return n;
+}
+
+int RK_socket_packet_client_setup(const char *socket_path)
+{
+    struct sockaddr_un address;
+    int sockfd;
+
+    if ((sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1) {
+        log_err("%s: can not creat socket\n", __func__);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+
+    if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        log_err("%s: can not connect to %s: %s\n", __func__, socket_path, strerror(errno));
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+static int rk_socket_packet_slot(struct rk_socket_packet_server *server, int fd)
+{
+    int i;
+
+    for (i = 0; i < RK_SOCKET_PACKET_CLIENTS; i++) {
+        if (server->clients[i] == fd)
+            return i;
+    }
+    return -1;
+}
+
+static int rk_socket_packet_accept(struct rk_socket_packet_server *server)
+{
+    struct epoll_event ev;
+    int fd, slot, handled = 0;
+
+    while ((fd = accept4(server->sockfd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+        slot = rk_socket_packet_slot(server, -1);
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (slot < 0 || epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            log_warn("%s: no room for another client\n", __func__);
+            close(fd);
+            continue;
+        }
+
+        server->clients[slot] = fd;
+        server->callback(server, fd, RK_SOCKET_PACKET_CONNECTED, NULL, server->userdata);
+        handled++;
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        log_err("%s: %s\n", __func__, strerror(errno));
+    return handled;
+}
+
+/* a batch at most, so one busy client can't keep the others waiting */
+static int rk_socket_packet_read(struct rk_socket_packet_server *server, int fd)
+{
+    struct rk_socket_packet packets[RK_SOCKET_PACKET_BATCH];
+    int i, n, handled = 0;
+
+    for (i = 0; i < RK_SOCKET_PACKET_BATCH; i++) {
+        packets[i].data = server->buf + i * RK_SOCKET_PACKET_MAX;
+        packets[i].size = RK_SOCKET_PACKET_MAX;
+        packets[i].len = -1;
+    }
+
+    n = rk_socket_packet_recvmmsg(fd, packets, RK_SOCKET_PACKET_BATCH, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+
+    for (i = 0; i < n; i++) {
+        /* the callback may have hung up on it */
+        if (rk_socket_packet_slot(server, fd) < 0) {
+            if (packets[i].fd >= 0)
+                close(packets[i].fd);
+            continue;
+        }
+        if (packets[i].len < 0)
+            continue;
+        server->callback(server, fd, RK_SOCKET_PACKET_MESSAGE, &packets[i], server->userdata);
+        handled++;
+    }
+
+    /* short of a full batch with no error: nothing left, or it has gone */
+    if (n < 0 || (n < RK_SOCKET_PACKET_BATCH && !packets[n].len)) {
+        if (n < 0)
+            log_warn("%s: %s\n", __func__, strerror(errno));
+        RK_socket_packet_server_close(server, fd);
+        handled++;
+    }
+
+    return handled;
+}
+
+int RK_socket_packet_server_setup(struct rk_socket_packet_server *server, const char *socket_path,
+                                  RK_socket_packet_callback callback, void *userdata)
+{
+    struct sockaddr_un address;
+    struct epoll_event ev;
+    int i;
+
+    memset(server, 0, sizeof(*server));
+    server->sockfd = server->epfd = -1;
+    for (i = 0; i < RK_SOCKET_PACKET_CLIENTS; i++)
+        server->clients[i] = -1;
+    server->callback = callback;
+    server->userdata = userdata;
+    strncpy(server->sock_path, socket_path, sizeof(server->sock_path) - 1);
+
+    server->buf = (char *)malloc(RK_SOCKET_PACKET_BATCH * RK_SOCKET_PACKET_MAX);
+    if (!server->buf || !callback)
+        goto fail;
+
+    unlink(server->sock_path);
+    if ((server->sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+        goto fail;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, server->sock_path);
+    if (bind(server->sockfd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(server->sockfd, RK_SOCKET_PACKET_CLIENTS) < 0)
+        goto fail;
+
+    if ((server->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        goto fail;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = server->sockfd;
+    if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, server->sockfd, &ev) < 0)
+        goto fail;
+
+    log_dbg("%s: %s ready for clients\n", __func__, server->sock_path);
+    return 0;
+
+fail:
+    log_err("%s: %s: %s\n", __func__, socket_path, strerror(errno));
+    RK_socket_packet_server_teardown(server);
+    return -1;
+}
+
+int RK_socket_packet_server_poll(struct rk_socket_packet_server *server, int timeout_ms)
+{
+    struct epoll_event events[RK_SOCKET_PACKET_CLIENTS + 1];
+    int i, n, fd, handled = 0;
+
+    n = epoll_wait(server->epfd, events, RK_SOCKET_PACKET_CLIENTS + 1, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR)
+            return 0;
+        log_err("%s: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    /*
+     * A hangup is only taken from an empty read, so an event left for an
+     * fd closed and reused earlier in this pass does no harm.
+     */
+    for (i = 0; i < n; i++) {
+        fd = events[i].data.fd;
+        if (fd == server->sockfd)
+            handled += rk_socket_packet_accept(server);
+        else if (rk_socket_packet_slot(server, fd) >= 0)
+            handled += rk_socket_packet_read(server, fd);
+    }
+
+    return handled;
+}
+
+void RK_socket_packet_server_close(struct rk_socket_packet_server *server, int client_fd)
+{
+    int slot = rk_socket_packet_slot(server, client_fd);
+
+    if (client_fd < 0 || slot < 0)
+        return;
+
+    server->clients[slot] = -1;
+    server->callback(server, client_fd, RK_SOCKET_PACKET_DISCONNECTED, NULL, server->userdata);
+    epoll_ctl(server->epfd, EPOLL_CTL_DEL, client_fd, NULL);
+    close(client_fd);
+}
+
+void RK_socket_packet_server_teardown(struct rk_socket_packet_server *server)
+{
+    int i;
+
+    for (i = 0; i < RK_SOCKET_PACKET_CLIENTS; i++)
+        RK_socket_packet_server_close(server, server->clients[i]);
+
+    if (server->epfd >= 0)
+        close(server->epfd);
+    if (server->sockfd >= 0) {
+        close(server->sockfd);
+        unlink(server->sock_path);
+    }
+    free(server->buf);
+    server->buf = NULL;
+    server->sockfd = server->epfd = -1;
+}
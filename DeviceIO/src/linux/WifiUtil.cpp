@@ -28,6 +28,8 @@
 
 #include "DeviceIo/DeviceIo.h"
 #include "Timer.h"
+#include "utility.h"
+#include "wifi/netif.h"
 
 using DeviceIOFramework::Timer;
 using DeviceIOFramework::TimerManager;
@@ -128,19 +130,18 @@ bool WifiUtil::start_wpa_supplicant() {
 		}
 	}
 
-    Shell::system("ifconfig wlan0 down");
-    Shell::system("ifconfig wlan0 up");
-    Shell::system("ifconfig wlan0 0.0.0.0");
-    Shell::system("killall dhcpcd");
-    Shell::system("killall wpa_supplicant");
-    usleep(100000);
+    netif_set_link("wlan0", false);
+    netif_set_link("wlan0", true);
+    netif_flush_ipv4("wlan0");
+    kill_task_timeout("dhcpcd", 0);
+    kill_task_timeout("wpa_supplicant", 2000);
 
 retry:
     Shell::system("wpa_supplicant -B -i wlan0 -c /data/cfg/wpa_supplicant.conf");
 	if ((!Shell::pidof("wpa_supplicant")) && (count--))
 		goto retry;
 
-    usleep(600000);
+    /* -B returns once the ctrl interface is up, nothing to wait for */
     Shell::system("dhcpcd -L -f /etc/dhcpcd.conf");
     Shell::system("dhcpcd wlan0 -t 0 &");
 	if (start_wifi_monitor_threadId > 0)
@@ -152,15 +153,15 @@ retry:
 }
 
 bool WifiUtil::stop_wpa_supplicant() {
-    Shell::system("ifconfig wlan0 down");
-    return Shell::system("killall wpa_supplicant &");
+    netif_set_link("wlan0", false);
+    return kill_task_timeout("wpa_supplicant", 0) == 0;
 }
 
 bool WifiUtil::stop_ap_mode() {
     APP_INFO("stop_ap_mode\n");
 
     Shell::system("softapDemo stop");
-    Shell::system("killall softapServer &");
+    kill_task_timeout("softapServer", 0);
     int time = 100;
     while (time-- > 0 && !access("/var/run/hostapd", F_OK)) {
         usleep(10 * 1000);
@@ -202,7 +203,7 @@ bool starup_ap_interface() {
         return true;
     }
 
-    return Shell::system("ifconfig wlan1 up &");
+    return netif_set_link(NETWORK_DEVICE_FOR_AP, true) == 0;
 }
 
 bool down_ap_interface() {
@@ -211,12 +212,12 @@ bool down_ap_interface() {
         return true;
     }
 
-    return Shell::system("ifconfig wlan1 down &");
+    return netif_set_link(NETWORK_DEVICE_FOR_AP, false) == 0;
 }
 
 bool starup_wlan0_interface() {
 
-    return Shell::system("ifconfig wlan0 up &");
+    return netif_set_link(NETWORK_DEVICE_FOR_WORK, true) == 0;
 }
 
 bool down_wlan0_interface() {
@@ -225,20 +226,20 @@ bool down_wlan0_interface() {
         return true;
     }
 
-    Shell::system("ifconfig wlan0 0.0.0.0");
+    netif_flush_ipv4(NETWORK_DEVICE_FOR_WORK);
 
-    return Shell::system("ifconfig wlan0 down &");
+    return netif_set_link(NETWORK_DEVICE_FOR_WORK, false) == 0;
 }
 
 bool stop_dhcp_server() {
-    return Shell::system("killall dnsmasq &");
+    /* dnsmasq holds port 53 and 67 until it has exited */
+    return kill_task_timeout("dnsmasq", 1000) == 0;
 }
 
 bool start_dhcp_server() {
     if (stop_dhcp_server()) {
         APP_DEBUG("[Start_dhcp_server] dnsmasq is killed.\n");
     }
-    sleep(1);
 
     return Shell::system("dnsmasq &");
 }
@@ -763,9 +764,7 @@ bool checkWifiIsConnected() {
 	connect_retry_count = WIFI_CONNECT_RETRY;
 
 	Shell::exec("dhcpcd -k wlan0", ret_buff, 1024);
-	usleep(500000);
-	Shell::exec("killall dhcpcd", ret_buff, 1024);
-	usleep(500000);
+	kill_task_timeout("dhcpcd", 1000);
 
     /* 15s to check wifi whether connected */
     for(int i=0;i<connect_retry_count;i++){
@@ -792,9 +791,7 @@ bool checkWifiIsConnected() {
 				dhcpcd_retry--;
 				// udhcpc network
 				Shell::exec("dhcpcd -k wlan0", ret_buff, 1024);
-				usleep(500000);
-				Shell::exec("killall dhcpcd", ret_buff, 1024);
-				usleep(500000);
+				kill_task_timeout("dhcpcd", 1000);
 				Shell::exec("dhcpcd -L -f /etc/dhcpcd.conf", ret_buff, 1024);
 				sleep(1);
 				Shell::system("dhcpcd wlan0 -t 0 &");
@@ -1022,26 +1019,9 @@ char PASSWD[65];
 #define UDHCPC "udhcpc"
 
 int get_pid(const char Name[]) {
-    int len;
-    char name[32] = {0};
-    len = strlen(Name);
-    strncpy(name,Name,len);
-    name[31] ='\0';
-    char cmdresult[256] = {0};
-    char cmd[64] = {0};
-    FILE *pFile = NULL;
-    int  pid = 0;
-
-    sprintf(cmd, "pidof %s", name);
-    pFile = popen(cmd, "r");
-    if (pFile != NULL)  {
-        while (fgets(cmdresult, sizeof(cmdresult), pFile)) {
-            pid = atoi(cmdresult);
-            break;
-        }
-        pclose(pFile);
-    }
-    printf("get_pid pidof %s: %d\n", name, pid);
+    int pid = get_ps_pid(Name);
+
+    printf("get_pid pidof %s: %d\n", Name, pid);
     return pid;
 }
 
@@ -1087,7 +1067,7 @@ int dispatch_event(char* event)
 	
 	if (str_starts_with(event, (char *)WPA_EVENT_DISCONNECTED)) {
 		printf("%s: wifi is disconnect\n", __FUNCTION__);
-		system("ip addr flush dev wlan0");
+		netif_flush_ipv4("wlan0");
 		m_ping_interval = 1;
 	} else if (str_starts_with(event, (char *)WPA_EVENT_CONNECTED)) {
 		printf("%s: wifi is connected\n", __func__);
@@ -0,0 +1,693 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <linux/input.h>
+
+#include "key_gesture.h"
+
+typedef struct gesture_timer gesture_timer_t;
+typedef void (*gesture_timer_fn)(gesture_timer_t *timer, const uint64_t now);
+
+struct gesture_timer {
+	uint64_t due;
+	int slot;							// index in m_heap, -1 when not armed
+	gesture_timer_fn fire;
+	void *arg;
+};
+
+typedef struct {
+	uint32_t time;
+	RK_input_long_press_callback cb;
+	RK_input_long_press_hb_callback hb;
+} long_reg_t;
+
+typedef struct {
+	int times;
+	RK_input_multiple_press_callback cb;
+} multiple_reg_t;
+
+typedef struct {
+	int *codes;
+	int count;
+	int held;							// how many of codes are down
+	uint32_t time;
+	char *keys;							// "a b ", as the callback gets it
+	RK_input_compose_press_callback cb;
+	gesture_timer_t timer;
+} compose_reg_t;
+
+typedef struct {
+	int *codes;
+	int count;
+	uint32_t time;						// max gap between two of the keys
+	char *keys;							// " a b "
+	RK_input_transaction_press_callback cb;
+} transaction_reg_t;
+
+typedef struct {
+	int code;
+	int down;
+	uint64_t down_time;
+
+	long_reg_t *longs;					// by time, all cb or all hb
+	int long_count;
+	gesture_timer_t long_timer;
+	int long_fired;						// nothing left for key up to report
+
+	multiple_reg_t *multiples;			// by times
+	int multiple_count;
+
+	int *composes;						// m_composes this key is part of
+	int compose_count;
+
+	int *transactions;					// m_transactions starting with it, newest first
+	int transaction_count;
+} key_entry_t;
+
+static void multiple_timer_fire(gesture_timer_t *timer, const uint64_t now);
+static void transaction_timer_fire(gesture_timer_t *timer, const uint64_t now);
+
+static pthread_mutex_t m_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+static key_entry_t *m_keys[KEY_CNT];
+static int m_down_count;
+/* a compose went off, the keys are its own until all of them are up */
+static int m_compose_swallow;
+
+static compose_reg_t **m_composes;
+static int m_compose_count;
+static transaction_reg_t **m_transactions;
+static int m_transaction_count;
+
+static RK_input_press_callback m_press_cb;
+
+static struct {
+	int code;
+	int times;
+	int responded;						// this sequence was reported, key up stays quiet
+	gesture_timer_t timer;
+} m_multiple = { 0, 0, 0, { 0, -1, multiple_timer_fire, NULL } };
+
+static struct {
+	transaction_reg_t *reg;
+	int next;							// index of the key expected next
+	gesture_timer_t timer;
+} m_transaction = { NULL, 0, { 0, -1, transaction_timer_fire, NULL } };
+
+static gesture_timer_t **m_heap;
+static int m_heap_len, m_heap_cap;
+
+/***************************** timers *****************************/
+
+static void heap_set(const int i, gesture_timer_t *timer)
+{
+	m_heap[i] = timer;
+	timer->slot = i;
+}
+
+static void heap_fix(int i)
+{
+	gesture_timer_t *timer = m_heap[i];
+	int child;
+
+	while (i > 0 && m_heap[(i - 1) / 2]->due > timer->due) {
+		heap_set(i, m_heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	while ((child = 2 * i + 1) < m_heap_len) {
+		if (child + 1 < m_heap_len && m_heap[child + 1]->due < m_heap[child]->due)
+			child++;
+		if (m_heap[child]->due >= timer->due)
+			break;
+		heap_set(i, m_heap[child]);
+		i = child;
+	}
+	heap_set(i, timer);
+}
+
+static void timer_init(gesture_timer_t *timer, gesture_timer_fn fire, void *arg)
+{
+	timer->slot = -1;
+	timer->fire = fire;
+	timer->arg = arg;
+}
+
+static void timer_cancel(gesture_timer_t *timer)
+{
+	int slot = timer->slot;
+
+	if (slot < 0)
+		return;
+
+	timer->slot = -1;
+	if (--m_heap_len > slot) {
+		heap_set(slot, m_heap[m_heap_len]);
+		heap_fix(slot);
+	}
+}
+
+static void timer_arm(gesture_timer_t *timer, const uint64_t due)
+{
+	gesture_timer_t **heap;
+
+	timer->due = due;
+	if (timer->slot >= 0) {
+		heap_fix(timer->slot);
+		return;
+	}
+
+	if (m_heap_len == m_heap_cap) {
+		heap = (gesture_timer_t **)realloc(m_heap, (m_heap_cap + 16) * sizeof(*heap));
+		if (!heap) {
+			printf("%s: out of memory, gesture dropped\n", __func__);
+			return;
+		}
+		m_heap = heap;
+		m_heap_cap += 16;
+	}
+	heap_set(m_heap_len, timer);
+	heap_fix(m_heap_len++);
+}
+
+/**************************** gestures ****************************/
+
+static key_entry_t *key_entry(const int code, const bool create);
+
+static void press(const int code)
+{
+	if (m_press_cb)
+		m_press_cb(code);
+}
+
+/* a long press is what the key did, not the first of several presses */
+static void multiple_drop(const int code)
+{
+	if (m_multiple.code != code)
+		return;
+
+	timer_cancel(&m_multiple.timer);
+	m_multiple.code = 0;
+	m_multiple.times = 0;
+}
+
+static void long_timer_fire(gesture_timer_t *timer, const uint64_t now)
+{
+	key_entry_t *e = (key_entry_t *)timer->arg;
+	long_reg_t top = e->longs[e->long_count - 1];
+
+	e->long_fired = 1;
+	multiple_drop(e->code);
+	if (top.cb) {
+		top.cb(e->code, top.time);
+	} else if (top.hb) {
+		/* every time ms for as long as the key is held */
+		if (top.time)
+			timer_arm(timer, timer->due + top.time);
+		top.hb(e->code, 1);
+	}
+}
+
+/* the sequence is over: report the most presses registered, or a plain press */
+static void multiple_resolve(void)
+{
+	multiple_reg_t reg = { 0, NULL };
+	key_entry_t *e;
+	int code = m_multiple.code;
+
+	timer_cancel(&m_multiple.timer);
+	e = key_entry(code, false);
+	for (int i = 0; e && i < e->multiple_count && e->multiples[i].times <= m_multiple.times; i++)
+		reg = e->multiples[i];
+	m_multiple.code = 0;
+	m_multiple.times = 0;
+
+	if (reg.times) {
+		m_multiple.responded = 1;
+		if (reg.cb)
+			reg.cb(code, reg.times);
+	} else if (!(e && e->down && e->long_count)) {
+		/* a held long press key reports on key up instead */
+		press(code);
+	}
+}
+
+static void multiple_timer_fire(gesture_timer_t *timer, const uint64_t now)
+{
+	multiple_resolve();
+}
+
+static void multiple_press(key_entry_t *e, const uint64_t now)
+{
+	multiple_reg_t max = e->multiples[e->multiple_count - 1];
+
+	if (m_multiple.code && m_multiple.code != e->code)
+		multiple_resolve();
+
+	if (m_multiple.code == e->code) {
+		m_multiple.times++;
+	} else {
+		m_multiple.code = e->code;
+		m_multiple.times = 1;
+	}
+
+	/* nothing registered goes higher, no need to wait */
+	if (m_multiple.times >= max.times) {
+		timer_cancel(&m_multiple.timer);
+		m_multiple.code = 0;
+		m_multiple.times = 0;
+		m_multiple.responded = 1;
+		if (max.cb)
+			max.cb(e->code, max.times);
+		return;
+	}
+
+	timer_arm(&m_multiple.timer, now + KEY_GESTURE_MULTIPLE_MS);
+}
+
+static void compose_timer_fire(gesture_timer_t *timer, const uint64_t now)
+{
+	compose_reg_t *comp = (compose_reg_t *)timer->arg;
+
+	if (comp->cb)
+		comp->cb(comp->keys, comp->time);
+}
+
+static void transaction_timer_fire(gesture_timer_t *timer, const uint64_t now)
+{
+	m_transaction.reg = NULL;
+}
+
+static void transaction_step(key_entry_t *e, const uint64_t now)
+{
+	transaction_reg_t *reg = m_transaction.reg;
+
+	if (reg && reg->codes[m_transaction.next] == e->code) {
+		if (++m_transaction.next < reg->count) {
+			timer_arm(&m_transaction.timer, now + reg->time);
+			return;
+		}
+	} else {
+		/* off the sequence: maybe this key starts another one */
+		reg = e->transaction_count ? m_transactions[e->transactions[0]] : NULL;
+		m_transaction.reg = reg;
+		m_transaction.next = 1;
+		if (reg && reg->count > 1) {
+			timer_arm(&m_transaction.timer, now + reg->time);
+			return;
+		}
+	}
+
+	timer_cancel(&m_transaction.timer);
+	m_transaction.reg = NULL;
+	if (reg && reg->cb)
+		reg->cb(reg->keys, reg->time);
+}
+
+static void key_down(key_entry_t *e, const uint64_t now)
+{
+	int composed = 0;
+
+	e->down = 1;
+	e->down_time = now;
+	m_down_count++;
+
+	transaction_step(e, now);
+
+	for (int i = 0; i < e->compose_count; i++) {
+		compose_reg_t *comp = m_composes[e->composes[i]];
+
+		if (++comp->held == comp->count) {
+			/* goes off once all of them have been held for time, due now if 0 */
+			timer_arm(&comp->timer, now + comp->time);
+			composed = 1;
+		}
+	}
+	if (composed) {
+		for (int i = 0; i < KEY_CNT; i++) {
+			if (m_keys[i] && m_keys[i]->down) {
+				timer_cancel(&m_keys[i]->long_timer);
+				m_keys[i]->long_fired = 1;
+			}
+		}
+		m_compose_swallow = 1;
+	}
+	if (m_compose_swallow)
+		return;
+
+	if (e->long_count) {
+		timer_arm(&e->long_timer, now + e->longs[e->long_count - 1].time);
+		e->long_fired = 0;
+		/* a press is only known on key up, multi-press still counts it */
+		if (e->multiple_count)
+			multiple_press(e, now);
+		return;
+	}
+
+	if (e->multiple_count)
+		multiple_press(e, now);
+	else
+		press(e->code);
+}
+
+static void key_up(key_entry_t *e, const uint64_t now)
+{
+	long_reg_t reg = { 0, NULL, NULL };
+	uint32_t held = now - e->down_time;
+	int quiet;
+
+	e->down = 0;
+	m_down_count--;
+
+	for (int i = 0; i < e->compose_count; i++) {
+		compose_reg_t *comp = m_composes[e->composes[i]];
+
+		/* let go before its time */
+		if (comp->held-- == comp->count)
+			timer_cancel(&comp->timer);
+	}
+
+	quiet = m_multiple.responded;
+	m_multiple.responded = 0;
+	timer_cancel(&e->long_timer);
+
+	if (m_compose_swallow) {
+		if (m_down_count == 0)
+			m_compose_swallow = 0;
+		return;
+	}
+	if (!e->long_count || e->long_fired)
+		return;
+
+	/* the longest registration the key was held for; heartbeats report while held */
+	for (int i = 0; i < e->long_count && e->longs[i].time <= held; i++)
+		reg = e->longs[i];
+	if (reg.cb || reg.hb)
+		multiple_drop(e->code);
+	if (reg.cb)
+		reg.cb(e->code, reg.time);
+	else if (!reg.hb && !quiet && m_multiple.code != e->code)
+		press(e->code);
+}
+
+void key_gesture_event(const int code, const int value, const uint64_t now)
+{
+	key_entry_t *e;
+
+	pthread_mutex_lock(&m_lock);
+	e = key_entry(code, true);
+	if (e && value == 1 && !e->down)
+		key_down(e, now);
+	else if (e && value == 0 && e->down)
+		key_up(e, now);
+	pthread_mutex_unlock(&m_lock);
+}
+
+int key_gesture_expire(const uint64_t now)
+{
+	gesture_timer_t *timer;
+	int ret = -1;
+
+	pthread_mutex_lock(&m_lock);
+	while (m_heap_len > 0 && m_heap[0]->due <= now) {
+		timer = m_heap[0];
+		timer_cancel(timer);
+		/* may arm itself again */
+		timer->fire(timer, now);
+	}
+	if (m_heap_len > 0)
+		ret = m_heap[0]->due - now;
+	pthread_mutex_unlock(&m_lock);
+
+	return ret;
+}
+
+/************************** registration **************************/
+
+static key_entry_t *key_entry(const int code, const bool create)
+{
+	key_entry_t *e;
+
+	if (code <= 0 || code >= KEY_CNT)
+		return NULL;
+	if (m_keys[code] || !create)
+		return m_keys[code];
+
+	e = (key_entry_t *)calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+	e->code = code;
+	timer_init(&e->long_timer, long_timer_fire, e);
+	m_keys[code] = e;
+
+	return e;
+}
+
+static int add_index(int **list, int *count, const int index, const bool front)
+{
+	int *tmp = (int *)realloc(*list, (*count + 1) * sizeof(int));
+
+	if (!tmp)
+		return -1;
+	if (front) {
+		memmove(tmp + 1, tmp, *count * sizeof(int));
+		tmp[0] = index;
+	} else {
+		tmp[*count] = index;
+	}
+	*list = tmp;
+	(*count)++;
+
+	return 0;
+}
+
+static char *keys_string(const char *lead, const int *codes, const int count)
+{
+	std::string keys(lead);
+
+	for (int i = 0; i < count; i++)
+		keys += std::to_string(codes[i]) + " ";
+
+	return strdup(keys.c_str());
+}
+
+void key_gesture_set_press_cb(RK_input_press_callback cb)
+{
+	pthread_mutex_lock(&m_lock);
+	m_press_cb = cb;
+	pthread_mutex_unlock(&m_lock);
+}
+
+int key_gesture_add_long(const int code, const uint32_t time,
+		RK_input_long_press_callback cb, RK_input_long_press_hb_callback hb)
+{
+	key_entry_t *e;
+	long_reg_t *longs;
+	int i, ret = 0;
+
+	pthread_mutex_lock(&m_lock);
+	e = key_entry(code, true);
+	if (!e) {
+		ret = -1;
+		goto out;
+	}
+
+	/* a key long presses with callbacks or with heartbeats, the newer kind wins */
+	if (e->long_count && !!e->longs[0].hb != !!hb) {
+		timer_cancel(&e->long_timer);
+		e->long_count = 0;
+	}
+
+	for (i = 0; i < e->long_count && e->longs[i].time < time; i++)
+		;
+	if (i < e->long_count && e->longs[i].time == time)	// already registered, ignore
+		goto out;
+
+	longs = (long_reg_t *)realloc(e->longs, (e->long_count + 1) * sizeof(*longs));
+	if (!longs) {
+		ret = -1;
+		goto out;
+	}
+	memmove(longs + i + 1, longs + i, (e->long_count - i) * sizeof(*longs));
+	longs[i].time = time;
+	longs[i].cb = hb ? NULL : cb;
+	longs[i].hb = hb;
+	e->longs = longs;
+	e->long_count++;
+
+out:
+	pthread_mutex_unlock(&m_lock);
+	return ret;
+}
+
+int key_gesture_add_multiple(const int code, const int times, RK_input_multiple_press_callback cb)
+{
+	multiple_reg_t *multiples;
+	key_entry_t *e;
+	int i, ret = 0;
+
+	pthread_mutex_lock(&m_lock);
+	e = key_entry(code, true);
+	if (!e || times <= 0) {
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < e->multiple_count && e->multiples[i].times < times; i++)
+		;
+	if (i < e->multiple_count && e->multiples[i].times == times) {
+		printf("RK_input_register_multiple_press_callback already exist. code:%d; times:%d\n", code, times);
+		ret = -1;
+		goto out;
+	}
+
+	multiples = (multiple_reg_t *)realloc(e->multiples, (e->multiple_count + 1) * sizeof(*multiples));
+	if (!multiples) {
+		ret = -1;
+		goto out;
+	}
+	memmove(multiples + i + 1, multiples + i, (e->multiple_count - i) * sizeof(*multiples));
+	multiples[i].times = times;
+	multiples[i].cb = cb;
+	e->multiples = multiples;
+	e->multiple_count++;
+
+out:
+	pthread_mutex_unlock(&m_lock);
+	return ret;
+}
+
+int key_gesture_add_compose(const int *codes, const int count, const uint32_t time,
+		RK_input_compose_press_callback cb)
+{
+	compose_reg_t *comp, **composes;
+	int ret = -1;
+
+	if (count <= 0)
+		return -1;
+
+	pthread_mutex_lock(&m_lock);
+	for (int i = 0; i < count; i++) {
+		if (!key_entry(codes[i], true))
+			goto out;
+	}
+
+	composes = (compose_reg_t **)realloc(m_composes, (m_compose_count + 1) * sizeof(*composes));
+	if (!composes)
+		goto out;
+	m_composes = composes;
+
+	comp = (compose_reg_t *)calloc(1, sizeof(*comp));
+	comp->codes = (int *)malloc(count * sizeof(int));
+	memcpy(comp->codes, codes, count * sizeof(int));
+	comp->count = count;
+	comp->time = time;
+	comp->cb = cb;
+	comp->keys = keys_string("", codes, count);
+	timer_init(&comp->timer, compose_timer_fire, comp);
+
+	for (int i = 0; i < count; i++) {
+		key_entry_t *e = m_keys[codes[i]];
+
+		add_index(&e->composes, &e->compose_count, m_compose_count, false);
+		if (e->down)
+			comp->held++;
+	}
+	m_composes[m_compose_count++] = comp;
+	ret = 0;
+
+out:
+	pthread_mutex_unlock(&m_lock);
+	return ret;
+}
+
+int key_gesture_add_transaction(const int *codes, const int count, const uint32_t time,
+		RK_input_transaction_press_callback cb)
+{
+	transaction_reg_t *trans, **transactions;
+	key_entry_t *e;
+	int ret = -1;
+
+	if (count <= 0)
+		return -1;
+
+	pthread_mutex_lock(&m_lock);
+	e = key_entry(codes[0], true);
+	if (!e)
+		goto out;
+
+	transactions = (transaction_reg_t **)realloc(m_transactions, (m_transaction_count + 1) * sizeof(*transactions));
+	if (!transactions)
+		goto out;
+	m_transactions = transactions;
+
+	trans = (transaction_reg_t *)calloc(1, sizeof(*trans));
+	trans->codes = (int *)malloc(count * sizeof(int));
+	memcpy(trans->codes, codes, count * sizeof(int));
+	trans->count = count;
+	trans->time = time;
+	trans->cb = cb;
+	trans->keys = keys_string(" ", codes, count);
+	printf("RK_input_register_transaction_press_callback keys:\"%s\"\n", trans->keys);
+
+	add_index(&e->transactions, &e->transaction_count, m_transaction_count, true);
+	m_transactions[m_transaction_count++] = trans;
+	ret = 0;
+
+out:
+	pthread_mutex_unlock(&m_lock);
+	return ret;
+}
+
+void key_gesture_print(void)
+{
+	std::string str("long:{");
+	char tmp[64];
+	bool first = true;
+
+	pthread_mutex_lock(&m_lock);
+	for (int code = 0; code < KEY_CNT; code++) {
+		key_entry_t *e = m_keys[code];
+
+		if (!e || !e->long_count)
+			continue;
+		snprintf(tmp, sizeof(tmp), "%s%d:[", first ? "" : ",", code);
+		str += tmp;
+		for (int i = 0; i < e->long_count; i++) {
+			snprintf(tmp, sizeof(tmp), "%s(%d %u%s)", i ? "," : "", code, e->longs[i].time,
+					e->longs[i].hb ? " hb" : "");
+			str += tmp;
+		}
+		str += "]";
+		first = false;
+	}
+
+	str += "}\nmultiple:{";
+	first = true;
+	for (int code = 0; code < KEY_CNT; code++) {
+		key_entry_t *e = m_keys[code];
+
+		for (int i = 0; e && i < e->multiple_count; i++) {
+			snprintf(tmp, sizeof(tmp), "%s(%d %d)", first ? "" : ",", code, e->multiples[i].times);
+			str += tmp;
+			first = false;
+		}
+	}
+
+	str += "}\ncompose:{";
+	for (int i = 0; i < m_compose_count; i++) {
+		snprintf(tmp, sizeof(tmp), "%s(%u, ", i ? "," : "", m_composes[i]->time);
+		str = str + tmp + m_composes[i]->keys + ")";
+	}
+
+	str += "}\ntransaction:{";
+	for (int i = 0; i < m_transaction_count; i++) {
+		snprintf(tmp, sizeof(tmp), "%s(%u, ", i ? "," : "", m_transactions[i]->time);
+		str = str + tmp + m_transactions[i]->keys + ")";
+	}
+	str += "}\n";
+	pthread_mutex_unlock(&m_lock);
+
+	printf("%s\n", str.c_str());
+}
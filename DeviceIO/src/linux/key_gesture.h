@@ -0,0 +1,39 @@
+#ifndef DEVICEIO_FRAMEWORK_KEY_GESTURE_H_
+#define DEVICEIO_FRAMEWORK_KEY_GESTURE_H_
+
+#include <stdint.h>
+
+#include "DeviceIo/Rk_key.h"
+
+/* a multi-press sequence is over this long after its last press */
+#define KEY_GESTURE_MULTIPLE_MS	500
+
+/*
+ * Key gestures (press, long press and its heartbeat, multi-press,
+ * compose and transaction) as one state machine. Registrations are
+ * indexed by key code and every pending deadline sits in one timer
+ * heap, so nothing here has a thread of its own: the input thread feeds
+ * key_gesture_event() and calls key_gesture_expire() when the earliest
+ * deadline comes up. Callbacks run on that thread.
+ *
+ * Times are ms on any monotonic clock, as long as it is the same one
+ * for every call.
+ */
+void key_gesture_set_press_cb(RK_input_press_callback cb);
+int key_gesture_add_long(const int code, const uint32_t time,
+		RK_input_long_press_callback cb, RK_input_long_press_hb_callback hb);
+int key_gesture_add_multiple(const int code, const int times, RK_input_multiple_press_callback cb);
+int key_gesture_add_compose(const int *codes, const int count, const uint32_t time,
+		RK_input_compose_press_callback cb);
+int key_gesture_add_transaction(const int *codes, const int count, const uint32_t time,
+		RK_input_transaction_press_callback cb);
+
+/* key down (value 1) or up (0) at now */
+void key_gesture_event(const int code, const int value, const uint64_t now);
+
+/* run every deadline up to now, return ms until the next one or -1 */
+int key_gesture_expire(const uint64_t now);
+
+void key_gesture_print(void);
+
+#endif // DEVICEIO_FRAMEWORK_KEY_GESTURE_H_
@@ -26,11 +26,15 @@
 #include <sys/time.h>
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
-#include <csignal>
 #include <errno.h>
 #include <paths.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <map>
 
 #include "TcpServer.h"
 #include "UdpServer.h"
@@ -40,12 +44,9 @@
 #include "DeviceIo/NetLinkWrapper.h"
 #include "../SoundController.h"
 #include "../shell.h"
+#include "../wifi/ping.h"
 #include <DeviceIo/RkBle.h>
 
-extern "C" {
-	extern int m_ping_interval;
-}
-
 namespace DeviceIOFramework {
 
 using std::string;
@@ -63,6 +64,25 @@ static string m_target_ssid_prefix;
 static int m_network_status = 0;
 static bool m_pinging = false;
 
+/* last IFF_UP/IFF_RUNNING seen per ifindex, only touched by the monitor thread */
+static std::map<int, unsigned int> m_link_flags;
+
+enum {
+	EV_CONFIG_TIMEOUT = 1,
+	EV_CHECK,
+	EV_RTNETLINK,
+};
+
+/* 0 disarms the timer */
+static void arm_timer(int fd, long delay_ms) {
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = delay_ms / 1000;
+	its.it_value.tv_nsec = (delay_ms % 1000) * 1000000;
+	timerfd_settime(fd, 0, &its, NULL);
+}
+
 NetLinkWrapper::NetLinkWrapper() : m_networkStatus{NETLINK_NETWORK_SUCCEEDED},
 		m_isLoopNetworkConfig{false},
 		m_isNetworkOnline{false},
@@ -72,12 +92,10 @@ NetLinkWrapper::NetLinkWrapper() : m_networkStatus{NETLINK_NETWORK_SUCCEEDED},
 		wifi_link_state{false},
 		net_link_state{false}{
 	s_destroyOnce = PTHREAD_ONCE_INIT;
-	m_maxPacketSize = MAX_PACKETS_COUNT;
-	m_datalen = 56;
-	m_nsend = 0;
-	m_nreceived = 0;
-	m_icmp_seq = 0;
 	m_stop_network_recovery = false;
+	m_check_interval = 1;
+	m_epoll_fd = m_timeout_fd = m_check_fd = m_rtnl_fd = -1;
+	m_monitoring = false;
 	m_operation_type = operation_type::EOperationStart;
 
 	pthread_mutex_init(&m_ping_lock, NULL);
@@ -116,32 +134,34 @@ void NetLinkWrapper::setCallback(INetLinkWrapperCallback *callback) {
 void NetLinkWrapper::logFunction(const char* msg, ...) {
 }
 
-void NetLinkWrapper::sigalrm_fn(int sig) {
+void NetLinkWrapper::on_network_config_timeout() {
 	APP_INFO("alarm is run.");
 
-	getInstance()->m_operation_type = operation_type::EAutoEnd;
+	m_operation_type = operation_type::EAutoEnd;
 
-	getInstance()->stop_network_config_timeout_alarm();
-	getInstance()->stop_network_config();
-	getInstance()->notify_network_config_status(ENetworkConfigRouteFailed);
+	stop_network_config_timeout_alarm();
+	stop_network_config();
+	notify_network_config_status(ENetworkConfigRouteFailed);
 }
 
 void NetLinkWrapper::init_network_config_timeout_alarm() {
 	APP_INFO("set alarm.");
 
-	signal(SIGALRM, sigalrm_fn);
+	start_event_loop();
 }
 
 void NetLinkWrapper::start_network_config_timeout_alarm(int timeout) {
 	APP_INFO("start alarm.");
 
-	alarm(timeout);
+	if (m_timeout_fd >= 0)
+		arm_timer(m_timeout_fd, timeout * 1000L);
 }
 
 void NetLinkWrapper::stop_network_config_timeout_alarm() {
 	APP_INFO("stop alarm.");
 
-	alarm(0);
+	if (m_timeout_fd >= 0)
+		arm_timer(m_timeout_fd, 0);
 }
 
 static string generate_ssid(void) {
@@ -429,7 +449,7 @@ bool NetLinkWrapper::start_network_config() {
 	DeviceIo::getInstance()->controlBt(BtControl::BT_BLE_OPEN);
 	printf("==start notify_network_config_status ===\n");
 	getInstance()->notify_network_config_status(ENetworkConfigStarted);
-	m_ping_interval = 1;
+	schedule_check(1000);
 	wifi_link_state = false;
 }
 
@@ -441,23 +461,148 @@ void NetLinkWrapper::stop_network_config() {
 	DeviceIo::getInstance()->controlBt(BtControl::BT_BLE_DISCONNECT);
 }
 
+void NetLinkWrapper::start_event_loop() {
+	std::call_once(m_loopOnce, [this] {
+		struct sockaddr_nl snl;
+		struct epoll_event ev;
+		pthread_t tid;
+
+		m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		m_timeout_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		m_check_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (m_epoll_fd < 0 || m_timeout_fd < 0 || m_check_fd < 0) {
+			APP_ERROR("monitor loop setup failed: %s", strerror(errno));
+			return;
+		}
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = EV_CONFIG_TIMEOUT;
+		epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_timeout_fd, &ev);
+		ev.data.u32 = EV_CHECK;
+		epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_check_fd, &ev);
+
+		/* without rtnetlink we still have the backoff timer, just slower to notice */
+		m_rtnl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+		if (m_rtnl_fd >= 0) {
+			memset(&snl, 0, sizeof(snl));
+			snl.nl_family = AF_NETLINK;
+			snl.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE;
+			if (bind(m_rtnl_fd, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+				APP_ERROR("rtnetlink bind failed: %s", strerror(errno));
+				close(m_rtnl_fd);
+				m_rtnl_fd = -1;
+			} else {
+				ev.data.u32 = EV_RTNETLINK;
+				epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_rtnl_fd, &ev);
+			}
+		} else {
+			APP_ERROR("rtnetlink socket failed: %s", strerror(errno));
+		}
+
+		pthread_create(&tid, nullptr, monitor_work_routine, this);
+		pthread_detach(tid);
+	});
+}
+
+void NetLinkWrapper::schedule_check(int delay_ms) {
+	if (!m_monitoring || m_check_fd < 0)
+		return;
+
+	/* a zero it_value would disarm instead of firing now */
+	arm_timer(m_check_fd, delay_ms > 0 ? delay_ms : 1);
+}
+
+/* true if the batch holds a change that can affect reachability */
+bool NetLinkWrapper::handle_rtnetlink_event() {
+	char buf[8192];
+	bool changed = false;
+	int len;
+
+	while ((len = recv(m_rtnl_fd, buf, sizeof(buf), 0)) > 0) {
+		for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			switch (nh->nlmsg_type) {
+			case RTM_NEWLINK:
+			case RTM_DELLINK: {
+				struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(nh);
+				unsigned int flags = ifi->ifi_flags & (IFF_UP | IFF_RUNNING);
+
+				if (ifi->ifi_flags & IFF_LOOPBACK)
+					break;
+				if (nh->nlmsg_type == RTM_DELLINK) {
+					m_link_flags.erase(ifi->ifi_index);
+					changed = true;
+					break;
+				}
+				/* NEWLINK also reports stats and name changes, only carrier matters */
+				auto it = m_link_flags.find(ifi->ifi_index);
+				if (it == m_link_flags.end() || it->second != flags) {
+					APP_DEBUG("link %d flags 0x%x", ifi->ifi_index, flags);
+					m_link_flags[ifi->ifi_index] = flags;
+					changed = true;
+				}
+				break;
+			}
+			case RTM_NEWADDR:
+			case RTM_DELADDR: {
+				struct ifaddrmsg *ifa = (struct ifaddrmsg *)NLMSG_DATA(nh);
+
+				if (ifa->ifa_scope != RT_SCOPE_HOST)
+					changed = true;
+				break;
+			}
+			case RTM_NEWROUTE:
+			case RTM_DELROUTE: {
+				struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(nh);
+
+				/* default route only */
+				if (rtm->rtm_table == RT_TABLE_MAIN && rtm->rtm_dst_len == 0)
+					changed = true;
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+
+	return changed;
+}
+
 void *NetLinkWrapper::monitor_work_routine(void *arg) {
 	auto thread = static_cast<NetLinkWrapper*>(arg);
-	int time_interval = 1;
-	int time_count = 1;
-	while(1) {
-		thread->ping_network(false);
-		time_count = time_interval = m_ping_interval;
-		APP_DEBUG("monitor_work_routine m_ping_interval:%d", m_ping_interval);
-
-		while (time_count > 0) {
-			struct timeval tv;
-			tv.tv_sec = 1;
-			tv.tv_usec = 0;
-			::select(0, NULL, NULL, NULL, &tv);
-			time_count--;
-			if (time_interval != m_ping_interval) {
-				APP_DEBUG("monitor_work_routine m_ping_interval:%d, time_interval:%d", m_ping_interval, time_interval);
+	struct epoll_event events[4];
+	uint64_t expirations;
+
+	prctl(PR_SET_NAME, "netlink_monitor");
+
+	while (1) {
+		int nfds = epoll_wait(thread->m_epoll_fd, events, 4, -1);
+		if (nfds < 0) {
+			if (errno == EINTR)
+				continue;
+			APP_ERROR("monitor epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < nfds; i++) {
+			switch (events[i].data.u32) {
+			case EV_CONFIG_TIMEOUT:
+				if (read(thread->m_timeout_fd, &expirations, sizeof(expirations)) > 0)
+					thread->on_network_config_timeout();
+				break;
+			case EV_RTNETLINK:
+				if (thread->handle_rtnetlink_event()) {
+					APP_DEBUG("monitor_work_routine: network changed, check soon");
+					thread->schedule_check(NETLINK_EVENT_SETTLE_MS);
+				}
+				break;
+			case EV_CHECK:
+				if (read(thread->m_check_fd, &expirations, sizeof(expirations)) <= 0)
+					break;
+				thread->ping_network(false);
+				APP_DEBUG("monitor_work_routine m_check_interval:%d", thread->m_check_interval);
+				thread->schedule_check(thread->m_check_interval * 1000);
 				break;
 			}
 		}
@@ -467,10 +612,9 @@ void *NetLinkWrapper::monitor_work_routine(void *arg) {
 }
 
 void NetLinkWrapper::start_network_monitor() {
-	pthread_t network_config_threadId;
-
-	pthread_create(&network_config_threadId, nullptr, monitor_work_routine, this);
-	pthread_detach(network_config_threadId);
+	start_event_loop();
+	m_monitoring = true;
+	schedule_check(0);
 }
 
 bool is_first_network_config(string path) {
@@ -892,287 +1036,44 @@ void NetLinkWrapper::OnNetworkReady() {
 				   "/etc/init.d/S49ntp start");
 }
 
-unsigned short NetLinkWrapper::getChksum(unsigned short *addr,int len) {
-	int nleft = len;
-	int sum = 0;
-	unsigned short *w = addr;
-	unsigned short answer = 0;
-
-	while (nleft > 1) {
-		sum += *w++;
-		nleft-= 2;
-	}
-
-	if (nleft == 1) {
-		*(unsigned char *)(&answer) = *(unsigned char *)w;
-		sum += answer;
-	}
-
-	sum = ((sum>>16) + (sum&0xffff));
-	sum += (sum>>16);
-	answer = ~sum;
-
-	return answer;
-}
-
-int NetLinkWrapper::packIcmp(int pack_no, struct icmp* icmp) {
-	int packsize;
-	struct icmp *picmp;
-	struct timeval *tval;
-
-	picmp = icmp;
-	picmp->icmp_type = ICMP_ECHO;
-	picmp->icmp_code = 0;
-	picmp->icmp_cksum = 0;
-	picmp->icmp_seq = pack_no;
-	picmp->icmp_id = m_pid;
-	packsize = (8 + m_datalen);
-	tval= (struct timeval *)icmp->icmp_data;
-	gettimeofday(tval, nullptr);
-	picmp->icmp_cksum = getChksum((unsigned short *)icmp, packsize);
-
-	return packsize;
-}
-
-bool NetLinkWrapper::unpackIcmp(char *buf, int len, struct IcmpEchoReply *icmpEchoReply) {
-	int iphdrlen;
-	struct ip *ip;
-	struct icmp *icmp;
-	struct timeval *tvsend, tvrecv, tvresult;
-	double rtt;
-
-	ip = (struct ip *)buf;
-	iphdrlen = ip->ip_hl << 2;
-	icmp = (struct icmp *)(buf + iphdrlen);
-	len -= iphdrlen;
-
-	if (len < 8) {
-		APP_ERROR("ICMP packets's length is less than 8.");
-		return false;
-	}
-
-	if( (icmp->icmp_type == ICMP_ECHOREPLY) && (icmp->icmp_id == m_pid) ) {
-		tvsend = (struct timeval *)icmp->icmp_data;
-		gettimeofday(&tvrecv, nullptr);
-		tvresult = timevalSub(tvrecv, *tvsend);
-		rtt = tvresult.tv_sec*1000 + tvresult.tv_usec/1000;	 //ms
-		icmpEchoReply->rtt = rtt;
-		icmpEchoReply->icmpSeq = icmp->icmp_seq;
-		icmpEchoReply->ipTtl = ip->ip_ttl;
-		icmpEchoReply->icmpLen = len;
-
-		return true;
-	} else {
-		return false;
-	}
-}
-
-struct timeval NetLinkWrapper::timevalSub(struct timeval timeval1, struct timeval timeval2) {
-	struct timeval result;
-
-	result = timeval1;
-
-	if ((result.tv_usec < timeval2.tv_usec) && (timeval2.tv_usec < 0)) {
-		-- result.tv_sec;
-		result.tv_usec += 1000000;
-	}
-
-	result.tv_sec -= timeval2.tv_sec;
-
-	return result;
-}
-
-bool NetLinkWrapper::sendPacket() {
-	size_t packetsize;
-	while( m_nsend < m_maxPacketSize) {
-		m_nsend ++;
-		m_icmp_seq ++;
-		packetsize = packIcmp(m_icmp_seq, (struct icmp*)m_sendpacket);
-
-		if (sendto(m_sockfd,m_sendpacket, packetsize, 0, (struct sockaddr *) &m_dest_addr, sizeof(m_dest_addr)) < 0) {
-			APP_ERROR("Ping sendto failed:%s.", strerror(errno));
-			continue;
-		}
-	}
-
-	return true;
-}
-
-bool NetLinkWrapper::recvPacket(PingResult &pingResult) {
-	int len = 0;
-	struct IcmpEchoReply icmpEchoReply;
-	int maxfds = m_sockfd + 1;
-	int nfd	 = 0;
-	fd_set rset;
-	struct timeval timeout;
-	socklen_t fromlen = sizeof(m_from_addr);
-
-	timeout.tv_sec = MAX_WAIT_TIME;
-	timeout.tv_usec = 0;
-
-	FD_ZERO(&rset);
-
-	for (int recvCount = 0; recvCount < m_maxPacketSize; recvCount ++) {
-		FD_SET(m_sockfd, &rset);
-		if ((nfd = select(maxfds, &rset, nullptr, nullptr, &timeout)) == -1) {
-			APP_ERROR("Ping recv select failed:%s.", strerror(errno));
-			continue;
-		}
-
-		if (nfd == 0) {
-			icmpEchoReply.isReply = false;
-			pingResult.icmpEchoReplys.push_back(icmpEchoReply);
-			continue;
-		}
-
-		if (FD_ISSET(m_sockfd, &rset)) {
-			if ((len = recvfrom(m_sockfd,
-								m_recvpacket,
-								sizeof(m_recvpacket),
-								0,
-								(struct sockaddr *)&m_from_addr,
-								&fromlen)) <0) {
-				if(errno == EINTR) {
-					continue;
-				}
-				APP_ERROR("Ping recvfrom failed: %s.", strerror(errno));
-				continue;
-			}
-
-			icmpEchoReply.fromAddr = inet_ntoa(m_from_addr.sin_addr) ;
-			if (strncmp(icmpEchoReply.fromAddr.c_str(), pingResult.ip, strlen(pingResult.ip)) != 0) {
-				recvCount--;
-				continue;
-			}
-		}
-
-		if (!unpackIcmp(m_recvpacket, len, &icmpEchoReply)) {
-			recvCount--;
-			continue;
-		}
-
-		icmpEchoReply.isReply = true;
-		pingResult.icmpEchoReplys.push_back(icmpEchoReply);
-		m_nreceived ++;
-	}
-
-	return true;
-
-}
-
-bool NetLinkWrapper::getsockaddr(const char * hostOrIp, struct sockaddr_in* sockaddr) {
-	struct hostent *host;
-	struct sockaddr_in dest_addr;
-	unsigned long inaddr = 0l;
-
-	bzero(&dest_addr,sizeof(dest_addr));
-	dest_addr.sin_family = AF_INET;
-
-	inaddr = inet_addr(hostOrIp);
-	if (inaddr == INADDR_NONE) {
-		host = gethostbyname(hostOrIp);
-		if (host == nullptr) {
-			return false;
-		}
-		memcpy( (char *)&dest_addr.sin_addr,host->h_addr, host->h_length);
-	} else if (!inet_aton(hostOrIp, &dest_addr.sin_addr)) {
-		return false;
-	}
-
-	*sockaddr = dest_addr;
-
-	return true;
-}
-
-bool NetLinkWrapper::ping(string host, int count, PingResult& pingResult) {
-	int size = 50 * 1024;
-	IcmpEchoReply icmpEchoReply;
-
-	m_nsend = 0;
-	m_nreceived = 0;
-	pingResult.icmpEchoReplys.clear();
-	m_maxPacketSize = count;
-	m_pid = getpid();
-
-	pingResult.dataLen = m_datalen;
-
-	if ((m_sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) < 0) {
-		APP_ERROR("Ping socket failed:%s.", strerror(errno));
-		pingResult.error = strerror(errno);
-		return false;
-	}
-
-	if (setsockopt(m_sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0) {
-		APP_ERROR("Setsockopt SO_RCVBUF failed:%s.", strerror(errno));
-		close(m_sockfd);
-		return false;
-	}
-
-	if (!getsockaddr(host.c_str(), &m_dest_addr)) {
-		pingResult.error = "unknow host " + host;
-		close(m_sockfd);
-		return false;
-	}
-
-	strcpy(pingResult.ip, inet_ntoa(m_dest_addr.sin_addr));
-
-	sendPacket();
-	recvPacket(pingResult);
-
-	pingResult.nsend = m_nsend;
-	pingResult.nreceived = m_nreceived;
-
-	close(m_sockfd);
-
-	return true;
-}
-
 bool NetLinkWrapper::ping_network(bool wakeupTrigger) {
-	string hostOrIp = PING_DEST_HOST1;
-	int nsend = 0, nreceived = 0;
+	icmp_probe_t probes[2];
+	int nreceived;
 	bool ret;
-	PingResult pingResult;
 	InternetConnectivity networkResult = UNAVAILABLE;
 
 	pthread_mutex_lock(&m_ping_lock);
 
-	for (int count = 1; count <= MAX_PACKETS_COUNT; count ++) {
-		memset(&pingResult.ip, 0x0, 32);
-		ret = ping(hostOrIp, 1, pingResult);
-
-		if (!ret) {
-			APP_ERROR("Ping error:%s", pingResult.error.c_str());
-		} else {
-			nsend += pingResult.nsend;
-			nreceived += pingResult.nreceived;
-			if (nreceived > 0)
-				break;
-		}
+	/* both hosts at once: the first answer from either settles it */
+	icmp_probe_target_init(&probes[0], PING_DEST_HOST1);
+	icmp_probe_target_init(&probes[1], PING_DEST_HOST2);
+	nreceived = icmp_probe_run(probes, 2, ICMP_PROBE_COUNT, ICMP_PROBE_TIMEOUT_MS, true);
+	if (nreceived < 0)
+		APP_ERROR("Ping error: no icmp socket");
 
-		if (count == 2) {
-			hostOrIp = PING_DEST_HOST2;
-		}
-	}
+	for (int i = 0; i < 2; i++)
+		APP_DEBUG("ping %s: sent %d recv %d rtt %d/%d/%d us",
+				  probes[i].host, probes[i].sent, probes[i].received,
+				  probes[i].rtt_min_us, probes[i].rtt_avg_us, probes[i].rtt_max_us);
 
 	if (nreceived > 0) {
 		ret = true;
 		networkResult = AVAILABLE;
 		if (m_network_status == (int)UNAVAILABLE) {
-			m_ping_interval = 1;
-		} else {
-			if (m_ping_interval < MAX_PING_INTERVAL) {
-				m_ping_interval = m_ping_interval * 2;
-				if (m_ping_interval > MAX_PING_INTERVAL) {
-					m_ping_interval = MAX_PING_INTERVAL;
-				}
-			}
+			m_check_interval = 1;
+		} else if (m_check_interval < MAX_PING_INTERVAL) {
+			m_check_interval = std::min(m_check_interval * 2, MAX_PING_INTERVAL);
 		}
 		m_network_status = 1;
 	} else {
 		ret = false;
 		networkResult = UNAVAILABLE;
+		if (m_network_status == (int)AVAILABLE) {
+			m_check_interval = 1;
+		} else if (m_check_interval < MAX_OFFLINE_PING_INTERVAL) {
+			m_check_interval = std::min(m_check_interval * 2, MAX_OFFLINE_PING_INTERVAL);
+		}
 		m_network_status = 0;
-		m_ping_interval = 1;
 	}
 
 	network_status_changed(networkResult, wakeupTrigger);
@@ -34,6 +34,7 @@
 #include "rapidjson/prettywriter.h"
 #include <DeviceIo/Rk_wifi.h>
 #include "TcpServer.h"
+#include "../wifi/scan_result_json.h"
 
 #define REQUEST_WIFI_LIST					"/provision/wifiListInfo"
 #define REQUEST_WIFI_SET_UP					"/provision/wifiSetup"
@@ -130,33 +131,27 @@ static bool sendWifiList(const int fd, const char* buf) {
 	std::list<ScanResult*> scanResults;
 	std::list<ScanResult*>::iterator iterator;
 	char msg[MSG_BUFF_LEN] = {0};
-	size_t i, size = 0;
-	std::string json;
-	json = "{\"type\":\"WifiList\", \"content\":[";
+	rapidjson::StringBuffer json;
+	ScanResultWriter writer(json);
 
 	wifiManager = WifiManager::getInstance();
 
-scan_retry:
-	wifiManager->startScan();
-	sleep(1);
+	/* served from the scan cache, which rescans in the background when stale */
 	scanResults = wifiManager->getScanResults();
 
-	size = scanResults.size();
-	if(size <= 0)
-		goto scan_retry;
-
-	for (iterator = scanResults.begin(), i = 0; iterator != scanResults.end(); iterator++, i++) {
-		ScanResult* item = *iterator;
-		json += item->toString();
-
-		if (i < size - 1) {
-			json += ", ";
-		}
+	writer.StartObject();
+	writer.Key("type");
+	writer.String("WifiList");
+	writer.Key("content");
+	writer.StartArray();
+	for (iterator = scanResults.begin(); iterator != scanResults.end(); iterator++) {
+		writeScanResult(writer, *iterator);
+		delete *iterator;
 	}
+	writer.EndArray();
+	writer.EndObject();
 
-	json += "]}";
-
-	snprintf(msg, sizeof(msg), HTTP_RESPOSE_MESSAGE, strlen(json.c_str()), json.c_str());
+	snprintf(msg, sizeof(msg), HTTP_RESPOSE_MESSAGE, (int) json.GetSize(), json.GetString());
 	if (send(fd, msg, sizeof(msg), 0) < 0) {
 		return false;
 	}
@@ -20,13 +20,18 @@
  * SOFTWARE.
  */
 #include <mutex>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/prctl.h>
 #include <unistd.h>
+#include <wpa_ctrl.h>
 #include "rapidjson/rapidjson.h"
 #include "rapidjson/document.h"
 #include "rapidjson/filereadstream.h"
@@ -41,8 +46,25 @@ const char* MSG_WIFI_CONNECTED = "{\"method\":\"softAP\", \"magic\":\"KugouMusic
 const char* MSG_WIFI_FAILED = "{\"method\":\"softAP\", \"magic\":\"KugouMusic\", \"params\":\"wifi_failed\"}";
 const char* MSG_WIFI_LIST_FORMAT = "{\"method\":\"softAP\", \"magic\":\"KugouMusic\", \"params\":{\"wifilist\":%s}}";
 
+/* broadcast intervals in ms, picked by provisioning state */
+#define BROADCAST_RESULT_MS		500		/* result waiting for the phone's ack */
+#define BROADCAST_ACTIVE_MS		1000	/* advertising or connecting */
+#define BROADCAST_IDLE_MS		4000	/* advertising, nobody has talked to us */
+#define BROADCAST_IDLE_AFTER	30		/* active broadcasts before backing off */
+
+#define CONNECT_TIMEOUT_S		60
+#define WPA_MONITOR_PATH		"/var/run/wpa_supplicant/wlan0"
+
 namespace DeviceIOFramework {
 
+enum {
+	EV_REQUEST = 1,
+	EV_BROADCAST,
+	EV_CONNECT_TIMER,
+	EV_WPA_MONITOR,
+	EV_WAKE,
+};
+
 static std::string m_broadcastMsg = "";
 static bool m_isConnecting = false;
 static RK_SOFTAP_STATE_CALLBACK m_cb = NULL;
@@ -50,6 +72,16 @@ static int m_fd_broadcast = -1;
 static sockaddr_in m_addrto;
 static RK_SOFTAP_STATE m_state = RK_SOFTAP_STATE_IDLE;
 
+/* everything below is only touched by the loop thread, apart from m_fd_wake */
+static int m_fd_epoll = -1;
+static int m_fd_broadcast_timer = -1;
+static int m_fd_connect_timer = -1;
+static int m_fd_wake = -1;
+static int m_broadcast_interval = 0;
+static int m_broadcast_count = 0;
+static int m_connect_polls = 0;
+static struct wpa_ctrl* m_wpa_monitor = NULL;
+
 UdpServer* UdpServer::m_instance;
 UdpServer* UdpServer::getInstance() {
 	if (m_instance == NULL) {
@@ -65,14 +97,13 @@ UdpServer* UdpServer::getInstance() {
 
 UdpServer::UdpServer() {
 	m_wifiManager = WifiManager::getInstance();
-	m_thread_broadcast = -1;
 	m_thread = 0;
 	m_fd_broadcast = -1;
 	m_state = RK_SOFTAP_STATE_IDLE;
 }
 
 bool UdpServer::isRunning() {
-	return (m_thread >= 0);
+	return (m_thread > 0);
 }
 
 static void sendState(RK_SOFTAP_STATE state, const char* data) {
@@ -85,7 +116,7 @@ static int initSocket(const unsigned int port) {
 	struct sockaddr_in server_addr;
 
 	/* create a socket */
-	fd_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	fd_socket = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
 	if (fd_socket < 0) {
 		return -1;
 	}
@@ -106,29 +137,177 @@ static int initSocket(const unsigned int port) {
 	return fd_socket;
 }
 
-void* checkWifi(void *arg) {
-	printf("Wifi check thread start...\n");
-	WifiManager* wifiManager = WifiManager::getInstance();
+static int initBroadcastSocket(const unsigned int port) {
+	int sock, ret;
+	const int opt = 1;
 
-	prctl(PR_SET_NAME,"checkWifi");
+	bzero(&m_addrto, sizeof(struct sockaddr_in));
+	m_addrto.sin_family = AF_INET;
+	m_addrto.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+	m_addrto.sin_port = htons(port);
 
-	bool ret = false;
-	int time;
-	for (time = 0; time < 60; time++) {
-		if (wifiManager->isWifiConnected()) {
-			ret = true;
-			break;
-		}
-		sleep(1);
+	if ((sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+		printf("create udp broadcast socket of port %d failed. error:%d\n", port, sock);
+		return -1;
+	}
+
+	ret = setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (char *)&opt, sizeof(opt));
+	if (ret < 0) {
+		printf("udp broadcast setsockopt failed. error:%d\n", ret);
+		close(sock);
+		return -2;
 	}
 
-	m_broadcastMsg = (ret ? MSG_WIFI_CONNECTED : MSG_WIFI_FAILED);
+	return sock;
+}
+
+static int epollAdd(int fd, int tag) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = tag;
+	return epoll_ctl(m_fd_epoll, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void armTimer(int fd, int ms, bool repeat) {
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000;
+	if (repeat)
+		its.it_interval = its.it_value;
+	timerfd_settime(fd, 0, &its, NULL);
+}
+
+static void sendBroadcast() {
+	int ret;
+
+	if (m_broadcastMsg.empty() || m_fd_broadcast < 0)
+		return;
+
 	printf("UDP broadcast sendto \"%s\"\n", m_broadcastMsg.c_str());
-	sendto(m_fd_broadcast, m_broadcastMsg.c_str(), strlen(m_broadcastMsg.c_str()), 0,
+	ret = sendto(m_fd_broadcast, m_broadcastMsg.c_str(), m_broadcastMsg.size(), 0,
 			(struct sockaddr*)&m_addrto, sizeof(m_addrto));
+	if (ret < 0)
+		printf("udp send broadcast failed. error:%d\n", ret);
+}
+
+/*
+ * Switch what we broadcast and how often. The message goes out at once,
+ * then periodically; an empty message stops broadcasting.
+ */
+static void setBroadcast(const std::string& msg, int interval_ms) {
+	m_broadcastMsg = msg;
+	m_broadcast_count = 0;
+	m_broadcast_interval = msg.empty() ? 0 : interval_ms;
+
+	sendBroadcast();
+	armTimer(m_fd_broadcast_timer, m_broadcast_interval, true);
+}
+
+static void onBroadcastTimer() {
+	uint64_t expirations;
+
+	if (read(m_fd_broadcast_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	sendBroadcast();
+
+	/* nobody is provisioning us, slow the advertisement down */
+	if (m_broadcastMsg == MSG_BROADCAST_AP_MODE && m_broadcast_interval == BROADCAST_ACTIVE_MS
+			&& ++m_broadcast_count >= BROADCAST_IDLE_AFTER) {
+		m_broadcast_interval = BROADCAST_IDLE_MS;
+		armTimer(m_fd_broadcast_timer, m_broadcast_interval, true);
+	}
+}
+
+static void stopConnectWatch() {
+	if (m_wpa_monitor) {
+		epoll_ctl(m_fd_epoll, EPOLL_CTL_DEL, wpa_ctrl_get_fd(m_wpa_monitor), NULL);
+		wpa_ctrl_detach(m_wpa_monitor);
+		wpa_ctrl_close(m_wpa_monitor);
+		m_wpa_monitor = NULL;
+	}
+	armTimer(m_fd_connect_timer, 0, false);
+}
+
+/*
+ * Attach to the supplicant before connecting so that the completion event
+ * can't slip past us. Without a monitor we fall back to polling once a second.
+ */
+static void startConnectWatch() {
+	stopConnectWatch();
+
+	m_wpa_monitor = wpa_ctrl_open(WPA_MONITOR_PATH);
+	if (m_wpa_monitor && wpa_ctrl_attach(m_wpa_monitor) != 0) {
+		wpa_ctrl_close(m_wpa_monitor);
+		m_wpa_monitor = NULL;
+	}
+
+	if (m_wpa_monitor) {
+		epollAdd(wpa_ctrl_get_fd(m_wpa_monitor), EV_WPA_MONITOR);
+		armTimer(m_fd_connect_timer, CONNECT_TIMEOUT_S * 1000, false);
+	} else {
+		printf("UdpServer: no wpa monitor, poll wifi state instead\n");
+		m_connect_polls = 0;
+		armTimer(m_fd_connect_timer, 1000, true);
+	}
+}
+
+static void finishConnect(bool connected) {
+	stopConnectWatch();
 	m_isConnecting = false;
-	printf("Wifi connect result %d\n", ret ? 1 : 0);
-	return NULL;
+	setBroadcast(connected ? MSG_WIFI_CONNECTED : MSG_WIFI_FAILED, BROADCAST_RESULT_MS);
+	printf("Wifi connect result %d\n", connected ? 1 : 0);
+}
+
+static void onConnectTimer() {
+	uint64_t expirations;
+
+	if (read(m_fd_connect_timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	if (!m_isConnecting)
+		return;
+
+	if (m_wpa_monitor) {
+		finishConnect(false);
+		return;
+	}
+
+	/* isWifiConnected also saves the new network once it completes */
+	m_connect_polls += expirations;
+	if (WifiManager::getInstance()->isWifiConnected())
+		finishConnect(true);
+	else if (m_connect_polls >= CONNECT_TIMEOUT_S)
+		finishConnect(false);
+}
+
+static void onWpaEvent() {
+	char event[512];
+	size_t len;
+
+	while (m_wpa_monitor && wpa_ctrl_pending(m_wpa_monitor) > 0) {
+		len = sizeof(event) - 1;
+		if (wpa_ctrl_recv(m_wpa_monitor, event, &len) < 0)
+			break;
+		event[len] = '\0';
+
+		if (!m_isConnecting)
+			continue;
+
+		if (strstr(event, WPA_EVENT_CONNECTED)) {
+			if (WifiManager::getInstance()->isWifiConnected())
+				finishConnect(true);
+		} else if (strstr(event, "reason=WRONG_KEY")) {
+			printf("UdpServer: wrong key, give up\n");
+			finishConnect(false);
+		} else if (strstr(event, WPA_EVENT_TERMINATING)) {
+			finishConnect(false);
+		}
+	}
 }
 
 static void handleRequest(const char* buff) {
@@ -152,11 +331,11 @@ static void handleRequest(const char* buff) {
 
 			para = params.GetString();
 			if (0 == strcmp(para.c_str(), "wifi_connected")) {
-				m_broadcastMsg = "";
+				setBroadcast("", 0);
 				sendState(RK_SOFTAP_STATE_SUCCESS, NULL);
 				m_state = RK_SOFTAP_STATE_SUCCESS;
 			} else if (0 == strcmp(para.c_str(), "wifi_failed")) {
-				m_broadcastMsg = "";
+				setBroadcast("", 0);
 				sendState(RK_SOFTAP_STATE_FAIL, NULL);
 				m_state = RK_SOFTAP_STATE_FAIL;
 			}
@@ -173,21 +352,8 @@ static void handleRequest(const char* buff) {
 
 			if (0 == strcmp(cmd.c_str(), "getWifilists")) {
 				char *wifilist;
-				m_broadcastMsg = "";
-
-				system("rm -rf /tmp/scan_r");
-				RK_wifi_scan();
-				int i = 0;
-				FILE *fi;
-				while (i < 3) {
-					fi = fopen("/tmp/scan_r", "rb");
-					if (fi) {
-						fclose(fi);
-						break;
-					}
-					i--;
-					sleep(1);
-				}
+
+				/* answered from the scan cache, a stale list triggers a rescan itself */
 				wifilist = RK_wifi_scan_r_sec(0x14);
 
 				printf("handle getWifilists: \"%s\"\n", wifilist);
@@ -197,9 +363,9 @@ static void handleRequest(const char* buff) {
 
 					snprintf(tmp, sizeof(tmp), MSG_WIFI_LIST_FORMAT, wifilist);
 
-					m_broadcastMsg = tmp;
-					sendto(m_fd_broadcast, m_broadcastMsg.c_str(), strlen(m_broadcastMsg.c_str()), 0,
-						(struct sockaddr*)&m_addrto, sizeof(m_addrto));
+					setBroadcast(tmp, BROADCAST_ACTIVE_MS);
+				} else {
+					setBroadcast("", 0);
 				}
 				free(wifilist);
 			}
@@ -215,137 +381,138 @@ static void handleRequest(const char* buff) {
 			}
 			printf("do connect ssid:\"%s\", psk:\"%s\", isConnecting:%d\n", ssid.c_str(), passwd.c_str(), m_isConnecting);
 			if (!m_isConnecting && !ssid.empty()) {
-				m_broadcastMsg = MSG_WIFI_CONNECTING;
-				printf("UDP broadcast sendto \"%s\"\n", m_broadcastMsg.c_str());
-				sendto(m_fd_broadcast, m_broadcastMsg.c_str(), strlen(m_broadcastMsg.c_str()), 0,
-						(struct sockaddr*)&m_addrto, sizeof(m_addrto));
+				setBroadcast(MSG_WIFI_CONNECTING, BROADCAST_ACTIVE_MS);
 				sendState(RK_SOFTAP_STATE_CONNECTTING, userdata.c_str());
 				m_state = RK_SOFTAP_STATE_CONNECTTING;
+				m_isConnecting = true;
+				startConnectWatch();
 				WifiManager* wifiManager = WifiManager::getInstance();
 				int id = wifiManager->connect(ssid, passwd);
 				if (0 != id) {
 					printf("wifi connect failed %d. ssid:\"%s\", id, psk:\"%s\"\n", id, ssid.c_str(), passwd.c_str());
-					m_broadcastMsg = MSG_WIFI_FAILED;
-					sendto(m_fd_broadcast, m_broadcastMsg.c_str(), strlen(m_broadcastMsg.c_str()), 0,
-							(struct sockaddr*)&m_addrto, sizeof(m_addrto));
+					stopConnectWatch();
+					setBroadcast(MSG_WIFI_FAILED, BROADCAST_RESULT_MS);
 					sendState(RK_SOFTAP_STATE_FAIL, NULL);
 					m_state = RK_SOFTAP_STATE_FAIL;
 					m_isConnecting = false;
 					return;
 				}
-				m_isConnecting = true;
-				pthread_t pid;
-				pthread_create(&pid, NULL, checkWifi, NULL);
-				pthread_detach(pid);
 			}
 		}
 	}
 }
 
-void* UdpServer::threadAccept(void *arg) {
-	int fd_server, port;
+static void onRequest(int fd_server) {
 	struct sockaddr_in addr_client;
-	socklen_t len_addr_client;
-	len_addr_client = sizeof(addr_client);
+	socklen_t len_addr_client = sizeof(addr_client);
 	char buff[512 + 1];
 	int n;
 
-	prctl(PR_SET_NAME,"udp threadAccept");
-
-	port = *(int*) arg;
-	fd_server = initSocket(port);
-
-	if (fd_server < 0) {
-		printf("UdpServer::threadAccept init tcp socket port %d fail. error:%d\n", port, fd_server);
-		goto end;
-	}
-
-	/* Recv from all time */
-	while (1) {
-		memset(buff, 0, sizeof(buff));
-		n = recvfrom(fd_server, buff, sizeof(buff) - 1, 0, (struct sockaddr*)&addr_client, &len_addr_client);
-		if (n < 0)
-			goto end;
-
-		printf("UDP broadcast recvfrom \"%s\"\n", buff);
-		handleRequest(buff);
-	}
-
-end:
-	if (fd_server >= 0)
-		close(fd_server);
-	m_instance->m_thread = 0;
+	memset(buff, 0, sizeof(buff));
+	n = recvfrom(fd_server, buff, sizeof(buff) - 1, MSG_DONTWAIT, (struct sockaddr*)&addr_client, &len_addr_client);
+	if (n <= 0)
+		return;
 
-	return NULL;
+	printf("UDP broadcast recvfrom \"%s\"\n", buff);
+	handleRequest(buff);
 }
 
-int UdpServer::startUdpServer(const unsigned int port) {
-	int ret;
-
-	startBroadcastThread();
-
-	m_port = port;
-	ret = pthread_create(&m_thread, NULL, threadAccept, &m_port);
-	if (0 != ret) {
-		m_thread = 0;
+static void closeFd(int* fd) {
+	if (*fd >= 0) {
+		close(*fd);
+		*fd = -1;
 	}
-	return ret;
 }
 
-void* UdpServer::threadBroadcast(void* arg) {
-	int sock, port, ret;
-	const int opt = 1;
-	struct sockaddr_in addrto;
-
-	prctl(PR_SET_NAME,"udp threadBroadcast");
+void* UdpServer::threadLoop(void *arg) {
+	UdpServer* server = (UdpServer*) arg;
+	struct epoll_event events[8];
+	int fd_server = -1;
+	bool running = true;
+	int i, n;
 
-	port = *(int*) arg;
-	bzero(&addrto, sizeof(struct sockaddr_in));
-	addrto.sin_family = AF_INET;
-	addrto.sin_addr.s_addr = htonl(INADDR_BROADCAST);
-	addrto.sin_port = htons(port);
+	prctl(PR_SET_NAME,"udp threadLoop");
 
-	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-		printf("create udp broadcast socket of port %d failed. error:%d\n", port, sock);
+	fd_server = initSocket(server->m_port);
+	if (fd_server < 0) {
+		printf("UdpServer::threadLoop init udp socket port %d fail. error:%d\n", server->m_port, fd_server);
 		goto end;
 	}
-	m_fd_broadcast = sock;
-	m_addrto = addrto;
 
-	ret = setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (char *)&opt, sizeof(opt));
-	if (ret < 0) {
-		printf("udp broadcast setsockopt failed. error:%d\n", ret);
+	m_fd_broadcast = initBroadcastSocket(server->m_port_broadcast);
+	m_fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+	m_fd_broadcast_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	m_fd_connect_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (m_fd_broadcast < 0 || m_fd_epoll < 0 || m_fd_broadcast_timer < 0 || m_fd_connect_timer < 0) {
+		printf("UdpServer::threadLoop init failed\n");
 		goto end;
 	}
 
-	m_broadcastMsg = MSG_BROADCAST_AP_MODE;
-	while (true) {
-		if (!m_broadcastMsg.empty()) {
-			printf("UDP broadcast sendto \"%s\"\n", m_broadcastMsg.c_str());
-			ret = sendto(sock, m_broadcastMsg.c_str(), m_broadcastMsg.size(), 0, (struct sockaddr*)&addrto, sizeof(addrto));
-			if (ret < 0) {
-				printf("udp send broadcast failed. error:%d\n", ret);
+	epollAdd(fd_server, EV_REQUEST);
+	epollAdd(m_fd_broadcast_timer, EV_BROADCAST);
+	epollAdd(m_fd_connect_timer, EV_CONNECT_TIMER);
+	epollAdd(m_fd_wake, EV_WAKE);
+
+	setBroadcast(MSG_BROADCAST_AP_MODE, BROADCAST_ACTIVE_MS);
+
+	while (running) {
+		n = epoll_wait(m_fd_epoll, events, sizeof(events) / sizeof(events[0]), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			switch (events[i].data.u32) {
+			case EV_REQUEST:
+				onRequest(fd_server);
+				break;
+			case EV_BROADCAST:
+				onBroadcastTimer();
+				break;
+			case EV_CONNECT_TIMER:
+				onConnectTimer();
+				break;
+			case EV_WPA_MONITOR:
+				onWpaEvent();
+				break;
+			case EV_WAKE:
+				running = false;
+				break;
 			}
 		}
-		sleep(1);
 	}
 
 end:
-	if (sock >= 0)
-		close(sock);
-	m_fd_broadcast = -1;
-	m_instance->m_thread_broadcast = -1;
+	stopConnectWatch();
+	m_broadcastMsg = "";
+	m_isConnecting = false;
+	closeFd(&fd_server);
+	closeFd(&m_fd_broadcast);
+	closeFd(&m_fd_broadcast_timer);
+	closeFd(&m_fd_connect_timer);
+	closeFd(&m_fd_epoll);
 
 	return NULL;
 }
 
-int UdpServer::startBroadcastThread(const unsigned int port) {
+int UdpServer::startUdpServer(const unsigned int port, const unsigned int broadcastPort) {
 	int ret;
 
-	m_port_broadcast = port;
-	ret = pthread_create(&m_thread_broadcast, NULL, threadBroadcast, &m_port_broadcast);
+	if (m_thread > 0)
+		return 0;
+
+	m_fd_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_fd_wake < 0)
+		return -1;
+
+	m_port = port;
+	m_port_broadcast = broadcastPort;
+	ret = pthread_create(&m_thread, NULL, threadLoop, this);
 	if (0 != ret) {
-		m_thread_broadcast = -1;
+		m_thread = 0;
+		closeFd(&m_fd_wake);
 	}
 	return ret;
 }
@@ -358,35 +525,20 @@ RK_SOFTAP_STATE UdpServer::getState() {
 	return m_state;
 }
 
-int UdpServer::stopBroadcastThread() {
-	if (m_thread_broadcast < 0)
-		return 0;
-
-	if (0 != pthread_cancel(m_thread_broadcast)) {
-		return -1;
-	}
-
-	if (0 != pthread_join(m_thread_broadcast, NULL)) {
-		return -1;
-	}
-
-	m_thread_broadcast = -1;
-	return 0;
-}
-
 int UdpServer::stopUdpServer() {
-	stopBroadcastThread();
+	uint64_t one = 1;
+
 	if (m_thread <= 0)
 		return 0;
 
-	if (0 != pthread_cancel(m_thread)) {
+	if (write(m_fd_wake, &one, sizeof(one)) != sizeof(one))
 		return -1;
-	}
 
 	if (0 != pthread_join(m_thread, NULL)) {
 		return -1;
 	}
 
+	closeFd(&m_fd_wake);
 	m_thread = 0;
 	return 0;
 }
@@ -37,9 +37,7 @@ public:
 	 */
 	static UdpServer* getInstance();
 	bool isRunning();
-	int startUdpServer(const unsigned int port = 9877);
-	int startBroadcastThread(const unsigned int port = 9876);
-	int stopBroadcastThread();
+	int startUdpServer(const unsigned int port = 9877, const unsigned int broadcastPort = 9876);
 	int stopUdpServer();
 	void registerCallback(RK_SOFTAP_STATE_CALLBACK cb);
 	RK_SOFTAP_STATE getState();
@@ -50,13 +48,12 @@ private:
 	UdpServer(const UdpServer&){};
 	UdpServer& operator=(const UdpServer&){return *this;};
 
-	static void* threadAccept(void* arg);
-	static void* threadBroadcast(void* arg);
+	/* one epoll loop serves requests, broadcasts and wifi events */
+	static void* threadLoop(void* arg);
 
 	/* UdpServer single instance */
 	static UdpServer* m_instance;
 	pthread_t m_thread;
-	pthread_t m_thread_broadcast;
 	int m_port;
 	int m_port_broadcast;
 	WifiManager* m_wifiManager;
@@ -7,6 +7,7 @@
 #include <sys/wait.h>
 
 #include "Logger.h"
+#include "utility.h"
 
 static char *spec_char_convers(const char *buf, char *dst)
 {
@@ -153,24 +154,5 @@ bool Shell::system(const char *cmd) {
 }
 
 int Shell::pidof(const char *Name) {
-    int len;
-    char name[32] = {0};
-    len = strlen(Name);
-    strncpy(name,Name,len);
-    name[31] ='\0';
-    char cmdresult[256] = {0};
-    char cmd[64] = {0};
-    FILE *pFile = NULL;
-    int  pid = 0;
-
-    sprintf(cmd, "pidof %s", name);
-    pFile = popen(cmd, "r");
-    if (pFile != NULL)  {
-        while (fgets(cmdresult, sizeof(cmdresult), pFile)) {
-            pid = atoi(cmdresult);
-            break;
-        }
-        pclose(pFile);
-    }
-    return pid;
+    return get_ps_pid(Name);
 }
@@ -0,0 +1,478 @@
+#include <pthread.h>
+#include <poll.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "alsa/asoundlib.h"
+
+#include "softvol.h"
+
+#define SOFTVOL_MAX_POLLFDS		4
+#define SOFTVOL_RETRY_MS		1000		// between attempts to subscribe to a card that isn't there
+
+extern char **environ;
+
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+static snd_ctl_t *m_handle = NULL;
+static snd_ctl_elem_info_t *m_info = NULL;
+static snd_ctl_elem_value_t *m_value = NULL;
+
+static pthread_once_t m_thread_once = PTHREAD_ONCE_INIT;
+static pthread_t m_thread_tid;
+static bool m_thread_running = false;
+static bool m_thread_exit = false;
+static int m_wake[2] = { -1, -1 };
+
+/* the volume as the control events tell it, valid while subscribed */
+static bool m_cache_valid = false;
+static int m_cache_volume;
+static int m_notified_volume;
+static RK_audio_volume_callback m_listeners[SOFTVOL_MAX_LISTENERS];
+static int m_listener_count = 0;
+
+static bool m_store_pending = false;
+static uint64_t m_store_first, m_store_last;	// ms, first and last change since the last store
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int volume_of(snd_ctl_elem_value_t *value)
+{
+	return (snd_ctl_elem_value_get_integer(value, 0) + snd_ctl_elem_value_get_integer(value, 1)) >> 1;
+}
+
+/* find the element on handle, fill info and value's id */
+static int elem_lookup(snd_ctl_t *handle, snd_ctl_elem_info_t *info, snd_ctl_elem_value_t *value)
+{
+	snd_ctl_elem_id_t *id;
+	int err;
+
+	snd_ctl_elem_id_alloca(&id);
+	if (snd_ctl_ascii_elem_id_parse(id, SOFTVOL_ELEM)) {
+		fprintf(stderr, "Wrong control identifier: %s\n", SOFTVOL_ELEM);
+		return -EINVAL;
+	}
+
+	snd_ctl_elem_info_set_id(info, id);
+	if ((err = snd_ctl_elem_info(handle, info)) < 0)
+		return err;
+	snd_ctl_elem_info_get_id(info, id);     /* FIXME: Remove it when hctl find works ok !!! */
+	snd_ctl_elem_value_set_id(value, id);
+
+	return 0;
+}
+
+static void ctl_drop(void)
+{
+	if (m_handle) {
+		snd_ctl_close(m_handle);
+		m_handle = NULL;
+	}
+}
+
+/* open the card and find the element, unless that's done already */
+static int ctl_open(void)
+{
+	int err;
+
+	if (m_handle)
+		return 0;
+
+	if (!m_info && (snd_ctl_elem_info_malloc(&m_info) < 0 || snd_ctl_elem_value_malloc(&m_value) < 0))
+		return -ENOMEM;
+
+	if ((err = snd_ctl_open(&m_handle, SOFTVOL_CARD, 0)) < 0) {
+		printf("Control %s open error: %d\n", SOFTVOL_CARD, err);
+		m_handle = NULL;
+		return err;
+	}
+
+	if ((err = elem_lookup(m_handle, m_info, m_value)) < 0) {
+		printf("Cannot find the given element from control %s\n", SOFTVOL_CARD);
+		ctl_drop();
+		return err;
+	}
+
+	return 0;
+}
+
+static void store(void)
+{
+	char *const argv[] = { (char *)"alsactl", (char *)"store", (char *)"--file=" SOFTVOL_STATE_FILE, NULL };
+	pid_t pid;
+	int status;
+
+	if (posix_spawnp(&pid, "alsactl", NULL, NULL, argv, environ) != 0) {
+		printf("%s: spawn alsactl failed\n", __func__);
+		return;
+	}
+	waitpid(pid, &status, 0);
+}
+
+/* ms until the pending store is due, -1 if there's none */
+static int store_timeout(void)
+{
+	uint64_t due, now;
+
+	if (!m_store_pending)
+		return -1;
+
+	due = m_store_last + SOFTVOL_STORE_DELAY_MS;
+	if (due > m_store_first + SOFTVOL_STORE_MAX_MS)
+		due = m_store_first + SOFTVOL_STORE_MAX_MS;
+	now = now_ms();
+
+	return now < due ? (int)(due - now) : 0;
+}
+
+/*
+ * The thread's own subscribed handle, and its copy of the element.
+ * numid is 0 while the element isn't known on it.
+ */
+typedef struct {
+	snd_ctl_t *handle;
+	snd_ctl_elem_info_t *info;
+	snd_ctl_elem_value_t *value;
+	unsigned int numid;
+	uint64_t retry;
+} mirror_t;
+
+/* with m_lock held */
+static void mirror_open(mirror_t *mirror)
+{
+	uint64_t now = now_ms();
+
+	if (mirror->handle || now < mirror->retry)
+		return;
+
+	mirror->retry = now + SOFTVOL_RETRY_MS;
+	if (snd_ctl_open(&mirror->handle, SOFTVOL_CARD, SND_CTL_NONBLOCK) < 0) {
+		mirror->handle = NULL;
+		return;
+	}
+	if (snd_ctl_subscribe_events(mirror->handle, 1) < 0) {
+		printf("%s: subscribe to %s failed\n", __func__, SOFTVOL_CARD);
+		snd_ctl_close(mirror->handle);
+		mirror->handle = NULL;
+	}
+}
+
+/* with m_lock held */
+static void mirror_close(mirror_t *mirror)
+{
+	if (mirror->handle) {
+		snd_ctl_close(mirror->handle);
+		mirror->handle = NULL;
+	}
+	mirror->numid = 0;
+	m_cache_valid = false;
+}
+
+/* with m_lock held: look the element up if need be and read it into the cache */
+static void mirror_update(mirror_t *mirror)
+{
+	if (!mirror->numid) {
+		if (elem_lookup(mirror->handle, mirror->info, mirror->value) < 0)
+			return;		// not there yet, an add event will bring us back
+		mirror->numid = snd_ctl_elem_info_get_numid(mirror->info);
+	}
+
+	if (snd_ctl_elem_read(mirror->handle, mirror->value) < 0) {
+		mirror->numid = 0;
+		m_cache_valid = false;
+		return;
+	}
+
+	m_cache_volume = volume_of(mirror->value);
+	if (!m_cache_valid)
+		m_notified_volume = m_cache_volume;
+	m_cache_valid = true;
+}
+
+/* with m_lock held: take every queued event, update the cache if ours changed */
+static void mirror_read(mirror_t *mirror)
+{
+	snd_ctl_event_t *event;
+	unsigned int mask;
+	bool changed = false;
+	int err;
+
+	snd_ctl_event_alloca(&event);
+	while ((err = snd_ctl_read(mirror->handle, event)) > 0) {
+		if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
+			continue;
+		if (!mirror->numid) {
+			changed = true;
+			continue;
+		}
+		if (snd_ctl_event_elem_get_numid(event) != mirror->numid)
+			continue;
+
+		mask = snd_ctl_event_elem_get_mask(event);
+		if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+			mirror->numid = 0;
+			m_cache_valid = false;
+		} else if (mask & SND_CTL_EVENT_MASK_VALUE) {
+			changed = true;
+		}
+	}
+	if (err < 0 && err != -EAGAIN) {
+		printf("%s: read events from %s failed: %d\n", __func__, SOFTVOL_CARD, err);
+		mirror_close(mirror);
+		return;
+	}
+
+	if (changed)
+		mirror_update(mirror);
+}
+
+/* with m_lock held, which is let go while the listeners run */
+static void notify(void)
+{
+	RK_audio_volume_callback listeners[SOFTVOL_MAX_LISTENERS];
+	int count, volume;
+
+	if (!m_cache_valid || m_cache_volume == m_notified_volume)
+		return;
+
+	volume = m_notified_volume = m_cache_volume;
+	count = m_listener_count;
+	memcpy(listeners, m_listeners, sizeof(listeners));
+
+	pthread_mutex_unlock(&m_lock);
+	for (int i = 0; i < count; i++)
+		listeners[i](volume);
+	pthread_mutex_lock(&m_lock);
+}
+
+static void *softvol_thread(void *arg)
+{
+	struct pollfd pfds[1 + SOFTVOL_MAX_POLLFDS];
+	mirror_t mirror;
+	char buf[16];
+	int nfds, timeout;
+
+	memset(&mirror, 0, sizeof(mirror));
+	snd_ctl_elem_info_malloc(&mirror.info);
+	snd_ctl_elem_value_malloc(&mirror.value);
+
+	pthread_mutex_lock(&m_lock);
+	while (!m_thread_exit) {
+		mirror_open(&mirror);
+		if (mirror.handle && !m_cache_valid)
+			mirror_update(&mirror);
+		notify();
+
+		timeout = store_timeout();
+		if (timeout == 0) {
+			m_store_pending = false;
+			pthread_mutex_unlock(&m_lock);
+			store();
+			pthread_mutex_lock(&m_lock);
+			continue;
+		}
+		/* without a subscription, look again in a while */
+		if (!mirror.handle && (timeout < 0 || timeout > SOFTVOL_RETRY_MS) && m_listener_count)
+			timeout = SOFTVOL_RETRY_MS;
+
+		pfds[0].fd = m_wake[0];
+		pfds[0].events = POLLIN;
+		nfds = 1;
+		if (mirror.handle)
+			nfds += snd_ctl_poll_descriptors(mirror.handle, pfds + 1, SOFTVOL_MAX_POLLFDS);
+
+		pthread_mutex_unlock(&m_lock);
+		poll(pfds, nfds, timeout);
+		if (pfds[0].revents & POLLIN)
+			while (read(m_wake[0], buf, sizeof(buf)) > 0);
+		pthread_mutex_lock(&m_lock);
+
+		if (mirror.handle && nfds > 1)
+			mirror_read(&mirror);
+	}
+	mirror_close(&mirror);
+	pthread_mutex_unlock(&m_lock);
+
+	snd_ctl_elem_info_free(mirror.info);
+	snd_ctl_elem_value_free(mirror.value);
+	return NULL;
+}
+
+static void thread_init(void)
+{
+	/* a change nobody stored yet still makes it to the file */
+	atexit(softvol_ctl_flush);
+}
+
+/* with m_lock held */
+static int thread_start(void)
+{
+	pthread_once(&m_thread_once, thread_init);
+	if (m_thread_running)
+		return 0;
+
+	if (pipe2(m_wake, O_NONBLOCK | O_CLOEXEC) < 0) {
+		printf("%s: create pipe failed\n", __func__);
+		return -1;
+	}
+	m_thread_exit = false;
+	if (pthread_create(&m_thread_tid, NULL, softvol_thread, NULL) != 0) {
+		printf("%s: create softvol thread failed\n", __func__);
+		close(m_wake[0]);
+		close(m_wake[1]);
+		m_wake[0] = m_wake[1] = -1;
+		return -1;
+	}
+	m_thread_running = true;
+
+	return 0;
+}
+
+/* with m_lock held */
+static void thread_wake(void)
+{
+	if (m_thread_running && write(m_wake[1], "", 1) < 0 && errno != EAGAIN)
+		printf("%s: wake softvol thread failed\n", __func__);
+}
+
+/* with m_lock held */
+static void store_schedule(void)
+{
+	uint64_t now = now_ms();
+
+	if (thread_start() < 0) {
+		printf("%s: no softvol thread, storing now\n", __func__);
+		store();
+		return;
+	}
+
+	if (!m_store_pending)
+		m_store_first = now;
+	m_store_last = now;
+	m_store_pending = true;
+	thread_wake();
+}
+
+int softvol_ctl_set(const char *value)
+{
+	int err;
+
+	pthread_mutex_lock(&m_lock);
+	if ((err = ctl_open()) < 0)
+		goto out;
+
+	if ((err = snd_ctl_elem_read(m_handle, m_value)) < 0) {
+		printf("Cannot read the given element from control %s\n", SOFTVOL_CARD);
+		ctl_drop();
+		goto out;
+	}
+	if ((err = snd_ctl_ascii_value_parse(m_handle, m_value, m_info, value)) < 0) {
+		printf("Control %s parse error: %d\n", SOFTVOL_CARD, err);
+		goto out;
+	}
+	if ((err = snd_ctl_elem_write(m_handle, m_value)) < 0) {
+		printf("Control %s element write error: %d; errno: %d\n", SOFTVOL_CARD, err, errno);
+		ctl_drop();
+		goto out;
+	}
+
+	/* the event for it comes later, a get right after must see it already */
+	if (m_cache_valid)
+		m_cache_volume = volume_of(m_value);
+	store_schedule();
+	err = 0;
+out:
+	pthread_mutex_unlock(&m_lock);
+	return err;
+}
+
+int softvol_ctl_get(void)
+{
+	int err;
+
+	pthread_mutex_lock(&m_lock);
+	if (m_cache_valid) {
+		err = m_cache_volume;
+		goto out;
+	}
+
+	/* not subscribed (yet): read it, and have the thread try again */
+	if (thread_start() == 0)
+		thread_wake();
+	if ((err = ctl_open()) < 0)
+		goto out;
+	if ((err = snd_ctl_elem_read(m_handle, m_value)) < 0) {
+		printf("Cannot read the given element from control %s\n", SOFTVOL_CARD);
+		ctl_drop();
+		goto out;
+	}
+	err = volume_of(m_value);
+out:
+	pthread_mutex_unlock(&m_lock);
+	return err;
+}
+
+int softvol_ctl_add_listener(RK_audio_volume_callback cb)
+{
+	int ret = -1;
+
+	if (!cb)
+		return -1;
+
+	pthread_mutex_lock(&m_lock);
+	if (m_listener_count < SOFTVOL_MAX_LISTENERS && thread_start() == 0) {
+		m_listeners[m_listener_count++] = cb;
+		thread_wake();
+		ret = 0;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return ret;
+}
+
+void softvol_ctl_flush(void)
+{
+	bool pending;
+
+	pthread_mutex_lock(&m_lock);
+	pending = m_store_pending;
+	m_store_pending = false;
+	pthread_mutex_unlock(&m_lock);
+
+	if (pending)
+		store();
+}
+
+void softvol_ctl_close(void)
+{
+	bool running;
+
+	pthread_mutex_lock(&m_lock);
+	running = m_thread_running;
+	m_thread_exit = true;
+	m_thread_running = false;
+	if (running)
+		write(m_wake[1], "", 1);
+	pthread_mutex_unlock(&m_lock);
+
+	if (running) {
+		pthread_join(m_thread_tid, NULL);
+		close(m_wake[0]);
+		close(m_wake[1]);
+		m_wake[0] = m_wake[1] = -1;
+	}
+	softvol_ctl_flush();
+
+	pthread_mutex_lock(&m_lock);
+	ctl_drop();
+	pthread_mutex_unlock(&m_lock);
+}
@@ -0,0 +1,44 @@
+#ifndef DEVICEIO_FRAMEWORK_SOFTVOL_H_
+#define DEVICEIO_FRAMEWORK_SOFTVOL_H_
+
+#include "DeviceIo/Rk_audio.h"
+
+#define SOFTVOL_CARD			"default"
+#define SOFTVOL_ELEM			"name='Master Playback Volume'"
+#define SOFTVOL_STATE_FILE		"/data/cfg/asound.state"
+
+/* the state is stored this long after the last change, at the latest this long after the first */
+#define SOFTVOL_STORE_DELAY_MS	1000
+#define SOFTVOL_STORE_MAX_MS	5000
+
+#define SOFTVOL_MAX_LISTENERS	4
+
+/*
+ * The softvol control of SOFTVOL_CARD. The ctl handle and the element
+ * are looked up once and kept until an access fails (the softvol element
+ * only shows up after the first playback), then looked up again on the
+ * next call.
+ *
+ * One thread does the rest: it subscribes to the card's control events
+ * and keeps a copy of the volume, which is what softvol_ctl_get() returns
+ * while the subscription works, and it tells the listeners about every
+ * change. It also stores the mixer state; stores are coalesced into one
+ * "alsactl store" once the volume stops moving.
+ */
+
+/* value as amixer takes it, "50%"; 0 or a negative error */
+int softvol_ctl_set(const char *value);
+
+/* average of the channels in raw units, or a negative error */
+int softvol_ctl_get(void);
+
+/* cb runs on the softvol thread, without any lock held */
+int softvol_ctl_add_listener(RK_audio_volume_callback cb);
+
+/* store now if a store is pending */
+void softvol_ctl_flush(void);
+
+/* flush, stop the thread and drop the handles */
+void softvol_ctl_close(void);
+
+#endif // DEVICEIO_FRAMEWORK_SOFTVOL_H_
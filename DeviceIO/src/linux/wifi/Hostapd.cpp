@@ -1,10 +1,20 @@
+#include <errno.h>
 #include <error.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <string>
+#include <wpa_ctrl.h>
 #include "Hostapd.h"
+#include "netif.h"
+#include "utility.h"
 
 #define DBG true
 
@@ -15,6 +25,58 @@
 #endif
 #define DEBUG_ERR(M, ...) printf("Hostapd %d: " M, __LINE__, ##__VA_ARGS__)
 
+#ifndef AP_EVENT_ENABLED
+#define AP_EVENT_ENABLED "AP-ENABLED "
+#endif
+#ifndef AP_EVENT_DISABLED
+#define AP_EVENT_DISABLED "AP-DISABLED "
+#endif
+#ifndef AP_STA_CONNECTED
+#define AP_STA_CONNECTED "AP-STA-CONNECTED "
+#endif
+#ifndef AP_STA_DISCONNECTED
+#define AP_STA_DISCONNECTED "AP-STA-DISCONNECTED "
+#endif
+
+#define HOSTAPD_CTRL_DIR "/var/run/hostapd"
+#define HOSTAPD_CONF_PATH "/userdata/bin/hostapd.conf"
+#define DNSMASQ_CONF_PATH "/userdata/bin/dnsmasq.conf"
+#define SOFTAP_INTERFACE_STATIC_IP "10.201.126.1"
+/* from launching or reloading hostapd to its AP-ENABLED */
+#define HOSTAPD_ENABLE_TIMEOUT_MS 10000
+/* for the monitor to attach to a hostapd that's already up */
+#define HOSTAPD_ATTACH_TIMEOUT_MS 1000
+
+/* what was last written to path, so unchanged configs aren't rewritten */
+typedef struct {
+	const char *path;
+	bool loaded;
+	std::string text;
+} conf_cache_t;
+
+static conf_cache_t hostapd_conf = { HOSTAPD_CONF_PATH, false, "" };
+static conf_cache_t dnsmasq_conf = { DNSMASQ_CONF_PATH, false, "" };
+
+/* serializes start/stop, which own the monitor below */
+static pthread_mutex_t ap_op_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* shared with the monitor thread */
+static pthread_mutex_t ap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ap_cond = PTHREAD_COND_INITIALIZER;
+static char ap_ctrl_dir[96] = HOSTAPD_CTRL_DIR;
+static char ap_iface[16];
+static pthread_t ap_tid;
+static bool ap_started = false;
+static bool ap_alive = false;
+static bool ap_attached = false;
+static bool ap_enabled = false;
+static unsigned int ap_enabled_gen = 0;	/* bumped on every AP-ENABLED */
+static int ap_exit_fds[2] = { -1, -1 };
+static wifi_hostapd_sta_cb ap_sta_cb = NULL;
+
+static int ap_start_ms = -1;
+static int ap_start_how = HOSTAPD_STARTED;
+
 const bool console_run(const char *cmdline) {
 	DEBUG_INFO("cmdline = %s\n", cmdline);
 	int ret;
@@ -52,136 +114,563 @@ end:
 	return ret;
 }
 
-int _create_hostapd_file(const char* ap, const char* ssid, const char* psk) {
-	FILE* fp;
-	char cmdline[256] = {0};
-	static char HOSTAPD_CONF_DIR[] = "/userdata/bin/hostapd.conf";
+static int elapsed_ms(const struct timeval *since)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_usec - since->tv_usec) / 1000;
+}
+
+/* 1 if conf->path was rewritten, 0 if it already held text, -1 on error */
+static int conf_update(conf_cache_t *conf, const std::string &text)
+{
+	std::string tmp = std::string(conf->path) + ".tmp";
+	char buf[512];
+	size_t len;
+	FILE *fp;
+
+	if (!conf->loaded) {
+		conf->text.clear();
+		fp = fopen(conf->path, "r");
+		if (fp) {
+			while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+				conf->text.append(buf, len);
+			fclose(fp);
+		}
+		conf->loaded = true;
+	}
+	if (conf->text == text)
+		return 0;
 
-	fp = fopen(HOSTAPD_CONF_DIR, "wt+");
-	if (NULL == fp)
+	/* hostapd may be reading it as it starts, never show it half written */
+	fp = fopen(tmp.c_str(), "w");
+	if (NULL == fp) {
+		DEBUG_ERR("open %s failed: %s\n", tmp.c_str(), strerror(errno));
 		return -1;
+	}
+	if (fwrite(text.data(), 1, text.size(), fp) != text.size() || fflush(fp) != 0) {
+		DEBUG_ERR("write %s failed: %s\n", tmp.c_str(), strerror(errno));
+		fclose(fp);
+		unlink(tmp.c_str());
+		return -1;
+	}
+	fsync(fileno(fp));
+	fclose(fp);
+	if (rename(tmp.c_str(), conf->path) != 0) {
+		DEBUG_ERR("rename %s failed: %s\n", conf->path, strerror(errno));
+		unlink(tmp.c_str());
+		return -1;
+	}
+
+	conf->text = text;
+	return 1;
+}
+
+int _create_hostapd_file(const char* ap, const char* ssid, const char* psk) {
+	std::string conf;
 
-	sprintf(cmdline, "interface=%s\n", ap);
-	fputs(cmdline, fp);
-	fputs("ctrl_interface=/var/run/hostapd\n", fp);
-	fputs("driver=nl80211\n", fp);
-	fputs("ssid=", fp);
-	fputs(ssid, fp);
-	fputs("\n", fp);
-	fputs("channel=6\n", fp);
-	fputs("hw_mode=g\n", fp);
-	fputs("ieee80211n=1\n", fp);
-	fputs("ignore_broadcast_ssid=0\n", fp);
+	conf += "interface=";
+	conf += ap;
+	conf += "\n";
+	conf += "ctrl_interface=" HOSTAPD_CTRL_DIR "\n";
+	conf += "driver=nl80211\n";
+	conf += "ssid=";
+	conf += ssid;
+	conf += "\n";
+	conf += "channel=6\n";
+	conf += "hw_mode=g\n";
+	conf += "ieee80211n=1\n";
+	conf += "ignore_broadcast_ssid=0\n";
 
 	if (psk != NULL && 0 != strcmp(psk, "")) {
-		fputs("auth_algs=1\n", fp);
-		fputs("wpa=3\n", fp);
-		fputs("wpa_passphrase=", fp);
-		fputs(psk, fp);
-		fputs("\n", fp);
-		fputs("wpa_key_mgmt=WPA-PSK\n", fp);
-		fputs("wpa_pairwise=TKIP\n", fp);
-		fputs("rsn_pairwise=CCMP", fp);
+		conf += "auth_algs=1\n";
+		conf += "wpa=3\n";
+		conf += "wpa_passphrase=";
+		conf += psk;
+		conf += "\n";
+		conf += "wpa_key_mgmt=WPA-PSK\n";
+		conf += "wpa_pairwise=TKIP\n";
+		conf += "rsn_pairwise=CCMP";
 	}
 
-	fclose(fp);
-	return 0;
+	return conf_update(&hostapd_conf, conf);
 }
 
 bool _creat_dnsmasq_file() {
-	FILE* fp;
-	static char DNSMASQ_CONF_DIR[] = "/userdata/bin/dnsmasq.conf";
-	static char SOFTAP_INTERFACE_STATIC_IP[] = "10.201.126.1";
-	fp = fopen(DNSMASQ_CONF_DIR, "wt+");
-	if (NULL == fp)
-		return false;
+	std::string conf;
 
-	fputs("user=root\n", fp);
-	fputs("listen-address=", fp);
-	fputs(SOFTAP_INTERFACE_STATIC_IP, fp);
-	fputs("\n", fp);
-	fputs("dhcp-range=10.201.126.50,10.201.126.150\n", fp);
-	fputs("server=/google/8.8.8.8\n", fp);
-	fclose(fp);
-	return true;
+	conf += "user=root\n";
+	conf += "listen-address=" SOFTAP_INTERFACE_STATIC_IP "\n";
+	conf += "dhcp-range=10.201.126.50,10.201.126.150\n";
+	conf += "server=/google/8.8.8.8\n";
+
+	return conf_update(&dnsmasq_conf, conf) >= 0;
+}
+
+/* one request on its own connection, the monitor's is attached */
+static int hostapd_request(const char *ap, const char *cmd, char *reply, size_t len)
+{
+	char path[128];
+	struct wpa_ctrl *ctrl;
+	size_t reply_len = len - 1;
+	int ret;
+
+	pthread_mutex_lock(&ap_lock);
+	snprintf(path, sizeof(path), "%s/%s", ap_ctrl_dir, ap);
+	pthread_mutex_unlock(&ap_lock);
+
+	ctrl = wpa_ctrl_open(path);
+	if (ctrl == NULL)
+		return -1;
+	ret = wpa_ctrl_request(ctrl, cmd, strlen(cmd), reply, &reply_len, NULL);
+	wpa_ctrl_close(ctrl);
+	if (ret != 0)
+		return -1;
+
+	reply[reply_len] = '\0';
+	return 0;
+}
+
+static void hostapd_dispatch_event(char *event)
+{
+	wifi_hostapd_sta_cb cb;
+	char mac[18] = {0};
+	int connected;
+
+	/* "<3>AP-STA-CONNECTED 02:..." */
+	if (event[0] == '<' && strchr(event, '>'))
+		event = strchr(event, '>') + 1;
+
+	if (!strncmp(event, AP_EVENT_ENABLED, strlen(AP_EVENT_ENABLED) - 1)) {
+		pthread_mutex_lock(&ap_lock);
+		ap_enabled = true;
+		ap_enabled_gen++;
+		pthread_cond_broadcast(&ap_cond);
+		pthread_mutex_unlock(&ap_lock);
+		DEBUG_INFO("%s beaconing\n", ap_iface);
+		return;
+	}
+	if (!strncmp(event, AP_EVENT_DISABLED, strlen(AP_EVENT_DISABLED) - 1)) {
+		pthread_mutex_lock(&ap_lock);
+		ap_enabled = false;
+		pthread_mutex_unlock(&ap_lock);
+		return;
+	}
+
+	if (!strncmp(event, AP_STA_CONNECTED, strlen(AP_STA_CONNECTED)))
+		connected = 1;
+	else if (!strncmp(event, AP_STA_DISCONNECTED, strlen(AP_STA_DISCONNECTED)))
+		connected = 0;
+	else
+		return;
+
+	sscanf(strchr(event, ' ') + 1, "%17s", mac);
+	pthread_mutex_lock(&ap_lock);
+	cb = ap_sta_cb;
+	pthread_mutex_unlock(&ap_lock);
+	if (cb)
+		cb(mac, connected);
+}
+
+static void *hostapd_monitor(void *arg)
+{
+	char path[128], buf[256];
+	struct wpa_ctrl *mon = NULL;
+	struct pollfd pfd[2];
+	struct timeval start;
+	size_t len;
+
+	prctl(PR_SET_NAME, "hostapd_monitor");
+
+	pthread_mutex_lock(&ap_lock);
+	snprintf(path, sizeof(path), "%s/%s", ap_ctrl_dir, ap_iface);
+	pfd[0].fd = ap_exit_fds[1];
+	pthread_mutex_unlock(&ap_lock);
+	pfd[0].events = POLLIN;
+
+	/* a freshly launched hostapd creates its socket once the interface is set up */
+	gettimeofday(&start, NULL);
+	for (;;) {
+		mon = wpa_ctrl_open(path);
+		if (mon && wpa_ctrl_attach(mon) == 0)
+			break;
+		if (mon) {
+			wpa_ctrl_close(mon);
+			mon = NULL;
+		}
+		if (poll(pfd, 1, 20) > 0 || elapsed_ms(&start) > HOSTAPD_ENABLE_TIMEOUT_MS)
+			goto out;
+	}
+
+	/* AP-ENABLED may have gone out before we attached */
+	if (hostapd_request(ap_iface, "STATUS", buf, sizeof(buf)) == 0 && strstr(buf, "state=ENABLED")) {
+		pthread_mutex_lock(&ap_lock);
+		ap_enabled = true;
+		ap_enabled_gen++;
+		pthread_mutex_unlock(&ap_lock);
+	}
+
+	pthread_mutex_lock(&ap_lock);
+	ap_attached = true;
+	pthread_cond_broadcast(&ap_cond);
+	pthread_mutex_unlock(&ap_lock);
+
+	pfd[1].fd = wpa_ctrl_get_fd(mon);
+	pfd[1].events = POLLIN;
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfd[0].revents)
+			break;
+		if (pfd[1].revents & (POLLERR | POLLHUP))
+			break;
+		if (!(pfd[1].revents & POLLIN))
+			continue;
+
+		len = sizeof(buf) - 1;
+		if (wpa_ctrl_recv(mon, buf, &len) != 0)
+			break;
+		buf[len] = '\0';
+		hostapd_dispatch_event(buf);
+	}
+
+out:
+	if (mon)
+		wpa_ctrl_close(mon);
+
+	pthread_mutex_lock(&ap_lock);
+	ap_attached = false;
+	ap_enabled = false;
+	ap_alive = false;
+	pthread_cond_broadcast(&ap_cond);
+	pthread_mutex_unlock(&ap_lock);
+	return NULL;
+}
+
+/* under ap_op_lock */
+static void hostapd_monitor_stop(void)
+{
+	if (!ap_started)
+		return;
+
+	write(ap_exit_fds[0], "T", 1);
+	pthread_join(ap_tid, NULL);
+	ap_started = false;
+
+	close(ap_exit_fds[0]);
+	close(ap_exit_fds[1]);
+	ap_exit_fds[0] = ap_exit_fds[1] = -1;
+}
+
+/* under ap_op_lock; returns at once, the monitor finds the socket by itself */
+static int hostapd_monitor_start(const char *ap)
+{
+	bool same;
+
+	pthread_mutex_lock(&ap_lock);
+	same = ap_alive && !strcmp(ap_iface, ap);
+	pthread_mutex_unlock(&ap_lock);
+	if (ap_started && same)
+		return 0;
+
+	hostapd_monitor_stop();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ap_exit_fds) == -1) {
+		DEBUG_ERR("socketpair failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	pthread_mutex_lock(&ap_lock);
+	snprintf(ap_iface, sizeof(ap_iface), "%s", ap);
+	ap_alive = true;
+	ap_attached = ap_enabled = false;
+	pthread_mutex_unlock(&ap_lock);
+
+	if (pthread_create(&ap_tid, NULL, hostapd_monitor, NULL) != 0) {
+		pthread_mutex_lock(&ap_lock);
+		ap_alive = false;
+		pthread_mutex_unlock(&ap_lock);
+		close(ap_exit_fds[0]);
+		close(ap_exit_fds[1]);
+		ap_exit_fds[0] = ap_exit_fds[1] = -1;
+		return -1;
+	}
+	ap_started = true;
+
+	return 0;
+}
+
+/* wait until pred(arg) holds under ap_lock, or the monitor has given up */
+static int hostapd_wait(bool (*pred)(unsigned int), unsigned int arg, int timeout_ms)
+{
+	struct timeval now;
+	struct timespec deadline;
+	int ret = 0;
+
+	gettimeofday(&now, NULL);
+	deadline.tv_sec = now.tv_sec + timeout_ms / 1000;
+	deadline.tv_nsec = now.tv_usec * 1000 + (timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&ap_lock);
+	while (!pred(arg) && ap_alive && ret != ETIMEDOUT)
+		ret = pthread_cond_timedwait(&ap_cond, &ap_lock, &deadline);
+	ret = pred(arg) ? 0 : -1;
+	pthread_mutex_unlock(&ap_lock);
+
+	return ret;
+}
+
+static bool hostapd_attached(unsigned int arg)
+{
+	return ap_attached;
+}
+
+static bool hostapd_enabled_since(unsigned int gen)
+{
+	return ap_enabled_gen != gen;
+}
+
+static unsigned int hostapd_enabled_gen(void)
+{
+	unsigned int gen;
+
+	pthread_mutex_lock(&ap_lock);
+	gen = ap_enabled_gen;
+	pthread_mutex_unlock(&ap_lock);
+
+	return gen;
+}
+
+/* "SET <field> <value>" to the running hostapd */
+static int hostapd_set(const char *ap, const char *field, const char *value)
+{
+	char cmd[160], reply[16];
+
+	snprintf(cmd, sizeof(cmd), "SET %s %s", field, value);
+	if (hostapd_request(ap, cmd, reply, sizeof(reply)) != 0 || strncmp(reply, "OK", 2)) {
+		DEBUG_ERR("hostapd SET %s failed\n", field);
+		return -1;
+	}
+	return 0;
+}
+
+/* STATUS says the AP beacons ssid, polled: RELOAD sends no AP-ENABLED */
+static int hostapd_wait_status(const char *ap, const char *ssid, int timeout_ms)
+{
+	char reply[2048], want[96];
+	struct timeval start;
+
+	snprintf(want, sizeof(want), "\nssid[0]=%s\n", ssid);
+	gettimeofday(&start, NULL);
+	do {
+		if (hostapd_request(ap, "STATUS", reply, sizeof(reply)) == 0 &&
+				strstr(reply, "state=ENABLED\n") && strstr(reply, want))
+			return 0;
+		usleep(50 * 1000);
+	} while (elapsed_ms(&start) < timeout_ms);
+
+	return -1;
+}
+
+/*
+ * hostapd already runs on ap: switch it to the new config without a
+ * restart. RELOAD only restarts the BSS from hostapd's config in memory,
+ * it never reads hostapd.conf again, so what the file changed goes in
+ * through SET first.
+ */
+static int hostapd_reconfigure(const char* ap, const char* ssid, const char* psk, bool changed) {
+	char reply[64];
+	bool enabled;
+	bool wpa = psk != NULL && 0 != strcmp(psk, "");
+
+	hostapd_monitor_start(ap);
+	if (hostapd_wait(hostapd_attached, 0, HOSTAPD_ATTACH_TIMEOUT_MS) != 0)
+		return -1;
+
+	pthread_mutex_lock(&ap_lock);
+	enabled = ap_enabled;
+	pthread_mutex_unlock(&ap_lock);
+	if (!changed && enabled) {
+		ap_start_how = HOSTAPD_UNCHANGED;
+		return 0;
+	}
+
+	if (hostapd_set(ap, "ssid", ssid) != 0)
+		return -1;
+	if (wpa) {
+		if (hostapd_set(ap, "auth_algs", "1") != 0 ||
+				hostapd_set(ap, "wpa", "3") != 0 ||
+				hostapd_set(ap, "wpa_passphrase", psk) != 0 ||
+				hostapd_set(ap, "wpa_key_mgmt", "WPA-PSK") != 0 ||
+				hostapd_set(ap, "wpa_pairwise", "TKIP") != 0 ||
+				hostapd_set(ap, "rsn_pairwise", "CCMP") != 0)
+			return -1;
+	} else if (hostapd_set(ap, "wpa", "0") != 0) {
+		return -1;
+	}
+
+	if (hostapd_request(ap, "RELOAD", reply, sizeof(reply)) != 0 || strncmp(reply, "OK", 2)) {
+		DEBUG_ERR("hostapd RELOAD failed\n");
+		return -1;
+	}
+	if (hostapd_wait_status(ap, ssid, HOSTAPD_ENABLE_TIMEOUT_MS) != 0) {
+		DEBUG_ERR("hostapd didn't come back with %s\n", ssid);
+		return -1;
+	}
+	ap_start_how = HOSTAPD_RELOADED;
+
+	return 0;
 }
 
 int _wifi_rtl_start_hostapd(const char* ap, const char* ssid, const char* psk, const char* ip) {
 	char cmdline[256] = {0};
-	static char DNSMASQ_CONF_DIR[] = "/userdata/bin/dnsmasq.conf";
-	static char HOSTAPD_CONF_DIR[] = "/userdata/bin/hostapd.conf";
-	_create_hostapd_file(ap, ssid, psk);
+	unsigned int gen;
 
-	sprintf(cmdline, "ifconfig %s up", ap);
-	console_run(cmdline);
-	sprintf(cmdline, "ifconfig %s 10.201.126.1 netmask 255.255.255.0", ap);
-	console_run(cmdline);
-	sprintf(cmdline, "route add default gw %s %s", ip, ap);
-	console_run(cmdline);
+	netif_set_link(ap, true);
+	netif_set_ipv4(ap, SOFTAP_INTERFACE_STATIC_IP, 24);
+	if (ip && ip[0])
+		netif_add_default_route(ap, ip);
 
-	// _creat_dnsmasq_file();
+	/* leases from the subnet set up above; an old file is still used if this fails */
+	_creat_dnsmasq_file();
 	memset(cmdline, 0, sizeof(cmdline));
-	sprintf(cmdline, "dnsmasq -C %s --interface=%s", DNSMASQ_CONF_DIR, ap);
+	sprintf(cmdline, "dnsmasq -C %s --interface=%s", DNSMASQ_CONF_PATH, ap);
 	console_run(cmdline);
 
+	gen = hostapd_enabled_gen();
 	memset(cmdline, 0, sizeof(cmdline));
-	sprintf(cmdline, "hostapd %s &", HOSTAPD_CONF_DIR);
+	sprintf(cmdline, "hostapd %s &", HOSTAPD_CONF_PATH);
 	console_run(cmdline);
+	ap_start_how = HOSTAPD_STARTED;
 
-	int time = 100;
-	while (time-- > 0 && access("/var/run/hostapd", F_OK)) {
-		usleep(100 * 1000);
+	/* the monitor attaches as soon as the socket shows up */
+	hostapd_monitor_start(ap);
+	if (hostapd_wait(hostapd_enabled_since, gen, HOSTAPD_ENABLE_TIMEOUT_MS) != 0) {
+		DEBUG_ERR("hostapd didn't enable %s\n", ap);
+		return -1;
 	}
 	return 0;
 }
 
 int wifi_rtl_start_hostapd(const char* ssid, const char* psk, const char* ip) {
-	char wifi_type[64];
+	char wifi_type[64] = {0};
 	char ap[64];
+	char reply[16];
+	struct timeval start;
+	int changed, ret;
+
+	gettimeofday(&start, NULL);
+	pthread_mutex_lock(&ap_op_lock);
 
 	check_wifi_chip_type_string(wifi_type);
 	DEBUG_INFO("wifi type: %s\n", wifi_type);
-	console_run("killall dnsmasq");
-	console_run("killall hostapd");
-	//console_run("killall udhcpc");
+	strcpy(ap, !strncmp(wifi_type, "RTL", 3) ? "p2p0" : "wlan1");
+
+	changed = _create_hostapd_file(ap, ssid, psk);
+	if (changed < 0) {
+		pthread_mutex_unlock(&ap_op_lock);
+		return -1;
+	}
+
+	if (hostapd_request(ap, "PING", reply, sizeof(reply)) == 0 && !strncmp(reply, "PONG", 4)) {
+		ret = hostapd_reconfigure(ap, ssid, psk, changed);
+		if (ret == 0) {
+			if (ip && ip[0])
+				netif_add_default_route(ap, ip);
+			goto out;
+		}
+		DEBUG_ERR("reconfiguring hostapd on %s failed, starting it over\n", ap);
+	}
+
+	/* nothing to reconfigure: the interface and both daemons start over */
+	hostapd_monitor_stop();
+	/* the old ones must be gone before the new ones bind */
+	kill_task_timeout("dnsmasq", 0);
+	kill_task_timeout("hostapd", 1000);
 
 	if (!strncmp(wifi_type, "RTL", 3)) {
-		strcpy(ap, "p2p0");
-		console_run("ifconfig p2p0 down");
-		console_run("rm -rf /userdata/bin/p2p0");
+		netif_set_link("p2p0", false);
+		unlink("/userdata/bin/p2p0");
 	} else {
-		strcpy(ap, "wlan1");
-		console_run("ifconfig wlan1 down");
-		console_run("rm -rf /userdata/bin/wlan1");
+		netif_set_link("wlan1", false);
+		unlink("/userdata/bin/wlan1");
 		console_run("iw dev wlan1 del");
-		console_run("ifconfig wlan0 up");
+		netif_set_link("wlan0", true);
 
 		if (!strncmp(wifi_type, "AP6181", 6)) {
 			console_run("iw dev wlan0 interface add wlan1 type __ap");
 		} else {
 			console_run("iw phy0 interface add wlan1 type managed");
 		}
+		/* the driver registers the new netdev asynchronously */
+		netif_wait_link("wlan1", 0, 1000);
 	}
 
-	return _wifi_rtl_start_hostapd(ap, ssid, psk, ip);
+	ret = _wifi_rtl_start_hostapd(ap, ssid, psk, ip);
+
+out:
+	ap_start_ms = ret == 0 ? elapsed_ms(&start) : -1;
+	DEBUG_INFO("softap %s on %s: %s in %d ms\n", ssid, ap,
+			ap_start_how == HOSTAPD_UNCHANGED ? "unchanged" :
+			ap_start_how == HOSTAPD_RELOADED ? "reloaded" : "started", elapsed_ms(&start));
+	pthread_mutex_unlock(&ap_op_lock);
+	return ret;
 }
 
 int wifi_rtl_stop_hostapd() {
-	char wifi_type[64];
+	char wifi_type[64] = {0};
 
-	console_run("killall hostapd");
+	pthread_mutex_lock(&ap_op_lock);
+	hostapd_monitor_stop();
+	/* hostapd removes its ctrl interface on the way out */
+	kill_task_timeout("hostapd", 1000);
 	check_wifi_chip_type_string(wifi_type);
 	if (!strncmp(wifi_type, "RTL", 3)) {
-		console_run("ifconfig p2p0 down");
+		netif_set_link("p2p0", false);
 	} else {
-		console_run("killall dnsmasq");
-		console_run("ifconfig wlan1 down");
+		kill_task_timeout("dnsmasq", 0);
+		netif_set_link("wlan1", false);
 	}
+	ap_start_ms = -1;
+	pthread_mutex_unlock(&ap_op_lock);
 
-	int time = 100;
-	while (time-- > 0 && !access("/var/run/hostapd", F_OK)) {
-		usleep(10 * 1000);
-	}
+	return 0;
+}
+
+void wifi_rtl_hostapd_register_callback(wifi_hostapd_sta_cb cb) {
+	pthread_mutex_lock(&ap_lock);
+	ap_sta_cb = cb;
+	pthread_mutex_unlock(&ap_lock);
+}
+
+int wifi_rtl_hostapd_set_ctrl_dir(const char *dir) {
+	pthread_mutex_lock(&ap_op_lock);
+	/* the monitor was attached to the old one */
+	hostapd_monitor_stop();
+	pthread_mutex_lock(&ap_lock);
+	snprintf(ap_ctrl_dir, sizeof(ap_ctrl_dir), "%s", dir ? dir : HOSTAPD_CTRL_DIR);
+	pthread_mutex_unlock(&ap_lock);
+	pthread_mutex_unlock(&ap_op_lock);
 
 	return 0;
 }
+
+int wifi_rtl_hostapd_start_time(int *how) {
+	int ms;
+
+	pthread_mutex_lock(&ap_op_lock);
+	ms = ap_start_ms;
+	if (how)
+		*how = ap_start_how;
+	pthread_mutex_unlock(&ap_op_lock);
+
+	return ms;
+}
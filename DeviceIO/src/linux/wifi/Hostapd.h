@@ -6,8 +6,27 @@ extern "C" {
 #endif
 
 
+/* how the last wifi_rtl_start_hostapd() got the AP up */
+#define HOSTAPD_STARTED		0	/* interface and daemons started over */
+#define HOSTAPD_RELOADED	1	/* running hostapd reloaded the new config */
+#define HOSTAPD_UNCHANGED	2	/* already up with the same config */
+
+/* a station joined (connected 1) or left (0) the softAP */
+typedef int (*wifi_hostapd_sta_cb)(const char *mac, int connected);
+
+/*
+ * Returns once the AP is up. A hostapd already running on the AP
+ * interface is reconfigured through its control socket (SET, RELOAD, then
+ * STATUS until it beacons the new ssid), started over if that fails, and
+ * not touched at all if the config didn't change.
+ */
 int wifi_rtl_start_hostapd(const char* ssid, const char* psk, const char* ip);
 int wifi_rtl_stop_hostapd();
+void wifi_rtl_hostapd_register_callback(wifi_hostapd_sta_cb cb);
+/* control socket directory of another hostapd (e.g. a test double), NULL for the default */
+int wifi_rtl_hostapd_set_ctrl_dir(const char *dir);
+/* ms from the last start call to AP-ENABLED, -1 if the AP isn't up; how is HOSTAPD_* */
+int wifi_rtl_hostapd_start_time(int *how);
 
 
 #ifdef __cplusplus
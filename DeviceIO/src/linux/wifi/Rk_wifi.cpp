@@ -10,23 +10,32 @@
 #include <errno.h>
 #include <sys/prctl.h>
 #include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include "Hostapd.h"
+#include "bringup.h"
+#include "bss_table.h"
+#include "fast_reconnect.h"
+#include "netif.h"
 #include "ping.h"
+#include "scan_cache.h"
+#include "scan_parser.h"
+#include "wifi_sm.h"
+#include "wpa_ctrl_channel.h"
 #include "DeviceIo/RK_encode.h"
 #include "DeviceIo/RK_log.h"
 #include "DeviceIo/RK_property.h"
 #include "DeviceIo/Rk_wifi.h"
 #include "slog.h"
 #include "utility.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
 
 static bool save_last_ap = false;
-static int connecting_id = -1;
 
 static RK_WIFI_RUNNING_State_e gstate = RK_WIFI_State_OFF;
 
-static char retry_connect_cmd[128];
-
 typedef struct {
 	char ssid[SSID_BUF_LEN];
 	char bssid[BSSID_BUF_LEN];
@@ -38,117 +47,15 @@ static RK_WIFI_CONNECT_INFO connect_info =
 	"",
 };
 
-typedef struct RK_WIFI_encode_gbk {
-	char ori[128];
-	char utf8[128];
-	struct RK_WIFI_encode_gbk *next;
-} RK_WIFI_encode_gbk_t;
-
-// GBK编码路由链表
-static RK_WIFI_encode_gbk_t *m_gbk_head = NULL;
-// 无密码路由链表
-static RK_WIFI_encode_gbk_t *m_nonpsk_head = NULL;
-
-static RK_WIFI_encode_gbk_t* encode_gbk_insert(RK_WIFI_encode_gbk_t *head, const char *ori, const char *utf8)
-{
-	if ((ori == NULL || strlen(ori) == 0) || (utf8 == NULL || strlen(utf8) == 0))
-		return;
-
-	RK_WIFI_encode_gbk_t *gbk = (RK_WIFI_encode_gbk_t*) malloc(sizeof(RK_WIFI_encode_gbk_t));
-	memset(gbk->ori, 0, sizeof(gbk->ori));
-	memset(gbk->utf8, 0, sizeof(gbk->utf8));
-
-	if (strlen(ori) >= sizeof(gbk->ori) || strlen(utf8) >= sizeof(gbk->utf8)) {
-		free(gbk);
-		return;
-	}
-
-	strcat(gbk->ori, ori);
-	strcat(gbk->utf8, utf8);
-
-	gbk->next = head;
-	head = gbk;
-}
-
-static RK_WIFI_encode_gbk_t* encode_gbk_reset(RK_WIFI_encode_gbk_t *head)
-{
-	RK_WIFI_encode_gbk_t *gbk, *gbk_next;
-
-	gbk = head;
-	while (gbk) {
-		gbk_next = gbk->next;
-		free(gbk);
-
-		gbk = gbk_next;
-	}
-	head = NULL;
-
-	return head;
-}
-
-static char* get_encode_gbk_ori(RK_WIFI_encode_gbk_t* head, const char* str, char* dst)
-{
-	int is_gbk = 0;
-	RK_WIFI_encode_gbk_t *gbk = head;
-
-	while (gbk) {
-		if (strcmp(gbk->utf8, str) == 0) {
-			is_gbk = 1;
-			strncpy(dst, gbk->ori, strlen(gbk->ori));
-			break;
-		}
-		gbk = gbk->next;
-	}
-	if (!is_gbk) {
-		strncpy(dst, str, strlen(str));
-	}
-
-	return dst;
-}
-
-static char* get_encode_gbk_utf8(RK_WIFI_encode_gbk_t* head, const char* str, char* dst)
-{
-	int is_gbk = 0;
-	RK_WIFI_encode_gbk_t *gbk = head;
-
-	while (gbk) {
-		if (strcmp(gbk->ori, str) == 0) {
-			is_gbk = 1;
-			strncpy(dst, gbk->utf8, strlen(gbk->utf8));
-			break;
-		}
-		gbk = gbk->next;
-	}
-	if (!is_gbk) {
-		strncpy(dst, str, strlen(str));
-	}
-
-	return dst;
-}
-
-static int is_non_psk(const char* str)
-{
-	RK_WIFI_encode_gbk_t *nonpsk = m_nonpsk_head;
-	while (nonpsk) {
-		if (strcmp(nonpsk->utf8, str) == 0) {
-			return 1;
-		}
-		nonpsk = nonpsk->next;
-	}
-
-	return 0;
-}
-
 static RK_wifi_state_callback m_cb;
 static int priority = 0;
-static volatile bool wifi_wrong_key = false;
-static volatile bool wifi_cancel = false;
 static volatile bool wifi_connect_lock = false;
-static volatile bool wifi_is_exist = false;
 
 static void format_wifiinfo(int flag, char *info);
 static int get_pid(const char Name[]);
-static void RK_wifi_start_monitor(void *arg);
+static void wifi_monitor_start(void);
+static void wifi_monitor_stop(void);
+static void wifi_sm_post(wifi_sm_event_e ev, int id = -1, bool saved = false);
 
 static char* wifi_state[] = {
 	"RK_WIFI_State_IDLE",
@@ -226,50 +133,18 @@ static char* exec1(const char* cmd)
 	return ret;
 }
 
-static char *remove_escape_character(const char *buf, char *dst)
+/* ssid as the supplicant prints it (escaped, maybe GBK) to a UTF-8 name */
+static void ssid_to_display(const char *escaped, char *dst, size_t size)
 {
-	char buf_temp[strlen(buf) + 1];
-	int i = 0;
+	char ssid[SCAN_SSID_MAX_LEN + 1];
+	std::string utf8;
+	size_t len;
 
-	memset(buf_temp, 0, sizeof(buf_temp));
-	while(*buf != '\0') {
-		if (*buf == '\\' && (*(buf + 1) == '\\' || *(buf + 1) == '\"')) {
-			dst[i] = *(buf + 1);
-			buf = buf + 2;
-		} else {
-			dst[i] = *buf;
-			buf++;
-		}
-		i++;
-	}
-	dst[i] = '\0';
+	len = scan_ssid_unescape(escaped, strlen(escaped), ssid);
+	if (!wifi_ssid_to_utf8(ssid, len, utf8))
+		utf8.assign(ssid, len);
 
-	return dst;
-}
-
-static char *spec_char_convers(const char *buf, char *dst)
-{
-	char buf_temp[strlen(buf) + 1];
-	int i = 0;
-	unsigned long con;
-
-	memset(buf_temp, 0, sizeof(buf_temp));
-	while(*buf != '\0') {
-		if(*buf == '\\' && *(buf + 1) == 'x') {
-			strcpy(buf_temp, buf);
-			*buf_temp = '0';
-			*(buf_temp + 4) = '\0';
-			con = strtoul(buf_temp, NULL, 16);
-			dst[i] = con;
-			buf += 4;
-		} else {
-			dst[i] = *buf;
-			buf++;
-		}
-		i++;
-	}
-	dst[i] = '\0';
-	return dst;
+	snprintf(dst, size, "%s", utf8.c_str());
 }
 
 static int exec(const char* cmd, const char* ret)
@@ -335,178 +210,61 @@ static int RK_wifi_search_with_ssid(const char *ssid)
 	return -1;
 }
 
-static bool get_ssid_directly(char *flags, int row, int columns)
+/* one LIST_NETWORKS row: network id / ssid / bssid / flags, tab separated */
+static void parse_saved_network(char *line, RK_WIFI_SAVED_INFO_s *info)
 {
-	/* <=3: id ssid bssid
-	   4: id ssid bssid flags*/
-	if(columns <= 3 || (columns == 4 && strlen(flags) > 0))
-		return true;
-
-	return false;
-}
-
-static int get_ssid_from_list_network(RK_WIFI_SAVED_INFO_s *info, int row, int columns)
-{
-	int start = 0, end = 0;
-	char cmd[128], str[128];
-	char ssid[128], sname[128], utf8[128];
-	char *bssid;
-
-	if(!info)
-		return -1;
-
-	memset(info->ssid, 0, SSID_BUF_LEN);
-	memset(cmd, 0, 128);
-	memset(str, 0, 128);
-
-	if(get_ssid_directly(info->state, row, columns)) {
-		snprintf(cmd, sizeof(cmd), "wpa_cli -i wlan0 list_network | awk '{print $2}' | sed -n %dp", row);
-		exec(cmd, str);
-		pr_info("%s: row = %d, column(2) = %s\n", __func__, row, str);
-
-		memset(sname, 0, sizeof(sname));
-		memset(utf8, 0, sizeof(utf8));
-		memset(ssid, 0, sizeof(ssid));
+	char *fields[4] = {NULL, NULL, NULL, NULL};
+	int n = 0;
 
-		str[strlen(str)-1] = '\0';
-		remove_escape_character(str, ssid);
-		spec_char_convers(ssid, sname);
-		get_encode_gbk_utf8(m_gbk_head, sname, utf8);
-		pr_info("direct: convers str: %s, sname: %s, ori: %s\n", ssid, sname, utf8);
-		strncpy(info->ssid, utf8, strlen(utf8));
-
-		return 0;
-	}
-
-	snprintf(cmd, sizeof(cmd), "wpa_cli -i wlan0 list_network | sed -n %dp", row);
-	exec(cmd, str);
-	pr_info("%s: row(%d) = %s\n", __func__, row, str);
-
-	memset(cmd, 0, 128);
-	sprintf(cmd, "%d", info->id);
-	start = strlen(cmd);
-
-	if((bssid = strstr(str, info->bssid)) == NULL) {
-		pr_err("%s: %s can't find bssid(%s)\n", __func__, str, info->bssid);
-		return -1;
+	fields[n++] = line;
+	for (char *p = line; *p && n < 4; p++) {
+		if (*p == '\t') {
+			*p = '\0';
+			fields[n++] = p + 1;
+		}
 	}
-	end = strlen(str) - strlen(bssid);
-
-	memset(ssid, 0, 128);
-	strncpy(ssid, str + start, end - start);
-	RK_property_trim(ssid);
-
-	memset(str, 0, 128);
-	memset(sname, 0, 128);
-	memset(utf8, 0, 128);
-	remove_escape_character(ssid, str);
-	spec_char_convers(str, sname);
-	get_encode_gbk_utf8(m_gbk_head, sname, utf8);
-	pr_info("ndirect convers str: %s, sname: %s, ori: %s\n", str, sname, utf8);
-	strncpy(info->ssid, utf8, strlen(utf8));
-}
-
-int get_bssid_from_list_network(RK_WIFI_SAVED_INFO_s *info, int row, int columns)
-{
-	char cmd[128], str[128];
-	int bssid_column = columns;
-
-	if(!info)
-		return -1;
-
-	memset(info->bssid, 0, BSSID_BUF_LEN);
-	memset(cmd, 0, 128);
-	memset(str, 0, 128);
 
-	if(strlen(info->state) > 0)
-		bssid_column = columns - 1;
+	info->id = atoi(fields[0]);
 
-	snprintf(cmd, sizeof(cmd), "wpa_cli -i wlan0 list_network | awk '{print $%d}' | sed -n %dp", bssid_column, row);
-	exec(cmd, str);
-	pr_info("%s: row = %d, column(%d) = %s\n", __func__, row, bssid_column, str);
+	if (fields[2])
+		strncpy(info->bssid, fields[2], BSSID_BUF_LEN - 1);
 
-	strncpy(info->bssid, str, ((strlen(str) - 1) > BSSID_BUF_LEN) ? BSSID_BUF_LEN : (strlen(str) - 1));
-	return 0;
-}
-
-int get_id_from_list_network(int row)
-{
-	int network_id;
-	char cmd[128], str[128];
-
-	memset(cmd, 0, 128);
-	memset(str, 0, 128);
-	snprintf(cmd, sizeof(cmd), "wpa_cli -i wlan0 list_network | awk '{print $1}' | sed -n %dp", row);
-	exec(cmd, str);
-	network_id = atoi(str);
-
-	pr_info("%s: row = %d, network_id = %d\n", __func__, row, network_id);
-	return network_id;
-}
+	if (fields[3] && (!strncmp(fields[3], "[CURRENT]", strlen("[CURRENT]"))
+				|| !strncmp(fields[3], "[DISABLED]", strlen("[DISABLED]"))))
+		strncpy(info->state, fields[3], STATE_BUF_LEN - 1);
 
-int get_columns_from_list_network(int row)
-{
-	int columns;
-	char cmd[128], str[128];
-
-	memset(cmd, 0, 128);
-	memset(str, 0, 128);
-
-	snprintf(cmd, sizeof(cmd), "wpa_cli -i wlan0 list_network | awk '{print NF}' | sed -n %dp", row);
-	exec(cmd, str);
-	columns = atoi(str);
-
-	pr_info("%s: row = %d, columns = %d\n", __func__, row, columns);
-	return columns;
-}
-
-void get_flags_from_list_network(char *flags_buf, int buf_len, int row, int columns)
-{
-	char cmd[128], str[128];
-
-	memset(flags_buf, 0, buf_len);
-	memset(cmd, 0, 128);
-	memset(str, 0, 128);
-
-	snprintf(cmd, sizeof(cmd), "wpa_cli -i wlan0 list_network | awk '{print $%d}' | sed -n %dp", columns, row);
-	exec(cmd, str);
-	if(!strncmp(str, "[CURRENT]", strlen("[CURRENT]"))
-				|| !strncmp(str, "[DISABLED]", strlen("[DISABLED]"))) {
-		strncpy(flags_buf, str, ((strlen(str) - 1) > buf_len) ? buf_len : (strlen(str) - 1));
-		pr_info("%s: row = %d, column(%d) = %s\n", __func__, row, columns, flags_buf);
-	}
+	if (fields[1])
+		ssid_to_display(fields[1], info->ssid, SSID_BUF_LEN);
 }
 
 int RK_wifi_getSavedInfo(RK_WIFI_SAVED_INFO* pInfo)
 {
-	FILE *fp = NULL;
-	int cnt, row, columns;
-	char str[128];
+	std::string reply;
+	char *line, *saveptr;
+	int cnt = 0;
 
 	if (pInfo == NULL)
 		return -1;
 
 	memset(pInfo, 0, sizeof(RK_WIFI_SAVED_INFO));
 
-	memset(str, 0, 128);
-	exec("wpa_cli -i wlan0 list_network | wc -l", str);
-	cnt = atoi(str) - 1;
+	if (wpa_ctrl_channel_request("LIST_NETWORKS", reply) != 0)
+		return -1;
+
+	char buf[reply.size() + 1];
+	memcpy(buf, reply.c_str(), reply.size() + 1);
+
+	/* skip the header line */
+	line = strtok_r(buf, "\n", &saveptr);
+	while (line && (line = strtok_r(NULL, "\n", &saveptr)) && cnt < RK_WIFI_SAVED_INFO_MAX)
+		parse_saved_network(line, &pInfo->save_info[cnt++]);
+
 	pInfo->count = cnt;
-	pr_info("wifi cnt: %d(%s)\n", cnt, str);
+	pr_info("wifi cnt: %d\n", cnt);
 
 	if (cnt <= 0)
 		return -1;
 
-	for (int i = 0; i < cnt; i++) {
-		row = i+2;
-
-		columns = get_columns_from_list_network(row);
-		pInfo->save_info[i].id = get_id_from_list_network(row);
-		get_flags_from_list_network(pInfo->save_info[i].state, STATE_BUF_LEN, row, columns);
-		get_bssid_from_list_network(&pInfo->save_info[i], row, columns);
-		get_ssid_from_list_network(&pInfo->save_info[i], row, columns);
-	}
-
 	for (int i = 0; i < cnt; i++) {
 		pr_info("id: %d, name: %s, bssid: %s, state: %s\n", pInfo->save_info[i].id, pInfo->save_info[i].ssid, pInfo->save_info[i].bssid,
 					pInfo->save_info[i].state);
@@ -517,30 +275,39 @@ int RK_wifi_getSavedInfo(RK_WIFI_SAVED_INFO* pInfo)
 
 int RK_wifi_running_getState(RK_WIFI_RUNNING_State_e* pState)
 {
-	int ret;
-	char str[128];
+	std::string status;
 
 	if(!pState)
 		return -1;
 
-	// check wpa is running first
-	memset(str, 0, sizeof(str));
-	ret = exec("pidof wpa_supplicant", str);
-	if (0 == strlen(str)) {
+	// the monitor follows every event, no need to ask
+	switch (wifi_sm_state()) {
+	case WIFI_SM_ASSOCIATED:
+	case WIFI_SM_ONLINE:
+		*pState = RK_WIFI_State_CONNECTED;
+		return 0;
+	case WIFI_SM_IDLE:
+	case WIFI_SM_CONNECTING:
+		*pState = RK_WIFI_State_DISCONNECTED;
+		return 0;
+	default:
+		break;
+	}
+
+	// no answer on the control socket means wpa_supplicant isn't running
+	if (wpa_ctrl_channel_request("STATUS", status) != 0) {
 		*pState = RK_WIFI_State_IDLE;
-		return ret;
+		return 0;
 	}
 
 	// check whether wifi connected
-	memset(str, 0, sizeof(str));
-	ret = exec("wpa_cli -iwlan0 status | grep wpa_state | awk -F '=' '{printf $2}'", str);
-	if (0 == strncmp(str, "COMPLETED", 9)) {
+	if (status.find("\nwpa_state=COMPLETED") != std::string::npos
+			|| status.compare(0, 19, "wpa_state=COMPLETED") == 0)
 		*pState = RK_WIFI_State_CONNECTED;
-		return ret;
-	} else {
+	else
 		*pState = RK_WIFI_State_DISCONNECTED;
-		return ret;
-	}
+
+	return 0;
 }
 
 int RK_wifi_running_getConnectionInfo(RK_WIFI_INFO_Connection_s* pInfo)
@@ -548,26 +315,20 @@ int RK_wifi_running_getConnectionInfo(RK_WIFI_INFO_Connection_s* pInfo)
 	FILE *fp = NULL;
 	char line[512];
 	char *value;
+	std::string status;
 
 	if (pInfo == NULL)
 		return -1;
 
-	if (remove("/tmp/status.tmp"))
-		pr_err("remove /tmp/status.tmp failed!\n");
-	exec_command_system("wpa_cli -iwlan0 status > /tmp/status.tmp");
-
-	// check wpa is running first
-	memset(line, 0, sizeof(line));
-	exec("cat /tmp/status.tmp", line);
-	pr_info("status.tmp: %s\n", line);
-
-	memset(line, 0, sizeof(line));
-	exec("wpa_cli -iwlan0 status", line);
-	pr_info("wpa_cli status: %s\n", line);
+	if (wpa_ctrl_channel_request("STATUS", status) != 0 || status.empty()) {
+		pr_err("%s: wpa_supplicant status failed!\n", __func__);
+		return -1;
+	}
+	pr_info("wpa status: %s\n", status.c_str());
 
-	fp = fopen("/tmp/status.tmp", "r");
+	fp = fmemopen((void *) status.c_str(), status.size(), "r");
 	if (!fp) {
-		pr_err("fopen /tmp/status.tmp failed!\n");
+		pr_err("fmemopen status failed!\n");
 		return -1;
 	}
 
@@ -590,17 +351,8 @@ int RK_wifi_running_getConnectionInfo(RK_WIFI_INFO_Connection_s* pInfo)
 		} else if (0 == strncmp(line, "ssid", 4)) {
 			value = strchr(line, '=');
 			if (value && strlen(value) > 0) {
-				char sname[128];
-				char sname1[128];
-				char utf8[128];
-				memset(sname, 0, sizeof(sname));
-				memset(sname1, 0, sizeof(sname));
-				memset(utf8, 0, sizeof(utf8));
-				spec_char_convers(value + 1, sname);
-				remove_escape_character(sname, sname1);
-				get_encode_gbk_utf8(m_gbk_head, sname1, utf8);
-				pr_info("convers str: %s, sname: %s, ori: %s\n", value + 1, sname1, utf8);
-				strncpy(pInfo->ssid,  utf8, strlen(utf8));
+				ssid_to_display(value + 1, pInfo->ssid, sizeof(pInfo->ssid));
+				pr_info("convers str: %s, ssid: %s\n", value + 1, pInfo->ssid);
 			}
 		} else if (0 == strncmp(line, "id", 2)) {
 			value = strchr(line, '=');
@@ -643,6 +395,27 @@ int RK_wifi_disable_ap()
 	return wifi_rtl_stop_hostapd();
 }
 
+int RK_wifi_register_ap_callback(RK_wifi_ap_sta_callback cb)
+{
+	wifi_rtl_hostapd_register_callback(cb);
+	return 0;
+}
+
+int RK_wifi_get_ap_start_time(RK_WIFI_AP_TIME_s *pTime)
+{
+	if (!pTime)
+		return -1;
+
+	pTime->start_ms = wifi_rtl_hostapd_start_time(&pTime->how);
+
+	return pTime->start_ms < 0 ? -1 : 0;
+}
+
+int RK_wifi_set_ap_ctrl_dir(const char *dir)
+{
+	return wifi_rtl_hostapd_set_ctrl_dir(dir);
+}
+
 static int is_wifi_enable()
 {
 	int ret = 0;
@@ -658,52 +431,155 @@ out:
 	return ret;
 }
 
-int RK_wifi_enable(const int enable)
+/* how long a fresh wpa_supplicant gets to answer PING */
+#define WIFI_SUPPLICANT_READY_MS	5000
+
+enum {
+	BRINGUP_LINK = 0,
+	BRINGUP_STOP_DHCP,
+	BRINGUP_STOP_SUPPLICANT,
+	BRINGUP_SUPPLICANT,
+	BRINGUP_DHCP,
+};
+
+static pthread_mutex_t bringup_lock = PTHREAD_MUTEX_INITIALIZER;
+static wifi_bringup_timing_t bringup_timing[WIFI_BRINGUP_MAX_STEPS];
+static int bringup_count = 0;
+static int bringup_total_ms = -1;
+
+static int bringup_link(void)
+{
+	int ret;
+
+	ret = netif_set_link("wlan0", true);
+	if (ret)
+		return ret;
+	netif_flush_ipv4("wlan0");
+
+	/* IFF_UP is set synchronously, this only catches a vanishing netdev */
+	return netif_wait_link("wlan0", IFF_UP, 1000);
+}
+
+static int bringup_stop_dhcp(void)
+{
+	/* a dhcpcd still running makes the new one exit at once */
+	kill_task_timeout("dnsmasq", 0);
+	return kill_task_timeout("dhcpcd", 1000) < 0 ? -EBUSY : 0;
+}
+
+static int bringup_stop_supplicant(void)
+{
+	/* a stale supplicant still holds the ctrl socket */
+	return kill_task_timeout("wpa_supplicant", 2000) < 0 ? -EBUSY : 0;
+}
+
+static int bringup_supplicant(void)
+{
+	struct timeval start, now;
+	std::string reply;
+
+	wpa_ctrl_channel_close();
+	if (exec_command_system("wpa_supplicant -B -i wlan0 -c /data/cfg/wpa_supplicant.conf -d") != 0)
+		return -EIO;
+
+	/* -B returns once the ctrl interface is up, PONG proves it answers */
+	gettimeofday(&start, NULL);
+	for (;;) {
+		if (wpa_ctrl_channel_request("PING", reply, 200) == 0 && !reply.compare(0, 4, "PONG"))
+			return 0;
+
+		gettimeofday(&now, NULL);
+		if ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000 >= WIFI_SUPPLICANT_READY_MS)
+			return -ETIMEDOUT;
+		/* no socket yet fails at once, don't spin on it */
+		usleep(20 * 1000);
+	}
+}
+
+static int bringup_dhcp(void)
 {
-	static pthread_t start_wifi_monitor_threadId = 0;
+	//exec_command_system("udhcpc -i wlan0 -t 5 &");
+	return exec_command_system("dhcpcd wlan0 -AL -t 0 &") != 0 ? -EIO : 0;
+}
+
+static const wifi_bringup_step_t bringup_steps[] = {
+	{ "link", 0, bringup_link },
+	{ "stop_dhcp", 0, bringup_stop_dhcp },
+	{ "stop_supplicant", 0, bringup_stop_supplicant },
+	{ "supplicant", (1 << BRINGUP_LINK) | (1 << BRINGUP_STOP_SUPPLICANT), bringup_supplicant },
+	{ "dhcp", (1 << BRINGUP_LINK) | (1 << BRINGUP_STOP_DHCP), bringup_dhcp },
+};
 
-	pr_info("[RKWIFI] start_wpa_supplicant wpa_pid: %d, monitor_id: 0x%x\n",
-			get_pid("wpa_supplicant"), start_wifi_monitor_threadId);
+static int wifi_bringup(void)
+{
+	int count = sizeof(bringup_steps) / sizeof(bringup_steps[0]);
+	wifi_bringup_timing_t timing[WIFI_BRINGUP_MAX_STEPS];
+	struct timeval start, end;
+
+	gettimeofday(&start, NULL);
+	wifi_bringup_run(bringup_steps, count, timing);
+	gettimeofday(&end, NULL);
+
+	pthread_mutex_lock(&bringup_lock);
+	memcpy(bringup_timing, timing, sizeof(timing[0]) * count);
+	bringup_count = count;
+	bringup_total_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+	pthread_mutex_unlock(&bringup_lock);
+
+	/* dhcpcd can be retried later, without a supplicant there is no wifi */
+	return timing[BRINGUP_SUPPLICANT].result;
+}
+
+int RK_wifi_get_bringup_time(RK_WIFI_BRINGUP_TIME_s *pTime)
+{
+	if (!pTime)
+		return -1;
+
+	memset(pTime, 0, sizeof(*pTime));
+	pthread_mutex_lock(&bringup_lock);
+	pTime->count = bringup_count;
+	pTime->total_ms = bringup_total_ms;
+	for (int i = 0; i < bringup_count && i < RK_WIFI_BRINGUP_STEPS_MAX; i++) {
+		snprintf(pTime->steps[i].name, sizeof(pTime->steps[i].name), "%s", bringup_timing[i].name);
+		pTime->steps[i].result = bringup_timing[i].result;
+		pTime->steps[i].start_ms = bringup_timing[i].start_ms;
+		pTime->steps[i].time_ms = bringup_timing[i].time_ms;
+	}
+	pthread_mutex_unlock(&bringup_lock);
+
+	return pTime->total_ms < 0 ? -1 : 0;
+}
+
+int RK_wifi_enable(const int enable)
+{
+	pr_info("[RKWIFI] start_wpa_supplicant wpa_pid: %d, state: %s\n",
+			get_pid("wpa_supplicant"), wifi_sm_state_name(wifi_sm_state()));
 
 	pr_info("+++++ wifi version: %s +++++\n", RK_WIFI_VERSION);
 
 	if (enable) {
 		if (!is_wifi_enable()) {
-			//exec_command_system("ifconfig wlan0 down");
-			exec_command_system("ifconfig wlan0 up");
-			exec_command_system("ifconfig wlan0 0.0.0.0");
-			exec_command_system("killall dhcpcd");
-			exec_command_system("killall dnsmasq");
-
-			if (get_pid("wpa_supplicant") > 0) {
-				//exec_command_system("killall udhcpc");
-				exec_command_system("killall wpa_supplicant");
-				usleep(600000);
+			if (wifi_bringup() != 0) {
+				pr_err("RK_wifi_enable: wpa_supplicant didn't come up\n");
+				return -1;
 			}
-			exec_command_system("wpa_supplicant -B -i wlan0 -c /data/cfg/wpa_supplicant.conf -d");
-			usleep(100000);
-			//exec_command_system("udhcpc -i wlan0 -t 5 &");
-			exec_command_system("dhcpcd wlan0 -AL -t 0 &");
 
 			gstate = RK_WIFI_State_OPEN;
 			wifi_state_send(gstate, NULL);
 
-			pthread_create(&start_wifi_monitor_threadId, nullptr, RK_wifi_start_monitor, nullptr);
-			pthread_detach(start_wifi_monitor_threadId);
+			wifi_monitor_start();
 
 			pr_info("RK_wifi_enable enable ok!\n");
 		}
 	} else {
 		if (is_wifi_enable()) {
-			exec_command_system("ifconfig wlan0 down");
-			exec_command_system("killall wpa_supplicant");
-			//exec_command_system("killall udhcpc");
-			usleep(600000);
-			if (start_wifi_monitor_threadId > 0) {
-				pthread_cancel(start_wifi_monitor_threadId);
-				pthread_join(start_wifi_monitor_threadId, NULL);
-			}
-			start_wifi_monitor_threadId = 0;
+			/* detach while the supplicant is still there to answer */
+			wifi_monitor_stop();
+			netif_set_link("wlan0", false);
+			kill_task_timeout("wpa_supplicant", 2000);
+			wpa_ctrl_channel_close();
+			wifi_scan_cache_invalidate();
+			wifi_fast_reconnect_cancel();
 
 			gstate = RK_WIFI_State_OFF;
 			wifi_state_send(gstate, NULL);
@@ -716,17 +592,13 @@ int RK_wifi_enable(const int enable)
 
 int RK_wifi_scan(void)
 {
-	int ret;
-	char str[32];
-
-	memset(str, 0, sizeof(str));
-	ret = exec("wpa_cli -iwlan0 scan", str);
+	std::string reply;
 
-	if (0 != ret)
+	if (wpa_ctrl_channel_request("SCAN", reply) != 0)
 		return -1;
 
-	if (0 != strncmp(str, "OK", 2) &&  0 != strncmp(str, "ok", 2)) {
-		pr_info("scan error: %s\n", str);
+	if (0 != reply.compare(0, 2, "OK")) {
+		pr_info("scan error: %s\n", reply.c_str());
 		return -2;
 	}
 
@@ -738,193 +610,132 @@ char* RK_wifi_scan_r(void)
 	return RK_wifi_scan_r_sec(0x1F);
 }
 
-char* RK_wifi_scan_r_sec(const unsigned int cols)
+/* the reply JSON is built here and copied out once, the buffer keeps its capacity */
+static pthread_mutex_t m_scan_json_lock = PTHREAD_MUTEX_INITIALIZER;
+static rapidjson::StringBuffer m_scan_json;
+
+typedef struct {
+	rapidjson::Writer<rapidjson::StringBuffer> *writer;
+	unsigned int cols;
+} scan_json_ctx_t;
+
+static bool bss_to_json(const wifi_bss_t *bss, void *arg)
 {
-	char line[256], utf[256];
-	char item[384];
-	char col[128];
-	char *scan_r, *p_strtok;
-	size_t size = 0, index = 0;
-	static size_t UNIT_SIZE = 512;
-	FILE *fp = NULL;
-	int is_utf8;
-	int is_nonpsk;
+	scan_json_ctx_t *ctx = (scan_json_ctx_t *) arg;
+	rapidjson::Writer<rapidjson::StringBuffer> *writer = ctx->writer;
+
+	// if convert gbk to utf8 failed, ignore it
+	if (!bss->ssid.empty() && bss->utf8.empty())
+		return true;
 
-	if (!(cols & 0x1F)) {
-		scan_r = (char*) malloc(3 * sizeof(char));
-		memset(scan_r, 0, 3);
-		strcpy(scan_r, "[]");
-		pr_err("_scan_r: %s\n");
-		return scan_r;
+	writer->StartObject();
+	if (ctx->cols & 0x01) {
+		writer->Key("bssid");
+		writer->String(bss->bssid.c_str(), bss->bssid.size());
+	}
+	if (ctx->cols & 0x02) {
+		writer->Key("frequency");
+		writer->Int(bss->frequency);
+	}
+	if (ctx->cols & 0x04) {
+		writer->Key("rssi");
+		writer->Int(bss->level);
+	}
+	if (ctx->cols & 0x08) {
+		writer->Key("flags");
+		writer->String(bss->flags.c_str(), bss->flags.size());
+	}
+	if (ctx->cols & 0x10) {
+		writer->Key("ssid");
+		writer->String(bss->utf8.c_str(), bss->utf8.size());
 	}
+	writer->EndObject();
 
-	remove("/tmp/scan_r.tmp");
-	exec_command_system("wpa_cli -iwlan0 scan_r > /tmp/scan_r.tmp");
+	return true;
+}
 
-	fp = fopen("/tmp/scan_r.tmp", "r");
-	if (!fp) {
-		pr_err("open /tmp/scan_r.tmp fail!!!\n");
-		return NULL;
+char* RK_wifi_scan_r_sec(const unsigned int cols)
+{
+	scan_json_ctx_t ctx;
+	char *scan_r;
+
+	/* the BSS table follows every scan_results fetch and BSS event */
+	if (!(cols & 0x1F) || wifi_scan_cache_refresh() != 0) {
+		if (cols & 0x1F)
+			pr_info("%s: no scan results yet\n", __func__);
+		return strdup("[]");
 	}
 
-	memset(line, 0, sizeof(line));
-	fgets(line, sizeof(line), fp);
+	pthread_mutex_lock(&m_scan_json_lock);
+	m_scan_json.Clear();
+	rapidjson::Writer<rapidjson::StringBuffer> writer(m_scan_json);
+	ctx.writer = &writer;
+	ctx.cols = cols;
 
-	size += UNIT_SIZE;
-	scan_r = (char*) malloc(size * sizeof(char));
-	memset(scan_r, 0, size);
-	strcat(scan_r, "[");
+	writer.StartArray();
+	wifi_bss_table_foreach(bss_to_json, &ctx);
+	writer.EndArray();
 
-	m_gbk_head = encode_gbk_reset(m_gbk_head);
-	m_nonpsk_head = encode_gbk_reset(m_nonpsk_head);
-	while (fgets(line, sizeof(line) - 1, fp)) {
-		index = 0;
-		is_nonpsk = 0;
-		p_strtok = strtok(line, "\t");
-		memset(item, 0, sizeof(item));
-		strcat(item, "{");
-		while (p_strtok) {
-			if (p_strtok[strlen(p_strtok) - 1] == '\n')
-				p_strtok[strlen(p_strtok) - 1] = '\0';
-			if ((cols & (1 << index)) || 3 == index) {
-				memset(col, 0, sizeof(col));
-				if (0 == index) {
-					snprintf(col, sizeof(col), "\"bssid\":\"%s\",", p_strtok);
-				} else if (1 == index) {
-					snprintf(col, sizeof(col), "\"frequency\":%d,", atoi(p_strtok));
-				} else if (2 == index) {
-					snprintf(col, sizeof(col), "\"rssi\":%d,", atoi(p_strtok));
-				} else if (3 == index) {
-					if (cols & (1 << index)) {
-						snprintf(col, sizeof(col), "\"flags\":\"%s\",", p_strtok);
-					}
-					if (!strstr(p_strtok, "WPA") && !strstr(p_strtok, "WEP")) {
-						is_nonpsk = 1;
-					}
-				} else if (4 == index) {
-					char utf8[strlen(p_strtok) + 1];
-					memset(utf8, 0, sizeof(utf8));
-
-					if (strlen(p_strtok) > 0) {
-						char dst[strlen(p_strtok) + 1];
-						memset(dst, 0, sizeof(dst));
-						spec_char_convers(p_strtok, dst);
-
-						// Strings that will send should retain escape characters
-						// Strings whether GBK or UTF8 that need save local should remove escape characters
-						// The ssid can't contains escape character while do connect
-						is_utf8 = RK_encode_is_utf8(dst, strlen(dst));
-						char utf8_noescape[sizeof(utf8)];
-						char dst_noescape[sizeof(utf8)];
-						memset(utf8_noescape, 0, sizeof(utf8_noescape));
-						memset(dst_noescape, 0, sizeof(dst_noescape));
-						if (!is_utf8) {
-							RK_encode_gbk_to_utf8(dst, strlen(dst), utf8);
-							remove_escape_character(dst, dst_noescape);
-							remove_escape_character(utf8, utf8_noescape);
-							m_gbk_head = encode_gbk_insert(m_gbk_head, dst_noescape, utf8_noescape);
-
-							// if convert gbk to utf8 failed, ignore it
-							if (!RK_encode_is_utf8(utf8, strlen(utf8))) {
-								continue;
-							}
-						} else {
-							strncpy(utf8, dst, strlen(dst));
-							remove_escape_character(dst, dst_noescape);
-							remove_escape_character(utf8, utf8_noescape);
-						}
-
-						// Decide whether encrypted or not
-						if (is_nonpsk) {
-							m_nonpsk_head = encode_gbk_insert(m_nonpsk_head, dst_noescape, utf8_noescape);
-						}
-					}
-					snprintf(col, sizeof(col), "\"ssid\":\"%s\",", utf8);
-				}
-				strcat(item, col);
-			}
-			p_strtok = strtok(NULL, "\t");
-			index++;
-		}
-		if (item[strlen(item) - 1] == ',') {
-			item[strlen(item) - 1] = '\0';
-		}
-		strcat(item, "},");
+	scan_r = (char *) malloc(m_scan_json.GetSize() + 1);
+	if (scan_r)
+		memcpy(scan_r, m_scan_json.GetString(), m_scan_json.GetSize() + 1);
+	pthread_mutex_unlock(&m_scan_json_lock);
 
-		if (size <= (strlen(scan_r) + strlen(item)) + 3) {
-			size += UNIT_SIZE;
-			scan_r = (char*) realloc(scan_r, sizeof(char) * size);
-		}
-		strcat(scan_r, item);
-	}
-	if (scan_r[strlen(scan_r) - 1] == ',') {
-		scan_r[strlen(scan_r) - 1] = '\0';
-	}
-	strcat(scan_r, "]");
-	fclose(fp);
-	pr_err("__scan_r: %s\n");
 	return scan_r;
 }
 
 static int add_network()
 {
-	char ret[8];
+	std::string reply;
 
-	memset(ret, 0, sizeof(ret));
-	exec("wpa_cli -iwlan0 add_network", ret);
+	if (wpa_ctrl_channel_request("ADD_NETWORK", reply) != 0 || reply.empty())
+		return -1;
 
-	if (0 == strlen(ret))
+	if (reply.compare(0, 4, "FAIL") == 0)
 		return -1;
 
-	return atoi(ret);
+	return atoi(reply.c_str());
 }
 
 static int set_network(const int id, const char* ssid, const char* psk, const RK_WIFI_CONNECTION_Encryp_e encryp)
 {
-	int ret;
-	char str[8];
 	char cmd[512];
 	char wifi_ssid[512];
-	char wifi_psk[512];
+	std::vector<std::string> cmds, replies;
+	std::vector<int> errs;
 
 	strcpy(wifi_ssid, ssid);
-	strcpy(wifi_psk, psk);
 
-	// 1. set network ssid
-	memset(str, 0, sizeof(str));
-	memset(cmd, 0, sizeof(cmd));
+	// 1. set network ssid, hex so any byte survives
 	format_wifiinfo(0, wifi_ssid);
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d ssid %s", id, wifi_ssid);
-	ret = exec(cmd, str);
-	if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
-		return -1;
+	snprintf(cmd, sizeof(cmd), "SET_NETWORK %d ssid %s", id, wifi_ssid);
+	cmds.push_back(cmd);
+	errs.push_back(-1);
 
 	// 2. set network psk
-	memset(str, 0, sizeof(str));
-	memset(cmd, 0, sizeof(cmd));
 	if (strlen(psk) == 0 && encryp == NONE) {
-		snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d key_mgmt NONE", id);
-		ret = exec(cmd, str);
-		if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
-			return -2;
+		snprintf(cmd, sizeof(cmd), "SET_NETWORK %d key_mgmt NONE", id);
+		cmds.push_back(cmd);
+		errs.push_back(-2);
 	}  else if (encryp == WEP) {
-		snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d key_mgmt NONE", id);
-		ret = exec(cmd, str);
-		if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
-			return -41;
-
-		memset(str, 0, sizeof(str));
-		memset(cmd, 0, sizeof(cmd));
-		snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d wep_key0 \\\"%s\\\"", id, psk);
-		ret = exec(cmd, str);
-		if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
-			return -42;
+		snprintf(cmd, sizeof(cmd), "SET_NETWORK %d key_mgmt NONE", id);
+		cmds.push_back(cmd);
+		errs.push_back(-41);
+
+		snprintf(cmd, sizeof(cmd), "SET_NETWORK %d wep_key0 \"%s\"", id, psk);
+		cmds.push_back(cmd);
+		errs.push_back(-42);
 	} else if (strlen(psk) || encryp == WPA) {
-		format_wifiinfo(1, wifi_psk);
-		snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d psk \\\"%s\\\"", id, wifi_psk);
-		ret = exec(cmd, str);
-		if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
-			return -3;
+		// the supplicant takes everything up to the last quote, no escaping needed
+		snprintf(cmd, sizeof(cmd), "SET_NETWORK %d psk \"%s\"", id, psk);
+		cmds.push_back(cmd);
+		errs.push_back(-3);
+	}
+
+	wpa_ctrl_channel_pipeline(cmds, replies);
+	for (size_t i = 0; i < cmds.size(); i++) {
+		if (i >= replies.size() || 0 != replies[i].compare(0, 2, "OK"))
+			return errs[i];
 	}
 
 	return 0;
@@ -932,33 +743,12 @@ static int set_network(const int id, const char* ssid, const char* psk, const RK
 
 static int set_hide_network(const int id)
 {
-	int ret;
-	char str[8];
-	char cmd[128];
-
-	memset(str, 0, sizeof(str));
-	memset(cmd, 0, sizeof(cmd));
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d scan_ssid %d", id, 1);
-	ret = exec(cmd, str);
-
-	if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
-		return -1;
-
-	return 0;
+	return wpa_ctrl_channel_cmd("SET_NETWORK %d scan_ssid %d", id, 1);
 }
 
 static int clear_bssid_network(const int id)
 {
-	int ret;
-	char str[8];
-	char cmd[128];
-
-	memset(str, 0, sizeof(str));
-	memset(cmd, 0, sizeof(cmd));
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 bssid %d 00:00:00:00:00:00", id);
-	ret = exec(cmd, str);
-
-	if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2)) {
+	if (wpa_ctrl_channel_cmd("BSSID %d 00:00:00:00:00:00", id) != 0) {
 		pr_err("clear_bssid_network fail!\n");
 		return -1;
 	}
@@ -968,94 +758,14 @@ static int clear_bssid_network(const int id)
 
 static int select_network(const int id)
 {
-	int ret;
-	char str[8];
-	char cmd[128];
-
 	clear_bssid_network(id);
 
-	memset(str, 0, sizeof(str));
-	memset(cmd, 0, sizeof(cmd));
-	memset(retry_connect_cmd, 0, sizeof(retry_connect_cmd));
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 select_network %d", id);
-	snprintf(retry_connect_cmd, sizeof(retry_connect_cmd), "wpa_cli -iwlan0 select_network %d", id);
-	ret = exec(cmd, str);
-
-	if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
-		return -1;
-
-	return 0;
+	return wpa_ctrl_channel_cmd("SELECT_NETWORK %d", id);
 }
 
 static int enable_network(const int id)
 {
-	int ret;
-	char str[8];
-	char cmd[128];
-
-	memset(str, 0, sizeof(str));
-	memset(cmd, 0, sizeof(cmd));
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 enable_network %d", id);
-	ret = exec(cmd, str);
-
-	if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
-		return -1;
-
-	return 0;
-}
-
-#define WIFI_CONNECT_RETRY 50
-static bool check_wifi_isconnected(void) {
-
-	pr_info("check_wifi_isconnected\n");
-	bool isWifiConnected = false;
-	int connect_retry_count = WIFI_CONNECT_RETRY;
-	RK_WIFI_INFO_Connection_s wifiinfo;
-	int flag = 1;
-
-	for (int i = 0; i < connect_retry_count; i++) {
-		sleep(1);
-		memset(&wifiinfo, 0, sizeof(RK_WIFI_INFO_Connection_s));
-		RK_wifi_running_getConnectionInfo(&wifiinfo);
-		if (strncmp(wifiinfo.wpa_state, "COMPLETED", 9) == 0) {
-			if ((strlen(wifiinfo.ip_address) != 0) &&
-				strncmp(wifiinfo.ip_address, "127.0.0.1", 9) != 0) {
-				isWifiConnected = true;
-				pr_info("wifi is connected.\n");
-				break;
-			} else {
-				if ((!(i%30)) || flag) {
-					flag = 0;
-					//exec_command_system("killall udhcpc");
-					//usleep(300000);
-					//exec_command_system("udhcpc -i wlan0 -t 10 &");
-					exec_command_system("killall dhcpcd");
-					usleep(300000);
-					exec_command_system("dhcpcd wlan0 -AL -t 0 &");
-				}
-			}
-		}
-
-		pr_info("Check wifi state with none state. try more %d/%d, \n", i + 1, WIFI_CONNECT_RETRY);
-
-		if (wifi_wrong_key == true) {
-			pr_info("check_wifi_isconnected is wifi_wrong_key break.\n");
-			break;
-		}
-
-		if (wifi_cancel == true) {
-			exec_command_system("wpa_cli flush");
-			exec_command_system("wpa_cli reconfigure");
-			exec_command_system("wpa_cli -iwlan0 disable_network all");
-			wifi_cancel = false;
-			break;
-		}
-	}
-
-	if (!isWifiConnected)
-		pr_info("wifi is not connected.\n");
-
-	return isWifiConnected;
+	return wpa_ctrl_channel_cmd("ENABLE_NETWORK %d", id);
 }
 
 static void format_wifiinfo(int flag, char *info)
@@ -1081,152 +791,112 @@ static void format_wifiinfo(int flag, char *info)
 	}
 }
 
-static int set_priority_network(const int id, int priority)
-{
-	int ret;
-	char str[8];
-	char cmd[128];
-
-	memset(str, 0, sizeof(str));
-	memset(cmd, 0, sizeof(cmd));
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d priority %d", id, priority);
-	ret = exec(cmd, str);
-
-	if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
-		return -1;
-
-	return 0;
-}
-
 static void set_network_highest_priority(const int id)
 {
-	char str[128];
-	int cnt;
-	int network_id;
-	char cmd[128];
-
-	exec("wpa_cli -i wlan0 list_network | wc -l", str);
-	cnt = atoi(str) - 1;
-	pr_info("wifi cnt: %d(%s)\n", cnt, str);
+	RK_WIFI_SAVED_INFO wsi;
+	std::vector<std::string> cmds, replies;
+	char cmd[64];
 
-	for (int i = 0; i < cnt; i++) {
-		snprintf(cmd, sizeof(cmd), "wpa_cli -i wlan0 list_network | awk '{print $1}' | sed -n %dp", i+2);
-		exec(cmd, str);
-		network_id = atoi(str);
+	if (RK_wifi_getSavedInfo(&wsi) != 0)
+		return;
 
-		if (network_id == id)
-			set_priority_network(network_id, cnt);
-		else
-			set_priority_network(network_id, 1);
+	for (int i = 0; i < wsi.count; i++) {
+		snprintf(cmd, sizeof(cmd), "SET_NETWORK %d priority %d", wsi.save_info[i].id,
+				wsi.save_info[i].id == id ? wsi.count : 1);
+		cmds.push_back(cmd);
 	}
+
+	if (wpa_ctrl_channel_pipeline(cmds, replies) != (int) cmds.size())
+		pr_err("%s: set priority failed\n", __func__);
 }
 
 static int save_configuration()
 {
-	exec_command_system("wpa_cli -iwlan0 enable_network all");
-	exec_command_system("wpa_cli -iwlan0 save_config");
-	exec_command_system("sync");
+	std::vector<std::string> cmds, replies;
 
-	return 0;
-}
+	cmds.push_back("ENABLE_NETWORK all");
+	cmds.push_back("SAVE_CONFIG");
+	wpa_ctrl_channel_pipeline(cmds, replies);
+	sync();
 
-static void check_ping_test()
-{
-	char line[1024];
-	int ping_retry = 10;
-	int dns_retry;
-
-	while (ping_retry--) {
-		dns_retry = 5;
-		memset(line, 0, sizeof(line));
-		pr_info("check dns\n");
-		while (dns_retry--) {
-			exec("cat /etc/resolv.conf", line);
-			if (strstr(line, "nameserver"))
-				break;
-			sleep(1);
-		}
-		pr_info("dns ok: %s\n", line);
-		pr_info("to ping\n");
-		sync();
-		sleep(1);
-		memset(line, 0, sizeof(line));
-		exec("ping www.baidu.com -c 1", line);
-		//RK_shell_exec("ping 8.8.8.8 -c 1", line, sizeof(line));
-		//usleep(100000);
-		pr_info("line: %s\n", line);
-		//if (strstr(line, "PING www.baidu.com") && strstr(line, "bytes from")) {
-		//if (strstr(line, "PING 8.8.8.8") && strstr(line, "bytes from")) {
-		if (strstr(line, "bytes from")) {
-			pr_info("ping ok\n");
-			break;
-		}
-		usleep(200000);
-	}
+	return 0;
 }
 
-static void wifi_connectfail_process(int id)
+static void wifi_connectfail_process(int id, bool saved)
 {
-	char str[128];
-	char cmd1[128];
-	char cmd2[128];
-
-	memset(str, 0, sizeof(str));
-	memset(cmd1, 0, sizeof(cmd1));
-
-	snprintf(cmd1, sizeof(cmd1), "wpa_cli -iwlan0 disable_network %d", id);
-	snprintf(cmd2, sizeof(cmd2), "wpa_cli -iwlan0 remove_network %d", id);
-
-	if (wifi_is_exist == true) {
-		exec(cmd1, str);
+	if (saved) {
+		wpa_ctrl_channel_cmd("DISABLE_NETWORK %d", id);
 	} else {
-		exec(cmd2, str);
+		wpa_ctrl_channel_cmd("REMOVE_NETWORK %d", id);
 	}
 	//exec_command_system("wpa_cli flush");
 	//exec_command_system("wpa_cli reconfigure");
 	//exec_command_system("wpa_cli reconnect");
 }
 
-static void* wifi_connect_state_check(void *arg)
+/* the address may have come before we looked, otherwise rtnetlink reports it */
+static void wifi_check_ip(bool requested)
 {
-	RK_WIFI_RUNNING_State_e state = -1;
-	bool isconnected;
-	RK_WIFI_INFO_Connection_s cndinfo;
-	int id = *((int *)arg);
-
-	prctl(PR_SET_NAME,"wifi_connect_state_check");
-	pr_info("[%s]\n", __func__);
+	RK_WIFI_INFO_Connection_s info;
 
-	isconnected = check_wifi_isconnected();
+	memset(&info, 0, sizeof(info));
+	RK_wifi_running_getConnectionInfo(&info);
+	if (strlen(info.ip_address) && strncmp(info.ip_address, "127.0.0.1", 9) != 0) {
+		wifi_sm_post(WIFI_SM_EV_IP_READY);
+		return;
+	}
 
-	if (isconnected == 1) {
-		char cmd[128];
-		char str[8];
-		RK_WIFI_SAVED_INFO wsi;
+	/* a fresh association asked for by the user gets a fresh lease */
+	if (requested) {
+		//exec_command_system("udhcpc -i wlan0 -t 10 &");
+		kill_task_timeout("dhcpcd", 1000);
+		exec_command_system("dhcpcd wlan0 -AL -t 0 &");
+	}
+}
 
-		//RK_wifi_running_getConnectionInfo(&cndinfo);
-		//snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 bssid %d %s", cndinfo.id, cndinfo.bssid);
-		//exec(cmd, str);
-		//pr_info("set bssid: %s\n", cmd);
+/* feed an event to the state machine and do what the transition asks */
+static void wifi_sm_post(wifi_sm_event_e ev, int id, bool saved)
+{
+	wifi_sm_step_t step;
 
-		RK_wifi_getSavedInfo(&wsi);
+	wifi_sm_event(ev, id, saved, &step);
+	if (step.from != step.to || step.actions)
+		pr_info("[RKWIFI] %s: %s -> %s on %s, actions 0x%x\n", __func__,
+				wifi_sm_state_name(step.from), wifi_sm_state_name(step.to),
+				wifi_sm_event_name(ev), step.actions);
 
+	if (step.actions & WIFI_SM_ACT_ABORT) {
+		wpa_ctrl_channel_cmd("FLUSH");
+		wpa_ctrl_channel_cmd("RECONFIGURE");
+		wpa_ctrl_channel_cmd("DISABLE_NETWORK all");
+	}
+	if (step.actions & WIFI_SM_ACT_GIVE_UP)
+		wifi_connectfail_process(step.id, step.saved);
+	if (step.actions & WIFI_SM_ACT_FAILED)
+		wifi_state_send(RK_WIFI_State_CONNECTFAILED, NULL);
+	if (step.actions & WIFI_SM_ACT_ONLINE) {
 		save_configuration();
-		check_ping_test();
-		state = RK_WIFI_State_DHCP_OK;
-	} else {
-		if (wifi_wrong_key == false)
-			state = RK_WIFI_State_CONNECTFAILED;
-		wifi_connectfail_process(id);
+		wifi_state_send(RK_WIFI_State_DHCP_OK, NULL);
 	}
+	if (step.actions & WIFI_SM_ACT_CHECK_IP)
+		wifi_check_ip(step.id >= 0);
+}
 
-	wifi_is_exist = false;
+/* deadline of a connect request passed, unless its events went missing */
+static void wifi_connect_timeout(void)
+{
+	RK_WIFI_INFO_Connection_s info;
 
-	if (state < 0)
-		return NULL;
+	memset(&info, 0, sizeof(info));
+	RK_wifi_running_getConnectionInfo(&info);
+	if (strncmp(info.wpa_state, "COMPLETED", 9) == 0 && strlen(info.ip_address) &&
+			strncmp(info.ip_address, "127.0.0.1", 9) != 0) {
+		wifi_sm_post(WIFI_SM_EV_CONNECTED);
+		return;
+	}
 
-	wifi_state_send(state, NULL);
-	return NULL;
+	pr_info("wifi is not connected.\n");
+	wifi_sm_post(WIFI_SM_EV_TIMEOUT);
 }
 
 void save_connect_info(char* ssid, char *bssid)
@@ -1270,7 +940,8 @@ int RK_wifi_connect(const char* ssid, const char* psk)
 int RK_wifi_connect1(const char* ssid, const char* psk, const RK_WIFI_CONNECTION_Encryp_e encryp, const int hide)
 {
 	int id, ret;
-	char ori[strlen(ssid) + 1];
+	std::string ori;
+	bool is_open = false;
 
 	if(!ssid) {
 		pr_err("%s: invalid ssid\n", __func__);
@@ -1280,16 +951,14 @@ int RK_wifi_connect1(const char* ssid, const char* psk, const RK_WIFI_CONNECTION
 
 	save_connect_info(ssid, NULL);
 	wifi_state_send(RK_WIFI_State_CONNECTING, NULL);
+	wifi_fast_reconnect_begin(false);
 
-	exec_command_system("wpa_cli -iwlan0 disable_network all");
-	wifi_wrong_key = false;
-	usleep(100000);
+	wpa_ctrl_channel_cmd("DISABLE_NETWORK all");
 
 	if (save_last_ap) {
 		exec_command_system("cp /data/cfg/wpa_supplicant.conf /data/cfg/wpa_supplicant.conf.bak");
-		exec_command_system("wpa_cli flush");
-		sleep(100000);
-		exec_command_system("wpa_cli save_config");
+		wpa_ctrl_channel_cmd("FLUSH");
+		wpa_ctrl_channel_cmd("SAVE_CONFIG");
 	}
 
 	if ((id = RK_wifi_search_with_ssid(ssid)) < 0) {
@@ -1300,29 +969,27 @@ int RK_wifi_connect1(const char* ssid, const char* psk, const RK_WIFI_CONNECTION
 		}
 	}
 
-	connecting_id = id;
-
-	memset(ori, 0, sizeof(ori));
-	if ((psk == NULL) || is_non_psk(ssid)) {
+	/* configure the octets the AP broadcasts, which may be GBK */
+	if (!wifi_bss_lookup_ssid(ssid, &ori, &is_open))
+		ori = ssid;
+	if ((psk == NULL) || is_open) {
 		pr_info("%s: is none psk, ssid:\"%s\" ssid_len:%lu\n", __func__, ssid, strlen(ssid));
-		get_encode_gbk_ori(m_nonpsk_head, ssid, ori);
 
-		ret = set_network(id, ori, "", NONE);
+		ret = set_network(id, ori.c_str(), "", NONE);
 		if (0 != ret) {
 			pr_info("%s: set_network failed. ssid:\"%s\"\n", __func__, ssid);
 			goto fail;
 		}
 	} else {
 		pr_info("%s: ssid:\"%s\" ssid_len:%lu; psk:\"%s\", encryp: %d.\n", __func__, ssid, strlen(ssid), psk, encryp);
-		get_encode_gbk_ori(m_gbk_head, ssid, ori);
 
-		ret = set_network(id, ori, psk, encryp);
+		ret = set_network(id, ori.c_str(), psk, encryp);
 		if (0 != ret) {
 			pr_info("%s: set_network failed. ssid:\"%s\", psk:\"%s\"\n", __func__, ssid, psk);
 			goto fail;
 		}
 	}
-	pr_info("%s: ori:\"%s\" ori_len:%lu\n", __func__, ori, strlen(ori));
+	pr_info("%s: ori:\"%s\" ori_len:%lu\n", __func__, ori.c_str(), ori.size());
 
 	set_network_highest_priority(id);
 
@@ -1332,6 +999,10 @@ int RK_wifi_connect1(const char* ssid, const char* psk, const RK_WIFI_CONNECTION
 		goto fail;
 	}
 
+	/* before the supplicant can report anything about it */
+	wifi_monitor_start();
+	wifi_sm_post(WIFI_SM_EV_CONNECT, id, false);
+
 	ret = select_network(id);
 	if (0 != ret) {
 		pr_err("%s: select_network id: %d failed!\n", __func__, id);
@@ -1344,21 +1015,16 @@ int RK_wifi_connect1(const char* ssid, const char* psk, const RK_WIFI_CONNECTION
 		goto fail;
 	}
 
-	pthread_t pth;
-	pthread_create(&pth, NULL, wifi_connect_state_check, &connecting_id);
-
 	return 0;
 
 fail:
-	wifi_state_send(RK_WIFI_State_CONNECTFAILED, NULL);
+	wifi_sm_post(WIFI_SM_EV_CONNECT_ERROR);
 	return -1;
 }
 
 int RK_wifi_forget_with_ssid(const char *ssid)
 {
 	int id, ret;
-	char cmd[64];
-	char str[8];
 
 	pr_info("[%s]: ssid %s\n", __func__, ssid);
 
@@ -1373,23 +1039,20 @@ int RK_wifi_forget_with_ssid(const char *ssid)
 		return -1;
 	}
 
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 remove_network %d", id);
-	ret = exec(cmd, str);
-	pr_info("[%s]: ret: %s\n", __func__, ret);
+	ret = wpa_ctrl_channel_cmd("REMOVE_NETWORK %d", id);
+	pr_info("[%s]: ret: %d\n", __func__, ret);
 
-	if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
+	if (0 != ret)
 		return -1;
 
-	exec_command_system("wpa_cli -iwlan0 save");
+	wpa_ctrl_channel_cmd("SAVE_CONFIG");
 
 	return 0;
 }
 
 int RK_wifi_forget_with_bssid(const char *bssid)
 {
-	int id, ret;
-	char cmd[64];
-	char str[8];
+	int id;
 
 	if(!bssid) {
 		pr_err("%s: bssid is null\n", __func__);
@@ -1407,48 +1070,30 @@ int RK_wifi_forget_with_bssid(const char *bssid)
 		return -1;
 	}
 	
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 remove_network %d", id);
-	ret = exec(cmd, str);
-
-	if (0 != ret || 0 == strlen(str) || 0 != strncmp(str, "OK", 2))
+	if (0 != wpa_ctrl_channel_cmd("REMOVE_NETWORK %d", id))
 		return -1;
 
-	exec_command_system("wpa_cli -iwlan0 save");
-	exec_command_system("sync");
+	wpa_ctrl_channel_cmd("SAVE_CONFIG");
+	sync();
 
 	return 0;
 }
 
 int RK_wifi_cancel(void)
 {
-	int timeout = 8;
-
-	if (wifi_connect_lock == false) {
+	if (!wifi_sm_connecting()) {
 		pr_info("wifi dont connecting!");
 		return -1;
 	}
 
-	wifi_cancel = true;
-
-	while (timeout--) {
-		if (wifi_cancel == false)
-			break;
-		sleep(1);
-	}
-
-	if (wifi_cancel == false)
-		return 0;
-	else
-		return -1;
+	wifi_sm_post(WIFI_SM_EV_CANCEL);
+	return 0;
 }
 
 int RK_wifi_connect_with_ssid(const char *ssid)
 {
 	int id, ret;
 
-	wifi_wrong_key = false;
-	wifi_is_exist = true;
-
 	pr_err("%s: %s\n", __func__, ssid);
 
 	if(!ssid) {
@@ -1462,12 +1107,15 @@ int RK_wifi_connect_with_ssid(const char *ssid)
 		goto fail;
 	}
 
-	connecting_id = id;
-
 	save_connect_info(NULL, ssid);
 	wifi_state_send(RK_WIFI_State_CONNECTING, NULL);
+	wifi_fast_reconnect_begin(false);
+
+	wpa_ctrl_channel_cmd("DISABLE_NETWORK all");
 
-	exec_command_system("wpa_cli -iwlan0 disable_network all");
+	/* saved network: on failure disable it, don't remove it */
+	wifi_monitor_start();
+	wifi_sm_post(WIFI_SM_EV_CONNECT, id, true);
 
 	ret = select_network(id);
 	if (0 != ret) {
@@ -1483,14 +1131,10 @@ int RK_wifi_connect_with_ssid(const char *ssid)
 		goto fail;
 	}
 
-	pthread_t pth;
-	pthread_create(&pth, NULL, wifi_connect_state_check, &connecting_id);
-
 	return 0;
 
 fail:
-	wifi_state_send(RK_WIFI_State_CONNECTFAILED, NULL);
-	wifi_is_exist = false;
+	wifi_sm_post(WIFI_SM_EV_CONNECT_ERROR);
 	return -1;
 }
 
@@ -1498,8 +1142,6 @@ int RK_wifi_connect_with_bssid(const char *bssid)
 {
 	int id, ret;
 
-	wifi_wrong_key = false;
-
 	pr_err("%s: %s\n", __func__, bssid);
 
 	if(!bssid) {
@@ -1518,12 +1160,14 @@ int RK_wifi_connect_with_bssid(const char *bssid)
 		return -1;
 	}
 
-	connecting_id = id;
-
 	save_connect_info(NULL, bssid);
 	wifi_state_send(RK_WIFI_State_CONNECTING, NULL);
+	wifi_fast_reconnect_begin(false);
+
+	wpa_ctrl_channel_cmd("DISABLE_NETWORK all");
 
-	exec_command_system("wpa_cli -iwlan0 disable_network all");
+	wifi_monitor_start();
+	wifi_sm_post(WIFI_SM_EV_CONNECT, id, false);
 
 	ret = select_network(id);
 	if (0 != ret) {
@@ -1539,19 +1183,17 @@ int RK_wifi_connect_with_bssid(const char *bssid)
 		goto fail;
 	}
 
-	pthread_t pth;
-	pthread_create(&pth, NULL, wifi_connect_state_check, &connecting_id);
-
 	return 0;
 
 fail:
-	wifi_state_send(RK_WIFI_State_CONNECTFAILED, NULL);
+	wifi_sm_post(WIFI_SM_EV_CONNECT_ERROR);
 	return -1;
 }
 
 int RK_wifi_disconnect_network(void)
 {
-	exec_command_system("wpa_cli -iwlan0 disconnect");
+	wifi_fast_reconnect_hold();
+	wpa_ctrl_channel_cmd("DISCONNECT");
 	return 0;
 }
 
@@ -1582,8 +1224,8 @@ int RK_wifi_get_hostname(char* name, int len)
 int RK_wifi_reset(void)
 {
 	if (get_pid("wpa_supplicant")) {
-		exec_command_system("wpa_cli -i wlan0 flush");
-		exec_command_system("wpa_cli -i wlan0 save");
+		wpa_ctrl_channel_cmd("FLUSH");
+		wpa_ctrl_channel_cmd("SAVE_CONFIG");
 	} else {
 		exec_command_system("rm /data/cfg/wpa_supplicant.conf");
 		exec_command_system("cp /etc/wpa_supplicant.conf /data/cfg/wpa_supplicant.conf");
@@ -1597,9 +1239,9 @@ int RK_wifi_recovery(void)
 		exec_command_system("cp /data/cfg/wpa_supplicant.conf.bak /data/cfg/wpa_supplicant.conf");
 	}
 
-	exec_command_system("wpa_cli -i wlan0 flush");
-	exec_command_system("wpa_cli -i wlan0 reconfigure");
-	exec_command_system("wpa_cli -i wlan0 reconnect");
+	wpa_ctrl_channel_cmd("FLUSH");
+	wpa_ctrl_channel_cmd("RECONFIGURE");
+	wpa_ctrl_channel_cmd("RECONNECT");
 }
 
 int RK_wifi_get_mac(char *wifi_mac)
@@ -1672,6 +1314,42 @@ int RK_wifi_ping(char *address)
 	return rk_ping(address);
 }
 
+/* monitor socket when not the default one, e.g. a test double */
+static char monitor_path[108];
+
+int RK_wifi_set_ctrl_path(const char *path)
+{
+	bool monitoring = wifi_sm_state() != WIFI_SM_OFF;
+
+	/* events of the old supplicant must not drive the new one either */
+	wifi_monitor_stop();
+	wpa_ctrl_channel_set_path(path);
+	snprintf(monitor_path, sizeof(monitor_path), "%s", path ? path : "");
+	/* results of the old supplicant must not leak into the new one */
+	wifi_scan_cache_invalidate();
+	if (path || monitoring)
+		wifi_monitor_start();
+	return 0;
+}
+
+int RK_wifi_fast_reconnect(void)
+{
+	return wifi_fast_reconnect_begin(true);
+}
+
+int RK_wifi_get_connect_time(RK_WIFI_CONNECT_TIME_s *pTime)
+{
+	bool fast;
+
+	if (!pTime)
+		return -1;
+
+	pTime->time_ms = wifi_fast_reconnect_last(&fast);
+	pTime->fast = fast;
+
+	return pTime->time_ms < 0 ? -1 : 0;
+}
+
 #define EVENT_BUF_SIZE 1024
 #define PROPERTY_VALUE_MAX 32
 #define PROPERTY_KEY_MAX 32
@@ -1686,9 +1364,14 @@ static const char IFACE_DIR[]           = "/var/run/wpa_supplicant";
 #define IFNAMELEN                       (sizeof(IFNAME) - 1)
 static struct wpa_ctrl *ctrl_conn;
 static struct wpa_ctrl *monitor_conn;
+static pthread_mutex_t monitor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t monitor_tid;
+static bool monitor_started = false;
+static volatile bool monitor_alive = false;
 #define DBG_NETWORK 1
 
-static int exit_sockets[2];
+static int exit_sockets[2] = {-1, -1};
+static int rtnl_fd = -1;
 static char primary_iface[PROPERTY_VALUE_MAX] = "wlan0";
 
 #define HOSTAPD "hostapd"
@@ -1699,26 +1382,7 @@ static char primary_iface[PROPERTY_VALUE_MAX] = "wlan0";
 #define UDHCPC "udhcpc"
 
 static int get_pid(const char Name[]) {
-    int len;
-    char name[32] = {0};
-    len = strlen(Name);
-    strncpy(name,Name,len);
-    name[31] ='\0';
-    char cmdresult[256] = {0};
-    char cmd[64] = {0};
-    FILE *pFile = NULL;
-    int  pid = 0;
-
-    sprintf(cmd, "pidof %s", name);
-    pFile = popen(cmd, "r");
-    if (pFile != NULL)  {
-        while (fgets(cmdresult, sizeof(cmdresult), pFile)) {
-            pid = atoi(cmdresult);
-            break;
-        }
-        pclose(pFile);
-    }
-    return pid;
+    return get_ps_pid(Name);
 }
 
 static void wifi_close_sockets() {
@@ -1732,14 +1396,9 @@ static void wifi_close_sockets() {
 		monitor_conn = NULL;
 	}
 
-	if (exit_sockets[0] >= 0) {
-		close(exit_sockets[0]);
-		exit_sockets[0] = -1;
-	}
-
-	if (exit_sockets[1] >= 0) {
-		close(exit_sockets[1]);
-		exit_sockets[1] = -1;
+	if (rtnl_fd >= 0) {
+		close(rtnl_fd);
+		rtnl_fd = -1;
 	}
 }
 
@@ -1788,18 +1447,9 @@ static void get_wifi_info_by_event(char *event, RK_WIFI_RUNNING_State_e state, R
 			}
 			len = strlen(start_tag) - strlen(end_tag) - strlen("ssid=\"");
 			char value[128] = {0};
-			char sname[128];
-			char sname1[128];
-			char utf8[128];
-			memset(sname, 0, sizeof(sname));
-			memset(sname1, 0, sizeof(sname));
-			memset(utf8, 0, sizeof(utf8));
-			strncpy(value, start_tag + strlen("ssid=\""), len);
-			spec_char_convers(value, sname);
-			remove_escape_character(sname, sname1);
-			get_encode_gbk_utf8(m_gbk_head, sname1, utf8);
-			pr_info("convers str: %s, sname: %s, ori: %s\n", value, sname1, utf8);
-			strncpy(info->ssid,  utf8, strlen(utf8));
+			strncpy(value, start_tag + strlen("ssid=\""), len < (int)sizeof(value) ? len : sizeof(value) - 1);
+			ssid_to_display(value, info->ssid, sizeof(info->ssid));
+			pr_info("convers str: %s, ssid: %s\n", value, info->ssid);
 		}
 
 		id_tag =  strstr(event, "id=");
@@ -1837,34 +1487,42 @@ static int dispatch_event(char* event)
 {
 	RK_WIFI_INFO_Connection_s info;
 
-	if (strstr(event, "CTRL-EVENT-BSS") || strstr(event, "CTRL-EVENT-TERMINATING"))
+	if (strstr(event, "CTRL-EVENT-BSS")) {
+		wifi_bss_table_on_event(event);
 		return 0;
+	}
+	/* also the ones wifi_wait_on_socket() makes up, which carry IFNAME= */
+	if (strstr(event, WPA_EVENT_TERMINATING)) {
+		pr_info("%s: wifi is WPA_EVENT_TERMINATING!\n", __func__);
+		wifi_close_sockets();
+		return -1;
+	}
 
 	pr_info("%s: %s\n", __func__, event);
 
 	if (str_starts_with(event, (char *)WPA_EVENT_DISCONNECTED)) {
 		pr_info("%s: wifi is disconnect\n", __FUNCTION__);
-		exec_command_system("ip addr flush dev wlan0");
+		netif_flush_ipv4("wlan0");
 		get_wifi_info_by_event(event, RK_WIFI_State_DISCONNECTED, &info);
 		wifi_state_send(RK_WIFI_State_DISCONNECTED, &info);
-		exec_command_system("wpa_cli -i wlan0 reconnect");
+		wifi_sm_post(WIFI_SM_EV_DISCONNECTED);
+		/* try the channel we were just on before scanning every band */
+		wifi_fast_reconnect_on_disconnected();
 	} else if (str_starts_with(event, (char *)WPA_EVENT_CONNECTED)) {
 		pr_info("%s: wifi is connected\n", __func__);
+		wifi_fast_reconnect_on_connected();
 		get_valid_connect_info(&info);
 		wifi_state_send(RK_WIFI_State_CONNECTED, &info);
+		wifi_sm_post(WIFI_SM_EV_CONNECTED);
 	} else if (str_starts_with(event, (char *)WPA_EVENT_SCAN_RESULTS)) {
 		pr_info("%s: wifi event results\n", __func__);
-		exec_command_system("echo 1 > /tmp/scan_r");
+		wifi_scan_cache_on_results();
 		wifi_state_send(RK_WIFI_State_SCAN_RESULTS, NULL);
 	} else if (strstr(event, "reason=WRONG_KEY")) {
-		wifi_wrong_key = true;
 		pr_info("%s: wifi reason=WRONG_KEY \n", __func__);
 		get_wifi_info_by_event(event, RK_WIFI_State_CONNECTFAILED_WRONG_KEY, &info);
 		wifi_state_send(RK_WIFI_State_CONNECTFAILED_WRONG_KEY, &info);
-	} else if (str_starts_with(event, (char *)WPA_EVENT_TERMINATING)) {
-		pr_info("%s: wifi is WPA_EVENT_TERMINATING!\n", __func__);
-		wifi_close_sockets();
-		return -1;
+		wifi_sm_post(WIFI_SM_EV_WRONG_KEY);
 	}
 
 	return 0;
@@ -1881,19 +1539,69 @@ static int check_wpa_supplicant_state() {
 	return 0;
 }
 
+/* RTM_NEWADDR for our interface is the IP_READY event */
+static void wifi_rtnl_recv(void)
+{
+	char buf[4096];
+	unsigned int ifindex = if_nametoindex(primary_iface);
+	bool ready = false;
+	int len;
+
+	while ((len = recv(rtnl_fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			struct ifaddrmsg *ifa = (struct ifaddrmsg *)NLMSG_DATA(nh);
+
+			if (nh->nlmsg_type == RTM_NEWADDR && ifa->ifa_index == ifindex &&
+					ifa->ifa_family == AF_INET && ifa->ifa_scope != RT_SCOPE_HOST)
+				ready = true;
+		}
+	}
+
+	if (ready)
+		wifi_sm_post(WIFI_SM_EV_IP_READY);
+}
+
+static void wifi_rtnl_open(void)
+{
+	struct sockaddr_nl snl;
+
+	/* without it the connect deadline still catches the address, just late */
+	rtnl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (rtnl_fd < 0) {
+		pr_err("%s: rtnetlink socket failed: %s\n", __func__, strerror(errno));
+		return;
+	}
+
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = RTMGRP_IPV4_IFADDR;
+	if (bind(rtnl_fd, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		pr_err("%s: rtnetlink bind failed: %s\n", __func__, strerror(errno));
+		close(rtnl_fd);
+		rtnl_fd = -1;
+	}
+}
+
 static int wifi_ctrl_recv(char *reply, size_t *reply_len)
 {
 	int res;
 	int ctrlfd = wpa_ctrl_get_fd(monitor_conn);
-	struct pollfd rfds[2];
+	struct pollfd rfds[3];
 
-	memset(rfds, 0, 2 * sizeof(struct pollfd));
+	memset(rfds, 0, 3 * sizeof(struct pollfd));
 	rfds[0].fd = ctrlfd;
 	rfds[0].events |= POLLIN;
 	rfds[1].fd = exit_sockets[1];
 	rfds[1].events |= POLLIN;
-	do {
-		res = TEMP_FAILURE_RETRY(poll(rfds, 2, 30000));
+	/* poll skips a negative fd */
+	rfds[2].fd = rtnl_fd;
+	rfds[2].events |= POLLIN;
+	for (;;) {
+		wifi_fast_reconnect_tick();
+		if (wifi_sm_expired())
+			wifi_connect_timeout();
+
+		res = TEMP_FAILURE_RETRY(poll(rfds, 3, wifi_sm_poll_ms(wifi_fast_reconnect_poll_ms(30000))));
 		if (res < 0) {
 			pr_info("Error poll = %d\n", res);
 			return res;
@@ -1902,8 +1610,14 @@ static int wifi_ctrl_recv(char *reply, size_t *reply_len)
 			res = check_wpa_supplicant_state();
 			if (res < 0)
 				return -2;
+			continue;
 		}
-	} while (res == 0);
+
+		if (rfds[2].revents & POLLIN)
+			wifi_rtnl_recv();
+		if ((rfds[0].revents | rfds[1].revents) & (POLLIN | POLLHUP | POLLERR))
+			break;
+	}
 
 	if (rfds[0].revents & POLLIN) {
 		return wpa_ctrl_recv(monitor_conn, reply, reply_len);
@@ -1979,7 +1693,8 @@ static int wifi_connect_on_socket_path(const char *path)
 {
 	char supp_status[PROPERTY_VALUE_MAX] = {'\0'};
 
-	if(!check_wpa_supplicant_state()) {
+	/* an overridden socket doesn't belong to a wpa_supplicant process */
+	if(!monitor_path[0] && !check_wpa_supplicant_state()) {
 		pr_info("%s: wpa_supplicant is not ready\n",__FUNCTION__);
 		return -1;
 	}
@@ -2003,12 +1718,6 @@ static int wifi_connect_on_socket_path(const char *path)
 		return -1;
 	}
 
-	if (socketpair(AF_UNIX, SOCK_STREAM, 0, exit_sockets) == -1) {
-		wpa_ctrl_close(monitor_conn);
-		wpa_ctrl_close(ctrl_conn);
-		ctrl_conn = monitor_conn = NULL;
-		return -1;
-	}
 	return 0;
 }
 
@@ -2018,11 +1727,20 @@ static int wifi_connect_to_supplicant()
 	static char path[1024];
 	int count = 10;
 
+	struct pollfd pfd;
+
 	pr_info("%s \n", __FUNCTION__);
+	if (monitor_path[0])
+		return wifi_connect_on_socket_path(monitor_path);
+
+	pfd.fd = exit_sockets[1];
+	pfd.events = POLLIN;
 	while(count-- > 0) {
 		if (access(IFACE_DIR, F_OK) == 0)
 			break;
-		sleep(1);
+		/* wifi_monitor_stop() doesn't wait out the supplicant's start */
+		if (poll(&pfd, 1, 1000) > 0)
+			return -1;
 	}
 
 	snprintf(path, sizeof(path), "%s/%s", IFACE_DIR, primary_iface);
@@ -2030,7 +1748,22 @@ static int wifi_connect_to_supplicant()
 	return wifi_connect_on_socket_path(path);
 }
 
-static void RK_wifi_start_monitor(void *arg)
+/* seed the state machine with what happened before we attached */
+static void wifi_monitor_sync(void)
+{
+	std::string status;
+
+	/* a connect request has its own events coming, an old association isn't one */
+	if (wifi_sm_connecting())
+		return;
+	if (wpa_ctrl_channel_request("STATUS", status) != 0)
+		return;
+	if (status.find("\nwpa_state=COMPLETED") != std::string::npos
+			|| status.compare(0, 19, "wpa_state=COMPLETED") == 0)
+		wifi_sm_post(WIFI_SM_EV_CONNECTED);
+}
+
+static void *RK_wifi_start_monitor(void *arg)
 {
 	char eventStr[EVENT_BUF_SIZE];
 	int ret;
@@ -2039,9 +1772,17 @@ static void RK_wifi_start_monitor(void *arg)
 
 	if ((ret = wifi_connect_to_supplicant()) != 0) {
 		pr_info("%s, connect to supplicant fail.\n", __FUNCTION__);
-		return;
+		goto out;
 	}
 
+	wifi_rtnl_open();
+	wifi_sm_post(WIFI_SM_EV_MONITOR_UP);
+	wifi_monitor_sync();
+
+	/* beat the supplicant's own full-band scan to the last known AP */
+	if (wifi_sm_state() != WIFI_SM_ASSOCIATED && wifi_sm_state() != WIFI_SM_ONLINE)
+		wifi_fast_reconnect_on_disconnected();
+
 	for (;;) {
 		memset(eventStr, 0, EVENT_BUF_SIZE);
 		if (!wifi_wait_on_socket(eventStr, EVENT_BUF_SIZE))
@@ -2052,6 +1793,67 @@ static void RK_wifi_start_monitor(void *arg)
 			break;
 		}
 	}
+
+out:
+	wifi_close_sockets();
+	wifi_sm_post(WIFI_SM_EV_MONITOR_DOWN);
+	monitor_alive = false;
+	return NULL;
+}
+
+static void wifi_monitor_reap_locked(void)
+{
+	if (!monitor_started)
+		return;
+
+	pthread_join(monitor_tid, NULL);
+	monitor_started = false;
+
+	close(exit_sockets[0]);
+	close(exit_sockets[1]);
+	exit_sockets[0] = exit_sockets[1] = -1;
+}
+
+static void wifi_monitor_start(void)
+{
+	pthread_mutex_lock(&monitor_lock);
+	/* it quits by itself when the supplicant goes away */
+	if (monitor_started && !monitor_alive)
+		wifi_monitor_reap_locked();
+
+	if (!monitor_started) {
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, exit_sockets) == -1) {
+			pr_err("%s: socketpair failed: %s\n", __func__, strerror(errno));
+		} else {
+			monitor_alive = true;
+			if (pthread_create(&monitor_tid, NULL, RK_wifi_start_monitor, NULL) == 0) {
+				monitor_started = true;
+			} else {
+				monitor_alive = false;
+				close(exit_sockets[0]);
+				close(exit_sockets[1]);
+				exit_sockets[0] = exit_sockets[1] = -1;
+			}
+		}
+	}
+	pthread_mutex_unlock(&monitor_lock);
+}
+
+static void wifi_monitor_stop(void)
+{
+	pthread_mutex_lock(&monitor_lock);
+	if (monitor_started) {
+		/* a state callback turning wifi off runs on the monitor itself */
+		if (pthread_equal(pthread_self(), monitor_tid)) {
+			pr_err("%s: called from the monitor thread\n", __func__);
+			pthread_mutex_unlock(&monitor_lock);
+			return;
+		}
+		/* wakes its poll, it sees a TERMINATING event and winds down */
+		write(exit_sockets[0], "T", 1);
+		wifi_monitor_reap_locked();
+	}
+	pthread_mutex_unlock(&monitor_lock);
 }
 
 static void execute(const char cmdline[], char recv_buff[], int len)
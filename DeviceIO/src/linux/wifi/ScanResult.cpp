@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include "DeviceIo/ScanResult.h"
+#include "scan_result_json.h"
 
 namespace DeviceIOFramework {
 
@@ -55,14 +56,12 @@ int ScanResult::getFrequency() {
 }
 
 std::string ScanResult::toString() {
-	std::string ret;
-	ret = "{\"bssid\":\"" + this->bssid + "\""
-		+ ", \"frequency\":\"" + std::to_string(this->frequency) + "\""
-		+ ", \"signalLevel\":\"" + std::to_string(this->level) + "\""
-		+ ", \"flags\":\"" + this->flags + "\""
-		+ ", \"ssid\":\"" + this->ssid + "\"}";
-
-	return ret;
+	rapidjson::StringBuffer buffer;
+	ScanResultWriter writer(buffer);
+
+	writeScanResult(writer, this);
+
+	return std::string(buffer.GetString(), buffer.GetSize());
 }
 
 ScanResult::~ScanResult() {
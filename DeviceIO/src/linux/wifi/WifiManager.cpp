@@ -3,6 +3,9 @@
 #include <unistd.h>
 #include "DeviceIo/WifiManager.h"
 #include "Hostapd.h"
+#include "scan_cache.h"
+#include "scan_parser.h"
+#include "wpa_ctrl_channel.h"
 
 namespace DeviceIOFramework {
 
@@ -90,13 +93,12 @@ static std::string exec(const std::string& cmd) {
 }
 
 bool WifiManager::isWifiConnected() {
-	std::string state;
-	state = exec("wpa_cli -iwlan0 status | grep wpa_state | awk -F '=' '{printf $2}'");
-
-	if (0 == state.compare("fail"))
+	std::string status;
+	if (0 != wpa_ctrl_channel_request("STATUS", status))
 		return false;
 
-	if (0 == state.compare(0, 9, "COMPLETED", 0, 9)) {
+	if (0 == status.compare(0, 19, "wpa_state=COMPLETED") ||
+			std::string::npos != status.find("\nwpa_state=COMPLETED")) {
 		saveConfiguration();
 		return true;
 	}
@@ -105,12 +107,11 @@ bool WifiManager::isWifiConnected() {
 }
 
 bool WifiManager::isWifiEnabled() {
-	std::string pid;
-	pid = exec("pidof wpa_supplicant");
-	if (0 == pid.compare("fail") || pid.empty()) {
+	std::string pong;
+	if (0 != wpa_ctrl_channel_request("PING", pong))
 		return false;
-	}
-	return true;
+
+	return 0 == pong.compare(0, 4, "PONG");
 }
 
 int WifiManager::setWifiEnabled(const bool enable) {
@@ -128,6 +129,7 @@ int WifiManager::setWifiEnabled(const bool enable) {
 	} else {
 		system("ifconfig wlan0 down");
 		system("killall wpa_supplicant");
+		wpa_ctrl_channel_close();
 	}
 
 	return 0;
@@ -143,12 +145,11 @@ int WifiManager::disableWifiAp() {
 
 int WifiManager::startScan() {
 	std::string scan;
-	scan = exec("wpa_cli -iwlan0 scan");
-	if (0 == scan.compare("fail")) {
+	if (0 != wpa_ctrl_channel_request("SCAN", scan)) {
 		return -1;
 	}
 
-	if (scan.find_first_of("OK") == std::string::npos && scan.find_first_of("ok") == std::string::npos) {
+	if (0 != scan.compare(0, 2, "OK")) {
 		return -2;
 	}
 
@@ -170,165 +171,92 @@ static std::list<std::string> strToList(const char* str) {
 	return strList;
 }
 
-static std::list<ScanResult*> strToScanResult(std::list<std::string> strList) {
-	std::list<ScanResult*> scanResult;
-	std::list<std::string>::iterator strIte;
+static bool scanEntryToResult(const scan_entry_t *entry, void *arg) {
+	std::list<ScanResult*> *scanResult = (std::list<ScanResult*> *) arg;
+	char ssid[SCAN_SSID_MAX_LEN + 1];
+	size_t len;
 
-	/* delete first useless item */
-	strList.pop_front();
+	len = scan_ssid_unescape(entry->ssid, entry->ssid_len, ssid);
+	scanResult->push_back(new ScanResult(std::string(entry->bssid, entry->bssid_len),
+			entry->frequency, entry->level,
+			std::string(entry->flags, entry->flags_len), std::string(ssid, len)));
 
-	for (strIte = strList.begin(); strIte != strList.end(); strIte++) {
-		std::string strItem = *strIte;
-		ScanResult* item = new ScanResult();
-
-		/* use for set item:bssid ssid etc*/
-		int index;
-		size_t i;
-		std::string tmpStr;
-		for (index = 0, i = 0; i < strItem.size(); i++) {
-			if (strItem.at(i) != '\t')
-				tmpStr += strItem.at(i);
-
-			if (strItem.at(i) == '\t' || i == (strItem.size() - 1)){
-				switch (index) {
-				case 0: //bssid
-					item->setBssid(tmpStr);
-					break;
-				case 1: //frequency
-					item->setFrequency(std::stoi(tmpStr));
-					break;
-				case 2: //signalLevel
-					item->setLevel(std::stoi(tmpStr));
-					break;
-				case 3: //flags
-					item->setFlags(tmpStr);
-					break;
-				case 4: //ssid
-					item->setSsid(tmpStr);
-					break;
-				default:
-					break;
-				}
-				index ++;
-				tmpStr.clear();
-			}
-		}
-		scanResult.push_back(item);
-	}
-	return scanResult;
+	return true;
 }
 
 std::list<ScanResult*> WifiManager::getScanResults() {
 	std::list<ScanResult*> result;
-	std::list<std::string> strList;
 	std::string scan_r;
-	scan_r = exec("wpa_cli -iwlan0 scan_r");
-	if (0 == scan_r.compare("fail"))
+	if (0 != wifi_scan_cache_get(scan_r) || scan_r.empty())
 		return result;
 
-	strList = strToList((const char*) scan_r.c_str());
-	result = strToScanResult(strList);
+	scan_parse_results(scan_r.c_str(), scan_r.size(), scanEntryToResult, &result);
 
 	return result;
 }
 
 int WifiManager::addNetwork() {
-	int id = -1;
 	std::string cmdRet;
 
-	cmdRet = exec("wpa_cli -iwlan0 add_network");
-	if (0 == cmdRet.compare("fail"))
+	if (0 != wpa_ctrl_channel_request("ADD_NETWORK", cmdRet) || 0 == cmdRet.compare(0, 4, "FAIL"))
 		return -1;
 
-	id = atoi(cmdRet.c_str());
-
-	return id;
+	return atoi(cmdRet.c_str());
 }
 
 int WifiManager::setNetwork(const int id, const std::string& ssid, const std::string& psk, const Encryp encryp) {
-	char cmd[128];
-	std::string cmdRet;
+	char cmd[256];
+	std::vector<std::string> cmds, replies;
+	std::vector<int> errs;
 
 	// 1. set network ssid
-	memset(cmd, 0, sizeof(cmd));
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d ssid \\\"%s\\\"", id, ssid.c_str());
-	cmdRet = exec(cmd);
-	if (0 == cmdRet.compare("fail")) {
-		return -1;
-	} else if (cmdRet.find_first_of("OK") == std::string::npos && cmdRet.find_first_of("ok") == std::string::npos) {
-		return -11;
-	}
+	snprintf(cmd, sizeof(cmd), "SET_NETWORK %d ssid \"%s\"", id, ssid.c_str());
+	cmds.push_back(cmd);
+	errs.push_back(-11);
 
 	// 2. set network psk
-	memset(cmd, 0, sizeof(cmd));
 	if ("" == psk || encryp == NONE) {
-		snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d key_mgmt NONE", id);
-		cmdRet = exec(cmd);
-		if (0 == cmdRet.compare("fail")) {
-			return -2;
-		} else if (cmdRet.find_first_of("OK") == std::string::npos && cmdRet.find_first_of("ok") == std::string::npos) {
-			return -21;
-		}
+		snprintf(cmd, sizeof(cmd), "SET_NETWORK %d key_mgmt NONE", id);
+		cmds.push_back(cmd);
+		errs.push_back(-21);
 	} else if (encryp == WPA) {
-		snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d psk \\\"%s\\\"", id, psk.c_str());
-		cmdRet = exec(cmd);
-		if (0 == cmdRet.compare("fail")) {
-			return -2;
-		} else if (cmdRet.find_first_of("OK") == std::string::npos && cmdRet.find_first_of("ok") == std::string::npos) {
-			return -21;
-		}
+		snprintf(cmd, sizeof(cmd), "SET_NETWORK %d psk \"%s\"", id, psk.c_str());
+		cmds.push_back(cmd);
+		errs.push_back(-21);
 	} else if (encryp == WEP) {
-		snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d key_mgmt NONE", id);
-		cmdRet = exec(cmd);
-		if (0 == cmdRet.compare("fail")) {
-			return -2;
-		} else if (cmdRet.find_first_of("OK") == std::string::npos && cmdRet.find_first_of("ok") == std::string::npos) {
-			return -21;
-		}
+		snprintf(cmd, sizeof(cmd), "SET_NETWORK %d key_mgmt NONE", id);
+		cmds.push_back(cmd);
+		errs.push_back(-21);
 
-		memset(cmd, 0, sizeof(cmd));
-		snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 set_network %d wep_key0 \\\"%s\\\"", id, psk.c_str());
-		cmdRet = exec(cmd);
-		if (0 == cmdRet.compare("fail")) {
-			return -22;
-		} else if (cmdRet.find_first_of("OK") == std::string::npos && cmdRet.find_first_of("ok") == std::string::npos) {
-			return -221;
-		}
+		snprintf(cmd, sizeof(cmd), "SET_NETWORK %d wep_key0 \"%s\"", id, psk.c_str());
+		cmds.push_back(cmd);
+		errs.push_back(-221);
+	}
+
+	/* all fields go out back to back, then the replies are checked in order */
+	if (wpa_ctrl_channel_pipeline(cmds, replies) < 0)
+		return -1;
+
+	for (size_t i = 0; i < cmds.size(); i++) {
+		if (i >= replies.size())
+			return i ? -2 : -1;
+		if (0 != replies[i].compare(0, 2, "OK"))
+			return errs[i];
 	}
 
 	return 0;
 }
 
 int WifiManager::selectNetwork(const int id) {
-	char cmd[128];
-	std::string cmdRet;
-
-	memset(cmd, 0, sizeof(cmd));
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 select_network %d", id);
-	cmdRet = exec(cmd);
-
-	if (0 == cmdRet.compare("fail")) {
-		return -1;
-	} else if (cmdRet.find_first_of("OK") == std::string::npos && cmdRet.find_first_of("ok") == std::string::npos) {
+	if (0 != wpa_ctrl_channel_cmd("SELECT_NETWORK %d", id))
 		return -2;
-	}
 
 	return 0;
 }
 
 int WifiManager::enableNetwork(const int id) {
-	char cmd[128];
-	std::string cmdRet;
-
-	memset(cmd, 0, sizeof(cmd));
-	snprintf(cmd, sizeof(cmd), "wpa_cli -iwlan0 enable_network %d", id);
-	cmdRet = exec(cmd);
-
-	if (0 == cmdRet.compare("fail")) {
-		return -1;
-	} else if (cmdRet.find_first_of("OK") == std::string::npos && cmdRet.find_first_of("ok") == std::string::npos) {
+	if (0 != wpa_ctrl_channel_cmd("ENABLE_NETWORK %d", id))
 		return -2;
-	}
 
 	return 0;
 }
@@ -353,8 +281,11 @@ int WifiManager::udhcpc() {
 }
 
 int WifiManager::saveConfiguration() {
-	system("wpa_cli enable_network all");
-	system("wpa_cli save_config");
+	std::vector<std::string> cmds, replies;
+
+	cmds.push_back("ENABLE_NETWORK all");
+	cmds.push_back("SAVE_CONFIG");
+	wpa_ctrl_channel_pipeline(cmds, replies);
 
 	return 0;
 }
@@ -448,10 +379,12 @@ WifiInfo* WifiManager::getConnectionInfo() {
 	std::list<std::string> strList;
 	std::list<std::string>::iterator strIte;
 
-	status = exec("wpa_cli -iwlan0 status");
-	if (0 == status.compare("fail"))
+	if (0 != wpa_ctrl_channel_request("STATUS", status))
 		return info;
 
+	char convers[status.size() + 1];
+	status = spec_char_convers(status.c_str(), convers);
+
 	strList = strToList((const char*) status.c_str());
 	for (strIte = strList.begin(); strIte != strList.end(); strIte++) {
 		std::string strItem = *strIte;
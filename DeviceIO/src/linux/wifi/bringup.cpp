@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "bringup.h"
+#include "slog.h"
+
+typedef enum {
+	STEP_WAITING = 0,
+	STEP_RUNNING,
+	STEP_DONE,
+} step_state_e;
+
+struct bringup_ctx;
+
+typedef struct {
+	struct bringup_ctx *ctx;
+	int index;
+	step_state_e state;
+	pthread_t tid;
+	bool threaded;
+} step_slot_t;
+
+typedef struct bringup_ctx {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const wifi_bringup_step_t *steps;
+	wifi_bringup_timing_t timing[WIFI_BRINGUP_MAX_STEPS];
+	step_slot_t slots[WIFI_BRINGUP_MAX_STEPS];
+	uint64_t start;
+} bringup_ctx_t;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void step_run(step_slot_t *slot)
+{
+	bringup_ctx_t *ctx = slot->ctx;
+	const wifi_bringup_step_t *step = &ctx->steps[slot->index];
+	uint64_t start = now_ms();
+	int ret;
+
+	ret = step->run();
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->timing[slot->index].result = ret;
+	ctx->timing[slot->index].start_ms = start - ctx->start;
+	ctx->timing[slot->index].time_ms = now_ms() - start;
+	slot->state = STEP_DONE;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static void *step_thread(void *arg)
+{
+	step_run((step_slot_t *)arg);
+	return NULL;
+}
+
+int wifi_bringup_run(const wifi_bringup_step_t *steps, int count, wifi_bringup_timing_t *timing)
+{
+	bringup_ctx_t ctx;
+	int ret = 0, i, j;
+	bool waiting, unlocked;
+
+	if (count <= 0 || count > WIFI_BRINGUP_MAX_STEPS)
+		return -EINVAL;
+
+	memset(&ctx, 0, sizeof(ctx));
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+	ctx.steps = steps;
+	ctx.start = now_ms();
+	for (i = 0; i < count; i++) {
+		ctx.timing[i].name = steps[i].name;
+		ctx.slots[i].ctx = &ctx;
+		ctx.slots[i].index = i;
+	}
+
+	pthread_mutex_lock(&ctx.lock);
+	do {
+		waiting = unlocked = false;
+		for (i = 0; i < count; i++) {
+			step_slot_t *slot = &ctx.slots[i];
+			bool ready = true, failed = false;
+
+			if (slot->state != STEP_WAITING)
+				continue;
+
+			for (j = 0; j < i; j++) {
+				if (!(steps[i].deps & (1u << j)))
+					continue;
+				if (ctx.slots[j].state != STEP_DONE)
+					ready = false;
+				else if (ctx.timing[j].result != 0)
+					failed = true;
+			}
+
+			if (failed) {
+				ctx.timing[i].result = -ECANCELED;
+				ctx.timing[i].start_ms = now_ms() - ctx.start;
+				slot->state = STEP_DONE;
+				/* whatever waits on this one can be settled in this same pass */
+				continue;
+			}
+			if (!ready) {
+				waiting = true;
+				continue;
+			}
+
+			slot->state = STEP_RUNNING;
+			slot->threaded = pthread_create(&slot->tid, NULL, step_thread, slot) == 0;
+			if (!slot->threaded) {
+				pthread_mutex_unlock(&ctx.lock);
+				step_run(slot);
+				pthread_mutex_lock(&ctx.lock);
+				unlocked = true;
+			}
+		}
+
+		/* a wakeup may have gone by while the lock was dropped */
+		if (waiting && !unlocked)
+			pthread_cond_wait(&ctx.cond, &ctx.lock);
+	} while (waiting);
+
+	/* nothing is waiting, but the last ones may still be running */
+	for (i = 0; i < count; i++) {
+		while (ctx.slots[i].state != STEP_DONE)
+			pthread_cond_wait(&ctx.cond, &ctx.lock);
+	}
+	pthread_mutex_unlock(&ctx.lock);
+
+	for (i = 0; i < count; i++) {
+		if (ctx.slots[i].threaded)
+			pthread_join(ctx.slots[i].tid, NULL);
+		if (ctx.timing[i].result != 0)
+			ret = -1;
+		pr_info("%s: %-16s +%4d ms %5d ms %s\n", __func__, ctx.timing[i].name,
+				ctx.timing[i].start_ms, ctx.timing[i].time_ms,
+				ctx.timing[i].result == 0 ? "ok" :
+				ctx.timing[i].result == -ECANCELED ? "skipped" : "failed");
+	}
+	pr_info("%s: %d ms in all\n", __func__, (int)(now_ms() - ctx.start));
+
+	if (timing)
+		memcpy(timing, ctx.timing, sizeof(*timing) * count);
+
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&ctx.lock);
+
+	return ret;
+}
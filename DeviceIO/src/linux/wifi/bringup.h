@@ -0,0 +1,31 @@
+#ifndef DEVICEIO_FRAMEWORK_BRINGUP_H_
+#define DEVICEIO_FRAMEWORK_BRINGUP_H_
+
+#define WIFI_BRINGUP_MAX_STEPS	8
+
+/* 0 when the step is done and what depends on it may start, -errno otherwise */
+typedef int (*wifi_bringup_fn)(void);
+
+typedef struct {
+	const char *name;
+	unsigned int deps;		/* bit i set: steps[i] must succeed first */
+	wifi_bringup_fn run;
+} wifi_bringup_step_t;
+
+typedef struct {
+	const char *name;
+	int result;				/* run()'s return, -ECANCELED if a dependency failed */
+	int start_ms;			/* since wifi_bringup_run() was called */
+	int time_ms;
+} wifi_bringup_timing_t;
+
+/*
+ * Run steps as a dependency graph: each one starts as soon as all of
+ * its deps have succeeded, independent ones run side by side on their
+ * own threads. deps may only name earlier steps. Returns once every
+ * step has finished or been skipped, 0 if all of them succeeded.
+ * timing[i] describes steps[i] and may be NULL.
+ */
+int wifi_bringup_run(const wifi_bringup_step_t *steps, int count, wifi_bringup_timing_t *timing);
+
+#endif // DEVICEIO_FRAMEWORK_BRINGUP_H_
@@ -0,0 +1,276 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include <wpa_ctrl.h>
+
+#include "bss_table.h"
+#include "scan_parser.h"
+#include "wpa_ctrl_channel.h"
+#include "DeviceIo/RK_encode.h"
+#include "slog.h"
+
+/* BSS reply fields: id, bssid, freq, level, flags, ssid */
+#define BSS_QUERY_MASK		"0x1887"
+
+/* every AP sharing a display name */
+typedef struct {
+	std::string ssid;
+	int count;
+	int open;
+} ssid_entry_t;
+
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::unordered_map<std::string, wifi_bss_t> m_bss;
+static std::unordered_map<std::string, ssid_entry_t> m_ssid_index;
+static unsigned long m_round = 0;
+
+bool wifi_ssid_to_utf8(const char *ssid, size_t len, std::string &utf8)
+{
+	char buf[SCAN_SSID_MAX_LEN * 3 + 1];
+	char raw[SCAN_SSID_MAX_LEN + 1];
+	int n;
+
+	if (len > SCAN_SSID_MAX_LEN)
+		len = SCAN_SSID_MAX_LEN;
+	memcpy(raw, ssid, len);
+	raw[len] = '\0';
+
+	if (RK_encode_is_utf8(raw, len)) {
+		utf8.assign(raw, len);
+		return true;
+	}
+
+	n = RK_encode_gbk_to_utf8((unsigned char *) raw, len, (unsigned char *) buf);
+	buf[n] = '\0';
+	if (!RK_encode_is_utf8(buf, n)) {
+		utf8.clear();
+		return false;
+	}
+
+	utf8.assign(buf, n);
+	return true;
+}
+
+static bool flags_open(const char *flags, size_t len)
+{
+	return !memmem(flags, len, "WPA", 3) && !memmem(flags, len, "WEP", 3);
+}
+
+static void index_add_locked(const wifi_bss_t &bss)
+{
+	if (bss.utf8.empty())
+		return;
+
+	ssid_entry_t &entry = m_ssid_index[bss.utf8];
+	if (!entry.count++)
+		entry.ssid = bss.ssid;
+	if (bss.open)
+		entry.open++;
+}
+
+static void index_del_locked(const wifi_bss_t &bss)
+{
+	std::unordered_map<std::string, ssid_entry_t>::iterator it;
+
+	if (bss.utf8.empty())
+		return;
+
+	it = m_ssid_index.find(bss.utf8);
+	if (it == m_ssid_index.end())
+		return;
+
+	if (bss.open)
+		it->second.open--;
+	if (--it->second.count <= 0)
+		m_ssid_index.erase(it);
+}
+
+static void update_locked(const char *bssid, size_t bssid_len, int frequency, int level,
+		const char *flags, size_t flags_len, const char *ssid, size_t ssid_len)
+{
+	wifi_bss_t &bss = m_bss[std::string(bssid, bssid_len)];
+	bool open = flags_open(flags, flags_len);
+
+	/* levels move on every scan, the name and security rarely do */
+	if (bss.bssid.empty() || open != bss.open ||
+			bss.ssid.compare(0, std::string::npos, ssid, ssid_len) != 0) {
+		if (!bss.bssid.empty())
+			index_del_locked(bss);
+		else
+			bss.bssid.assign(bssid, bssid_len);
+		bss.ssid.assign(ssid, ssid_len);
+		bss.open = open;
+		wifi_ssid_to_utf8(ssid, ssid_len, bss.utf8);
+		index_add_locked(bss);
+	}
+
+	bss.frequency = frequency;
+	bss.level = level;
+	bss.flags.assign(flags, flags_len);
+	bss.seen = m_round;
+}
+
+static void remove_locked(const std::string &bssid)
+{
+	std::unordered_map<std::string, wifi_bss_t>::iterator it;
+
+	it = m_bss.find(bssid);
+	if (it == m_bss.end())
+		return;
+
+	index_del_locked(it->second);
+	m_bss.erase(it);
+}
+
+static bool sync_entry(const scan_entry_t *entry, void *arg)
+{
+	char ssid[SCAN_SSID_MAX_LEN + 1];
+	size_t len;
+
+	len = scan_ssid_unescape(entry->ssid, entry->ssid_len, ssid);
+	update_locked(entry->bssid, entry->bssid_len, entry->frequency, entry->level,
+			entry->flags, entry->flags_len, ssid, len);
+
+	return true;
+}
+
+void wifi_bss_table_sync(const std::string &scan_r)
+{
+	std::unordered_map<std::string, wifi_bss_t>::iterator it;
+
+	pthread_mutex_lock(&m_lock);
+	m_round++;
+	scan_parse_results(scan_r.c_str(), scan_r.size(), sync_entry, NULL);
+
+	for (it = m_bss.begin(); it != m_bss.end();) {
+		if (it->second.seen != m_round) {
+			index_del_locked(it->second);
+			it = m_bss.erase(it);
+		} else {
+			++it;
+		}
+	}
+	pthread_mutex_unlock(&m_lock);
+}
+
+/* "BSS ID-<n>" reply, one key=value per line */
+static void bss_added(unsigned int id)
+{
+	std::string reply;
+	char cmd[64];
+	const char *bssid = NULL, *flags = "", *ssid = "";
+	int frequency = 0, level = 0;
+	char *line, *value, *saveptr;
+	char name[SCAN_SSID_MAX_LEN + 1];
+	size_t len;
+
+	snprintf(cmd, sizeof(cmd), "BSS ID-%u MASK=" BSS_QUERY_MASK, id);
+	if (wpa_ctrl_channel_request(cmd, reply) != 0 || reply.empty() ||
+			reply.compare(0, 4, "FAIL") == 0)
+		return;
+
+	char buf[reply.size() + 1];
+	memcpy(buf, reply.c_str(), reply.size() + 1);
+
+	for (line = strtok_r(buf, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+		value = strchr(line, '=');
+		if (!value)
+			continue;
+		*value++ = '\0';
+
+		if (!strcmp(line, "bssid"))
+			bssid = value;
+		else if (!strcmp(line, "freq"))
+			frequency = atoi(value);
+		else if (!strcmp(line, "level"))
+			level = atoi(value);
+		else if (!strcmp(line, "flags"))
+			flags = value;
+		else if (!strcmp(line, "ssid"))
+			ssid = value;
+	}
+	if (!bssid)
+		return;
+
+	len = scan_ssid_unescape(ssid, strlen(ssid), name);
+
+	pthread_mutex_lock(&m_lock);
+	update_locked(bssid, strlen(bssid), frequency, level, flags, strlen(flags), name, len);
+	pthread_mutex_unlock(&m_lock);
+}
+
+void wifi_bss_table_on_event(const char *event)
+{
+	const char *p;
+	unsigned int id;
+	char bssid[32];
+
+	if ((p = strstr(event, WPA_EVENT_BSS_ADDED))) {
+		if (sscanf(p + strlen(WPA_EVENT_BSS_ADDED), "%u", &id) == 1)
+			bss_added(id);
+	} else if ((p = strstr(event, WPA_EVENT_BSS_REMOVED))) {
+		if (sscanf(p + strlen(WPA_EVENT_BSS_REMOVED), "%u %31s", &id, bssid) == 2) {
+			pthread_mutex_lock(&m_lock);
+			remove_locked(bssid);
+			pthread_mutex_unlock(&m_lock);
+		}
+	}
+}
+
+void wifi_bss_table_clear(void)
+{
+	pthread_mutex_lock(&m_lock);
+	m_bss.clear();
+	m_ssid_index.clear();
+	pthread_mutex_unlock(&m_lock);
+}
+
+static bool stronger(const wifi_bss_t *a, const wifi_bss_t *b)
+{
+	return a->level > b->level;
+}
+
+int wifi_bss_table_foreach(wifi_bss_cb cb, void *arg)
+{
+	std::unordered_map<std::string, wifi_bss_t>::iterator it;
+	std::vector<const wifi_bss_t *> sorted;
+	int count = 0;
+
+	pthread_mutex_lock(&m_lock);
+	sorted.reserve(m_bss.size());
+	for (it = m_bss.begin(); it != m_bss.end(); ++it)
+		sorted.push_back(&it->second);
+	std::sort(sorted.begin(), sorted.end(), stronger);
+
+	for (size_t i = 0; i < sorted.size(); i++) {
+		count++;
+		if (!cb(sorted[i], arg))
+			break;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return count;
+}
+
+bool wifi_bss_lookup_ssid(const char *utf8, std::string *ssid, bool *open)
+{
+	std::unordered_map<std::string, ssid_entry_t>::iterator it;
+	bool found = false;
+
+	pthread_mutex_lock(&m_lock);
+	it = m_ssid_index.find(utf8);
+	if (it != m_ssid_index.end()) {
+		found = true;
+		if (ssid)
+			*ssid = it->second.ssid;
+		if (open)
+			*open = it->second.open > 0;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return found;
+}
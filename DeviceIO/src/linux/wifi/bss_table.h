@@ -0,0 +1,46 @@
+#ifndef DEVICEIO_FRAMEWORK_BSS_TABLE_H_
+#define DEVICEIO_FRAMEWORK_BSS_TABLE_H_
+
+#include <string>
+
+/* one AP as last reported by wpa_supplicant */
+typedef struct {
+	std::string bssid;
+	int frequency;
+	int level;
+	std::string flags;
+	std::string ssid;	/* octets as broadcast, GBK or UTF-8 */
+	std::string utf8;	/* display name, empty when ssid can't be decoded */
+	bool open;			/* neither WPA nor WEP */
+	unsigned long seen;	/* sync round that last reported it */
+} wifi_bss_t;
+
+/* return false to stop the walk */
+typedef bool (*wifi_bss_cb)(const wifi_bss_t *bss, void *arg);
+
+/*
+ * Bring the table in line with a "scan_results" reply: entries are
+ * added or updated in place, APs the scan no longer reports are
+ * dropped. Names of unchanged entries are not decoded again.
+ */
+void wifi_bss_table_sync(const std::string &scan_r);
+
+/* CTRL-EVENT-BSS-ADDED / CTRL-EVENT-BSS-REMOVED from the monitor socket */
+void wifi_bss_table_on_event(const char *event);
+
+void wifi_bss_table_clear(void);
+
+/* walk the table strongest signal first, under the table lock */
+int wifi_bss_table_foreach(wifi_bss_cb cb, void *arg);
+
+/*
+ * Look a network up by its display name. Fills in the SSID octets to
+ * configure and whether any AP of that name is open. Returns false when
+ * no AP of that name is known.
+ */
+bool wifi_bss_lookup_ssid(const char *utf8, std::string *ssid, bool *open);
+
+/* decode SSID octets for display, GBK is converted; false if neither fits */
+bool wifi_ssid_to_utf8(const char *ssid, size_t len, std::string &utf8);
+
+#endif // DEVICEIO_FRAMEWORK_BSS_TABLE_H_
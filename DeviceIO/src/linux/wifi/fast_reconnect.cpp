@@ -0,0 +1,323 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fast_reconnect.h"
+#include "scan_parser.h"
+#include "wpa_ctrl_channel.h"
+#include "slog.h"
+
+typedef struct {
+	bool valid;
+	char ssid[SCAN_SSID_MAX_LEN + 1];	/* octets, may be GBK */
+	size_t ssid_len;
+	char bssid[20];
+	int freq;
+	char key_mgmt[32];
+} last_assoc_t;
+
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t m_load_once = PTHREAD_ONCE_INIT;
+static last_assoc_t m_assoc;
+
+static uint64_t m_start = 0;		/* (re)connect being timed, 0 if none */
+static uint64_t m_deadline = 0;		/* full scan fallback due, 0 if none */
+static bool m_targeted = false;	/* still on the targeted scan, no fallback yet */
+static bool m_held = false;		/* we dropped the link, don't go back to it */
+static int m_last_ms = -1;
+static bool m_last_fast = false;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void assoc_load(void)
+{
+	char line[128], *value;
+	FILE *fp;
+
+	memset(&m_assoc, 0, sizeof(m_assoc));
+
+	fp = fopen(WIFI_LAST_ASSOC_PATH, "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		value = strchr(line, '=');
+		if (!value)
+			continue;
+		*value++ = '\0';
+
+		if (!strcmp(line, "ssid")) {
+			/* hex, so any octet survives the round trip */
+			size_t len = strlen(value) / 2;
+			unsigned int byte;
+
+			if (len > SCAN_SSID_MAX_LEN)
+				len = SCAN_SSID_MAX_LEN;
+			for (m_assoc.ssid_len = 0; m_assoc.ssid_len < len; m_assoc.ssid_len++) {
+				if (sscanf(value + m_assoc.ssid_len * 2, "%2x", &byte) != 1)
+					break;
+				m_assoc.ssid[m_assoc.ssid_len] = byte;
+			}
+			m_assoc.ssid[m_assoc.ssid_len] = '\0';
+		} else if (!strcmp(line, "bssid")) {
+			snprintf(m_assoc.bssid, sizeof(m_assoc.bssid), "%s", value);
+		} else if (!strcmp(line, "freq")) {
+			m_assoc.freq = atoi(value);
+		} else if (!strcmp(line, "key_mgmt")) {
+			snprintf(m_assoc.key_mgmt, sizeof(m_assoc.key_mgmt), "%s", value);
+		}
+	}
+	fclose(fp);
+
+	m_assoc.valid = m_assoc.freq > 0 && m_assoc.bssid[0];
+	if (m_assoc.valid)
+		pr_info("%s: last assoc %s on %d MHz (%s)\n", __func__,
+				m_assoc.bssid, m_assoc.freq, m_assoc.key_mgmt);
+}
+
+static void assoc_save(const last_assoc_t *assoc)
+{
+	char tmp[] = WIFI_LAST_ASSOC_PATH ".tmp";
+	FILE *fp;
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		pr_err("%s: open %s failed\n", __func__, tmp);
+		return;
+	}
+
+	fprintf(fp, "ssid=");
+	for (size_t i = 0; i < assoc->ssid_len; i++)
+		fprintf(fp, "%02x", (unsigned char) assoc->ssid[i]);
+	fprintf(fp, "\nbssid=%s\nfreq=%d\nkey_mgmt=%s\n", assoc->bssid, assoc->freq, assoc->key_mgmt);
+
+	fflush(fp);
+	fsync(fileno(fp));
+	fclose(fp);
+	rename(tmp, WIFI_LAST_ASSOC_PATH);
+}
+
+/* what the supplicant is associated with now, false unless COMPLETED */
+static bool assoc_query(last_assoc_t *assoc)
+{
+	std::string reply;
+	char *line, *saveptr;
+	bool completed = false;
+
+	memset(assoc, 0, sizeof(*assoc));
+	if (wpa_ctrl_channel_request("STATUS", reply) != 0)
+		return false;
+
+	char buf[reply.size() + 1];
+	memcpy(buf, reply.c_str(), reply.size() + 1);
+
+	for (line = strtok_r(buf, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+		if (!strncmp(line, "bssid=", 6))
+			snprintf(assoc->bssid, sizeof(assoc->bssid), "%s", line + 6);
+		else if (!strncmp(line, "freq=", 5))
+			assoc->freq = atoi(line + 5);
+		else if (!strncmp(line, "ssid=", 5))
+			assoc->ssid_len = scan_ssid_unescape(line + 5, strlen(line + 5), assoc->ssid);
+		else if (!strncmp(line, "key_mgmt=", 9))
+			snprintf(assoc->key_mgmt, sizeof(assoc->key_mgmt), "%s", line + 9);
+		else if (!strcmp(line, "wpa_state=COMPLETED"))
+			completed = true;
+	}
+
+	assoc->valid = completed && assoc->freq > 0 && assoc->bssid[0];
+	return assoc->valid;
+}
+
+static void full_reconnect(void)
+{
+	std::string reply;
+
+	/* RECONNECT only acts after a DISCONNECT, SCAN covers the rest */
+	wpa_ctrl_channel_cmd("RECONNECT");
+	wpa_ctrl_channel_request("SCAN", reply);
+}
+
+int wifi_fast_reconnect_begin(bool targeted)
+{
+	last_assoc_t assoc;
+	std::string reply;
+	char cmd[96];
+
+	pthread_once(&m_load_once, assoc_load);
+
+	pthread_mutex_lock(&m_lock);
+	m_start = now_ms();
+	m_deadline = 0;
+	m_targeted = false;
+	/* a connect of its own leaves the last AP behind, an explicit reconnect goes back */
+	m_held = !targeted;
+	assoc = m_assoc;
+	pthread_mutex_unlock(&m_lock);
+
+	if (!targeted)
+		return -1;
+
+	if (!assoc.valid) {
+		full_reconnect();
+		return -1;
+	}
+
+	/* the supplicant connects from the results of any scan, ours included */
+	snprintf(cmd, sizeof(cmd), "SCAN freq=%d bssid=%s", assoc.freq, assoc.bssid);
+	if (wpa_ctrl_channel_request(cmd, reply) == 0 && reply.compare(0, 9, "FAIL-BUSY") == 0) {
+		/* not ours to abort, it may be for a network just asked for; it connects from it */
+		pr_info("%s: supplicant already scanning, leaving it to that\n", __func__);
+		return -1;
+	}
+	if (reply.compare(0, 2, "OK") != 0) {
+		pr_info("%s: targeted scan refused (%s), full scan\n", __func__, reply.c_str());
+		full_reconnect();
+		return -1;
+	}
+
+	pr_info("%s: scanning %d MHz for %s\n", __func__, assoc.freq, assoc.bssid);
+
+	pthread_mutex_lock(&m_lock);
+	m_deadline = now_ms() + FAST_RECONNECT_TIMEOUT_MS;
+	m_targeted = true;
+	pthread_mutex_unlock(&m_lock);
+
+	return 0;
+}
+
+int wifi_fast_reconnect_on_disconnected(void)
+{
+	bool held;
+
+	pthread_mutex_lock(&m_lock);
+	held = m_held;
+	pthread_mutex_unlock(&m_lock);
+
+	if (held) {
+		pr_info("%s: our own doing, not going back to the last AP\n", __func__);
+		return -1;
+	}
+	return wifi_fast_reconnect_begin(true);
+}
+
+void wifi_fast_reconnect_hold(void)
+{
+	pthread_mutex_lock(&m_lock);
+	m_held = true;
+	m_start = m_deadline = 0;
+	m_targeted = false;
+	pthread_mutex_unlock(&m_lock);
+}
+
+void wifi_fast_reconnect_on_connected(void)
+{
+	last_assoc_t assoc;
+	bool changed;
+
+	pthread_once(&m_load_once, assoc_load);
+
+	pthread_mutex_lock(&m_lock);
+	if (m_start) {
+		m_last_ms = now_ms() - m_start;
+		m_last_fast = m_targeted;
+		pr_info("%s: connected in %d ms (%s)\n", __func__, m_last_ms,
+				m_last_fast ? "targeted scan" : "full scan");
+	}
+	m_start = m_deadline = 0;
+	m_targeted = false;
+	m_held = false;
+	pthread_mutex_unlock(&m_lock);
+
+	if (!assoc_query(&assoc))
+		return;
+
+	pthread_mutex_lock(&m_lock);
+	changed = !m_assoc.valid || m_assoc.freq != assoc.freq ||
+			strcmp(m_assoc.bssid, assoc.bssid) || strcmp(m_assoc.key_mgmt, assoc.key_mgmt) ||
+			m_assoc.ssid_len != assoc.ssid_len || memcmp(m_assoc.ssid, assoc.ssid, assoc.ssid_len);
+	if (changed)
+		m_assoc = assoc;
+	pthread_mutex_unlock(&m_lock);
+
+	/* flash writes only when we actually moved */
+	if (changed)
+		assoc_save(&assoc);
+}
+
+void wifi_fast_reconnect_cancel(void)
+{
+	pthread_mutex_lock(&m_lock);
+	m_start = m_deadline = 0;
+	m_targeted = false;
+	m_held = false;
+	pthread_mutex_unlock(&m_lock);
+}
+
+int wifi_fast_reconnect_poll_ms(int def_ms)
+{
+	uint64_t now;
+	int ms = def_ms;
+
+	pthread_mutex_lock(&m_lock);
+	if (m_deadline) {
+		now = now_ms();
+		ms = now >= m_deadline ? 0 : (int)(m_deadline - now);
+		if (def_ms >= 0 && ms > def_ms)
+			ms = def_ms;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return ms;
+}
+
+void wifi_fast_reconnect_tick(void)
+{
+	last_assoc_t assoc;
+	bool expired = false;
+
+	pthread_mutex_lock(&m_lock);
+	if (m_deadline && now_ms() >= m_deadline) {
+		m_deadline = 0;
+		expired = true;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	if (!expired)
+		return;
+
+	/* the CONNECTED event may have been missed */
+	if (assoc_query(&assoc)) {
+		wifi_fast_reconnect_on_connected();
+		return;
+	}
+
+	pr_info("%s: not found on its last channel, full scan\n", __func__);
+	pthread_mutex_lock(&m_lock);
+	m_targeted = false;
+	pthread_mutex_unlock(&m_lock);
+	full_reconnect();
+}
+
+int wifi_fast_reconnect_last(bool *fast)
+{
+	int ms;
+
+	pthread_mutex_lock(&m_lock);
+	ms = m_last_ms;
+	if (fast)
+		*fast = m_last_fast;
+	pthread_mutex_unlock(&m_lock);
+
+	return ms;
+}
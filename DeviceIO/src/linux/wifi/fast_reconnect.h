@@ -0,0 +1,46 @@
+#ifndef DEVICEIO_FRAMEWORK_FAST_RECONNECT_H_
+#define DEVICEIO_FRAMEWORK_FAST_RECONNECT_H_
+
+/* last good association, kept across reboots */
+#define WIFI_LAST_ASSOC_PATH		"/data/cfg/wifi_last_assoc"
+/* how long the single channel scan gets before falling back to a full one */
+#define FAST_RECONNECT_TIMEOUT_MS	1500
+
+/*
+ * Start timing a (re)connect. With targeted set and a remembered
+ * association, scan only its channel (and BSSID) first; the full scan
+ * follows from wifi_fast_reconnect_tick() if that doesn't connect in
+ * time. Returns 0 when the targeted scan went out, -1 when it fell
+ * straight back to a full reconnect, the supplicant was busy with a scan
+ * of its own (left alone) or only the clock was started.
+ */
+int wifi_fast_reconnect_begin(bool targeted);
+
+/*
+ * The link went down, or the monitor came up unassociated: begin(true),
+ * unless we are the reason. A connect the user asked for (begin(false))
+ * or wifi_fast_reconnect_hold() tears the old link down on purpose, and
+ * going back to it would undo that; nothing is tried until the next
+ * association. Returns what begin() did, -1 when held.
+ */
+int wifi_fast_reconnect_on_disconnected(void);
+
+/* about to drop the link on request (DISCONNECT), see above */
+void wifi_fast_reconnect_hold(void);
+
+/* association completed: stop the clock, lift a hold and remember where we are */
+void wifi_fast_reconnect_on_connected(void);
+
+/* wifi off, or the user picked another network */
+void wifi_fast_reconnect_cancel(void);
+
+/* poll timeout for the monitor loop, never beyond the fallback deadline */
+int wifi_fast_reconnect_poll_ms(int def_ms);
+
+/* run the full scan fallback once the deadline has passed */
+void wifi_fast_reconnect_tick(void);
+
+/* last time-to-connect in ms, -1 if none yet; fast set when the targeted scan did it */
+int wifi_fast_reconnect_last(bool *fast);
+
+#endif // DEVICEIO_FRAMEWORK_FAST_RECONNECT_H_
@@ -0,0 +1,464 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <vector>
+
+#include "netif.h"
+#include "slog.h"
+
+#define NL_BUF_SIZE		8192
+
+typedef struct {
+	struct nlmsghdr nh;
+	union {
+		struct ifinfomsg ifi;
+		struct ifaddrmsg ifa;
+		struct rtmsg rtm;
+	};
+	char attrs[128];
+} nl_req_t;
+
+/* return false to stop the walk */
+typedef bool (*nl_msg_cb)(struct nlmsghdr *nh, void *arg);
+
+typedef struct {
+	in_addr_t addr;
+	int prefix_len;
+} ipv4_addr_t;
+
+static uint32_t m_seq;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int ms_left(uint64_t deadline)
+{
+	uint64_t now = now_ms();
+
+	return now >= deadline ? 0 : (int)(deadline - now);
+}
+
+static int nl_open(unsigned int groups)
+{
+	struct sockaddr_nl snl;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return -errno;
+
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = groups;
+	if (bind(fd, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		int err = -errno;
+
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+static void nl_init(nl_req_t *req, int type, int flags, size_t body)
+{
+	memset(req, 0, sizeof(*req));
+	req->nh.nlmsg_len = NLMSG_LENGTH(body);
+	req->nh.nlmsg_type = type;
+	req->nh.nlmsg_flags = NLM_F_REQUEST | flags;
+}
+
+static void nl_addattr(nl_req_t *req, int type, const void *data, size_t len)
+{
+	struct rtattr *rta = (struct rtattr *)((char *)&req->nh + NLMSG_ALIGN(req->nh.nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	req->nh.nlmsg_len = NLMSG_ALIGN(req->nh.nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+/*
+ * Send one request with NLM_F_ACK and hand every reply to cb. Dumps end
+ * with NLMSG_DONE, everything else with the ack: 0 or the kernel's -errno.
+ */
+static int nl_talk(nl_req_t *req, nl_msg_cb cb, void *arg)
+{
+	char buf[NL_BUF_SIZE];
+	struct pollfd pfd;
+	uint64_t deadline;
+	uint32_t seq;
+	int fd, len, ret = -ETIMEDOUT;
+	bool done = false;
+
+	fd = nl_open(0);
+	if (fd < 0)
+		return fd;
+
+	seq = __sync_add_and_fetch(&m_seq, 1);
+	req->nh.nlmsg_seq = seq;
+	req->nh.nlmsg_flags |= NLM_F_ACK;
+	if (send(fd, &req->nh, req->nh.nlmsg_len, 0) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	deadline = now_ms() + NETIF_ACK_TIMEOUT_MS;
+	while (!done && poll(&pfd, 1, ms_left(deadline)) > 0) {
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			break;
+		}
+
+		for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq != seq)
+				continue;
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				ret = ((struct nlmsgerr *)NLMSG_DATA(nh))->error;
+				done = true;
+				break;
+			}
+			if (nh->nlmsg_type == NLMSG_DONE) {
+				ret = 0;
+				done = true;
+				break;
+			}
+			if (cb && !cb(nh, arg))
+				cb = NULL;
+		}
+	}
+
+	close(fd);
+	return ret;
+}
+
+typedef struct {
+	const char *ifname;
+	int index;
+	std::vector<ipv4_addr_t> addrs;
+	bool first_only;
+	bool ready;			/* netif_wait_ipv4: an address came */
+} addr_query_t;
+
+/* global IPv4 addresses of one interface */
+static bool addr_walk(struct nlmsghdr *nh, void *arg)
+{
+	addr_query_t *query = (addr_query_t *)arg;
+	struct ifaddrmsg *ifa = (struct ifaddrmsg *)NLMSG_DATA(nh);
+	int len = IFA_PAYLOAD(nh);
+	ipv4_addr_t addr;
+	bool found = false;
+
+	if (nh->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != AF_INET ||
+			(int)ifa->ifa_index != query->index || ifa->ifa_scope == RT_SCOPE_HOST)
+		return true;
+
+	for (struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		/* IFA_LOCAL is ours, IFA_ADDRESS the peer on point-to-point links */
+		if (rta->rta_type == IFA_LOCAL || (rta->rta_type == IFA_ADDRESS && !found)) {
+			memcpy(&addr.addr, RTA_DATA(rta), sizeof(addr.addr));
+			found = true;
+		}
+	}
+	if (!found)
+		return true;
+
+	addr.prefix_len = ifa->ifa_prefixlen;
+	query->addrs.push_back(addr);
+
+	return !query->first_only;
+}
+
+static int addr_query(const char *ifname, addr_query_t *query)
+{
+	nl_req_t req;
+
+	query->index = if_nametoindex(ifname);
+	if (!query->index)
+		return -ENODEV;
+
+	nl_init(&req, RTM_GETADDR, NLM_F_DUMP, sizeof(struct ifaddrmsg));
+	req.ifa.ifa_family = AF_INET;
+
+	return nl_talk(&req, addr_walk, query);
+}
+
+static int addr_del(int index, const ipv4_addr_t *addr)
+{
+	nl_req_t req;
+
+	nl_init(&req, RTM_DELADDR, 0, sizeof(struct ifaddrmsg));
+	req.ifa.ifa_family = AF_INET;
+	req.ifa.ifa_prefixlen = addr->prefix_len;
+	req.ifa.ifa_index = index;
+	nl_addattr(&req, IFA_LOCAL, &addr->addr, sizeof(addr->addr));
+
+	return nl_talk(&req, NULL, NULL);
+}
+
+int netif_set_link(const char *ifname, bool up)
+{
+	nl_req_t req;
+	int index, ret;
+
+	index = if_nametoindex(ifname);
+	if (!index)
+		return -ENODEV;
+
+	nl_init(&req, RTM_NEWLINK, 0, sizeof(struct ifinfomsg));
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = index;
+	req.ifi.ifi_change = IFF_UP;
+	req.ifi.ifi_flags = up ? IFF_UP : 0;
+
+	ret = nl_talk(&req, NULL, NULL);
+	if (ret)
+		pr_err("%s: %s %s failed: %s\n", __func__, ifname, up ? "up" : "down", strerror(-ret));
+
+	return ret;
+}
+
+int netif_flush_ipv4(const char *ifname)
+{
+	addr_query_t query;
+	int ret;
+
+	query.first_only = false;
+	ret = addr_query(ifname, &query);
+	if (ret)
+		return ret;
+
+	for (size_t i = 0; i < query.addrs.size(); i++) {
+		/* secondaries go with their primary */
+		ret = addr_del(query.index, &query.addrs[i]);
+		if (ret && ret != -EADDRNOTAVAIL)
+			pr_err("%s: %s: %s\n", __func__, ifname, strerror(-ret));
+	}
+
+	return 0;
+}
+
+int netif_set_ipv4(const char *ifname, const char *addr, int prefix_len)
+{
+	nl_req_t req;
+	in_addr_t local, brd;
+	int index, ret;
+
+	if (prefix_len < 0 || prefix_len > 32 || inet_pton(AF_INET, addr, &local) != 1)
+		return -EINVAL;
+
+	index = if_nametoindex(ifname);
+	if (!index)
+		return -ENODEV;
+
+	netif_flush_ipv4(ifname);
+
+	brd = local | htonl(prefix_len == 32 ? 0 : 0xffffffffu >> prefix_len);
+	nl_init(&req, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, sizeof(struct ifaddrmsg));
+	req.ifa.ifa_family = AF_INET;
+	req.ifa.ifa_prefixlen = prefix_len;
+	req.ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+	req.ifa.ifa_index = index;
+	nl_addattr(&req, IFA_LOCAL, &local, sizeof(local));
+	nl_addattr(&req, IFA_ADDRESS, &local, sizeof(local));
+	nl_addattr(&req, IFA_BROADCAST, &brd, sizeof(brd));
+
+	ret = nl_talk(&req, NULL, NULL);
+	if (ret)
+		pr_err("%s: %s %s/%d failed: %s\n", __func__, ifname, addr, prefix_len, strerror(-ret));
+
+	return ret;
+}
+
+int netif_get_ipv4(const char *ifname, char *addr, size_t len)
+{
+	addr_query_t query;
+	int ret;
+
+	query.first_only = true;
+	ret = addr_query(ifname, &query);
+	if (ret)
+		return ret;
+	if (query.addrs.empty())
+		return -EADDRNOTAVAIL;
+
+	if (addr && !inet_ntop(AF_INET, &query.addrs[0].addr, addr, len))
+		return -errno;
+
+	return 0;
+}
+
+int netif_add_default_route(const char *ifname, const char *gw)
+{
+	nl_req_t req;
+	in_addr_t via;
+	int index, ret;
+
+	if (!gw || inet_pton(AF_INET, gw, &via) != 1)
+		return -EINVAL;
+
+	index = if_nametoindex(ifname);
+	if (!index)
+		return -ENODEV;
+
+	nl_init(&req, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL, sizeof(struct rtmsg));
+	req.rtm.rtm_family = AF_INET;
+	req.rtm.rtm_table = RT_TABLE_MAIN;
+	req.rtm.rtm_protocol = RTPROT_BOOT;
+	req.rtm.rtm_scope = RT_SCOPE_UNIVERSE;
+	req.rtm.rtm_type = RTN_UNICAST;
+	nl_addattr(&req, RTA_GATEWAY, &via, sizeof(via));
+	nl_addattr(&req, RTA_OIF, &index, sizeof(index));
+
+	ret = nl_talk(&req, NULL, NULL);
+	if (ret)
+		pr_err("%s: via %s dev %s failed: %s\n", __func__, gw, ifname, strerror(-ret));
+
+	return ret;
+}
+
+typedef struct {
+	const char *ifname;
+	unsigned int flags;
+	bool ready;
+} link_query_t;
+
+static bool link_walk(struct nlmsghdr *nh, void *arg)
+{
+	link_query_t *query = (link_query_t *)arg;
+	struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(nh);
+	int len = IFLA_PAYLOAD(nh);
+
+	if (nh->nlmsg_type != RTM_NEWLINK)
+		return true;
+
+	for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME && !strcmp((const char *)RTA_DATA(rta), query->ifname)) {
+			query->ready = (ifi->ifi_flags & query->flags) == query->flags;
+			return !query->ready;
+		}
+	}
+
+	return true;
+}
+
+static bool newaddr_walk(struct nlmsghdr *nh, void *arg)
+{
+	addr_query_t *query = (addr_query_t *)arg;
+
+	if (!query->index)
+		query->index = if_nametoindex(query->ifname);
+	addr_walk(nh, query);
+	query->ready = !query->addrs.empty();
+
+	return !query->ready;
+}
+
+/* feed what arrives on a subscribed socket to cb until it says stop */
+static int nl_wait(int fd, uint64_t deadline, nl_msg_cb cb, void *arg, bool *ready)
+{
+	char buf[NL_BUF_SIZE];
+	struct pollfd pfd;
+	int len, ret;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (!*ready) {
+		ret = poll(&pfd, 1, ms_left(deadline));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -ETIMEDOUT;
+
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			/* ENOBUFS: events were lost, the caller's query covers it */
+			if (errno == EINTR || errno == ENOBUFS)
+				continue;
+			return -errno;
+		}
+
+		for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (!cb(nh, arg))
+				break;
+		}
+	}
+
+	return 0;
+}
+
+int netif_wait_link(const char *ifname, unsigned int flags, int timeout_ms)
+{
+	link_query_t query;
+	nl_req_t req;
+	uint64_t deadline = now_ms() + timeout_ms;
+	int fd, ret;
+
+	/* subscribe before looking, so nothing falls in between */
+	fd = nl_open(RTMGRP_LINK);
+	if (fd < 0)
+		return fd;
+
+	query.ifname = ifname;
+	query.flags = flags;
+	query.ready = false;
+
+	nl_init(&req, RTM_GETLINK, 0, sizeof(struct ifinfomsg));
+	req.ifi.ifi_family = AF_UNSPEC;
+	nl_addattr(&req, IFLA_IFNAME, ifname, strlen(ifname) + 1);
+	nl_talk(&req, link_walk, &query);
+
+	ret = nl_wait(fd, deadline, link_walk, &query, &query.ready);
+	close(fd);
+
+	if (ret)
+		pr_info("%s: %s not ready (flags 0x%x) after %d ms\n", __func__, ifname, flags, timeout_ms);
+
+	return ret;
+}
+
+int netif_wait_ipv4(const char *ifname, int timeout_ms)
+{
+	addr_query_t query;
+	uint64_t deadline = now_ms() + timeout_ms;
+	int fd, ret;
+
+	/* subscribe before looking, so nothing falls in between */
+	fd = nl_open(RTMGRP_IPV4_IFADDR);
+	if (fd < 0)
+		return fd;
+
+	/* the index may only show up once the interface does */
+	query.ifname = ifname;
+	query.index = if_nametoindex(ifname);
+	query.first_only = true;
+	query.ready = netif_get_ipv4(ifname, NULL, 0) == 0;
+
+	ret = nl_wait(fd, deadline, newaddr_walk, &query, &query.ready);
+	close(fd);
+
+	if (ret)
+		pr_info("%s: no address on %s after %d ms\n", __func__, ifname, timeout_ms);
+
+	return ret;
+}
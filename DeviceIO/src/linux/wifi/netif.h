@@ -0,0 +1,41 @@
+#ifndef DEVICEIO_FRAMEWORK_NETIF_H_
+#define DEVICEIO_FRAMEWORK_NETIF_H_
+
+#include <stddef.h>
+
+/* how long to wait for the kernel to acknowledge a change */
+#define NETIF_ACK_TIMEOUT_MS	1000
+
+/*
+ * Interface and IPv4 address management over rtnetlink, in place of
+ * ifconfig/ip/route through the shell. Changes return once the kernel
+ * has acknowledged them. All return 0 on success and a negative errno
+ * otherwise (-ENODEV for an unknown interface, -ETIMEDOUT when nothing
+ * came in time).
+ */
+
+/* "ifconfig <ifname> up/down" */
+int netif_set_link(const char *ifname, bool up);
+
+/* "ip addr flush dev <ifname>", IPv4 only; same as "ifconfig <ifname> 0.0.0.0" */
+int netif_flush_ipv4(const char *ifname);
+
+/* "ifconfig <ifname> <addr> netmask ...", replacing the addresses already there */
+int netif_set_ipv4(const char *ifname, const char *addr, int prefix_len);
+
+/* first global IPv4 address of ifname, dotted */
+int netif_get_ipv4(const char *ifname, char *addr, size_t len);
+
+/* "route add default gw <gw> <ifname>" */
+int netif_add_default_route(const char *ifname, const char *gw);
+
+/*
+ * Wait until ifname exists with all of flags (IFF_UP, IFF_RUNNING...)
+ * set, e.g. after "iw ... interface add". Returns at once if it does.
+ */
+int netif_wait_link(const char *ifname, unsigned int flags, int timeout_ms);
+
+/* wait until ifname has a global IPv4 address, e.g. from dhcpcd */
+int netif_wait_ipv4(const char *ifname, int timeout_ms);
+
+#endif // DEVICEIO_FRAMEWORK_NETIF_H_
@@ -1,47 +1,28 @@
-#include <fstream>
 #include <string>
 #include <vector>
+#include <errno.h>
 #include <netdb.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/types.h>
 #include "ping.h"
 
 using std::string;
 using std::vector;
-using std::ifstream;
 
-#define PACKET_SIZE         4096
-#define MAX_WAIT_TIME       1
-#define MAX_PACKETS_COUNT   4
+#define ICMP_DATA_LEN       56
+/* largest IP header plus the echo header and payload */
+#define ICMP_PACKET_SIZE    (60 + 8 + ICMP_DATA_LEN)
 #define MAX_PING_INTERVAL   300
-#define PING_DEST_HOST1     "114.114.114.114"
-#define PING_DEST_HOST2     "8.8.8.8"
-
-struct IcmpEchoReply {
-    int icmpSeq;
-    int icmpLen;
-    int ipTtl;
-    double rtt;
-    std::string fromAddr;
-    bool isReply;
-};
-
-struct PingResult {
-    int dataLen;
-    int nsend;
-    int nreceived;
-    char ip[32];
-    std::string error;
-    std::vector<IcmpEchoReply> icmpEchoReplys;
-};
 
 //network status
 enum InternetConnectivity {
@@ -50,21 +31,32 @@ enum InternetConnectivity {
     UNKNOW
 };
 
+/* one echo request in flight, indexed by (seq - first seq of the run) */
+struct ProbeSlot {
+    int target;
+    long sent_us;
+    bool replied;
+};
+
+/* the socket and its epoll set live for the whole process */
+static pthread_mutex_t m_probe_lock = PTHREAD_MUTEX_INITIALIZER;
+static int m_sockfd = -1;
+static int m_epfd = -1;
+static bool m_raw = false;
+static unsigned short m_ident;
+static unsigned short m_icmp_seq = 0;
+
 static pthread_mutex_t m_ping_lock = PTHREAD_MUTEX_INITIALIZER;
-static char m_sendpacket[PACKET_SIZE];
-static char m_recvpacket[PACKET_SIZE];
-static int m_maxPacketSize = MAX_PACKETS_COUNT;
-static int m_sockfd;
-static int m_datalen = 56;
-static int m_nsend = 0;
-static int m_nreceived = 0;
-static int m_icmp_seq = 0;
-static struct sockaddr_in m_dest_addr;
-static struct sockaddr_in m_from_addr;
-static pid_t m_pid;
 int m_ping_interval = 1;
 static int m_network_status = 0;
-static bool m_pinging = false;
+
+static long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
 
 static unsigned short getChksum(unsigned short *addr,int len) {
     int nleft = len;
@@ -89,258 +81,305 @@ static unsigned short getChksum(unsigned short *addr,int len) {
     return answer;
 }
 
-static int packIcmp(int pack_no, struct icmp* icmp) {
-    int packsize;
-    struct icmp *picmp;
-    struct timeval *tval;
-
-    picmp = icmp;
-    picmp->icmp_type = ICMP_ECHO;
-    picmp->icmp_code = 0;
-    picmp->icmp_cksum = 0;
-    picmp->icmp_seq = pack_no;
-    picmp->icmp_id = m_pid;
-    packsize = (8 + m_datalen);
-    tval= (struct timeval *)icmp->icmp_data;
-    gettimeofday(tval, nullptr);
-    picmp->icmp_cksum = getChksum((unsigned short *)icmp, packsize);
-
-    return packsize;
-}
+/*
+ * Prefer an unprivileged ping socket: the kernel demuxes replies to it by
+ * id, so we only ever see our own. Fall back to a raw socket, which sees
+ * every ICMP packet on the box and has to filter by id itself.
+ */
+static bool probe_socket_open(void)
+{
+    struct epoll_event ev;
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    int size = 64 * 1024;
 
-static bool sendPacket() {
-    size_t packetsize;
-    while( m_nsend < m_maxPacketSize) {
-        m_nsend ++;
-        m_icmp_seq ++;
-        packetsize = packIcmp(m_icmp_seq, (struct icmp*)m_sendpacket);
+    if (m_sockfd >= 0)
+        return true;
 
-        if (sendto(m_sockfd,m_sendpacket, packetsize, 0, (struct sockaddr *) &m_dest_addr, sizeof(m_dest_addr)) < 0) {
-            //printf("Ping sendto failed:%s.", strerror(errno));
-            continue;
-        }
+    m_sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMP);
+    m_raw = false;
+    if (m_sockfd < 0) {
+        m_sockfd = socket(AF_INET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_ICMP);
+        m_raw = true;
+    }
+    if (m_sockfd < 0) {
+        printf("Ping socket failed:%s.\n", strerror(errno));
+        return false;
     }
 
-    return true;
-}
-
-static struct timeval timevalSub(struct timeval timeval1, struct timeval timeval2) {
-    struct timeval result;
+    if (setsockopt(m_sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0)
+        printf("Setsockopt SO_RCVBUF failed:%s.\n", strerror(errno));
 
-    result = timeval1;
+    if (m_raw) {
+        m_ident = getpid() & 0xffff;
+    } else {
+        /* the kernel rewrites the echo id to the socket's local port */
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        bind(m_sockfd, (struct sockaddr *)&local, sizeof(local));
+        if (getsockname(m_sockfd, (struct sockaddr *)&local, &len) == 0)
+            m_ident = ntohs(local.sin_port);
+    }
 
-    if ((result.tv_usec < timeval2.tv_usec) && (timeval2.tv_usec < 0)) {
-        -- result.tv_sec;
-        result.tv_usec += 1000000;
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epfd < 0) {
+        printf("Ping epoll_create failed:%s.\n", strerror(errno));
+        close(m_sockfd);
+        m_sockfd = -1;
+        return false;
     }
 
-    result.tv_sec -= timeval2.tv_sec;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = m_sockfd;
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_sockfd, &ev);
 
-    return result;
+    return true;
 }
 
-static bool unpackIcmp(char *buf, int len, struct IcmpEchoReply *icmpEchoReply) {
-    int iphdrlen;
-    struct ip *ip;
-    struct icmp *icmp;
-    struct timeval *tvsend, tvrecv, tvresult;
-    double rtt;
+static void probe_socket_close(void)
+{
+    if (m_epfd >= 0)
+        close(m_epfd);
+    if (m_sockfd >= 0)
+        close(m_sockfd);
+    m_epfd = m_sockfd = -1;
+}
 
-    ip = (struct ip *)buf;
-    iphdrlen = ip->ip_hl << 2;
-    icmp = (struct icmp *)(buf + iphdrlen);
-    len -= iphdrlen;
+static bool probe_resolve(icmp_probe_t *probe)
+{
+    struct addrinfo hints, *res = NULL;
+
+    if (probe->resolved)
+        return true;
+
+    memset(&probe->addr, 0, sizeof(probe->addr));
+    probe->addr.sin_family = AF_INET;
+    if (inet_aton(probe->host, &probe->addr.sin_addr)) {
+        probe->resolved = true;
+        return true;
+    }
 
-    if (len < 8) {
-        printf("ICMP packets's length is less than 8.");
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    if (getaddrinfo(probe->host, NULL, &hints, &res) != 0 || !res) {
+        printf("Ping unknow host %s\n", probe->host);
         return false;
     }
 
-    if( (icmp->icmp_type == ICMP_ECHOREPLY) && (icmp->icmp_id == m_pid) ) {
-        tvsend = (struct timeval *)icmp->icmp_data;
-        gettimeofday(&tvrecv, nullptr);
-        tvresult = timevalSub(tvrecv, *tvsend);
-        rtt = tvresult.tv_sec*1000 + tvresult.tv_usec/1000;  //ms
-        icmpEchoReply->rtt = rtt;
-        icmpEchoReply->icmpSeq = icmp->icmp_seq;
-        icmpEchoReply->ipTtl = ip->ip_ttl;
-        icmpEchoReply->icmpLen = len;
+    probe->addr.sin_addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    probe->resolved = true;
 
-        return true;
-    } else {
+    return true;
+}
+
+static bool probe_send(icmp_probe_t *probe, unsigned short seq)
+{
+    char packet[8 + ICMP_DATA_LEN];
+    struct icmp *icmp = (struct icmp *)packet;
+
+    memset(packet, 0, sizeof(packet));
+    icmp->icmp_type = ICMP_ECHO;
+    icmp->icmp_code = 0;
+    icmp->icmp_id = htons(m_ident);
+    icmp->icmp_seq = htons(seq);
+    icmp->icmp_cksum = getChksum((unsigned short *)icmp, sizeof(packet));
+
+    if (sendto(m_sockfd, packet, sizeof(packet), 0,
+               (struct sockaddr *)&probe->addr, sizeof(probe->addr)) < 0) {
+        printf("Ping sendto %s failed:%s.\n", probe->host, strerror(errno));
         return false;
     }
+    /* a probe that never left is not a lost one */
+    probe->sent++;
+
+    return true;
 }
 
-static bool recvPacket(PingResult &pingResult) {
-    int len = 0;
-    struct IcmpEchoReply icmpEchoReply;
-    int maxfds = m_sockfd + 1;
-    int nfd  = 0;
-    fd_set rset;
-    struct timeval timeout;
-    socklen_t fromlen = sizeof(m_from_addr);
+/* returns the echo sequence of a reply meant for us, -1 for anything else */
+static int probe_parse(char *buf, int len)
+{
+    struct icmp *icmp;
+    int iphdrlen = 0;
 
-    timeout.tv_sec = MAX_WAIT_TIME;
-    timeout.tv_usec = 0;
+    if (m_raw) {
+        if (len < (int)sizeof(struct ip))
+            return -1;
+        iphdrlen = ((struct ip *)buf)->ip_hl << 2;
+    }
+    if (len - iphdrlen < 8)
+        return -1;
 
-    FD_ZERO(&rset);
+    icmp = (struct icmp *)(buf + iphdrlen);
+    if (icmp->icmp_type != ICMP_ECHOREPLY)
+        return -1;
+    if (m_raw && ntohs(icmp->icmp_id) != m_ident)
+        return -1;
 
-    for (int recvCount = 0; recvCount < m_maxPacketSize; recvCount ++) {
-        FD_SET(m_sockfd, &rset);
-        if ((nfd = select(maxfds, &rset, nullptr, nullptr, &timeout)) == -1) {
-            printf("Ping recv select failed:%s.", strerror(errno));
-            continue;
-        }
+    return ntohs(icmp->icmp_seq);
+}
 
-        if (nfd == 0) {
-            icmpEchoReply.isReply = false;
-            pingResult.icmpEchoReplys.push_back(icmpEchoReply);
-            continue;
-        }
+static void probe_drain(void)
+{
+    char buf[ICMP_PACKET_SIZE];
 
-        if (FD_ISSET(m_sockfd, &rset)) {
-            if ((len = recvfrom(m_sockfd,
-                                m_recvpacket,
-                                sizeof(m_recvpacket),
-                                0,
-                                (struct sockaddr *)&m_from_addr,
-                                &fromlen)) <0) {
-                if(errno == EINTR) {
-                    continue;
-                }
-                printf("Ping recvfrom failed: %s.", strerror(errno));
-                continue;
-            }
+    while (recv(m_sockfd, buf, sizeof(buf), 0) > 0)
+        ;
+}
 
-            icmpEchoReply.fromAddr = inet_ntoa(m_from_addr.sin_addr) ;
-            if (strncmp(icmpEchoReply.fromAddr.c_str(), pingResult.ip, strlen(pingResult.ip)) != 0) {
-                recvCount--;
-                continue;
-            }
-        }
+void icmp_probe_target_init(icmp_probe_t *probe, const char *host)
+{
+    memset(probe, 0, sizeof(*probe));
+    probe->host = host;
+}
 
-        if (!unpackIcmp(m_recvpacket, len, &icmpEchoReply)) {
-            recvCount--;
-            continue;
-        }
+int icmp_probe_run(icmp_probe_t *probes, int n, int count, int timeout_ms, bool stop_on_reply)
+{
+    char buf[ICMP_PACKET_SIZE];
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct epoll_event ev;
+    vector<ProbeSlot> slots;
+    unsigned short base;
+    long start, now, deadline, next_send;
+    int round = 0, outstanding = 0, answered = 0;
+    bool done = false;
+
+    for (int i = 0; i < n; i++) {
+        probes[i].sent = probes[i].received = 0;
+        probes[i].rtt_min_us = probes[i].rtt_avg_us = probes[i].rtt_max_us = 0;
+        probes[i].rtt_sum_us = 0;
+        probes[i].loss_percent = 100;
+        probe_resolve(&probes[i]);
+    }
 
-        icmpEchoReply.isReply = true;
-        pingResult.icmpEchoReplys.push_back(icmpEchoReply);
-        m_nreceived ++;
+    pthread_mutex_lock(&m_probe_lock);
+    if (!probe_socket_open()) {
+        pthread_mutex_unlock(&m_probe_lock);
+        return -1;
     }
 
-    return true;
-}
+    /* late replies of an earlier run could alias this run's sequences */
+    probe_drain();
 
-static bool getsockaddr(const char * hostOrIp, struct sockaddr_in* sockaddr) {
-    struct hostent *host;
-    struct sockaddr_in dest_addr;
-    unsigned long inaddr = 0l;
+    slots.resize(n * count);
+    base = m_icmp_seq;
+    m_icmp_seq += n * count;
 
-    bzero(&dest_addr,sizeof(dest_addr));
-    dest_addr.sin_family = AF_INET;
+    start = next_send = now_us();
+    deadline = start + timeout_ms * 1000L;
 
-    inaddr = inet_addr(hostOrIp);
-    if (inaddr == INADDR_NONE) {
-        host = gethostbyname(hostOrIp);
-        if (host == nullptr) {
-            return false;
-        }
-        memcpy( (char *)&dest_addr.sin_addr,host->h_addr, host->h_length);
-    } else if (!inet_aton(hostOrIp, &dest_addr.sin_addr)) {
-        return false;
-    }
+    while (!done) {
+        now = now_us();
 
-    *sockaddr = dest_addr;
+        /* each round pings every target back to back */
+        if (round < count && now >= next_send) {
+            for (int i = 0; i < n; i++) {
+                ProbeSlot &slot = slots[round * n + i];
 
-    return true;
-}
+                slot.target = i;
+                slot.replied = false;
+                slot.sent_us = now_us();
+                if (probes[i].resolved && probe_send(&probes[i], base + round * n + i))
+                    outstanding++;
+            }
+            round++;
+            next_send = now + ICMP_PROBE_INTERVAL_MS * 1000L;
+        }
 
-static bool ping(string host, int count, PingResult& pingResult) {
-    int size = 50 * 1024;
-    IcmpEchoReply icmpEchoReply;
+        if (round >= count && outstanding == 0)
+            break;
+        if (now >= deadline)
+            break;
 
-    m_nsend = 0;
-    m_nreceived = 0;
-    pingResult.icmpEchoReplys.clear();
-    m_maxPacketSize = count;
-    m_pid = getpid();
+        long wake = deadline;
+        if (round < count && next_send < wake)
+            wake = next_send;
+        int wait_ms = (wake - now + 999) / 1000;
 
-    pingResult.dataLen = m_datalen;
+        int nfd = epoll_wait(m_epfd, &ev, 1, wait_ms);
+        if (nfd < 0) {
+            if (errno == EINTR)
+                continue;
+            printf("Ping epoll_wait failed:%s.\n", strerror(errno));
+            probe_socket_close();
+            break;
+        }
+        if (nfd == 0)
+            continue;
 
-    if ((m_sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP)) < 0) {
-        printf("Ping socket failed:%s.", strerror(errno));
-        pingResult.error = strerror(errno);
-        return false;
-    }
+        for (;;) {
+            fromlen = sizeof(from);
+            int len = recvfrom(m_sockfd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromlen);
+            if (len < 0)
+                break;
 
-    if (setsockopt(m_sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0) {
-        printf("Setsockopt SO_RCVBUF failed:%s.", strerror(errno));
-        close(m_sockfd);
-        return false;
-    }
+            int seq = probe_parse(buf, len);
+            if (seq < 0)
+                continue;
 
-    if (!getsockaddr(host.c_str(), &m_dest_addr)) {
-        pingResult.error = "unknow host " + host;
-        close(m_sockfd);
-        return false;
-    }
+            unsigned short idx = (unsigned short)(seq - base);
+            if (idx >= slots.size() || idx >= (unsigned)(round * n))
+                continue;
 
-    strcpy(pingResult.ip, inet_ntoa(m_dest_addr.sin_addr));
+            ProbeSlot &slot = slots[idx];
+            icmp_probe_t *probe = &probes[slot.target];
+            if (slot.replied || from.sin_addr.s_addr != probe->addr.sin_addr.s_addr)
+                continue;
 
-    sendPacket();
-    recvPacket(pingResult);
+            int rtt = now_us() - slot.sent_us;
+            slot.replied = true;
+            outstanding--;
+            if (!probe->received++)
+                answered++;
+            if (!probe->rtt_min_us || rtt < probe->rtt_min_us)
+                probe->rtt_min_us = rtt;
+            if (rtt > probe->rtt_max_us)
+                probe->rtt_max_us = rtt;
+            probe->rtt_sum_us += rtt;
+
+            if (stop_on_reply) {
+                done = true;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&m_probe_lock);
 
-    pingResult.nsend = m_nsend;
-    pingResult.nreceived = m_nreceived;
+    for (int i = 0; i < n; i++) {
+        icmp_probe_t *probe = &probes[i];
 
-    close(m_sockfd);
+        if (probe->received)
+            probe->rtt_avg_us = probe->rtt_sum_us / probe->received;
+        if (probe->sent)
+            probe->loss_percent = (probe->sent - probe->received) * 100 / probe->sent;
+    }
 
-    return true;
+    return answered;
 }
 
 bool rk_ping(char *address)
 {
-    string hostOrIp;
-    int nsend = 0, nreceived = 0;
+    icmp_probe_t probes[2];
+    int n = 0;
     bool ret;
-    PingResult pingResult;
-    InternetConnectivity networkResult = UNAVAILABLE;
 
-    pthread_mutex_lock(&m_ping_lock);
-
-    if (address)
-        hostOrIp = address;
-    else
-        hostOrIp = PING_DEST_HOST1;
+    if (address) {
+        icmp_probe_target_init(&probes[n++], address);
+    } else {
+        icmp_probe_target_init(&probes[n++], PING_DEST_HOST1);
+        icmp_probe_target_init(&probes[n++], PING_DEST_HOST2);
+    }
 
-    printf("%s: ping %s\n", __func__, hostOrIp.c_str());
+    ret = icmp_probe_run(probes, n, ICMP_PROBE_COUNT, ICMP_PROBE_TIMEOUT_MS, true) > 0;
 
-    for (int count = 1; count <= MAX_PACKETS_COUNT; count ++) {
-        memset(&pingResult.ip, 0x0, 32);
-        ret = ping(hostOrIp, 1, pingResult);
+    for (int i = 0; i < n; i++)
+        printf("%s: %s sent %d recv %d rtt %d us\n", __func__, probes[i].host,
+               probes[i].sent, probes[i].received, probes[i].rtt_avg_us);
 
-        if (!ret) {
-            printf("Ping error:%s\n", pingResult.error.c_str());
-        } else {
-            nsend += pingResult.nsend;
-            nreceived += pingResult.nreceived;
-            if (nreceived > 0)
-                break;
-        }
-
-        if (count == 2) {
-		    if (address)
-		        hostOrIp = address;
-		    else
-		        hostOrIp = PING_DEST_HOST2;
-        }
-    }
-
-    if (nreceived > 0) {
-        ret = true;
-        networkResult = AVAILABLE;
+    pthread_mutex_lock(&m_ping_lock);
+    if (ret) {
         if (m_network_status == (int)UNAVAILABLE) {
             m_ping_interval = 1;
         } else {
@@ -353,12 +392,9 @@ bool rk_ping(char *address)
         }
         m_network_status = 1;
     } else {
-        ret = false;
-        networkResult = UNAVAILABLE;
         m_network_status = 0;
         m_ping_interval = 1;
     }
-
     pthread_mutex_unlock(&m_ping_lock);
 
     return ret;
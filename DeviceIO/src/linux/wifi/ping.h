@@ -1,10 +1,48 @@
 #ifndef DEVICEIO_FRAMEWORK_PING_H_
 #define DEVICEIO_FRAMEWORK_PING_H_
 
+#include <netinet/in.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define PING_DEST_HOST1         "114.114.114.114"
+#define PING_DEST_HOST2         "8.8.8.8"
+
+/* echo requests per target and the spacing between them */
+#define ICMP_PROBE_COUNT        4
+#define ICMP_PROBE_INTERVAL_MS  250
+/* how long a probe run waits for replies after the first request */
+#define ICMP_PROBE_TIMEOUT_MS   2000
+
+typedef struct {
+    const char *host;           /* name or dotted quad, resolved on first use */
+    struct sockaddr_in addr;
+    bool resolved;
+
+    /* filled in by icmp_probe_run() */
+    int sent;
+    int received;
+    int rtt_min_us;
+    int rtt_avg_us;
+    int rtt_max_us;
+    int loss_percent;
+    long rtt_sum_us;
+} icmp_probe_t;
+
+void icmp_probe_target_init(icmp_probe_t *probe, const char *host);
+
+/*
+ * Ping all targets at once over one shared ICMP socket. Each target gets
+ * up to count echo requests, ICMP_PROBE_INTERVAL_MS apart; replies are
+ * matched back by id/sequence. With stop_on_reply the run ends on the
+ * first answer from any target, so a working uplink costs one RTT.
+ * Returns the number of targets that answered, -1 if no socket could
+ * be opened.
+ */
+int icmp_probe_run(icmp_probe_t *probes, int n, int count, int timeout_ms, bool stop_on_reply);
+
 bool rk_ping(char *address);
 
 #ifdef __cplusplus
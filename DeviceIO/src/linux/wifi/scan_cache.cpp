@@ -0,0 +1,209 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bss_table.h"
+#include "scan_cache.h"
+#include "slog.h"
+#include "wpa_ctrl_channel.h"
+
+/* how often a waiting caller re-reads scan_r when no scan event shows up */
+#define SCAN_CACHE_POLL_MS	500
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	std::string scan_r;
+	uint64_t stamp;			/* when scan_r was filled, 0 if never */
+	uint64_t scan_req;		/* when the pending scan was triggered, 0 if none */
+	unsigned long generation;
+} scan_cache_t;
+
+static scan_cache_t m_cache;
+static pthread_once_t m_cache_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void scan_cache_init(void)
+{
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&m_cache.lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&m_cache.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	m_cache.stamp = 0;
+	m_cache.scan_req = 0;
+	m_cache.generation = 0;
+}
+
+static bool fetch_scan_r(std::string &out)
+{
+	if (wpa_ctrl_channel_request("SCAN_RESULTS", out) != 0) {
+		pr_err("%s: scan_results failed\n", __func__);
+		out.clear();
+		return false;
+	}
+
+	wifi_bss_table_sync(out);
+	return true;
+}
+
+/* scan_r always starts with a header line, anything after it is an AP */
+static bool has_entries(const std::string &scan_r)
+{
+	std::string::size_type nl = scan_r.find('\n');
+
+	return nl != std::string::npos && nl + 1 < scan_r.size();
+}
+
+static void store_locked(std::string &scan_r)
+{
+	m_cache.scan_r.swap(scan_r);
+	m_cache.stamp = now_ms();
+	m_cache.scan_req = 0;
+	m_cache.generation++;
+	pthread_cond_broadcast(&m_cache.cond);
+}
+
+/* Trigger a rescan unless one is already on its way. Called unlocked. */
+static void request_scan(void)
+{
+	uint64_t now = now_ms();
+	std::string reply;
+	bool pending;
+
+	pthread_mutex_lock(&m_cache.lock);
+	pending = m_cache.scan_req && (now - m_cache.scan_req) < SCAN_CACHE_SCAN_TIMEOUT_MS;
+	if (!pending)
+		m_cache.scan_req = now;
+	pthread_mutex_unlock(&m_cache.lock);
+
+	if (pending)
+		return;
+
+	/* FAIL-BUSY just means a scan is already running */
+	if (wpa_ctrl_channel_request("SCAN", reply) != 0)
+		pr_err("%s: trigger scan failed\n", __func__);
+}
+
+/* scan_r may be NULL when the caller reads the BSS table instead */
+static int cache_get(std::string *scan_r, const int wait_ms)
+{
+	uint64_t now, age, deadline;
+	unsigned long generation;
+	std::string fetched;
+	struct timespec ts;
+	int ret = -1;
+
+	pthread_once(&m_cache_once, scan_cache_init);
+
+	now = now_ms();
+	pthread_mutex_lock(&m_cache.lock);
+	if (m_cache.stamp) {
+		age = now - m_cache.stamp;
+		if (age < SCAN_CACHE_MAX_STALE_MS) {
+			if (scan_r)
+				*scan_r = m_cache.scan_r;
+			pthread_mutex_unlock(&m_cache.lock);
+			if (age >= SCAN_CACHE_TTL_MS)
+				request_scan();
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&m_cache.lock);
+
+	/*
+	 * Nothing usable cached. The supplicant usually still holds the BSS
+	 * table of its last scan, so serve that and let a rescan refresh it.
+	 */
+	if (fetch_scan_r(fetched) && has_entries(fetched)) {
+		pthread_mutex_lock(&m_cache.lock);
+		store_locked(fetched);
+		if (scan_r)
+			*scan_r = m_cache.scan_r;
+		pthread_mutex_unlock(&m_cache.lock);
+		request_scan();
+		return 0;
+	}
+
+	request_scan();
+
+	deadline = now + wait_ms;
+	pthread_mutex_lock(&m_cache.lock);
+	generation = m_cache.generation;
+	while (generation == m_cache.generation) {
+		now = now_ms();
+		if (now >= deadline)
+			break;
+
+		now += (deadline - now) < SCAN_CACHE_POLL_MS ? (deadline - now) : SCAN_CACHE_POLL_MS;
+		ts.tv_sec = now / 1000;
+		ts.tv_nsec = (now % 1000) * 1000000;
+		if (pthread_cond_timedwait(&m_cache.cond, &m_cache.lock, &ts) == 0)
+			continue;
+
+		/* no scan event (monitor not running?), look for ourselves */
+		pthread_mutex_unlock(&m_cache.lock);
+		bool got = fetch_scan_r(fetched) && has_entries(fetched);
+		pthread_mutex_lock(&m_cache.lock);
+		if (got && generation == m_cache.generation)
+			store_locked(fetched);
+	}
+
+	if (generation != m_cache.generation) {
+		if (scan_r)
+			*scan_r = m_cache.scan_r;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&m_cache.lock);
+
+	return ret;
+}
+
+int wifi_scan_cache_get(std::string &scan_r, const int wait_ms)
+{
+	return cache_get(&scan_r, wait_ms);
+}
+
+int wifi_scan_cache_refresh(const int wait_ms)
+{
+	return cache_get(NULL, wait_ms);
+}
+
+void wifi_scan_cache_on_results(void)
+{
+	std::string fetched;
+
+	pthread_once(&m_cache_once, scan_cache_init);
+
+	if (!fetch_scan_r(fetched))
+		return;
+
+	pthread_mutex_lock(&m_cache.lock);
+	store_locked(fetched);
+	pthread_mutex_unlock(&m_cache.lock);
+}
+
+void wifi_scan_cache_invalidate(void)
+{
+	pthread_once(&m_cache_once, scan_cache_init);
+
+	pthread_mutex_lock(&m_cache.lock);
+	m_cache.scan_r.clear();
+	m_cache.stamp = 0;
+	m_cache.scan_req = 0;
+	pthread_mutex_unlock(&m_cache.lock);
+
+	wifi_bss_table_clear();
+}
@@ -0,0 +1,33 @@
+#ifndef DEVICEIO_FRAMEWORK_SCAN_CACHE_H_
+#define DEVICEIO_FRAMEWORK_SCAN_CACHE_H_
+
+#include <string>
+
+/* results younger than this are served without touching the supplicant */
+#define SCAN_CACHE_TTL_MS			10000
+/* results younger than this are served at once while a rescan refreshes them */
+#define SCAN_CACHE_MAX_STALE_MS		120000
+/* a triggered scan that hasn't reported back by then may be triggered again */
+#define SCAN_CACHE_SCAN_TIMEOUT_MS	5000
+/* default time a caller with no cached data waits for the first results */
+#define SCAN_CACHE_WAIT_MS			4000
+
+/*
+ * Fill scan_r with the raw "scan_results" reply (header line included).
+ * Returns 0 when results were served, -1 when none arrived within wait_ms.
+ */
+int wifi_scan_cache_get(std::string &scan_r, const int wait_ms = SCAN_CACHE_WAIT_MS);
+
+/*
+ * Same freshness rules without copying the reply out, for callers that
+ * read the BSS table (bss_table.h), which every fetch keeps in sync.
+ */
+int wifi_scan_cache_refresh(const int wait_ms = SCAN_CACHE_WAIT_MS);
+
+/* CTRL-EVENT-SCAN-RESULTS: pull the new results into the cache */
+void wifi_scan_cache_on_results(void);
+
+/* drop cached results and the BSS table, e.g. when wpa_supplicant goes away */
+void wifi_scan_cache_invalidate(void);
+
+#endif // DEVICEIO_FRAMEWORK_SCAN_CACHE_H_
@@ -0,0 +1,124 @@
+#include <string.h>
+
+#include "scan_parser.h"
+
+/* bssid, frequency, signal level, flags, ssid */
+#define SCAN_RESULT_COLS	5
+
+static int parse_int(const char *p, const char *end)
+{
+	bool neg = false;
+	int val = 0;
+
+	if (p < end && *p == '-') {
+		neg = true;
+		p++;
+	}
+	while (p < end && *p >= '0' && *p <= '9')
+		val = val * 10 + (*p++ - '0');
+
+	return neg ? -val : val;
+}
+
+static int hex_val(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+int scan_parse_results(const char *scan_r, size_t len, scan_entry_cb cb, void *arg)
+{
+	const char *p = scan_r, *end = scan_r + len;
+	const char *line_end, *col[SCAN_RESULT_COLS + 1];
+	scan_entry_t entry;
+	int count = 0, n;
+
+	/* "bssid / frequency / signal level / flags / ssid" */
+	p = (const char *) memchr(p, '\n', end - p);
+	if (!p)
+		return 0;
+	p++;
+
+	for (; p < end; p = line_end + 1) {
+		line_end = (const char *) memchr(p, '\n', end - p);
+		if (!line_end)
+			line_end = end;
+
+		/* col[i] is where column i starts, col[n] one past the last tab */
+		n = 0;
+		col[n++] = p;
+		for (const char *q = p; n < SCAN_RESULT_COLS && q < line_end; q++) {
+			if (*q == '\t')
+				col[n++] = q + 1;
+		}
+		if (n < SCAN_RESULT_COLS)
+			continue;
+		/* the ssid is escaped by the supplicant, it never holds a raw tab */
+		col[n] = line_end + 1;
+
+		entry.bssid = col[0];
+		entry.bssid_len = col[1] - col[0] - 1;
+		entry.frequency = parse_int(col[1], col[2] - 1);
+		entry.level = parse_int(col[2], col[3] - 1);
+		entry.flags = col[3];
+		entry.flags_len = col[4] - col[3] - 1;
+		entry.ssid = col[4];
+		entry.ssid_len = col[5] - col[4] - 1;
+
+		count++;
+		if (!cb(&entry, arg))
+			break;
+	}
+
+	return count;
+}
+
+size_t scan_ssid_unescape(const char *ssid, size_t len, char *dst)
+{
+	const char *p = ssid, *end = ssid + len;
+	size_t n = 0;
+	int hi, lo;
+
+	while (p < end && n < SCAN_SSID_MAX_LEN) {
+		if (*p != '\\' || p + 1 >= end) {
+			dst[n++] = *p++;
+			continue;
+		}
+
+		switch (p[1]) {
+		case 'x':
+			if (p + 3 < end && (hi = hex_val(p[2])) >= 0 && (lo = hex_val(p[3])) >= 0) {
+				dst[n++] = (char) (hi << 4 | lo);
+				p += 4;
+				continue;
+			}
+			dst[n++] = *p++;
+			continue;
+		case 'n':
+			dst[n++] = '\n';
+			break;
+		case 'r':
+			dst[n++] = '\r';
+			break;
+		case 't':
+			dst[n++] = '\t';
+			break;
+		case 'e':
+			dst[n++] = '\033';
+			break;
+		default:
+			/* \\ and \" */
+			dst[n++] = p[1];
+			break;
+		}
+		p += 2;
+	}
+	dst[n] = '\0';
+
+	return n;
+}
@@ -0,0 +1,43 @@
+#ifndef DEVICEIO_FRAMEWORK_SCAN_PARSER_H_
+#define DEVICEIO_FRAMEWORK_SCAN_PARSER_H_
+
+#include <stddef.h>
+
+/* an 802.11 SSID is at most 32 octets */
+#define SCAN_SSID_MAX_LEN	32
+
+/*
+ * One line of a "scan_results" reply. The strings point into the reply
+ * itself and are not NUL terminated; ssid is still escaped the way
+ * wpa_supplicant prints it (\xNN, \", \\ ...).
+ */
+typedef struct {
+	const char *bssid;
+	size_t bssid_len;
+	int frequency;
+	int level;
+	const char *flags;
+	size_t flags_len;
+	const char *ssid;
+	size_t ssid_len;
+} scan_entry_t;
+
+/* return false to stop the walk */
+typedef bool (*scan_entry_cb)(const scan_entry_t *entry, void *arg);
+
+/*
+ * Walk a "scan_results" reply in a single pass, without copying or
+ * modifying it, calling cb for every AP line. The header line and
+ * malformed lines are skipped. Returns the number of entries passed
+ * to cb.
+ */
+int scan_parse_results(const char *scan_r, size_t len, scan_entry_cb cb, void *arg);
+
+/*
+ * Undo wpa_supplicant's printf_encode() on an SSID. dst must hold
+ * SCAN_SSID_MAX_LEN + 1 bytes; the result is NUL terminated and its
+ * length is returned.
+ */
+size_t scan_ssid_unescape(const char *ssid, size_t len, char *dst);
+
+#endif // DEVICEIO_FRAMEWORK_SCAN_PARSER_H_
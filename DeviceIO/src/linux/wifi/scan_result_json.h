@@ -0,0 +1,38 @@
+#ifndef DEVICEIO_FRAMEWORK_SCAN_RESULT_JSON_H_
+#define DEVICEIO_FRAMEWORK_SCAN_RESULT_JSON_H_
+
+#include <string>
+#include "DeviceIo/ScanResult.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+namespace DeviceIOFramework {
+
+typedef rapidjson::Writer<rapidjson::StringBuffer> ScanResultWriter;
+
+/* the numbers go out as strings, which is what the apps already parse */
+static inline void writeScanResult(ScanResultWriter& writer, ScanResult* item) {
+	std::string value;
+
+	writer.StartObject();
+	writer.Key("bssid");
+	value = item->getBssid();
+	writer.String(value.c_str(), value.size());
+	writer.Key("frequency");
+	value = std::to_string(item->getFrequency());
+	writer.String(value.c_str(), value.size());
+	writer.Key("signalLevel");
+	value = std::to_string(item->getLevel());
+	writer.String(value.c_str(), value.size());
+	writer.Key("flags");
+	value = item->getFlags();
+	writer.String(value.c_str(), value.size());
+	writer.Key("ssid");
+	value = item->getSsid();
+	writer.String(value.c_str(), value.size());
+	writer.EndObject();
+}
+
+} // end of namespace DeviceIOFramework
+
+#endif // DEVICEIO_FRAMEWORK_SCAN_RESULT_JSON_H_
@@ -0,0 +1,200 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "wifi_sm.h"
+
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+static wifi_sm_state_e m_state = WIFI_SM_OFF;
+
+/* the connect request in flight, m_id < 0 if none */
+static int m_id = -1;
+static bool m_saved = false;
+static uint64_t m_deadline = 0;
+
+static const char *m_state_names[] = {
+	"OFF",
+	"IDLE",
+	"CONNECTING",
+	"ASSOCIATED",
+	"ONLINE",
+};
+
+static const char *m_event_names[] = {
+	"MONITOR_UP",
+	"MONITOR_DOWN",
+	"CONNECT",
+	"CONNECT_ERROR",
+	"CANCEL",
+	"CONNECTED",
+	"DISCONNECTED",
+	"WRONG_KEY",
+	"IP_READY",
+	"TIMEOUT",
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void request_end_locked(void)
+{
+	m_id = -1;
+	m_saved = false;
+	m_deadline = 0;
+}
+
+void wifi_sm_event(wifi_sm_event_e ev, int id, bool saved, wifi_sm_step_t *step)
+{
+	bool pending;
+
+	pthread_mutex_lock(&m_lock);
+	pending = m_id >= 0;
+
+	memset(step, 0, sizeof(*step));
+	step->from = step->to = m_state;
+	step->id = m_id;
+	step->saved = m_saved;
+
+	switch (ev) {
+	case WIFI_SM_EV_MONITOR_UP:
+		if (m_state == WIFI_SM_OFF)
+			step->to = pending ? WIFI_SM_CONNECTING : WIFI_SM_IDLE;
+		break;
+	case WIFI_SM_EV_MONITOR_DOWN:
+		/* nobody left to tell us how it ends */
+		if (pending)
+			step->actions = WIFI_SM_ACT_FAILED;
+		step->to = WIFI_SM_OFF;
+		request_end_locked();
+		break;
+	case WIFI_SM_EV_CONNECT:
+		/* a newer request replaces the one in flight */
+		m_id = step->id = id;
+		m_saved = step->saved = saved;
+		m_deadline = now_ms() + WIFI_CONNECT_TIMEOUT_MS;
+		if (m_state != WIFI_SM_OFF)
+			step->to = WIFI_SM_CONNECTING;
+		break;
+	case WIFI_SM_EV_CONNECT_ERROR:
+		step->actions = WIFI_SM_ACT_FAILED;
+		if (pending && m_state != WIFI_SM_OFF)
+			step->to = WIFI_SM_IDLE;
+		request_end_locked();
+		break;
+	case WIFI_SM_EV_CANCEL:
+		if (!pending)
+			break;
+		step->actions = WIFI_SM_ACT_ABORT | WIFI_SM_ACT_FAILED | WIFI_SM_ACT_GIVE_UP;
+		if (m_state != WIFI_SM_OFF)
+			step->to = WIFI_SM_IDLE;
+		request_end_locked();
+		break;
+	case WIFI_SM_EV_CONNECTED:
+		step->to = WIFI_SM_ASSOCIATED;
+		step->actions = WIFI_SM_ACT_CHECK_IP;
+		break;
+	case WIFI_SM_EV_DISCONNECTED:
+		/* while a request is in flight the supplicant keeps trying */
+		step->to = pending ? WIFI_SM_CONNECTING : WIFI_SM_IDLE;
+		break;
+	case WIFI_SM_EV_WRONG_KEY:
+		if (!pending)
+			break;
+		step->actions = WIFI_SM_ACT_GIVE_UP;
+		step->to = WIFI_SM_IDLE;
+		request_end_locked();
+		break;
+	case WIFI_SM_EV_IP_READY:
+		if (m_state != WIFI_SM_ASSOCIATED)
+			break;
+		step->to = WIFI_SM_ONLINE;
+		if (pending)
+			step->actions = WIFI_SM_ACT_ONLINE;
+		request_end_locked();
+		break;
+	case WIFI_SM_EV_TIMEOUT:
+		if (!pending)
+			break;
+		step->actions = WIFI_SM_ACT_FAILED | WIFI_SM_ACT_GIVE_UP;
+		step->to = WIFI_SM_IDLE;
+		request_end_locked();
+		break;
+	}
+
+	m_state = step->to;
+	pthread_mutex_unlock(&m_lock);
+}
+
+wifi_sm_state_e wifi_sm_state(void)
+{
+	wifi_sm_state_e state;
+
+	pthread_mutex_lock(&m_lock);
+	state = m_state;
+	pthread_mutex_unlock(&m_lock);
+
+	return state;
+}
+
+bool wifi_sm_connecting(void)
+{
+	bool pending;
+
+	pthread_mutex_lock(&m_lock);
+	pending = m_id >= 0;
+	pthread_mutex_unlock(&m_lock);
+
+	return pending;
+}
+
+int wifi_sm_poll_ms(int def_ms)
+{
+	uint64_t now;
+	int ms = def_ms;
+
+	pthread_mutex_lock(&m_lock);
+	if (m_deadline) {
+		now = now_ms();
+		ms = now >= m_deadline ? 0 : (int)(m_deadline - now);
+		if (def_ms >= 0 && ms > def_ms)
+			ms = def_ms;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return ms;
+}
+
+bool wifi_sm_expired(void)
+{
+	bool expired = false;
+
+	pthread_mutex_lock(&m_lock);
+	if (m_deadline && now_ms() >= m_deadline) {
+		/* the request stays pending until the TIMEOUT event ends it */
+		m_deadline = 0;
+		expired = true;
+	}
+	pthread_mutex_unlock(&m_lock);
+
+	return expired;
+}
+
+const char *wifi_sm_state_name(wifi_sm_state_e state)
+{
+	if (state < 0 || state >= (int)(sizeof(m_state_names) / sizeof(m_state_names[0])))
+		return "UNKNOWN";
+	return m_state_names[state];
+}
+
+const char *wifi_sm_event_name(wifi_sm_event_e ev)
+{
+	if (ev < 0 || ev >= (int)(sizeof(m_event_names) / sizeof(m_event_names[0])))
+		return "UNKNOWN";
+	return m_event_names[ev];
+}
@@ -0,0 +1,64 @@
+#ifndef DEVICEIO_FRAMEWORK_WIFI_SM_H_
+#define DEVICEIO_FRAMEWORK_WIFI_SM_H_
+
+/* a connect request that isn't online by then has failed */
+#define WIFI_CONNECT_TIMEOUT_MS		50000
+
+typedef enum {
+	WIFI_SM_OFF = 0,		/* not attached to the supplicant, state unknown */
+	WIFI_SM_IDLE,			/* not associated */
+	WIFI_SM_CONNECTING,		/* connect requested, not associated yet */
+	WIFI_SM_ASSOCIATED,		/* associated, waiting for an address */
+	WIFI_SM_ONLINE,			/* associated and addressed */
+} wifi_sm_state_e;
+
+typedef enum {
+	WIFI_SM_EV_MONITOR_UP = 0,	/* attached to the supplicant's events */
+	WIFI_SM_EV_MONITOR_DOWN,	/* detached: wifi off or supplicant gone */
+	WIFI_SM_EV_CONNECT,			/* a connect request configured network id */
+	WIFI_SM_EV_CONNECT_ERROR,	/* the request couldn't be configured */
+	WIFI_SM_EV_CANCEL,			/* RK_wifi_cancel() */
+	WIFI_SM_EV_CONNECTED,		/* CTRL-EVENT-CONNECTED */
+	WIFI_SM_EV_DISCONNECTED,	/* CTRL-EVENT-DISCONNECTED */
+	WIFI_SM_EV_WRONG_KEY,		/* CTRL-EVENT-SSID-TEMP-DISABLED reason=WRONG_KEY */
+	WIFI_SM_EV_IP_READY,		/* the interface has an address */
+	WIFI_SM_EV_TIMEOUT,			/* connect deadline passed */
+} wifi_sm_event_e;
+
+/* work a transition leaves to the caller, done outside the state lock */
+#define WIFI_SM_ACT_CHECK_IP	(1 << 0)	/* the address may be there already */
+#define WIFI_SM_ACT_ONLINE		(1 << 1)	/* save the config, report DHCP_OK */
+#define WIFI_SM_ACT_FAILED		(1 << 2)	/* report CONNECTFAILED */
+#define WIFI_SM_ACT_GIVE_UP		(1 << 3)	/* disable, or remove, the network */
+#define WIFI_SM_ACT_ABORT		(1 << 4)	/* stop whatever the supplicant is doing */
+
+typedef struct {
+	wifi_sm_state_e from;
+	wifi_sm_state_e to;
+	unsigned int actions;	/* WIFI_SM_ACT_* */
+	int id;					/* network of the connect request, -1 if none */
+	bool saved;				/* it was configured before the request: disable, don't remove */
+} wifi_sm_step_t;
+
+/*
+ * Feed one event and get back the transition it caused. id and saved
+ * only matter for WIFI_SM_EV_CONNECT. Callers run step->actions
+ * themselves, so callbacks never run under the state lock.
+ */
+void wifi_sm_event(wifi_sm_event_e ev, int id, bool saved, wifi_sm_step_t *step);
+
+wifi_sm_state_e wifi_sm_state(void);
+
+/* a connect request is still waiting for its outcome */
+bool wifi_sm_connecting(void);
+
+/* poll timeout for the monitor loop, never beyond the connect deadline */
+int wifi_sm_poll_ms(int def_ms);
+
+/* true once per request when its deadline has passed */
+bool wifi_sm_expired(void);
+
+const char *wifi_sm_state_name(wifi_sm_state_e state);
+const char *wifi_sm_event_name(wifi_sm_event_e ev);
+
+#endif // DEVICEIO_FRAMEWORK_WIFI_SM_H_
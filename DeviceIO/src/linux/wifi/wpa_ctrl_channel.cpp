@@ -0,0 +1,196 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <wpa_ctrl.h>
+
+#include "wpa_ctrl_channel.h"
+#include "slog.h"
+
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct wpa_ctrl *m_ctrl = NULL;
+static char m_path[108] = WPA_CTRL_IFACE_PATH;
+static char m_buf[WPA_CTRL_REPLY_MAX];
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void close_locked(void)
+{
+	if (m_ctrl) {
+		wpa_ctrl_close(m_ctrl);
+		m_ctrl = NULL;
+	}
+}
+
+static bool open_locked(void)
+{
+	if (m_ctrl)
+		return true;
+
+	m_ctrl = wpa_ctrl_open(m_path);
+	if (!m_ctrl) {
+		pr_err("%s: open %s failed: %s\n", __func__, m_path, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/* a restarted supplicant leaves us a dead socket, so reopen once */
+static int send_locked(const std::string &cmd)
+{
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (!open_locked())
+			return -1;
+		if (send(wpa_ctrl_get_fd(m_ctrl), cmd.c_str(), cmd.size(), 0) >= 0)
+			return 0;
+		pr_err("%s: %s: %s\n", __func__, cmd.c_str(), strerror(errno));
+		close_locked();
+	}
+
+	return -1;
+}
+
+static int recv_locked(std::string &reply, uint64_t deadline)
+{
+	struct pollfd pfd;
+	uint64_t now;
+	ssize_t len;
+
+	pfd.fd = wpa_ctrl_get_fd(m_ctrl);
+	pfd.events = POLLIN;
+
+	for (;;) {
+		now = now_ms();
+		if (now >= deadline)
+			return -2;
+
+		pfd.revents = 0;
+		if (poll(&pfd, 1, deadline - now) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!(pfd.revents & POLLIN))
+			continue;
+
+		len = recv(pfd.fd, m_buf, sizeof(m_buf), 0);
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+
+		/* not attached, but an unsolicited "<N>event" must never pass as a reply */
+		if (len > 0 && m_buf[0] == '<')
+			continue;
+
+		reply.assign(m_buf, len);
+		return 0;
+	}
+}
+
+int wpa_ctrl_channel_request(const char *cmd, std::string &reply, const int timeout_ms)
+{
+	std::vector<std::string> cmds(1, cmd);
+	std::vector<std::string> replies;
+	int ret;
+
+	ret = wpa_ctrl_channel_pipeline(cmds, replies, timeout_ms);
+	if (ret == 1) {
+		reply.swap(replies[0]);
+		return 0;
+	}
+
+	reply.clear();
+	return ret == 0 ? -2 : ret;
+}
+
+int wpa_ctrl_channel_cmd(const char *fmt, ...)
+{
+	char cmd[512];
+	std::string reply;
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(cmd, sizeof(cmd), fmt, args);
+	va_end(args);
+
+	if (wpa_ctrl_channel_request(cmd, reply) != 0)
+		return -1;
+
+	if (reply.compare(0, 2, "OK") != 0) {
+		pr_err("%s: %s: %s\n", __func__, cmd, reply.c_str());
+		return -1;
+	}
+
+	return 0;
+}
+
+int wpa_ctrl_channel_pipeline(const std::vector<std::string> &cmds,
+		std::vector<std::string> &replies, const int timeout_ms)
+{
+	size_t sent = 0;
+	int ret = 0;
+
+	replies.clear();
+	replies.reserve(cmds.size());
+
+	pthread_mutex_lock(&m_lock);
+	while (replies.size() < cmds.size()) {
+		/* keep the window full before blocking on the oldest reply */
+		while (sent < cmds.size() && sent - replies.size() < WPA_CTRL_PIPELINE_DEPTH) {
+			if (send_locked(cmds[sent]) != 0) {
+				ret = -1;
+				goto out;
+			}
+			sent++;
+		}
+
+		replies.push_back(std::string());
+		ret = recv_locked(replies.back(), now_ms() + timeout_ms);
+		if (ret != 0) {
+			replies.pop_back();
+			pr_err("%s: no reply to %s (%d)\n", __func__, cmds[replies.size()].c_str(), ret);
+			goto out;
+		}
+	}
+
+out:
+	/* late replies would be taken for answers to the next request */
+	if (ret != 0)
+		close_locked();
+	pthread_mutex_unlock(&m_lock);
+
+	if (ret == -1 && replies.empty())
+		return -1;
+
+	return replies.size();
+}
+
+void wpa_ctrl_channel_set_path(const char *path)
+{
+	pthread_mutex_lock(&m_lock);
+	close_locked();
+	snprintf(m_path, sizeof(m_path), "%s", path ? path : WPA_CTRL_IFACE_PATH);
+	pthread_mutex_unlock(&m_lock);
+}
+
+void wpa_ctrl_channel_close(void)
+{
+	pthread_mutex_lock(&m_lock);
+	close_locked();
+	pthread_mutex_unlock(&m_lock);
+}
@@ -0,0 +1,50 @@
+#ifndef DEVICEIO_FRAMEWORK_WPA_CTRL_CHANNEL_H_
+#define DEVICEIO_FRAMEWORK_WPA_CTRL_CHANNEL_H_
+
+#include <string>
+#include <vector>
+
+#define WPA_CTRL_IFACE_PATH		"/var/run/wpa_supplicant/wlan0"
+/* default time to wait for one reply */
+#define WPA_CTRL_TIMEOUT_MS		2000
+/*
+ * Stock wpa_supplicant caps replies at 4 KB, but vendor builds raise it
+ * so scan_results isn't cut short in crowded places
+ */
+#define WPA_CTRL_REPLY_MAX		65536
+/*
+ * Requests in flight at once. Unix datagram queues are short
+ * (net.unix.max_dgram_qlen defaults to 10) and the supplicant drops
+ * replies it can't queue, so don't run further ahead than this.
+ */
+#define WPA_CTRL_PIPELINE_DEPTH	8
+
+/*
+ * Persistent, thread-safe request connection to wpa_supplicant, used in
+ * place of forking wpa_cli. Commands are the raw control interface
+ * ones ("STATUS", "SET_NETWORK 0 ssid ..."), not wpa_cli aliases.
+ *
+ * Returns 0 with the reply filled in, -1 when the supplicant can't be
+ * reached, -2 when no reply came within timeout_ms.
+ */
+int wpa_ctrl_channel_request(const char *cmd, std::string &reply,
+		const int timeout_ms = WPA_CTRL_TIMEOUT_MS);
+
+/* printf-style request for OK/FAIL commands, 0 only on "OK" */
+int wpa_ctrl_channel_cmd(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/*
+ * Send all cmds without waiting on each reply in between, replies[i]
+ * answers cmds[i]. Stops at the first error; returns the number of
+ * replies received.
+ */
+int wpa_ctrl_channel_pipeline(const std::vector<std::string> &cmds,
+		std::vector<std::string> &replies, const int timeout_ms = WPA_CTRL_TIMEOUT_MS);
+
+/* talk to another control socket (e.g. a test double), NULL restores the default */
+void wpa_ctrl_channel_set_path(const char *path);
+
+/* drop the connection, the next request reopens it */
+void wpa_ctrl_channel_close(void);
+
+#endif // DEVICEIO_FRAMEWORK_WPA_CTRL_CHANNEL_H_
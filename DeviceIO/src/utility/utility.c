@@ -8,6 +8,11 @@
 #include <assert.h>
 #include <pthread.h>
 #include <paths.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 
 #include "slog.h"
@@ -121,67 +126,181 @@ int test_pthread(pthread_t tid) /*pthread_kill的返回值：成功（0） 线
 	return pthread_kill_err;
 }
 
+/* pidof without the fork: match /proc/<pid>/stat's comm, then argv[0] */
+static int proc_match(const char *pid, const char *name)
+{
+	char path[64], buf[512], *start, *end;
+	int fd, len;
+
+	snprintf(path, sizeof(path), "/proc/%s/stat", pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+
+	/* "pid (comm) state ...", comm may itself hold ')' */
+	start = strchr(buf, '(');
+	end = strrchr(buf, ')');
+	if (!start || !end || end < start || end[1] != ' ')
+		return 0;
+	/* a zombie has exited, it just hasn't been reaped */
+	if (end[2] == 'Z')
+		return 0;
+	*end = '\0';
+	if (!strcmp(start + 1, name))
+		return 1;
+
+	/* comm is cut at 15 chars, pidof also goes by argv[0] */
+	snprintf(path, sizeof(path), "/proc/%s/cmdline", pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+
+	start = strrchr(buf, '/');
+	return !strcmp(start ? start + 1 : buf, name);
+}
+
 int get_ps_pid(const char Name[])
 {
-	int len;
-	char name[32] = {0};
-	char cmdresult[256] = {0};
-	char cmd[64] = {0};
-	FILE *pFile = NULL;
-	int  pid = 0;
-
-	len = strlen(Name);
-	strncpy(name,Name,len);
-	name[31] ='\0';
-
-	sprintf(cmd, "pidof %s", name);
-
-	pFile = popen(cmd, "r");
-	if (pFile != NULL)  {
-		while (fgets(cmdresult, sizeof(cmdresult), pFile)) {
-			pid = atoi(cmdresult);
+	struct dirent *ent;
+	DIR *dir;
+	int pid = 0;
+
+	dir = opendir("/proc");
+	if (!dir)
+		return 0;
+
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] < '1' || ent->d_name[0] > '9')
+			continue;
+		if (proc_match(ent->d_name, Name)) {
+			pid = atoi(ent->d_name);
 			break;
 		}
-		pclose(pFile);
 	}
+	closedir(dir);
 
 	return pid;
 }
 
-int kill_task(char *name)
+static bool proc_alive(int pid)
 {
-	char cmd[128] = {0};
-	int exec_cnt = 3, retry_cnt = 10;
+	char path[32], buf[256], *end;
+	int fd, len;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return false;
+	buf[len] = '\0';
+
+	end = strrchr(buf, ')');
+	return end && end[1] == ' ' && end[2] != 'Z';
+}
 
-	if (!get_ps_pid(name))
-		return 0;
+/* 1 once pid has exited, 0 on timeout, -1 if the kernel can't tell us */
+static int pid_wait_exit(int pid, int timeout_ms)
+{
+#ifdef SYS_pidfd_open
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = syscall(SYS_pidfd_open, pid, 0);
+	if (pfd.fd < 0)
+		return errno == ESRCH ? 1 : -1;
+	pfd.events = POLLIN;
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+	close(pfd.fd);
+
+	return ret > 0 ? 1 : 0;
+#else
+	return -1;
+#endif
+}
 
-	memset(cmd, 0, 128);
-	sprintf(cmd, "killall %s", name);
+static int ms_until(const struct timespec *deadline)
+{
+	struct timespec now;
 
-	while(exec_cnt) {
-		if(!exec_command_system(cmd))
-			break;
-		exec_cnt--;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (deadline->tv_sec - now.tv_sec) * 1000 + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+}
 
-	if(exec_cnt <= 0) {
-		pr_info("%s: kill %s failed\n", __func__, name);
+#define KILL_TASK_MAX_PIDS	16
+
+int kill_task_timeout(const char *name, int timeout_ms)
+{
+	struct dirent *ent;
+	struct timespec deadline;
+	int pids[KILL_TASK_MAX_PIDS];
+	int count = 0, left, ret;
+	DIR *dir;
+
+	/* like killall: every instance gets SIGTERM before we wait on any */
+	dir = opendir("/proc");
+	if (!dir)
 		return -1;
+	while ((ent = readdir(dir)) != NULL && count < KILL_TASK_MAX_PIDS) {
+		if (ent->d_name[0] < '1' || ent->d_name[0] > '9')
+			continue;
+		if (!proc_match(ent->d_name, name))
+			continue;
+		pids[count] = atoi(ent->d_name);
+		if (kill(pids[count], SIGTERM) == 0)
+			count++;
 	}
-	msleep(100);
+	closedir(dir);
 
-retry:
-	if (get_ps_pid(name) && (retry_cnt--)) {
-		msleep(100);
-		goto retry;
+	if (!count || timeout_ms <= 0)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
 	}
 
-	pr_info("%s: kill %s, retry_cnt = %d\n", __func__, name, retry_cnt);
-	if (get_ps_pid(name))
-		return -1;
-	else
-		return 0;
+	for (int i = 0; i < count; i++) {
+		left = ms_until(&deadline);
+		ret = pid_wait_exit(pids[i], left > 0 ? left : 0);
+		/* no pidfd on this kernel, check back shortly */
+		while (ret < 0) {
+			if (!proc_alive(pids[i]))
+				ret = 1;
+			else if (ms_until(&deadline) <= 0)
+				ret = 0;
+			else
+				msleep(10);
+		}
+		if (!ret) {
+			pr_info("%s: %s(%d) still running after %d ms\n", __func__, name, pids[i], timeout_ms);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int kill_task(char *name)
+{
+	return kill_task_timeout(name, 1100);
 }
 
 int run_task(char *name, char *cmd)
@@ -10,6 +10,8 @@ void exec_command(const char cmdline[], char recv_buff[], int len);
 int exec_command_system(const char *cmd);
 int run_task(char *name, char *cmd);
 int kill_task(char *name);
+/* SIGTERM every process called name, wait up to timeout_ms for them to exit */
+int kill_task_timeout(const char *name, int timeout_ms);
 int get_ps_pid(const char Name[]);
 int test_pthread(pthread_t tid); /*pthread_kill的返回值：成功（0） 线程不存在（ESRCH） 信号不合法（EINVAL）*/
 
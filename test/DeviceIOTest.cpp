@@ -80,6 +80,13 @@ static command_t wifi_config_command_table[] = {
 	{"wifi_forget_with_ssid", rk_wifi_forget_with_ssid},
 	{"wifi_connect1", rk_wifi_connect1},
 	{"rk_wifi_disconnect", rk_wifi_disconnect},
+	{"wifi_scan_latency", rk_wifi_scan_latency},
+	{"wifi_ctrl_latency", rk_wifi_ctrl_latency},
+	{"wifi_scan_json_bench", rk_wifi_scan_json_bench},
+	{"wifi_fast_reconnect", rk_wifi_fast_reconnect_test},
+	{"wifi_bringup_time", rk_wifi_bringup_time},
+	{"wifi_event_latency", rk_wifi_event_latency},
+	{"wifi_ap_latency", rk_wifi_ap_latency},
 };
 
 static command_bt_t bt_command_table[] = {
@@ -115,6 +122,7 @@ static command_bt_t bt_command_table[] = {
 	{"bt_test_source_disconnect", bt_test_source_disconnect},
 	{"bt_test_source_disconnect_by_addr", bt_test_source_disconnect_by_addr},
 	{"bt_test_source_remove_by_addr", bt_test_source_remove_by_addr},
+	{"bt_test_source_tx_stats", bt_test_source_tx_stats},
 	{"bt_test_sink_open", bt_test_sink_open},
 	{"bt_test_sink_visibility00", bt_test_sink_visibility00},
 	{"bt_test_sink_visibility01", bt_test_sink_visibility01},
@@ -133,6 +141,7 @@ static command_bt_t bt_command_table[] = {
 	{"bt_test_sink_disconnect_by_addr", bt_test_sink_disconnect_by_addr},
 	{"bt_test_sink_get_play_status", bt_test_sink_get_play_status},
 	{"bt_test_sink_get_poschange", bt_test_sink_get_poschange},
+	{"bt_test_sink_buffer_stats", bt_test_sink_buffer_stats},
 	{"bt_test_sink_disconnect", bt_test_sink_disconnect},
 	{"bt_test_sink_close", bt_test_sink_close},
 	{"bt_test_ble_start", bt_test_ble_start},
@@ -166,6 +175,7 @@ static command_bt_t bt_command_table[] = {
 	{"bt_test_hfp_hp_dial_number", bt_test_hfp_hp_dial_number},
 	{"bt_test_hfp_hp_report_battery", bt_test_hfp_hp_report_battery},
 	{"bt_test_hfp_hp_set_volume", bt_test_hfp_hp_set_volume},
+	{"bt_test_hfp_hp_audio_stats", bt_test_hfp_hp_audio_stats},
 	{"bt_test_hfp_hp_close", bt_test_hfp_hp_close},
 	{"bt_test_hfp_hp_disconnect", bt_test_hfp_hp_disconnect},
 	{"bt_test_obex_init", bt_test_obex_init},
@@ -775,6 +775,24 @@ void bt_test_sink_get_poschange(char *data)
 	printf("support position change: %s\n", pos_change ? "yes" : "no");
 }
 
+void bt_test_sink_buffer_stats(char *data)
+{
+	RK_BT_SINK_BUFFER_STATS stats;
+
+	/* an optional argument sets the target latency in ms first */
+	if (data && atoi(data) > 0)
+		rk_bt_sink_set_buffer_latency(atoi(data));
+
+	if (rk_bt_sink_get_buffer_stats(&stats) < 0) {
+		printf("%s sink buffer stats not available!\n", __func__);
+		return;
+	}
+
+	printf("target %u ms, fill %u ms (max %u ms), latency %u ms, packets %u, dropped %u, underruns %u\n",
+		stats.target_ms, stats.fill_ms, stats.max_fill_ms, stats.latency_ms,
+		stats.packets, stats.dropped, stats.underruns);
+}
+
 /******************************************/
 /*              A2DP SOURCE               */
 /******************************************/
@@ -885,6 +903,20 @@ void bt_test_source_disconnect(char *data)
 	rk_bt_source_disconnect();
 }
 
+void bt_test_source_tx_stats(char *data)
+{
+	RK_BT_SOURCE_TX_STATS stats;
+
+	if (rk_bt_source_get_tx_stats(&stats) < 0) {
+		printf("%s source tx stats not available!\n", __func__);
+		return;
+	}
+
+	printf("queued %u ms (max %u ms), refused %u, dropped frames %u, sent %llu bytes\n",
+		stats.queued_ms, stats.max_queued_ms, stats.refused, stats.dropped_frames,
+		stats.sent_bytes);
+}
+
 /******************************************/
 /*                  BLE                   */
 /******************************************/
@@ -1943,6 +1975,24 @@ void bt_test_hfp_hp_set_volume(char *data)
 	}
 }
 
+void bt_test_hfp_hp_audio_stats(char *data)
+{
+	RK_BT_HFP_AUDIO_STATS stats[2];
+	const char *names[] = { "uplink", "downlink" };
+
+	if (rk_bt_hfp_get_audio_stats(&stats[0], &stats[1]) < 0) {
+		printf("%s hfp audio stats not available!\n", __func__);
+		return;
+	}
+
+	for (int i = 0; i < 2; i++)
+		printf("%s: frames %u, capture xruns %u, playback xruns %u, latency %u us (max %u us), "
+			"jitter target %u us, drift %+d ppm\n",
+			names[i], stats[i].frames, stats[i].capture_xruns, stats[i].playback_xruns,
+			stats[i].latency_us, stats[i].max_latency_us,
+			stats[i].jitter_target_us, stats[i].drift_ppm);
+}
+
 void bt_test_hfp_hp_close(char *data)
 {
 	rk_bt_hfp_close();
@@ -83,6 +83,7 @@ void bt_test_sink_connect_by_addr(char *data);
 void bt_test_sink_disconnect_by_addr(char *data);
 void bt_test_sink_get_play_status(char *data);
 void bt_test_sink_get_poschange(char *data);
+void bt_test_sink_buffer_stats(char *data);
 
 /******************************************/
 /*          A2DP SOURCE Test              */
@@ -96,6 +97,7 @@ void bt_test_source_connect_by_addr(char *data);
 void bt_test_source_disconnect_by_addr(char *data);
 void bt_test_source_remove_by_addr(char *data);
 void bt_test_source_disconnect(char *data);
+void bt_test_source_tx_stats(char *data);
 
 /******************************************/
 /*              SPP Test                  */
@@ -116,6 +118,7 @@ void bt_test_hfp_hp_redial(char *data);
 void bt_test_hfp_hp_dial_number(char *data);
 void bt_test_hfp_hp_report_battery(char *data);
 void bt_test_hfp_hp_set_volume(char *data);
+void bt_test_hfp_hp_audio_stats(char *data);
 void bt_test_hfp_hp_close(char *data);
 void bt_test_hfp_hp_disconnect(char *data);
 
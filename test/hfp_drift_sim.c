@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "hfp_jitter.h"
+
+/*
+ * The HFP bridge on two virtual clocks that don't agree: a capture end
+ * running at 8 kHz + a ppm, a playback end at 8 kHz + b ppm, and a bridge
+ * thread that gets to run a little late now and then. Simulates a long
+ * call in a moment, once with drift compensation and once without, and
+ * checks that the compensated one has no xruns after it settles, finds
+ * the right ratio and keeps the playback buffer small.
+ */
+
+#define RATE			8000
+#define CHANNELS		1			// the bridge works in mono
+#define PERIOD			160			// 20 ms
+#define CAP_BUFFER		3200		// 400 ms, as the bridge sets it up
+#define PLAY_BUFFER		800			// 100 ms
+#define STEP_US			500
+
+typedef struct {
+	int16_t *data;
+	unsigned int size;
+	double hw;						// frames the device has gone through
+	unsigned long long appl;		// frames the bridge has gone through
+	double rate;
+	int running;
+	unsigned int xruns;
+} sim_pcm_t;
+
+typedef struct {
+	const char *name;
+	int cap_ppm, play_ppm;
+} sim_case_t;
+
+typedef struct {
+	unsigned int cap_xruns, play_xruns, late_xruns;
+	double mean_fill_ms, max_fill_ms;
+	int ppm, min_ppm, max_ppm;
+	double target_ms;
+} sim_result_t;
+
+static unsigned int seed = 1;
+
+static unsigned int sim_rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+static void pcm_init(sim_pcm_t *pcm, unsigned int size, int ppm)
+{
+	memset(pcm, 0, sizeof(*pcm));
+	pcm->data = (int16_t *)calloc(size, CHANNELS * sizeof(int16_t));
+	pcm->size = size;
+	pcm->rate = RATE * (1.0 + ppm * 1e-6);
+}
+
+static void run(const sim_case_t *c, const int seconds, const int compensate, sim_result_t *res)
+{
+	sim_pcm_t cap, play;
+	hfp_jitter_t jb;
+	unsigned long long cap_hw, play_hw, made = 0;
+	unsigned int consumed, produced, n_in, n_out, used, off;
+	long long late_until = 0, t, settle = 60 * 1000000LL;
+	double fill_sum = 0, ppm_sum = 0;
+	long fill_before, fill_after, samples = 0;
+	int16_t *src, *dst;
+
+	memset(res, 0, sizeof(*res));
+	res->min_ppm = HFP_JITTER_MAX_PPM;
+	res->max_ppm = -HFP_JITTER_MAX_PPM;
+	pcm_init(&cap, CAP_BUFFER, c->cap_ppm);
+	pcm_init(&play, PLAY_BUFFER, c->play_ppm);
+	hfp_jitter_init(&jb, CHANNELS, RATE, RATE, PERIOD, PLAY_BUFFER);
+	cap.running = 1;
+
+	for (t = 0; t < seconds * 1000000LL; t += STEP_US) {
+		/* the devices move on */
+		cap.hw += cap.rate * STEP_US / 1e6;
+		cap_hw = (unsigned long long)cap.hw;
+		for (; made < cap_hw; made++) {
+			/* a 400 Hz tone, as the mic would hear it */
+			int16_t v = (int16_t)(8000 * sin(2 * M_PI * 400 * made / RATE));
+			cap.data[(made % cap.size) * CHANNELS] = v;
+		}
+		if (cap_hw - cap.appl > cap.size) {
+			cap.xruns++;
+			if (t > settle)
+				res->late_xruns++;
+			cap.appl = cap_hw;
+		}
+		if (play.running) {
+			play.hw += play.rate * STEP_US / 1e6;
+			play_hw = (unsigned long long)play.hw;
+			if (play_hw >= play.appl) {
+				play.xruns++;
+				if (t > settle)
+					res->late_xruns++;
+				play.running = 0;
+				play.hw = play.appl;
+				if (compensate)
+					hfp_jitter_underrun(&jb);
+			}
+		}
+
+		/* the bridge wakes on a capture period, unless it's held up */
+		if (t < late_until || cap_hw - cap.appl < PERIOD)
+			continue;
+		if (sim_rand() % 200 == 0)
+			late_until = t + (sim_rand() % 10000);		// up to 10 ms late now and then
+
+		play_hw = (unsigned long long)play.hw;
+		fill_before = play.appl - play_hw;
+		if (play.size - fill_before < PERIOD)
+			continue;
+
+		produced = consumed = 0;
+		while (cap_hw > cap.appl && play.size - (play.appl - play_hw) > 0) {
+			off = cap.appl % cap.size;
+			n_in = cap_hw - cap.appl;
+			if (n_in > cap.size - off)
+				n_in = cap.size - off;
+			src = cap.data + off * CHANNELS;
+
+			off = play.appl % play.size;
+			n_out = play.size - (play.appl - play_hw);
+			if (n_out > play.size - off)
+				n_out = play.size - off;
+			dst = play.data + off * CHANNELS;
+
+			if (compensate) {
+				n_out = hfp_jitter_resample(&jb, src, n_in, &used, dst, n_out);
+				n_in = used;
+			} else {
+				if (n_in > n_out)
+					n_in = n_out;
+				n_out = n_in;
+				memcpy(dst, src, n_in * CHANNELS * sizeof(int16_t));
+			}
+			cap.appl += n_in;
+			play.appl += n_out;
+			consumed += n_in;
+			produced += n_out;
+			if (!n_in && !n_out)
+				break;
+		}
+		fill_after = play.appl - play_hw;
+		if (compensate)
+			hfp_jitter_update(&jb, fill_before, fill_after, consumed);
+
+		/* start like the bridge does: at the threshold, two periods */
+		if (!play.running && fill_after >= 2 * PERIOD)
+			play.running = 1;
+
+		if (t > settle) {
+			int ppm = hfp_jitter_ppm(&jb);
+
+			fill_sum += fill_after;
+			ppm_sum += ppm;
+			samples++;
+			if (ppm < res->min_ppm)
+				res->min_ppm = ppm;
+			if (ppm > res->max_ppm)
+				res->max_ppm = ppm;
+			if (fill_after * 1000.0 / RATE > res->max_fill_ms)
+				res->max_fill_ms = fill_after * 1000.0 / RATE;
+		}
+	}
+
+	res->cap_xruns = cap.xruns;
+	res->play_xruns = play.xruns;
+	res->mean_fill_ms = samples ? fill_sum / samples * 1000.0 / RATE : 0;
+	res->ppm = samples ? (int)lrint(ppm_sum / samples) : 0;
+	res->target_ms = jb.target * 1000.0 / RATE;
+
+	free(cap.data);
+	free(play.data);
+}
+
+int main(int argc, char **argv)
+{
+	static const sim_case_t cases[] = {
+		{ "matched clocks", 0, 0 },
+		{ "bt fast 100, codec slow 100", 100, -100 },
+		{ "bt slow 300, codec fast 200", -300, 200 },
+		{ "1000 ppm apart", 1000, 0 },
+		{ "3000 ppm apart", 0, 3000 },
+	};
+	sim_result_t on, off;
+	int seconds = 3600, opt, failed = 0, expect;
+
+	while ((opt = getopt(argc, argv, "t:s:h")) != -1) {
+		switch (opt) {
+		case 't': seconds = atoi(optarg); break;
+		case 's': seed = atoi(optarg); break;
+		default:
+			printf("usage: %s [-t seconds of call (3600)] [-s seed]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		const sim_case_t *c = &cases[i];
+
+		run(c, seconds, 0, &off);
+		run(c, seconds, 1, &on);
+		/* input frames per output frame that keep the fill steady */
+		expect = (int)lrint(((1.0 + c->cap_ppm * 1e-6) / (1.0 + c->play_ppm * 1e-6) - 1.0) * 1e6);
+
+		printf("%-28s without: %4u cap + %4u play xruns | with: %u + %u xruns (%u after 60 s), "
+				"%+5d ppm (want %+5d, seen %+d..%+d), fill %.1f ms avg %.1f ms max, target %.1f ms\n",
+				c->name, off.cap_xruns, off.play_xruns, on.cap_xruns, on.play_xruns, on.late_xruns,
+				on.ppm, expect, on.min_ppm, on.max_ppm, on.mean_fill_ms, on.max_fill_ms, on.target_ms);
+
+		if (on.late_xruns || abs(on.ppm - expect) > 50 || on.mean_fill_ms > 60)
+			failed++;
+	}
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "hfp_jitter.h"
+#include "hfp_dsp.h"
+
+/*
+ * What the HFP bridge spends on the audio itself, per minute of call:
+ * both directions, 20 ms at a time, through the same channel conversion
+ * and resampler the bridge uses, with the PCMs replaced by plain memory.
+ * Narrowband stereo is how every call was carried before; the others are
+ * the mono paths, with the codec at the bt rate or at its own.
+ */
+
+#define PERIOD_MS		20
+#define MAX_FRAMES		(48000 * PERIOD_MS / 1000 * 2)
+
+typedef struct {
+	const char *name;
+	unsigned int bt_rate, bt_channels;
+	unsigned int codec_rate, codec_channels;
+	int mono;				// bridge in mono, or frame for frame as before
+} bench_case_t;
+
+typedef struct {
+	unsigned int cap_rate, cap_channels, play_rate, play_channels;
+	int16_t *cap, *mono_in, *mono_out, *play;
+	hfp_jitter_t jb;
+	unsigned long long bytes;
+} bench_dir_t;
+
+static double cpu_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void dir_init(bench_dir_t *d, unsigned int cap_rate, unsigned int cap_channels,
+		unsigned int play_rate, unsigned int play_channels, int mono)
+{
+	unsigned int period = play_rate * PERIOD_MS / 1000;
+
+	memset(d, 0, sizeof(*d));
+	d->cap_rate = cap_rate;
+	d->cap_channels = cap_channels;
+	d->play_rate = play_rate;
+	d->play_channels = play_channels;
+	d->cap = (int16_t *)calloc(MAX_FRAMES, cap_channels * sizeof(int16_t));
+	d->mono_in = (int16_t *)calloc(MAX_FRAMES, sizeof(int16_t));
+	d->mono_out = (int16_t *)calloc(MAX_FRAMES, sizeof(int16_t));
+	d->play = (int16_t *)calloc(MAX_FRAMES, play_channels * sizeof(int16_t));
+	for (unsigned int i = 0; i < MAX_FRAMES * cap_channels; i++)
+		d->cap[i] = (int16_t)(i * 97);
+	hfp_jitter_init(&d->jb, mono ? 1 : cap_channels, cap_rate, play_rate, period, period * 5);
+}
+
+static void dir_free(bench_dir_t *d)
+{
+	free(d->cap);
+	free(d->mono_in);
+	free(d->mono_out);
+	free(d->play);
+}
+
+/* one period from capture to playback, the fill held at the target */
+static void dir_period(bench_dir_t *d, int mono)
+{
+	unsigned int n_in = d->cap_rate * PERIOD_MS / 1000, n_out, used;
+	long fill = d->jb.target;
+
+	if (mono) {
+		hfp_dsp_downmix(d->cap, d->cap_channels, d->mono_in, n_in);
+		n_out = hfp_jitter_resample(&d->jb, d->mono_in, n_in, &used, d->mono_out, MAX_FRAMES);
+		hfp_dsp_upmix(d->mono_out, d->play, d->play_channels, n_out);
+	} else {
+		n_out = hfp_jitter_resample(&d->jb, d->cap, n_in, &used, d->play, MAX_FRAMES);
+	}
+	hfp_jitter_update(&d->jb, fill, fill + n_out, used);
+
+	d->bytes += (unsigned long long)n_in * d->cap_channels * sizeof(int16_t) +
+			(unsigned long long)n_out * d->play_channels * sizeof(int16_t);
+}
+
+int main(int argc, char **argv)
+{
+	static const bench_case_t cases[] = {
+		{ "cvsd, 8k stereo (as before)", 8000, 2, 8000, 2, 0 },
+		{ "cvsd, 8k mono", 8000, 1, 8000, 1, 1 },
+		{ "msbc, 16k mono", 16000, 1, 16000, 1, 1 },
+		{ "msbc, codec 16k stereo", 16000, 1, 16000, 2, 1 },
+		{ "msbc, codec 48k stereo", 16000, 1, 48000, 2, 1 },
+	};
+	int minutes = 10, opt;
+
+	while ((opt = getopt(argc, argv, "m:h")) != -1) {
+		switch (opt) {
+		case 'm': minutes = atoi(optarg); break;
+		default:
+			printf("usage: %s [-m minutes of call to time (10)]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (minutes < 1)
+		minutes = 1;
+
+	printf("simd: %s\n", hfp_dsp_simd());
+	for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		const bench_case_t *c = &cases[i];
+		unsigned long long periods = minutes * 60ULL * 1000 / PERIOD_MS;
+		bench_dir_t up, down;
+		double start, ms;
+
+		dir_init(&up, c->codec_rate, c->codec_channels, c->bt_rate, c->bt_channels, c->mono);
+		dir_init(&down, c->bt_rate, c->bt_channels, c->codec_rate, c->codec_channels, c->mono);
+
+		start = cpu_ms();
+		for (unsigned long long p = 0; p < periods; p++) {
+			dir_period(&up, c->mono);
+			dir_period(&down, c->mono);
+		}
+		ms = cpu_ms() - start;
+
+		printf("%-30s %7.2f ms cpu per call minute, %6.2f MB copied per call minute\n",
+				c->name, ms / minutes, (up.bytes + down.bytes) / 1e6 / minutes);
+
+		dir_free(&up);
+		dir_free(&down);
+	}
+
+	return 0;
+}
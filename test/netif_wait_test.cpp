@@ -0,0 +1,89 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "netif.h"
+
+/*
+ * netif_wait_ipv4() against the kernel: nothing there times out, an
+ * address added while it waits wakes it as soon as the kernel reports it,
+ * one already there returns at once. Works on lo by default, whose own
+ * 127.0.0.1 is host scope and doesn't count; needs CAP_NET_ADMIN and
+ * leaves no global address behind.
+ */
+
+#define TEST_ADDR		"10.254.254.1"
+#define ADD_AFTER_MS	100
+
+static const char *m_ifname = "lo";
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void *add_later(void *arg)
+{
+	usleep(ADD_AFTER_MS * 1000);
+	*(int *)arg = netif_set_ipv4(m_ifname, TEST_ADDR, 32);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t tid;
+	long long start, ms;
+	int ret, added = -1, failed = 0;
+
+	if (argc > 1)
+		m_ifname = argv[1];
+
+	ret = netif_flush_ipv4(m_ifname);
+	if (ret == -EPERM) {
+		printf("%s: needs CAP_NET_ADMIN, skipped\n", argv[0]);
+		return 0;
+	}
+
+	start = now_ms();
+	ret = netif_wait_ipv4(m_ifname, 200);
+	ms = now_ms() - start;
+	printf("no address:      %d after %lld ms\n", ret, ms);
+	if (ret != -ETIMEDOUT || ms < 200) {
+		printf("FAIL: expected -ETIMEDOUT after 200 ms\n");
+		failed++;
+	}
+
+	pthread_create(&tid, NULL, add_later, &added);
+	start = now_ms();
+	ret = netif_wait_ipv4(m_ifname, 2000);
+	ms = now_ms() - start;
+	pthread_join(tid, NULL);
+	printf("added at %d ms:  %d after %lld ms\n", ADD_AFTER_MS, ret, ms);
+	if (added) {
+		printf("FAIL: adding %s to %s: %s\n", TEST_ADDR, m_ifname, strerror(-added));
+		failed++;
+	} else if (ret || ms > ADD_AFTER_MS + 500) {
+		printf("FAIL: expected the address to end the wait\n");
+		failed++;
+	}
+
+	start = now_ms();
+	ret = netif_wait_ipv4(m_ifname, 2000);
+	ms = now_ms() - start;
+	printf("already there:   %d after %lld ms\n", ret, ms);
+	if (ret || ms > 50) {
+		printf("FAIL: expected to return at once\n");
+		failed++;
+	}
+
+	netif_flush_ipv4(m_ifname);
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
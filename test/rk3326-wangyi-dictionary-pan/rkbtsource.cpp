@@ -32,6 +32,7 @@
 #include <DeviceIo/RkBtBase.h>
 #include <DeviceIo/RkBtSink.h>
 #include <DeviceIo/RkBtSource.h>
+#include <DeviceIo/Rk_socket_app.h>
 
 #include "rkbtsource_common.h"
 
@@ -46,8 +47,6 @@ int main(int argc, char *argv[])
 {
 	char buff[100] = {0};
 	char ret_buff[4] = {0};
-	struct sockaddr_un serverAddr;
-	struct sockaddr_un clientAddr;
 	int sockfd, i, item_cnt, ret;
 	char scan_result[256];
 	scan_devices_t *scan_devices;
@@ -94,35 +93,13 @@ int main(int argc, char *argv[])
 		memcpy(msg->addr, argv[2], 17);
 	}
 
-	sockfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	sockfd = RK_socket_packet_client_setup(RKBTSOURCE_SERVER_PATH);
 	if (sockfd < 0) {
-		printf("%s: Socket create failed!\n", PRINT_FLAG_ERR);
+		printf("%s: Socket connect failed!\n", PRINT_FLAG_ERR);
 		return -1;
 	}
 
-	/* Set server address */
-	serverAddr.sun_family = AF_UNIX;
-	strcpy(serverAddr.sun_path, "/tmp/rockchip_btsource_server");
-
-	/* Set client address */
-	system("rm /tmp/rockchip_btsource_client -rf");
-	clientAddr.sun_family = AF_UNIX;
-	strcpy(clientAddr.sun_path, "/tmp/rockchip_btsource_client");
-	ret = bind(sockfd, (struct sockaddr *)&clientAddr, sizeof(clientAddr));
-	if (ret < 0) {
-		printf("%s: Socket bind failed! ret = %d\n", PRINT_FLAG_ERR, ret);
-		close(sockfd);
-		return -1;
-	}
-
-	ret = connect(sockfd, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
-	if (ret < 0) {
-		printf("%s: Socket connect failed! ret = %d\n", PRINT_FLAG_ERR, ret);
-		close(sockfd);
-		return -1;
-	}
-
-	ret = send(sockfd, buff, sizeof(bt_msg_t), MSG_DONTWAIT);
+	ret = RK_socket_packet_send(sockfd, buff, sizeof(bt_msg_t), -1);
 	if (ret < 0) {
 		printf("%s: Socket send failed! ret = %d\n", PRINT_FLAG_ERR, ret);
 		close(sockfd);
@@ -132,7 +109,7 @@ int main(int argc, char *argv[])
 	if (!strncmp(argv[1], "scan", 4)) {
 		while(1) {
 			memset(scan_result, 0, sizeof(scan_result));
-			ret = recv(sockfd, scan_result, sizeof(scan_result), 0);
+			ret = RK_socket_packet_recv(sockfd, scan_result, sizeof(scan_result), NULL);
 			if (ret <= 0) {
 				printf("%s: Socket recv failed!\n", PRINT_FLAG_ERR);
 				goto OUT;
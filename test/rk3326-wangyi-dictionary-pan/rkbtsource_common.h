@@ -8,6 +8,9 @@
 #define PRINT_FLAG_ERR "[RK_BT_ERROR]"
 #define PRINT_FLAG_SUCESS "[RK_BT_SUCESS]"
 
+/* SOCK_SEQPACKET, see RK_socket_packet_* */
+#define RKBTSOURCE_SERVER_PATH "/tmp/rockchip_btsource_server"
+
 typedef struct {
 	char cmd[24];
 	char name[48];
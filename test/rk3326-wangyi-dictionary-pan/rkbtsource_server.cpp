@@ -15,6 +15,7 @@
  */
 
 #include <string.h>
+#include <errno.h>
 #include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -32,6 +33,7 @@
 #include <DeviceIo/RkBtBase.h>
 #include <DeviceIo/RkBtSink.h>
 #include <DeviceIo/RkBtSource.h>
+#include <DeviceIo/Rk_socket_app.h>
 
 #include "rkbtsource_common.h"
 
@@ -44,10 +46,16 @@
 
 #define SCAN_DEVICES_SAVE_COUNT 30
 
-static int sockfd = 0;
+static struct rk_socket_packet_server server;
+static int server_exit = 0;
 static scan_devices_t scan_devices_bak[SCAN_DEVICES_SAVE_COUNT];
 static int scan_devices_count = 0;
 
+/* clients waiting for scan results, sent to from the bt callbacks */
+static pthread_mutex_t scan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int scan_clients[RK_SOCKET_PACKET_CLIENTS];
+static int scan_clients_count = 0;
+
 static void rk_bt_state_cb(RK_BT_STATE state)
 {
 	switch(state) {
@@ -81,22 +89,68 @@ static void rk_bt_bond_state_cb(const char *bd_addr, const char *name, RK_BT_BON
 	}
 }
 
-static int rk_bt_send_scan_msg(char *scan_msg, int scan_msg_len)
+static void rk_bt_scan_client_add(int client_fd)
 {
-	int ret;
-	struct sockaddr_un clientAddr;
+	int i;
 
-	/* Set client address */
-	clientAddr.sun_family = AF_UNIX;
-	strcpy(clientAddr.sun_path, "/tmp/rockchip_btsource_client");
+	pthread_mutex_lock(&scan_mutex);
+	for (i = 0; i < scan_clients_count; i++) {
+		if (scan_clients[i] == client_fd)
+			break;
+	}
+	if (i == scan_clients_count && scan_clients_count < RK_SOCKET_PACKET_CLIENTS)
+		scan_clients[scan_clients_count++] = client_fd;
+	pthread_mutex_unlock(&scan_mutex);
+}
 
-	ret = sendto(sockfd, scan_msg, scan_msg_len, 0, (struct sockaddr *)&clientAddr, sizeof(clientAddr));
-	if (ret < 0) {
-		printf("%s: sendto scan msg failed! ret = %d, scan_msg = %s\n", PRINT_FLAG_ERR, ret, scan_msg);
-		return -1;
+static void rk_bt_scan_client_del(int client_fd)
+{
+	int i;
+
+	pthread_mutex_lock(&scan_mutex);
+	for (i = 0; i < scan_clients_count; i++) {
+		if (scan_clients[i] == client_fd) {
+			scan_clients[i] = scan_clients[--scan_clients_count];
+			break;
+		}
 	}
+	pthread_mutex_unlock(&scan_mutex);
+}
 
-	return 0;
+/*
+ * Runs on the bt callback thread, so it must never block on a client.
+ * One that is not reading is dropped: shutdown() makes its next read
+ * come back empty and the server loop closes it from there.
+ */
+static int rk_bt_send_scan_msg(char *scan_msg, int scan_msg_len)
+{
+	int i = 0, ret = 0;
+
+	pthread_mutex_lock(&scan_mutex);
+	while (i < scan_clients_count) {
+		if (send(scan_clients[i], scan_msg, scan_msg_len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+			printf("%s: send scan msg failed(%s), dropping client %d\n", PRINT_FLAG_ERR,
+				strerror(errno), scan_clients[i]);
+			shutdown(scan_clients[i], SHUT_RDWR);
+			scan_clients[i] = scan_clients[--scan_clients_count];
+			ret = -1;
+			continue;
+		}
+		i++;
+	}
+	pthread_mutex_unlock(&scan_mutex);
+
+	return ret;
+}
+
+/* this scan is over, its clients are done waiting */
+static void rk_bt_send_scan_off()
+{
+	rk_bt_send_scan_msg("rkbt scan off", strlen("rkbt scan off"));
+
+	pthread_mutex_lock(&scan_mutex);
+	scan_clients_count = 0;
+	pthread_mutex_unlock(&scan_mutex);
 }
 
 static void rk_bt_discovery_status_cb(RK_BT_DISCOVERY_STATE status)
@@ -107,15 +161,15 @@ static void rk_bt_discovery_status_cb(RK_BT_DISCOVERY_STATE status)
 			break;
 		case RK_BT_DISC_STOPPED_AUTO:
 			printf("%s: RK_BT_DISC_STOPPED_AUTO\n", PRINT_FLAG_RKBTSOURCE);
-			rk_bt_send_scan_msg("rkbt scan off", strlen("rkbt scan off"));
+			rk_bt_send_scan_off();
 			break;
 		case RK_BT_DISC_START_FAILED:
 			printf("%s: RK_BT_DISC_START_FAILED\n", PRINT_FLAG_RKBTSOURCE);
-			rk_bt_send_scan_msg("rkbt scan off", strlen("rkbt scan off"));
+			rk_bt_send_scan_off();
 			break;
 		case RK_BT_DISC_STOPPED_BY_USER:
 			printf("%s: RK_BT_DISC_STOPPED_BY_USER\n", PRINT_FLAG_RKBTSOURCE);
-			rk_bt_send_scan_msg("rkbt scan off", strlen("rkbt scan off"));
+			rk_bt_send_scan_off();
 			break;
 	}
 }
@@ -249,130 +303,142 @@ static int rk_bt_server_deinit()
 	return rk_bt_deinit();
 }
 
-int main(int argc, char *argv[])
+static void rk_bt_server_msg(int client_fd, bt_msg_t *msg)
 {
 	int i, item_cnt, ret;
-	char buff[128] = {0};
-	bt_msg_t *msg;
-	struct sockaddr_un serverAddr;
-
-	RK_read_version(buff, 128);
-	printf("====== Version:%s =====\n", buff);
-	memset(buff, 0, sizeof(buff));
 
-	sockfd = socket(AF_UNIX, SOCK_DGRAM, 0);
-	if (sockfd < 0) {
-		printf("%s: Create socket failed!\n", PRINT_FLAG_ERR);
-		return -1;
+	item_cnt = sizeof(bt_command_table) / sizeof(bt_command_t);
+	for (i = 0; i < item_cnt; i++) {
+		if (!strncmp(msg->cmd, bt_command_table[i].cmd, strlen(bt_command_table[i].cmd)))
+			break;
 	}
 
-	/* Set server address */
-	system("rm -rf /tmp/rockchip_btsource_server");
-	serverAddr.sun_family = AF_UNIX;
-	strcpy(serverAddr.sun_path, "/tmp/rockchip_btsource_server");
-	ret = bind(sockfd, (struct sockaddr *)&serverAddr, sizeof(serverAddr));
-	if (ret < 0) {
-		printf("%s: Bind Local addr failed!\n", PRINT_FLAG_ERR);
-		goto fail;
+	if (i >= item_cnt) {
+		printf("%s: Invalid cmd(%s) recved!\n", PRINT_FLAG_ERR, msg->cmd);
+		return;
 	}
 
-	msg = (bt_msg_t *)buff;
-	item_cnt = sizeof(bt_command_table) / sizeof(bt_command_t);
-
-	while(1) {
-		memset(buff, 0, sizeof(buff));
-		ret = recv(sockfd, buff, sizeof(buff), 0);
-		if (ret <= 0) {
-			printf("%s: Recv cmd failed! ret = %d\n", PRINT_FLAG_ERR, ret);
-			goto fail;
-		}
+	switch (bt_command_table[i].cmd_id) {
+	case RK_BT_SOURCE_INIT:
+		if (strlen(msg->name))
+			ret = rk_bt_server_init(msg->name);
+		else
+			ret = rk_bt_server_init("ROCKCHIP_AUDIO");
 
-		for (i = 0; i < item_cnt; i++) {
-			if (!strncmp(msg->cmd, bt_command_table[i].cmd, strlen(bt_command_table[i].cmd)))
-				break;
+		if(ret < 0) {
+			printf("%s: bt server init failed!\n", PRINT_FLAG_ERR);
+			server_exit = -1;
+			return;
 		}
 
-		if (i >= item_cnt) {
-			printf("%s: Invalid cmd(%s) recved!\n", PRINT_FLAG_ERR, buff);
-			continue;
+		rk_bt_source_register_status_cb(NULL, rk_bt_source_status_callback);
+		if(rk_bt_source_open() < 0) {
+			printf("%s: bt source open failed!\n", PRINT_FLAG_ERR);
+			server_exit = -1;
+			return;
 		}
 
-		switch (bt_command_table[i].cmd_id) {
-		case RK_BT_SOURCE_INIT:
-			if (strlen(msg->name))
-				ret = rk_bt_server_init(msg->name);
-			else
-				ret = rk_bt_server_init("ROCKCHIP_AUDIO");
-
-			if(ret < 0) {
-				printf("%s: bt server init failed!\n", PRINT_FLAG_ERR);
-				goto fail;
-			}
-
-			rk_bt_source_register_status_cb(NULL, rk_bt_source_status_callback);
-			if(rk_bt_source_open() < 0) {
-				printf("%s: bt source open failed!\n", PRINT_FLAG_ERR);
-				goto fail;
-			}
-
-			printf("%s: bt server init sucessful!\n", PRINT_FLAG_SUCESS);
-			//system("echo 'bt server init sucessful' > /tmp/rk_bt.log");
-			break;
-
-		case RK_BT_SOURCE_CONNECT:
-			if (rk_bt_source_connect_by_addr(msg->addr) < 0)
-				printf("%s: rk_bt_source_connect_by_addr %s failed!\n", PRINT_FLAG_ERR, msg->addr);
-			break;
-
-		case RK_BT_SOURCE_SCAN_ON:
-			memset(scan_devices_bak, 0, sizeof(scan_devices_t) * SCAN_DEVICES_SAVE_COUNT);
-			scan_devices_count = 0;
-			/* Scan bluetooth devices, 10s for default*/
-			if(rk_bt_start_discovery(10000, SCAN_TYPE_AUTO) < 0)
-				printf("%s: rk_bt_start_discovery failed\n", PRINT_FLAG_ERR);
-			break;
+		printf("%s: bt server init sucessful!\n", PRINT_FLAG_SUCESS);
+		//system("echo 'bt server init sucessful' > /tmp/rk_bt.log");
+		break;
+
+	case RK_BT_SOURCE_CONNECT:
+		if (rk_bt_source_connect_by_addr(msg->addr) < 0)
+			printf("%s: rk_bt_source_connect_by_addr %s failed!\n", PRINT_FLAG_ERR, msg->addr);
+		break;
+
+	case RK_BT_SOURCE_SCAN_ON:
+		memset(scan_devices_bak, 0, sizeof(scan_devices_t) * SCAN_DEVICES_SAVE_COUNT);
+		scan_devices_count = 0;
+		rk_bt_scan_client_add(client_fd);
+		/* Scan bluetooth devices, 10s for default*/
+		if(rk_bt_start_discovery(10000, SCAN_TYPE_AUTO) < 0)
+			printf("%s: rk_bt_start_discovery failed\n", PRINT_FLAG_ERR);
+		break;
+
+	case RK_BT_SOURCE_SCAN_OFF:
+		rk_bt_cancel_discovery();
+		break;
+
+	case RK_BT_SOURCE_DISCONNECT:
+		if (rk_bt_source_disconnect_by_addr(msg->addr) < 0)
+			printf("%s: rk_bt_source_disconnect_by_addr failed!\n", PRINT_FLAG_ERR);
+		break;
+
+	case RK_BT_SOURCE_REMOVE:
+		if (rk_bt_source_remove(msg->addr) < 0)
+			printf("%s: remove failed!\n", PRINT_FLAG_ERR);
+		else
+			printf("%s: remove sucess!\n", PRINT_FLAG_SUCESS);
+		break;
 
-		case RK_BT_SOURCE_SCAN_OFF:
-			rk_bt_cancel_discovery();
-			break;
+	case RK_BT_SOURCE_DEINIT:
+		server_exit = 1;
+		break;
 
-		case RK_BT_SOURCE_DISCONNECT:
-			if (rk_bt_source_disconnect_by_addr(msg->addr) < 0)
-				printf("%s: rk_bt_source_disconnect_by_addr failed!\n", PRINT_FLAG_ERR);
-			break;
+	default:
+		break;
+	}
+}
 
-		case RK_BT_SOURCE_REMOVE:
-			if (rk_bt_source_remove(msg->addr) < 0)
-				printf("%s: remove failed!\n", PRINT_FLAG_ERR);
-			else
-				printf("%s: remove sucess!\n", PRINT_FLAG_SUCESS);
+static void rk_bt_server_cb(struct rk_socket_packet_server *server, int client_fd,
+		RK_SOCKET_PACKET_EVENT event, struct rk_socket_packet *packet, void *userdata)
+{
+	bt_msg_t msg;
+
+	switch (event) {
+	case RK_SOCKET_PACKET_MESSAGE:
+		if (packet->fd >= 0)
+			close(packet->fd);
+		if (packet->len != sizeof(bt_msg_t)) {
+			printf("%s: Invalid msg length %d!\n", PRINT_FLAG_ERR, packet->len);
 			break;
+		}
+		memcpy(&msg, packet->data, sizeof(msg));
+		msg.cmd[sizeof(msg.cmd) - 1] = '\0';
+		msg.name[sizeof(msg.name) - 1] = '\0';
+		rk_bt_server_msg(client_fd, &msg);
+		break;
+
+	case RK_SOCKET_PACKET_DISCONNECTED:
+		rk_bt_scan_client_del(client_fd);
+		break;
+
+	default:
+		break;
+	}
+}
 
-		case RK_BT_SOURCE_DEINIT:
-			rk_bt_server_deinit();
+int main(int argc, char *argv[])
+{
+	char buff[128] = {0};
 
-			if(sockfd) {
-				close(sockfd);
-				printf("%s: close server socket\n", PRINT_FLAG_RKBTSOURCE);
-				sockfd = 0;
-			}
+	RK_read_version(buff, 128);
+	printf("====== Version:%s =====\n", buff);
 
-			printf("%s:deinit bt server sucess!\n", PRINT_FLAG_SUCESS);
-			return 0;
+	if (RK_socket_packet_server_setup(&server, RKBTSOURCE_SERVER_PATH, rk_bt_server_cb, NULL) < 0) {
+		printf("%s: Create server socket failed!\n", PRINT_FLAG_ERR);
+		return -1;
+	}
 
-		default:
-			break;
+	while (!server_exit) {
+		if (RK_socket_packet_server_poll(&server, -1) < 0) {
+			printf("%s: Recv cmd failed!\n", PRINT_FLAG_ERR);
+			server_exit = -1;
 		}
 	}
 
-fail:
-	printf("%s: rkbtsource_server failed and exit\n", PRINT_FLAG_ERR);
-	if(sockfd) {
-		close(sockfd);
-		printf("%s: close server socket\n", PRINT_FLAG_RKBTSOURCE);
-		sockfd = 0;
-	}
+	if (server_exit < 0)
+		printf("%s: rkbtsource_server failed and exit\n", PRINT_FLAG_ERR);
 
+	/* the bt callbacks stop sending before the clients go */
 	rk_bt_server_deinit();
-	return -1;
+	RK_socket_packet_server_teardown(&server);
+	printf("%s: close server socket\n", PRINT_FLAG_RKBTSOURCE);
+
+	if (server_exit < 0)
+		return -1;
+
+	printf("%s:deinit bt server sucess!\n", PRINT_FLAG_SUCESS);
+	return 0;
 }
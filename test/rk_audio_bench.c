@@ -0,0 +1,160 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "DeviceIo/Rk_audio.h"
+
+/*
+ * Volume key held down: RK_audio_set_volume() ramps through the range at
+ * the key repeat rate, then the key is let go. Reports the cost of each
+ * change, how many of them made it to the volume callback, and how many
+ * times alsactl ran to store the mixer state. Then a volume display
+ * polls RK_audio_get_volume() as fast as it can. alsactl
+ * is found through a wrapper put first in PATH that counts its runs and
+ * hands over to the real one, if there is one.
+ */
+
+#define BENCH_DIR		"/tmp/rk_audio_bench"
+#define BENCH_COUNT		BENCH_DIR "/alsactl.count"
+#define STORE_WAIT_MS	7000		// longer than the library ever holds a store back
+
+static volatile int cb_count, cb_volume = -1;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int setup_wrapper(void)
+{
+	const char *path = getenv("PATH");
+	char *new_path;
+	FILE *fp;
+
+	mkdir(BENCH_DIR, 0755);
+	unlink(BENCH_COUNT);
+
+	fp = fopen(BENCH_DIR "/alsactl", "w");
+	if (!fp)
+		return -1;
+	fprintf(fp, "#!/bin/sh\n"
+			"echo \"$*\" >> %s\n"
+			"PATH='%s'\n"
+			"command -v alsactl >/dev/null && exec alsactl \"$@\"\n"
+			"exit 0\n", BENCH_COUNT, path ? path : "/usr/sbin:/usr/bin:/sbin:/bin");
+	fclose(fp);
+	chmod(BENCH_DIR "/alsactl", 0755);
+
+	new_path = (char *)malloc(strlen(BENCH_DIR) + (path ? strlen(path) : 0) + 2);
+	sprintf(new_path, "%s:%s", BENCH_DIR, path ? path : "");
+	setenv("PATH", new_path, 1);
+	free(new_path);
+
+	return 0;
+}
+
+static int store_count(void)
+{
+	char line[256];
+	int count = 0;
+	FILE *fp;
+
+	fp = fopen(BENCH_COUNT, "r");
+	if (!fp)
+		return 0;
+	while (fgets(line, sizeof(line), fp))
+		count++;
+	fclose(fp);
+
+	return count;
+}
+
+static int volume_cb(const int volume)
+{
+	cb_volume = volume;
+	cb_count++;
+	return 0;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char **argv)
+{
+	int interval = 50, steps = 100, polls = 1000000, opt, count, volume, failed = 0;
+	long long *costs, start, total;
+
+	while ((opt = getopt(argc, argv, "i:n:p:h")) != -1) {
+		switch (opt) {
+		case 'i': interval = atoi(optarg); break;
+		case 'n': steps = atoi(optarg); break;
+		case 'p': polls = atoi(optarg); break;
+		default:
+			printf("usage: %s [-i key repeat ms (50)] [-n volume steps (100)] [-p polls (1000000)]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (steps <= 0)
+		steps = 100;
+
+	if (setup_wrapper() < 0) {
+		printf("can't write %s/alsactl\n", BENCH_DIR);
+		return 1;
+	}
+
+	RK_audio_register_volume_callback(volume_cb);
+	/* the first access opens the card, leave that out */
+	RK_audio_set_volume(0);
+	usleep(100000);
+	cb_count = 0;
+
+	costs = (long long *)malloc(steps * sizeof(long long));
+	start = now_us();
+	for (int i = 0; i < steps; i++) {
+		long long t = now_us();
+
+		RK_audio_set_volume((i + 1) * 100 / steps);
+		costs[i] = now_us() - t;
+		if (interval > 0)
+			usleep(interval * 1000);
+	}
+	total = now_us() - start;
+
+	qsort(costs, steps, sizeof(costs[0]), cmp_ll);
+	printf("ramp: %d changes in %lld ms, p50 %lld us, p99 %lld us, max %lld us\n", steps, total / 1000,
+			costs[steps / 2], costs[steps * 99 / 100], costs[steps - 1]);
+	printf("ramp: alsactl ran %d times while the key was held\n", store_count());
+
+	usleep(STORE_WAIT_MS * 1000);
+	count = store_count();
+	printf("release: alsactl ran %d times in all\n", count);
+	/* one store for the whole ramp, plus one every few seconds of a long hold */
+	if (count < 1 || count > 1 + total / 1000000 / 5 + 1)
+		failed++;
+
+	volume = RK_audio_get_volume();
+	printf("callback: %d calls, last %d, volume now %d\n", cb_count, cb_volume, volume);
+	if (volume < 0 || cb_count == 0 || cb_volume != volume)
+		failed++;
+
+	start = now_us();
+	for (int i = 0; i < polls; i++)
+		RK_audio_get_volume();
+	total = now_us() - start;
+	printf("poll: %d reads in %lld ms, %.3f us per read\n", polls, total / 1000,
+			(double)total / (polls > 0 ? polls : 1));
+	free(costs);
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,358 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "DeviceIo/Rk_key.h"
+
+/*
+ * Key gesture recognition through the public RK_input_* API. Events are
+ * replayed into a fifo that stands in for /dev/input/event0, so this runs
+ * anywhere. Latency is from the moment a gesture is decided (the last key
+ * down, or the deadline it waits for) to its callback.
+ */
+
+#define BENCH_DEV_DIR	"/tmp/rk_key_bench"
+#define BENCH_DEV_NODE	BENCH_DEV_DIR "/event0"
+
+#define KEY_PLAIN		KEY_1
+#define KEY_LONG		KEY_A			// long press at 300 ms
+#define KEY_HB			KEY_B			// heartbeat every 100 ms
+#define KEY_MULTI		KEY_C			// 2 and 3 presses
+#define KEY_COMP1		KEY_D			// with KEY_COMP2, held 200 ms
+#define KEY_COMP2		KEY_E
+#define KEY_TRANS1		KEY_F			// then KEY_TRANS2, KEY_TRANS3, 300 ms apart at most
+#define KEY_TRANS2		KEY_G
+#define KEY_TRANS3		KEY_H
+
+#define LONG_MS			300
+#define HB_MS			100
+#define COMPOSE_MS		200
+#define MULTIPLE_MS		500				// how long the library waits for another press
+
+static int dev_fd = -1;
+static volatile long long raw_count;
+static volatile long long press_us, long_us, hb_us, multiple_us, compose_us, trans_us;
+static volatile int press_code, multiple_times, hb_count;
+static int failed;
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static long long cpu_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static int raw_cb(const int key_code, const int key_value)
+{
+	raw_count++;
+	return 0;
+}
+
+static int press_cb(const int key_code)
+{
+	press_code = key_code;
+	press_us = now_us();
+	return 0;
+}
+
+static int long_cb(const int key_code, const uint32_t time)
+{
+	long_us = now_us();
+	return 0;
+}
+
+static int hb_cb(const int key_code, const int times)
+{
+	hb_count++;
+	hb_us = now_us();
+	return 0;
+}
+
+static int multiple_cb(const int key_code, const int times)
+{
+	multiple_times = times;
+	multiple_us = now_us();
+	return 0;
+}
+
+static int compose_cb(const char *compose, const uint32_t time)
+{
+	compose_us = now_us();
+	return 0;
+}
+
+static int trans_cb(const char *trans, const uint32_t time)
+{
+	trans_us = now_us();
+	return 0;
+}
+
+/* one key event and its SYN_REPORT, stamped like the kernel would */
+static long long send_key(const int code, const int value)
+{
+	struct input_event ev[2];
+	long long us;
+
+	memset(ev, 0, sizeof(ev));
+	gettimeofday(&ev[0].time, NULL);
+	ev[0].type = EV_KEY;
+	ev[0].code = code;
+	ev[0].value = value;
+	ev[1].time = ev[0].time;
+	ev[1].type = EV_SYN;
+	ev[1].code = SYN_REPORT;
+
+	us = now_us();
+	if (write(dev_fd, ev, sizeof(ev)) != sizeof(ev))
+		printf("write %s failed\n", BENCH_DEV_NODE);
+	return us;
+}
+
+static void tap(const int code)
+{
+	send_key(code, 1);
+	usleep(20000);
+	send_key(code, 0);
+	usleep(20000);
+}
+
+/* us from since until *stamp moved past it, -1 if not within timeout_ms */
+static long long wait_cb(volatile long long *stamp, const long long since, const int timeout_ms)
+{
+	for (int i = 0; i < timeout_ms * 10; i++) {
+		if (*stamp >= since)
+			return *stamp - since;
+		usleep(100);
+	}
+
+	return -1;
+}
+
+/*
+ * how late stamp is for a deadline at due; the library keeps time in ms,
+ * so up to 1 ms early counts as on time, earlier is a miss
+ */
+static long long late(const long long stamp, const long long due)
+{
+	if (stamp - due >= 0)
+		return stamp - due;
+
+	return stamp - due > -1000 ? 0 : -1;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_result(const char *name, long long *costs, int count)
+{
+	int valid = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (costs[i] >= 0)
+			costs[valid++] = costs[i];
+	}
+	if (valid < count) {
+		printf("%-24s %d of %d missed\n", name, count - valid, count);
+		failed++;
+	}
+	if (!valid)
+		return;
+
+	qsort(costs, valid, sizeof(costs[0]), cmp_ll);
+	printf("%-24s p50 %6lld us, p99 %6lld us, max %6lld us\n", name,
+			costs[valid / 2], costs[valid * 99 / 100], costs[valid - 1]);
+}
+
+static void bench_gestures(long long *costs, int count)
+{
+	long long start;
+
+	for (int i = 0; i < count; i++) {
+		start = send_key(KEY_PLAIN, 1);
+		costs[i] = wait_cb(&press_us, start, 1000);
+		send_key(KEY_PLAIN, 0);
+	}
+	print_result("press", costs, count);
+
+	for (int i = 0; i < count; i++) {
+		start = send_key(KEY_LONG, 1);
+		costs[i] = wait_cb(&long_us, start, LONG_MS + 1000);
+		if (costs[i] >= 0)
+			costs[i] = late(long_us, start + LONG_MS * 1000);
+		send_key(KEY_LONG, 0);
+		usleep(10000);
+	}
+	print_result("long press", costs, count);
+
+	for (int i = 0; i < count; i++) {
+		hb_count = 0;
+		start = send_key(KEY_HB, 1);
+		usleep((3 * HB_MS + HB_MS / 2) * 1000);
+		send_key(KEY_HB, 0);
+		costs[i] = hb_count == 3 ? late(hb_us, start + 3 * HB_MS * 1000) : -1;
+		usleep(10000);
+	}
+	print_result("3rd heartbeat", costs, count);
+
+	/* the most presses registered: decided on the last one */
+	for (int i = 0; i < count; i++) {
+		tap(KEY_MULTI);
+		tap(KEY_MULTI);
+		start = send_key(KEY_MULTI, 1);
+		costs[i] = wait_cb(&multiple_us, start, 1000);
+		if (multiple_times != 3)
+			costs[i] = -1;
+		send_key(KEY_MULTI, 0);
+		usleep(10000);
+	}
+	print_result("triple press", costs, count);
+
+	/* fewer: decided once no other press follows */
+	for (int i = 0; i < count; i++) {
+		tap(KEY_MULTI);
+		start = send_key(KEY_MULTI, 1);
+		send_key(KEY_MULTI, 0);
+		costs[i] = wait_cb(&multiple_us, start, MULTIPLE_MS + 1000);
+		if (costs[i] >= 0)
+			costs[i] = multiple_times == 2 ? late(multiple_us, start + MULTIPLE_MS * 1000) : -1;
+		usleep(10000);
+	}
+	print_result("double press", costs, count);
+
+	for (int i = 0; i < count; i++) {
+		send_key(KEY_COMP1, 1);
+		start = send_key(KEY_COMP2, 1);
+		costs[i] = wait_cb(&compose_us, start, COMPOSE_MS + 1000);
+		if (costs[i] >= 0)
+			costs[i] = late(compose_us, start + COMPOSE_MS * 1000);
+		send_key(KEY_COMP2, 0);
+		send_key(KEY_COMP1, 0);
+		usleep(10000);
+	}
+	print_result("compose", costs, count);
+
+	for (int i = 0; i < count; i++) {
+		tap(KEY_TRANS1);
+		tap(KEY_TRANS2);
+		start = send_key(KEY_TRANS3, 1);
+		costs[i] = wait_cb(&trans_us, start, 1000);
+		send_key(KEY_TRANS3, 0);
+		usleep(10000);
+	}
+	print_result("transaction", costs, count);
+}
+
+/* as fast as the fifo takes them, over keys with and without gestures */
+static void bench_storm(const int events)
+{
+	static const int keys[] = { KEY_PLAIN, KEY_MULTI, KEY_LONG, KEY_TRANS1, KEY_TRANS2 };
+	long long start, cpu, wall, base = raw_count;
+
+	cpu = cpu_us();
+	start = now_us();
+	for (int i = 0; i < events / 2; i++) {
+		int code = keys[(i / 3) % (sizeof(keys) / sizeof(keys[0]))];
+
+		send_key(code, 1);
+		send_key(code, 0);
+	}
+	while (raw_count - base < events / 2 * 2 && now_us() - start < 30000000)
+		usleep(1000);
+	wall = now_us() - start;
+	cpu = cpu_us() - cpu;
+
+	if (raw_count - base < events / 2 * 2) {
+		printf("storm: %lld of %d events arrived\n", raw_count - base, events / 2 * 2);
+		failed++;
+	}
+	printf("storm: %d events in %lld ms, %.0f events/s, %.2f us cpu per event (writer included)\n",
+			events / 2 * 2, wall / 1000, (raw_count - base) * 1e6 / (wall ? wall : 1),
+			(double)cpu / (events ? events : 1));
+
+	/* let pending multi-presses and transactions run out */
+	usleep((MULTIPLE_MS + 100) * 1000);
+}
+
+/* nothing pressed, nothing pending: the library should not wake up */
+static void bench_idle(void)
+{
+	long long cpu = cpu_us();
+
+	sleep(1);
+	printf("idle: %lld us cpu in 1 s\n", cpu_us() - cpu);
+}
+
+int main(int argc, char **argv)
+{
+	int count = 20, events = 100000, opt;
+	long long *costs;
+
+	while ((opt = getopt(argc, argv, "n:e:h")) != -1) {
+		switch (opt) {
+		case 'n': count = atoi(optarg); break;
+		case 'e': events = atoi(optarg); break;
+		default:
+			printf("usage: %s [-n rounds per gesture (20)] [-e storm events (100000)]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (count <= 0)
+		count = 20;
+
+	mkdir(BENCH_DEV_DIR, 0755);
+	unlink(BENCH_DEV_NODE);
+	if (mkfifo(BENCH_DEV_NODE, 0600) < 0) {
+		printf("mkfifo %s failed\n", BENCH_DEV_NODE);
+		return 1;
+	}
+	/* read-write, so the fifo has a writer from before the library opens it */
+	dev_fd = open(BENCH_DEV_NODE, O_RDWR);
+
+	RK_input_set_dev_path(BENCH_DEV_DIR);
+	RK_input_register_press_callback(press_cb);
+	RK_input_register_long_press_callback(long_cb, LONG_MS, KEY_LONG);
+	RK_input_register_long_press_hb_callback(hb_cb, HB_MS, KEY_HB);
+	RK_input_register_multiple_press_callback(multiple_cb, KEY_MULTI, 2);
+	RK_input_register_multiple_press_callback(multiple_cb, KEY_MULTI, 3);
+	RK_input_register_compose_press_callback(compose_cb, COMPOSE_MS, 2, KEY_COMP1, KEY_COMP2);
+	RK_input_register_transaction_press_callback(trans_cb, 300, 3, KEY_TRANS1, KEY_TRANS2, KEY_TRANS3);
+	if (RK_input_init(raw_cb) != 0) {
+		printf("RK_input_init failed\n");
+		return 1;
+	}
+	RK_input_events_print();
+	usleep(100000);
+
+	costs = (long long *)malloc(count * sizeof(long long));
+	bench_gestures(costs, count);
+	free(costs);
+	bench_storm(events);
+	bench_idle();
+
+	RK_input_exit();
+	close(dev_fd);
+	unlink(BENCH_DEV_NODE);
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
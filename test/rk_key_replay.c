@@ -0,0 +1,322 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "DeviceIo/Rk_key.h"
+
+/*
+ * Record key input on a device, or play a recording (the format is in
+ * Rk_key.h) back into a fifo that stands in for an event node:
+ *
+ *   rk_key_replay -R key.rec [-t seconds] [-d dir]   record /dev/input, or dir
+ *   rk_key_replay [-s speed] [-l loops] key.rec
+ *   rk_key_replay -g taps [-i us]                     a synthetic burst instead
+ *   rk_key_replay -o node key.rec                     just write the events to node
+ *
+ * Played back in this process, events get stamped like the kernel does
+ * when they go in, and the report is the time from that stamp to the
+ * RK_input callback and to the press callback.
+ */
+
+#define REPLAY_DEV_DIR	"/tmp/rk_key_replay"
+#define REPLAY_DEV_NODE	REPLAY_DEV_DIR "/event0"
+
+typedef struct {
+	long long us;					// since the first event
+	struct input_event ev;
+} replay_event_t;
+
+static replay_event_t *events;
+static int event_count;
+
+/* stamps of what was sent, in the order the callbacks should see it */
+static long long *sent_us, *sent_down_us;
+static long long *raw_lat, *press_lat;
+static volatile int raw_count, press_count;
+static int key_count, down_count;
+
+static long long now_realtime_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* what reaches the callbacks, the monitor drops the rest */
+static int is_key(const struct input_event *ev)
+{
+	return ev->code != 0 && (ev->value == 0 || ev->value == 1);
+}
+
+static int raw_cb(const int key_code, const int key_value)
+{
+	int i = raw_count;
+
+	if (i < key_count)
+		raw_lat[i] = now_realtime_us() - sent_us[i];
+	raw_count = i + 1;
+	return 0;
+}
+
+static int press_cb(const int key_code)
+{
+	int i = press_count;
+
+	if (i < down_count)
+		press_lat[i] = now_realtime_us() - sent_down_us[i];
+	press_count = i + 1;
+	return 0;
+}
+
+static int add_event(const long long us, const int type, const int code, const int value)
+{
+	static int cap;
+	replay_event_t *tmp;
+
+	if (event_count == cap) {
+		tmp = (replay_event_t *)realloc(events, (cap + 1024) * sizeof(*events));
+		if (!tmp)
+			return -1;
+		events = tmp;
+		cap += 1024;
+	}
+
+	memset(&events[event_count], 0, sizeof(events[0]));
+	events[event_count].us = us;
+	events[event_count].ev.type = type;
+	events[event_count].ev.code = code;
+	events[event_count].ev.value = value;
+	event_count++;
+	return 0;
+}
+
+static int load(const char *path)
+{
+	char line[128];
+	long long us;
+	unsigned int type, code;
+	int value, lineno = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		printf("open %s failed: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%lld %u %u %d", &us, &type, &code, &value) != 4) {
+			printf("%s:%d doesn't parse\n", path, lineno);
+			fclose(fp);
+			return -1;
+		}
+		add_event(us, type, code, value);
+	}
+	fclose(fp);
+
+	return event_count;
+}
+
+/* taps over a few keys, interval us between every down and up */
+static void generate(const int taps, const int interval)
+{
+	static const int keys[] = { KEY_1, KEY_2, KEY_3, KEY_4 };
+
+	for (int i = 0; i < taps; i++) {
+		long long us = 2LL * i * interval;
+		int code = keys[i % (sizeof(keys) / sizeof(keys[0]))];
+
+		add_event(us, EV_KEY, code, 1);
+		add_event(us, EV_SYN, SYN_REPORT, 0);
+		add_event(us + interval, EV_KEY, code, 0);
+		add_event(us + interval, EV_SYN, SYN_REPORT, 0);
+	}
+}
+
+/* events with one timestamp go in together, like a kernel report */
+static int replay(const int fd, const double speed, const int loops)
+{
+	struct input_event frame[64];
+	struct timespec ts;
+	long long base, offset = 0, stamp;
+	int i, n, len;
+
+	base = now_us();
+	for (int loop = 0; loop < loops; loop++) {
+		for (i = 0; i < event_count; i = n) {
+			long long due = base + (long long)((offset + events[i].us) / speed);
+
+			ts.tv_sec = due / 1000000;
+			ts.tv_nsec = due % 1000000 * 1000;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+			stamp = now_realtime_us();
+			for (n = i, len = 0; n < event_count && events[n].us == events[i].us && len < 64; n++, len++) {
+				frame[len] = events[n].ev;
+				frame[len].time.tv_sec = stamp / 1000000;
+				frame[len].time.tv_usec = stamp % 1000000;
+				if (sent_us && is_key(&frame[len])) {
+					sent_us[key_count++] = stamp;
+					if (frame[len].value == 1)
+						sent_down_us[down_count++] = stamp;
+				}
+			}
+			if (write(fd, frame, len * sizeof(frame[0])) < 0) {
+				printf("write failed: %s\n", strerror(errno));
+				return -1;
+			}
+		}
+		/* the next loop starts a beat after this one ended */
+		offset += events[event_count - 1].us + 10000;
+	}
+
+	return 0;
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_percentiles(const char *name, long long *lat, const int count)
+{
+	if (count <= 0) {
+		printf("%-20s no events\n", name);
+		return;
+	}
+
+	qsort(lat, count, sizeof(lat[0]), cmp_ll);
+	printf("%-20s %6d events  p50 %5lld us  p90 %5lld us  p99 %5lld us  p99.9 %5lld us  max %5lld us\n",
+			name, count, lat[count / 2], lat[count * 90 / 100], lat[count * 99 / 100],
+			lat[count * 999 / 1000], lat[count - 1]);
+}
+
+static int record(const char *path, const char *dir, const int seconds)
+{
+	if (dir)
+		RK_input_set_dev_path(dir);
+	if (RK_input_init(NULL) != 0 || RK_input_record_start(path) != 0)
+		return 1;
+
+	printf("recording to %s for %d s\n", path, seconds);
+	sleep(seconds);
+	RK_input_record_stop();
+	RK_input_exit();
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *rec_out = NULL, *rec_dir = NULL, *node = NULL;
+	int seconds = 10, loops = 1, taps = 0, interval = 2000, opt, fd, failed = 0;
+	double speed = 1.0;
+	long long start;
+
+	while ((opt = getopt(argc, argv, "R:t:d:o:s:l:g:i:h")) != -1) {
+		switch (opt) {
+		case 'R': rec_out = optarg; break;
+		case 't': seconds = atoi(optarg); break;
+		case 'd': rec_dir = optarg; break;
+		case 'o': node = optarg; break;
+		case 's': speed = atof(optarg); break;
+		case 'l': loops = atoi(optarg); break;
+		case 'g': taps = atoi(optarg); break;
+		case 'i': interval = atoi(optarg); break;
+		default:
+			printf("usage: %s -R out [-t seconds] [-d dir] | [-o node] [-s speed] [-l loops] {-g taps [-i us] | file}\n",
+					argv[0]);
+			return 2;
+		}
+	}
+
+	if (rec_out)
+		return record(rec_out, rec_dir, seconds);
+
+	if (taps > 0)
+		generate(taps, interval > 0 ? interval : 2000);
+	else if (optind >= argc || load(argv[optind]) < 0)
+		return 2;
+	if (event_count == 0) {
+		printf("nothing to replay\n");
+		return 2;
+	}
+	if (speed <= 0)
+		speed = 1.0;
+	if (loops <= 0)
+		loops = 1;
+
+	if (node) {
+		fd = open(node, O_WRONLY);
+		if (fd < 0) {
+			printf("open %s failed: %s\n", node, strerror(errno));
+			return 1;
+		}
+		failed = replay(fd, speed, loops) < 0;
+		close(fd);
+		return failed;
+	}
+
+	sent_us = (long long *)calloc((size_t)event_count * loops, sizeof(long long));
+	sent_down_us = (long long *)calloc((size_t)event_count * loops, sizeof(long long));
+	raw_lat = (long long *)calloc((size_t)event_count * loops, sizeof(long long));
+	press_lat = (long long *)calloc((size_t)event_count * loops, sizeof(long long));
+
+	mkdir(REPLAY_DEV_DIR, 0755);
+	unlink(REPLAY_DEV_NODE);
+	if (mkfifo(REPLAY_DEV_NODE, 0600) < 0) {
+		printf("mkfifo %s failed: %s\n", REPLAY_DEV_NODE, strerror(errno));
+		return 1;
+	}
+	/* read-write, so the fifo has a writer from before the library opens it */
+	fd = open(REPLAY_DEV_NODE, O_RDWR);
+
+	RK_input_set_dev_path(REPLAY_DEV_DIR);
+	RK_input_register_press_callback(press_cb);
+	if (RK_input_init(raw_cb) != 0) {
+		printf("RK_input_init failed\n");
+		return 1;
+	}
+	usleep(100000);
+
+	start = now_us();
+	if (replay(fd, speed, loops) < 0)
+		failed++;
+	for (int i = 0; i < 1000 && (raw_count < key_count || press_count < down_count); i++)
+		usleep(1000);
+
+	printf("replayed %d events x%d at %.1fx in %lld ms\n", event_count, loops, speed, (now_us() - start) / 1000);
+	if (raw_count != key_count || press_count != down_count) {
+		printf("callbacks: %d of %d keys, %d of %d presses\n", raw_count, key_count, press_count, down_count);
+		failed++;
+	}
+	print_percentiles("stamp to callback", raw_lat, raw_count < key_count ? raw_count : key_count);
+	print_percentiles("stamp to press", press_lat, press_count < down_count ? press_count : down_count);
+
+	RK_input_exit();
+	close(fd);
+	unlink(REPLAY_DEV_NODE);
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
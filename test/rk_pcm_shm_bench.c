@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+
+#include "DeviceIo/Rk_socket_app.h"
+
+/*
+ * A player feeding the a2dp source, both ends through Rk_socket_app: once
+ * over the stream socket, once over the shared ring offered on it. The
+ * player writes 10 ms of 48 kHz stereo at a time, stamped with the time it
+ * was written; the reader wakes on the data like the pcm tx thread does
+ * and goes over every byte, in place when it can. Reports the cpu and the
+ * wakeups both ends spend per second of audio and how long a period takes
+ * from the write to the reader, then the same flat out, and checks that
+ * every byte arrived as written.
+ */
+
+#define RATE			48000
+#define FRAME			4
+#define PERIOD			(RATE / 100 * FRAME)
+#define STAGE			(32 * 1024)		// what the reader takes off the socket at once
+#define RING_SIZE		(64 * 1024)
+
+typedef struct {
+	int shm, paced;
+	unsigned long long bytes;			// to write
+	char path[108];
+	struct rk_socket_app app;
+
+	/* results */
+	unsigned long long wr_sum, rd_sum, rd_bytes;
+	double wr_cpu_ms, rd_cpu_ms;
+	long wr_csw, rd_csw;
+	double lat_sum_us, lat_max_us;
+	unsigned int lat_n;
+	double wall_s;
+	int error;
+} bench_run_t;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void thread_cost(double *cpu_ms, long *csw)
+{
+	struct timespec ts;
+	struct rusage ru;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	*cpu_ms = ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+	getrusage(RUSAGE_THREAD, &ru);
+	*csw = ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void *writer(void *arg)
+{
+	bench_run_t *run = (bench_run_t *)arg;
+	struct rk_shm_ring ring;
+	struct timespec next;
+	unsigned char buf[PERIOD];
+	unsigned long long off = 0, stamp;
+	int sockfd, n;
+
+	memset(&ring, 0, sizeof(ring));
+	if (run->shm)
+		sockfd = RK_socket_client_setup_ring(run->path, RING_SIZE, &ring);
+	else
+		sockfd = RK_socket_client_setup(run->path);
+	if (sockfd < 0 || run->shm != !!ring.data) {
+		run->error = 1;
+		return NULL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (off < run->bytes) {
+		if (run->paced) {
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+			next.tv_nsec += 10000000;
+			if (next.tv_nsec >= 1000000000) {
+				next.tv_nsec -= 1000000000;
+				next.tv_sec++;
+			}
+		}
+
+		for (int i = 0; i < PERIOD; i++)
+			buf[i] = (unsigned char)((off + i) * 7);
+		stamp = now_ns();
+		memcpy(buf, &stamp, sizeof(stamp));
+		for (int i = 0; i < PERIOD; i++)
+			run->wr_sum += buf[i];
+
+		if (ring.data)
+			n = RK_shm_ring_write(&ring, (char *)buf, PERIOD);
+		else
+			n = RK_socket_send(sockfd, (char *)buf, PERIOD);
+		if (n != PERIOD) {
+			run->error = 1;
+			break;
+		}
+		off += PERIOD;
+	}
+
+	thread_cost(&run->wr_cpu_ms, &run->wr_csw);
+	RK_shm_ring_teardown(&ring);
+	close(sockfd);
+	return NULL;
+}
+
+/* go over what came in, timing each period whose stamp it holds */
+static void consume(bench_run_t *run, const unsigned char *p, unsigned int len, unsigned char *stamp_buf)
+{
+	unsigned long long pos = run->rd_bytes, stamp, now = run->paced ? now_ns() : 0;
+	unsigned int i, at, n;
+	double us;
+
+	for (i = 0; i < len; i++)
+		run->rd_sum += p[i];
+
+	/* the stamp may come split over two reads */
+	for (i = 0; i < len; i += n) {
+		at = (pos + i) % PERIOD;
+		if (at >= sizeof(stamp)) {
+			n = PERIOD - at;
+			continue;
+		}
+		n = sizeof(stamp) - at < len - i ? sizeof(stamp) - at : len - i;
+		memcpy(stamp_buf + at, p + i, n);
+		if (at + n == sizeof(stamp) && run->paced) {
+			memcpy(&stamp, stamp_buf, sizeof(stamp));
+			us = (now - stamp) / 1e3;
+			run->lat_sum_us += us;
+			if (us > run->lat_max_us)
+				run->lat_max_us = us;
+			run->lat_n++;
+		}
+	}
+	run->rd_bytes += len;
+}
+
+static void read_socket(bench_run_t *run, int fd)
+{
+	static unsigned char stage[STAGE];
+	unsigned char stamp_buf[8];
+	fd_set rfds;
+	int n;
+
+	for (;;) {
+		FD_ZERO(&rfds);
+		FD_SET(fd, &rfds);
+		if (select(fd + 1, &rfds, NULL, NULL, NULL) < 0)
+			break;
+		n = RK_socket_recieve(fd, (char *)stage, sizeof(stage));
+		if (n <= 0)
+			break;
+		consume(run, stage, n, stamp_buf);
+	}
+}
+
+static void read_ring(bench_run_t *run, int fd, struct rk_shm_ring *ring)
+{
+	unsigned char stamp_buf[8];
+	uint32_t seen = 0, head, off, first;
+	fd_set rfds;
+	char byte;
+	int done = 0;
+
+	while (!done) {
+		head = RK_shm_ring_head(ring);
+		if (head == seen && !RK_shm_ring_wait_data(ring, seen)) {
+			FD_ZERO(&rfds);
+			FD_SET(ring->data_fd, &rfds);
+			FD_SET(fd, &rfds);
+			if (select((ring->data_fd > fd ? ring->data_fd : fd) + 1, &rfds, NULL, NULL, NULL) < 0)
+				break;
+			/* gone: take what it left, then stop */
+			if (FD_ISSET(fd, &rfds) && RK_socket_recieve(fd, &byte, 1) <= 0)
+				done = 1;
+			head = RK_shm_ring_head(ring);
+		}
+
+		if (head != seen) {
+			off = seen & (ring->size - 1);
+			first = head - seen < ring->size - off ? head - seen : ring->size - off;
+			consume(run, (unsigned char *)ring->data + off, first, stamp_buf);
+			consume(run, (unsigned char *)ring->data, head - seen - first, stamp_buf);
+			seen = head;
+			RK_shm_ring_release(ring, seen);
+		}
+	}
+}
+
+static void run_one(bench_run_t *run)
+{
+	struct rk_shm_ring ring;
+	pthread_t tid;
+	unsigned long long start;
+	double cpu_ms;
+	long csw;
+	int fd;
+
+	memset(&ring, 0, sizeof(ring));
+	snprintf(run->path, sizeof(run->path), "/tmp/rk_pcm_shm_bench.%d", (int)getpid());
+	memset(&run->app, 0, sizeof(run->app));
+	strcpy(run->app.sock_path, run->path);
+	if (RK_socket_server_setup(&run->app) < 0) {
+		run->error = 1;
+		return;
+	}
+
+	/* the reader is this thread, which has done other runs before */
+	thread_cost(&cpu_ms, &csw);
+	start = now_ns();
+	pthread_create(&tid, NULL, writer, run);
+	if (RK_socke_server_accpet(&run->app) == 0) {
+		fd = run->app.client_sockfd;
+		if (RK_socket_server_accept_ring(fd, &ring, 100) > 0)
+			read_ring(run, fd, &ring);
+		else
+			read_socket(run, fd);
+		RK_shm_ring_teardown(&ring);
+	}
+	thread_cost(&run->rd_cpu_ms, &run->rd_csw);
+	run->rd_cpu_ms -= cpu_ms;
+	run->rd_csw -= csw;
+	pthread_join(tid, NULL);
+	run->wall_s = (now_ns() - start) / 1e9;
+
+	RK_socket_server_teardown(&run->app);
+	if (run->rd_bytes != run->bytes || run->rd_sum != run->wr_sum)
+		run->error = 1;
+}
+
+static void print(const char *name, const bench_run_t *run)
+{
+	double audio_s = (double)run->bytes / (RATE * FRAME);
+
+	printf("  %-7s %s, cpu %7.1f + %7.1f us per audio second, wakeups %6.1f + %6.1f per audio second",
+			name, run->error ? "BROKEN" : "intact",
+			run->wr_cpu_ms * 1e3 / audio_s, run->rd_cpu_ms * 1e3 / audio_s,
+			run->wr_csw / audio_s, run->rd_csw / audio_s);
+	if (run->paced)
+		printf(", latency %6.1f us avg %7.1f us max\n",
+				run->lat_n ? run->lat_sum_us / run->lat_n : 0, run->lat_max_us);
+	else
+		printf(", %.0fx real time\n", audio_s / run->wall_s);
+}
+
+int main(int argc, char **argv)
+{
+	bench_run_t runs[2];
+	int seconds = 10, flat_s = 600, opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "t:f:h")) != -1) {
+		switch (opt) {
+		case 't': seconds = atoi(optarg); break;
+		case 'f': flat_s = atoi(optarg); break;
+		default:
+			printf("usage: %s [-t seconds played in real time (10)] [-f seconds of audio flat out (600)]\n",
+					argv[0]);
+			return 2;
+		}
+	}
+
+	for (int paced = 1; paced >= 0; paced--) {
+		printf("%s\n", paced ? "10 ms periods in real time" : "flat out");
+		for (int shm = 0; shm < 2; shm++) {
+			memset(&runs[shm], 0, sizeof(runs[shm]));
+			runs[shm].shm = shm;
+			runs[shm].paced = paced;
+			runs[shm].bytes = (unsigned long long)(paced ? seconds : flat_s) * RATE * FRAME / PERIOD * PERIOD;
+			run_one(&runs[shm]);
+			print(shm ? "ring" : "socket", &runs[shm]);
+			failed += runs[shm].error;
+		}
+	}
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "DeviceIo/Rk_socket_app.h"
+
+/*
+ * Messages of 64 B to 64 KB through the framed socket api: a server on its
+ * epoll loop in this thread, clients in their own. For each size, what one
+ * client gets through sending each message on its own and in batches, then
+ * four clients at once, with the old stream socket next to it for scale and
+ * how many of its reads didn't come back as one whole message; then the
+ * round trip of a message the server echoes. Every message is checked whole
+ * and in order per client, and an fd passed along has to reach the server.
+ */
+
+#define CLIENTS			4
+#define HDR				8			// client id, sequence
+
+enum {
+	MODE_STREAM,
+	MODE_SINGLE,
+	MODE_BATCH,
+	MODE_ECHO,
+};
+
+typedef struct {
+	int id, mode, size;
+	unsigned int count;
+	const char *path;
+
+	/* results */
+	double *rtt_us;					// MODE_ECHO, one per round trip
+	int error;
+} bench_client_t;
+
+typedef struct {
+	int mode, size;
+	unsigned int next_seq[CLIENTS];
+	unsigned long long msgs;
+	int gone;
+	int error;
+} bench_server_t;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fill(char *p, int size, uint32_t id, uint32_t seq)
+{
+	memcpy(p, &id, 4);
+	memcpy(p + 4, &seq, 4);
+	for (int i = HDR; i < size; i++)
+		p[i] = (char)(seq * 31 + i);
+}
+
+static int check(const char *p, int len, int size, uint32_t *id, uint32_t seq)
+{
+	uint32_t got;
+
+	if (len != size)
+		return -1;
+	memcpy(id, p, 4);
+	memcpy(&got, p + 4, 4);
+	if (*id >= CLIENTS || got != seq)
+		return -1;
+	for (int i = HDR; i < size; i++) {
+		if (p[i] != (char)(seq * 31 + i))
+			return -1;
+	}
+	return 0;
+}
+
+static void send_all(bench_client_t *c, int sockfd)
+{
+	struct rk_socket_packet pkts[RK_SOCKET_PACKET_BATCH];
+	char *buf = (char *)malloc((size_t)c->size * RK_SOCKET_PACKET_BATCH);
+	unsigned int seq = 0;
+	int n;
+
+	for (int i = 0; i < RK_SOCKET_PACKET_BATCH; i++) {
+		pkts[i].data = buf + i * c->size;
+		pkts[i].len = c->size;
+		pkts[i].fd = -1;
+	}
+
+	while (seq < c->count) {
+		if (c->mode == MODE_BATCH) {
+			n = c->count - seq < RK_SOCKET_PACKET_BATCH ? c->count - seq : RK_SOCKET_PACKET_BATCH;
+			for (int i = 0; i < n; i++)
+				fill(pkts[i].data, c->size, c->id, seq + i);
+			if (RK_socket_packet_send_batch(sockfd, pkts, n) != n)
+				break;
+		} else {
+			n = 1;
+			fill(buf, c->size, c->id, seq);
+			if (c->mode == MODE_STREAM) {
+				if (RK_socket_send(sockfd, buf, c->size) != c->size)
+					break;
+			} else if (RK_socket_packet_send(sockfd, buf, c->size, -1) != c->size) {
+				break;
+			}
+		}
+		seq += n;
+	}
+
+	if (seq != c->count)
+		c->error = 1;
+	free(buf);
+}
+
+static void echo_all(bench_client_t *c, int sockfd)
+{
+	char *out = (char *)malloc(c->size), *in = (char *)malloc(c->size);
+	unsigned long long t;
+	uint32_t id;
+	int pipefd[2], fd = -1;
+	char byte = 0;
+
+	/* the first one carries a pipe the server writes a byte into */
+	if (pipe(pipefd) < 0) {
+		c->error = 1;
+		return;
+	}
+
+	for (unsigned int seq = 0; seq < c->count; seq++) {
+		fill(out, c->size, c->id, seq);
+		t = now_ns();
+		if (RK_socket_packet_send(sockfd, out, c->size, seq ? -1 : pipefd[1]) != c->size ||
+			RK_socket_packet_recv(sockfd, in, c->size, &fd) != c->size ||
+			check(in, c->size, c->size, &id, seq) < 0 || fd >= 0) {
+			c->error = 1;
+			break;
+		}
+		c->rtt_us[seq] = (now_ns() - t) / 1e3;
+		if (!seq) {
+			close(pipefd[1]);
+			if (read(pipefd[0], &byte, 1) != 1 || byte != 'x')
+				c->error = 1;
+		}
+	}
+
+	close(pipefd[0]);
+	free(out);
+	free(in);
+}
+
+static void *client(void *arg)
+{
+	bench_client_t *c = (bench_client_t *)arg;
+	int sockfd;
+
+	if (c->mode == MODE_STREAM)
+		sockfd = RK_socket_client_setup((char *)c->path);
+	else
+		sockfd = RK_socket_packet_client_setup(c->path);
+	if (sockfd < 0) {
+		c->error = 1;
+		return NULL;
+	}
+
+	if (c->mode == MODE_ECHO)
+		echo_all(c, sockfd);
+	else
+		send_all(c, sockfd);
+	close(sockfd);
+	return NULL;
+}
+
+static void server_cb(struct rk_socket_packet_server *server, int client_fd,
+		RK_SOCKET_PACKET_EVENT event, struct rk_socket_packet *packet, void *userdata)
+{
+	bench_server_t *s = (bench_server_t *)userdata;
+	uint32_t id, seq;
+
+	if (event == RK_SOCKET_PACKET_DISCONNECTED)
+		s->gone++;
+	if (event != RK_SOCKET_PACKET_MESSAGE)
+		return;
+
+	memcpy(&id, packet->data, 4);
+	seq = id < CLIENTS ? s->next_seq[id]++ : 0;
+	if (check(packet->data, packet->len, s->size, &id, seq) < 0)
+		s->error = 1;
+	s->msgs++;
+
+	if (packet->fd >= 0) {
+		if (s->mode != MODE_ECHO || write(packet->fd, "x", 1) != 1)
+			s->error = 1;
+		close(packet->fd);
+	}
+	if (s->mode == MODE_ECHO &&
+		RK_socket_packet_send(client_fd, packet->data, packet->len, -1) != packet->len)
+		s->error = 1;
+}
+
+/* the stream socket: whatever each read brings, checked as one long run of messages */
+static void stream_serve(struct rk_socket_app *app, int size, unsigned int count, unsigned long long *odd_reads,
+		int *error)
+{
+	char *buf = (char *)malloc(size), *msg = (char *)malloc(size);
+	unsigned long long off = 0, total = (unsigned long long)size * count;
+	unsigned int at = 0;
+	uint32_t id;
+	int n;
+
+	if (RK_socke_server_accpet(app) < 0) {
+		*error = 1;
+		goto out;
+	}
+
+	while (off < total) {
+		n = RK_socket_recieve(app->client_sockfd, buf, size);
+		if (n <= 0)
+			break;
+		if (n != size)
+			(*odd_reads)++;
+		for (int i = 0; i < n; i++) {
+			msg[at++] = buf[i];
+			if (at == (unsigned int)size) {
+				if (check(msg, size, size, &id, off / size) < 0)
+					*error = 1;
+				at = 0;
+				off += size;
+			}
+		}
+	}
+	if (off != total)
+		*error = 1;
+
+out:
+	free(buf);
+	free(msg);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* MB/s, or the round trips into rtt */
+static double run(int mode, int clients, int size, unsigned int count, double *rtt, unsigned long long *odd_reads,
+		int *failed)
+{
+	struct rk_socket_packet_server server;
+	struct rk_socket_app app;
+	bench_server_t s;
+	bench_client_t *c[CLIENTS];
+	pthread_t tid[CLIENTS];
+	char path[108];
+	unsigned long long start, ns;
+	int error = 0;
+
+	snprintf(path, sizeof(path), "/tmp/rk_socket_packet_bench.%d", (int)getpid());
+	memset(&s, 0, sizeof(s));
+	s.mode = mode;
+	s.size = size;
+
+	if (mode == MODE_STREAM) {
+		memset(&app, 0, sizeof(app));
+		strcpy(app.sock_path, path);
+		if (RK_socket_server_setup(&app) < 0) {
+			(*failed)++;
+			return 0;
+		}
+	} else if (RK_socket_packet_server_setup(&server, path, server_cb, &s) < 0) {
+		(*failed)++;
+		return 0;
+	}
+
+	start = now_ns();
+	for (int i = 0; i < clients; i++) {
+		c[i] = (bench_client_t *)calloc(1, sizeof(bench_client_t));
+		c[i]->id = i;
+		c[i]->mode = mode;
+		c[i]->size = size;
+		c[i]->count = count;
+		c[i]->path = path;
+		c[i]->rtt_us = rtt;
+		pthread_create(&tid[i], NULL, client, c[i]);
+	}
+
+	if (mode == MODE_STREAM) {
+		stream_serve(&app, size, count, odd_reads, &error);
+	} else {
+		while (s.gone < clients && RK_socket_packet_server_poll(&server, 1000) >= 0)
+			;
+	}
+	ns = now_ns() - start;
+
+	for (int i = 0; i < clients; i++) {
+		pthread_join(tid[i], NULL);
+		error |= c[i]->error;
+		free(c[i]);
+	}
+
+	if (mode == MODE_STREAM) {
+		RK_socket_server_teardown(&app);
+	} else {
+		RK_socket_packet_server_teardown(&server);
+		if (s.error || s.msgs != (unsigned long long)clients * count)
+			error = 1;
+	}
+
+	*failed += error;
+	return (double)size * count * clients / (ns / 1e9) / (1024 * 1024);
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 64, 256, 1024, 4096, 16384, 65536 };
+	unsigned long long odd_reads;
+	unsigned int count, rounds = 2000, mb = 32;
+	double stream, single, batch, multi, *rtt;
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "m:r:h")) != -1) {
+		switch (opt) {
+		case 'm': mb = atoi(optarg); break;
+		case 'r': rounds = atoi(optarg); break;
+		default:
+			printf("usage: %s [-m MB per client and run (32)] [-r round trips per size (2000)]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (!rounds)
+		rounds = 1;
+	rtt = (double *)malloc(sizeof(double) * rounds);
+
+	printf("%6s  %-22s %10s %10s %10s  %s\n", "size", "stream MB/s, uneven", "MB/s", "batched",
+			"4 clients", "round trip avg / p99");
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		int size = sizes[i];
+
+		count = (unsigned long long)mb * 1024 * 1024 / size;
+		if (count < 1000)
+			count = 1000;
+
+		odd_reads = 0;
+		stream = run(MODE_STREAM, 1, size, count, NULL, &odd_reads, &failed);
+		single = run(MODE_SINGLE, 1, size, count, NULL, NULL, &failed);
+		batch = run(MODE_BATCH, 1, size, count, NULL, NULL, &failed);
+		multi = run(MODE_BATCH, CLIENTS, size, count, NULL, NULL, &failed);
+		run(MODE_ECHO, 1, size, rounds, rtt, NULL, &failed);
+		qsort(rtt, rounds, sizeof(double), cmp_double);
+
+		double avg = 0;
+		for (unsigned int r = 0; r < rounds; r++)
+			avg += rtt[r];
+		printf("%6d  %9.1f %5.1f%% reads %10.1f %10.1f %10.1f  %7.1f / %7.1f us\n", size, stream,
+				odd_reads * 100.0 / count, single, batch, multi, avg / rounds, rtt[rounds * 99 / 100]);
+	}
+
+	free(rtt);
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "DeviceIo/Rk_wifi.h"
+#include "wpa_ctrl_mock.h"
+
+/*
+ * Scan, connect and status through the public RK_wifi_* API against a
+ * mock wpa_supplicant, so the numbers are the library's own cost plus
+ * whatever delays the mock is told to add. Runs on a host without wifi.
+ */
+
+#define BENCH_CTRL_DIR	"/tmp/rk_wifi_bench"
+#define BENCH_CTRL_PATH	BENCH_CTRL_DIR "/wlan0"
+
+#define EV_SCAN_RESULTS	"<3>CTRL-EVENT-SCAN-RESULTS "
+#define EV_CONNECTED	"<3>CTRL-EVENT-CONNECTED - Connection to 00:11:22:33:44:55 completed [id=0 id_str=]"
+#define EV_DISCONNECTED	"<3>CTRL-EVENT-DISCONNECTED bssid=00:11:22:33:44:55 reason=3 locally_generated=1"
+
+static wpa_ctrl_mock_t *mock;
+static int failed;
+
+/* when each state was last reported */
+static volatile long long cb_us[RK_WIFI_State_DHCP_OK + 1];
+
+static int bench_callback(RK_WIFI_RUNNING_State_e state, RK_WIFI_INFO_Connection_s *info)
+{
+	if (state >= 0 && state <= RK_WIFI_State_DHCP_OK)
+		cb_us[state] = wpa_ctrl_mock_now_us();
+
+	return 0;
+}
+
+/* us from since until state was reported, -1 if it wasn't within timeout_ms */
+static long long wait_state(RK_WIFI_RUNNING_State_e state, long long since, int timeout_ms)
+{
+	for (int i = 0; i < timeout_ms; i++) {
+		if (cb_us[state] >= since)
+			return cb_us[state] - since;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+static void print_result(const char *name, long long *costs, int count)
+{
+	long long min = -1, max = 0, total = 0;
+	int valid = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (costs[i] < 0)
+			continue;
+		if (min < 0 || costs[i] < min)
+			min = costs[i];
+		if (costs[i] > max)
+			max = costs[i];
+		total += costs[i];
+		valid++;
+	}
+
+	if (valid < count) {
+		printf("%-24s %d of %d timed out\n", name, count - valid, count);
+		failed++;
+	}
+	if (valid)
+		printf("%-24s min %7lld us, avg %7lld us, max %7lld us\n", name, min, total / valid, max);
+}
+
+static void bench_scan(long long *costs, int count)
+{
+	long long start, *results;
+	char *scan_r;
+
+	/* the results event makes the library fetch and index them */
+	results = (long long *)malloc(count * sizeof(long long));
+	for (int i = 0; i < count; i++) {
+		start = wpa_ctrl_mock_now_us();
+		costs[i] = RK_wifi_scan() == 0 ? wpa_ctrl_mock_now_us() - start : -1;
+		results[i] = wait_state(RK_WIFI_State_SCAN_RESULTS, start, 5000);
+	}
+	print_result("scan (request)", costs, count);
+	print_result("scan to SCAN_RESULTS", results, count);
+	free(results);
+
+	for (int i = 0; i < count; i++) {
+		start = wpa_ctrl_mock_now_us();
+		scan_r = RK_wifi_scan_r();
+		costs[i] = scan_r ? wpa_ctrl_mock_now_us() - start : -1;
+		free(scan_r);
+	}
+	print_result("scan_r", costs, count);
+}
+
+static void bench_connect(long long *costs, int count)
+{
+	long long start, *connected, *dhcp_ok, *disconnected;
+
+	connected = (long long *)malloc(count * sizeof(long long));
+	dhcp_ok = (long long *)malloc(count * sizeof(long long));
+	disconnected = (long long *)malloc(count * sizeof(long long));
+
+	for (int i = 0; i < count; i++) {
+		start = wpa_ctrl_mock_now_us();
+		costs[i] = RK_wifi_connect("mock", "12345678") == 0 ? wpa_ctrl_mock_now_us() - start : -1;
+		connected[i] = wait_state(RK_WIFI_State_CONNECTED, start, 5000);
+		dhcp_ok[i] = wait_state(RK_WIFI_State_DHCP_OK, start, 5000);
+
+		start = wpa_ctrl_mock_now_us();
+		wpa_ctrl_mock_event(mock, EV_DISCONNECTED, 0);
+		disconnected[i] = wait_state(RK_WIFI_State_DISCONNECTED, start, 5000);
+	}
+	print_result("connect (requests)", costs, count);
+	print_result("connect to CONNECTED", connected, count);
+	print_result("connect to DHCP_OK", dhcp_ok, count);
+	print_result("DISCONNECTED callback", disconnected, count);
+
+	free(connected);
+	free(dhcp_ok);
+	free(disconnected);
+}
+
+static void bench_status(long long *costs, int count)
+{
+	RK_WIFI_RUNNING_State_e state;
+	RK_WIFI_INFO_Connection_s info;
+	RK_WIFI_SAVED_INFO saved;
+	long long start;
+
+	for (int i = 0; i < count; i++) {
+		start = wpa_ctrl_mock_now_us();
+		costs[i] = RK_wifi_running_getState(&state) == 0 ? wpa_ctrl_mock_now_us() - start : -1;
+	}
+	print_result("running_getState", costs, count);
+
+	for (int i = 0; i < count; i++) {
+		start = wpa_ctrl_mock_now_us();
+		costs[i] = RK_wifi_running_getConnectionInfo(&info) == 0 ? wpa_ctrl_mock_now_us() - start : -1;
+	}
+	print_result("getConnectionInfo", costs, count);
+
+	for (int i = 0; i < count; i++) {
+		start = wpa_ctrl_mock_now_us();
+		costs[i] = RK_wifi_getSavedInfo(&saved) == 0 ? wpa_ctrl_mock_now_us() - start : -1;
+	}
+	print_result("getSavedInfo", costs, count);
+}
+
+static void usage(const char *name)
+{
+	printf("usage: %s [-n count] [-a aps] [-l latency_ms] [-s scan_ms] [-c connect_ms] [-f script]\n"
+		   "  -n  rounds of each measurement (20)\n"
+		   "  -a  APs in the scan results (50)\n"
+		   "  -l  delay on every control reply (0)\n"
+		   "  -s  SCAN to CTRL-EVENT-SCAN-RESULTS (0)\n"
+		   "  -c  SELECT_NETWORK to CTRL-EVENT-CONNECTED (0)\n"
+		   "  -f  mock rules loaded last, see wpa_ctrl_mock.h\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	int count = 20, aps = 50, latency = 0, scan_ms = 0, connect_ms = 0, opt;
+	const char *script = NULL;
+	long long *costs;
+
+	while ((opt = getopt(argc, argv, "n:a:l:s:c:f:h")) != -1) {
+		switch (opt) {
+		case 'n': count = atoi(optarg); break;
+		case 'a': aps = atoi(optarg); break;
+		case 'l': latency = atoi(optarg); break;
+		case 's': scan_ms = atoi(optarg); break;
+		case 'c': connect_ms = atoi(optarg); break;
+		case 'f': script = optarg; break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (count <= 0)
+		count = 20;
+
+	mkdir(BENCH_CTRL_DIR, 0755);
+	mock = wpa_ctrl_mock_start(BENCH_CTRL_PATH);
+	if (!mock) {
+		printf("start mock wpa_supplicant at %s failed\n", BENCH_CTRL_PATH);
+		return 1;
+	}
+	wpa_ctrl_mock_set_latency(mock, latency);
+	wpa_ctrl_mock_scan_aps(mock, aps);
+	wpa_ctrl_mock_trigger(mock, "SCAN", EV_SCAN_RESULTS, scan_ms);
+	wpa_ctrl_mock_trigger(mock, "SELECT_NETWORK", EV_CONNECTED, connect_ms);
+	if (script && wpa_ctrl_mock_load(mock, script) < 0) {
+		printf("load %s failed\n", script);
+		wpa_ctrl_mock_stop(mock);
+		return 1;
+	}
+
+	RK_wifi_register_callback(bench_callback);
+	RK_wifi_set_ctrl_path(BENCH_CTRL_PATH);
+	if (wpa_ctrl_mock_wait_attached(mock, 1000) < 0) {
+		printf("the event monitor did not attach\n");
+		failed++;
+		goto out;
+	}
+
+	printf("%d rounds, %d APs, %d ms reply latency, %d ms scan, %d ms connect\n",
+			count, aps, latency, scan_ms, connect_ms);
+	costs = (long long *)malloc(count * sizeof(long long));
+	bench_scan(costs, count);
+	bench_connect(costs, count);
+	bench_status(costs, count);
+	free(costs);
+
+out:
+	RK_wifi_set_ctrl_path(NULL);
+	RK_wifi_register_callback(NULL);
+	wpa_ctrl_mock_stop(mock);
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed ? 1 : 0;
+}
@@ -1,13 +1,19 @@
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <pthread.h>
 #include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/un.h>
 
 #include "DeviceIo/Rk_wifi.h"
 #include "DeviceIo/Rk_softap.h"
+#include "wpa_ctrl_mock.h"
 
 struct wifi_info {
 	int ssid_len;
@@ -192,12 +198,29 @@ void rk_wifi_softap_stop(void *data)
 	RK_softap_stop();
 }
 
+void rk_wifi_bringup_time(void *data)
+{
+	RK_WIFI_BRINGUP_TIME_s time;
+	int i;
+
+	if (RK_wifi_get_bringup_time(&time) < 0) {
+		printf("bringup: wifi not enabled yet\n");
+		return;
+	}
+
+	for (i = 0; i < time.count; i++)
+		printf("%-16s +%4d ms %5d ms %s\n", time.steps[i].name, time.steps[i].start_ms,
+				time.steps[i].time_ms, time.steps[i].result ? strerror(-time.steps[i].result) : "ok");
+	printf("bringup: %d ms\n", time.total_ms);
+}
+
 void rk_wifi_open(void *data)
 {
 	RK_wifi_register_callback(rk_wifi_state_callback);
 
 	if (RK_wifi_enable(1) < 0)
 		printf("RK_wifi_enable 1 fail!\n");
+	rk_wifi_bringup_time(NULL);
 }
 
 void rk_wifi_close(void *data)
@@ -314,3 +337,606 @@ void rk_wifi_disconnect(void *data)
 {
 	RK_wifi_disconnect_network();
 }
+
+/*****************************************************************
+ *                     wifi scan latency test                    *
+ *****************************************************************/
+static long long now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#define MOCK_CTRL_DIR	"/tmp/rk_wifi_mock"
+#define MOCK_CTRL_PATH	MOCK_CTRL_DIR "/wlan0"
+
+static wpa_ctrl_mock_t *mock_ctrl;
+
+static int mock_ctrl_start(void)
+{
+	if (mock_ctrl)
+		return 0;
+
+	mkdir(MOCK_CTRL_DIR, 0755);
+	mock_ctrl = wpa_ctrl_mock_start(MOCK_CTRL_PATH);
+
+	return mock_ctrl ? 0 : -1;
+}
+
+static void print_latency(const char *name, long long *costs, int count)
+{
+	long long min = -1, max = 0, total = 0;
+
+	for (int i = 0; i < count; i++) {
+		if (min < 0 || costs[i] < min)
+			min = costs[i];
+		if (costs[i] > max)
+			max = costs[i];
+		total += costs[i];
+	}
+
+	printf("%-24s min %6lld us, avg %6lld us, max %6lld us\n", name, min, total / count, max);
+}
+
+#define MOCK_EV_SCAN_RESULTS	"<3>CTRL-EVENT-SCAN-RESULTS "
+
+/* the cache pulled the results from the mock within a second */
+static int mock_wait_scan_results(void)
+{
+	for (int i = 0; i < 1000; i++) {
+		if (wpa_ctrl_mock_last(mock_ctrl, "SCAN_RESULTS", NULL, 0, NULL) == 0)
+			return 0;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+//input count; 50 APs from the mock control socket, the first request is the cold (uncached) one
+void rk_wifi_scan_latency(void *data)
+{
+	static int scan_rules = 0;
+	int count = 10, failed = 0;
+	long long start, cold, *costs;
+	char *scan_r;
+
+	if (data)
+		count = atoi(data);
+	if (count <= 0)
+		count = 10;
+
+	if (mock_ctrl_start() < 0) {
+		printf("%s: start mock ctrl socket failed\n", __func__);
+		return;
+	}
+	/* a scan reports back at once, like a supplicant with nothing on the air */
+	if (!scan_rules++)
+		wpa_ctrl_mock_trigger(mock_ctrl, "SCAN", MOCK_EV_SCAN_RESULTS, 0);
+	wpa_ctrl_mock_scan_aps(mock_ctrl, 50);
+	RK_wifi_register_callback(NULL);
+	wpa_ctrl_mock_detach(mock_ctrl);
+	/* switching the socket drops whatever was cached */
+	RK_wifi_set_ctrl_path(MOCK_CTRL_PATH);
+	if (wpa_ctrl_mock_wait_attached(mock_ctrl, 1000) < 0) {
+		printf("%s: monitor did not attach to the mock\n", __func__);
+		goto out;
+	}
+
+	wpa_ctrl_mock_clear_history(mock_ctrl);
+	start = now_us();
+	scan_r = RK_wifi_scan_r();
+	cold = now_us() - start;
+	printf("%-24s %lld us, %d bytes\n", "scan_r cold", cold, scan_r ? (int)strlen(scan_r) : 0);
+	if (!scan_r || !strstr(scan_r, "ap_001")) {
+		printf("FAIL: cold scan_r without the mock's APs\n");
+		failed++;
+	}
+	free(scan_r);
+
+	/* the results event of that scan may still be on its way */
+	usleep(100000);
+	wpa_ctrl_mock_clear_history(mock_ctrl);
+	costs = (long long *)malloc(count * sizeof(long long));
+	for (int i = 0; i < count; i++) {
+		start = now_us();
+		scan_r = RK_wifi_scan_r();
+		costs[i] = now_us() - start;
+		free(scan_r);
+	}
+	print_latency("scan_r cached", costs, count);
+	free(costs);
+	if (wpa_ctrl_mock_last(mock_ctrl, "SCAN", NULL, 0, NULL) == 0 ||
+			wpa_ctrl_mock_last(mock_ctrl, "SCAN_RESULTS", NULL, 0, NULL) == 0) {
+		printf("FAIL: cached scan_r went to the supplicant\n");
+		failed++;
+	}
+
+	/* new results are pulled in on the event, not on the next request */
+	wpa_ctrl_mock_clear_history(mock_ctrl);
+	start = now_us();
+	wpa_ctrl_mock_event(mock_ctrl, MOCK_EV_SCAN_RESULTS, 0);
+	if (mock_wait_scan_results() < 0) {
+		printf("FAIL: SCAN-RESULTS event didn't refresh the cache\n");
+		failed++;
+	} else {
+		printf("%-24s %lld us\n", "event to refresh", now_us() - start);
+	}
+
+	printf("%s: %s (%d failures)\n", __func__, failed ? "FAIL" : "PASS", failed);
+
+out:
+	wpa_ctrl_mock_scan_aps(mock_ctrl, 0);
+	RK_wifi_set_ctrl_path(NULL);
+	RK_wifi_register_callback(rk_wifi_state_callback);
+}
+
+/*****************************************************************
+ *              wpa control channel latency test                 *
+ *****************************************************************/
+//input count; talks to a mock control socket, not the real wpa_supplicant
+void rk_wifi_ctrl_latency(void *data)
+{
+	int count = 100;
+	long long start, *costs;
+	RK_WIFI_RUNNING_State_e state;
+	RK_WIFI_INFO_Connection_s info;
+	RK_WIFI_SAVED_INFO saved;
+	char line[1024];
+	FILE *fp;
+
+	if (data)
+		count = atoi(data);
+	if (count <= 0)
+		count = 100;
+
+	if (mock_ctrl_start() < 0) {
+		printf("%s: start mock ctrl socket failed\n", __func__);
+		return;
+	}
+	costs = (long long *)malloc(count * sizeof(long long));
+	/* the usual callback pings on CONNECTED, which the mock can't answer */
+	RK_wifi_register_callback(NULL);
+	wpa_ctrl_mock_detach(mock_ctrl);
+	RK_wifi_set_ctrl_path(MOCK_CTRL_PATH);
+	wpa_ctrl_mock_wait_attached(mock_ctrl, 1000);
+
+	for (int i = 0; i < count; i++) {
+		start = now_us();
+		RK_wifi_running_getState(&state);
+		costs[i] = now_us() - start;
+	}
+	print_latency("running_getState", costs, count);
+
+	for (int i = 0; i < count; i++) {
+		start = now_us();
+		RK_wifi_running_getConnectionInfo(&info);
+		costs[i] = now_us() - start;
+	}
+	print_latency("getConnectionInfo", costs, count);
+
+	for (int i = 0; i < count; i++) {
+		start = now_us();
+		RK_wifi_getSavedInfo(&saved);
+		costs[i] = now_us() - start;
+	}
+	print_latency("getSavedInfo", costs, count);
+
+	/* the old path: one wpa_cli fork/exec per request */
+	for (int i = 0; i < count && i < 20; i++) {
+		start = now_us();
+		fp = popen("wpa_cli -p " MOCK_CTRL_DIR " -i wlan0 status", "r");
+		if (!fp)
+			break;
+		while (fgets(line, sizeof(line), fp))
+			;
+		pclose(fp);
+		costs[i] = now_us() - start;
+	}
+	print_latency("popen wpa_cli status", costs, count < 20 ? count : 20);
+
+	/* add/set/select/enable, up to where the supplicant's events take over */
+	start = now_us();
+	RK_wifi_connect("mock", "12345678");
+	printf("%-24s %lld us\n", "connect (requests)", now_us() - start);
+
+	/* let the request finish on the mock rather than fail when we detach */
+	wpa_ctrl_mock_event(mock_ctrl, "<3>CTRL-EVENT-CONNECTED - Connection to 00:11:22:33:44:55 completed [id=0 id_str=]", 0);
+	usleep(200000);
+	RK_wifi_set_ctrl_path(NULL);
+	RK_wifi_register_callback(rk_wifi_state_callback);
+	free(costs);
+}
+
+//input loop count per size; scan_results served by the mock control socket
+void rk_wifi_scan_json_bench(void *data)
+{
+	static const int aps[] = {50, 200, 500};
+	int count = 100;
+	long long start, *costs;
+	char *scan_r;
+
+	if (data)
+		count = atoi(data);
+	if (count <= 0)
+		count = 100;
+
+	if (mock_ctrl_start() < 0) {
+		printf("%s: start mock ctrl socket failed\n", __func__);
+		return;
+	}
+	costs = (long long *)malloc(count * sizeof(long long));
+
+	for (int n = 0; n < (int)(sizeof(aps) / sizeof(aps[0])); n++) {
+		char name[32];
+
+		wpa_ctrl_mock_scan_aps(mock_ctrl, aps[n]);
+		/* switching the socket drops the cached results, the first call refetches */
+		RK_wifi_set_ctrl_path(MOCK_CTRL_PATH);
+		scan_r = RK_wifi_scan_r();
+		printf("%d APs: %d bytes of json\n", aps[n], scan_r ? (int)strlen(scan_r) : 0);
+		free(scan_r);
+
+		/* cached from here on, so this is the parse and json cost */
+		for (int i = 0; i < count; i++) {
+			start = now_us();
+			scan_r = RK_wifi_scan_r();
+			costs[i] = now_us() - start;
+			free(scan_r);
+		}
+		snprintf(name, sizeof(name), "scan_r %d APs", aps[n]);
+		print_latency(name, costs, count);
+	}
+
+	wpa_ctrl_mock_scan_aps(mock_ctrl, 0);
+	RK_wifi_set_ctrl_path(NULL);
+	free(costs);
+}
+
+//talks to the mock control socket: connect once, then fast reconnect to it
+void rk_wifi_fast_reconnect_test(void *data)
+{
+	RK_WIFI_CONNECT_TIME_s ct;
+	long long start, scan_us = -1;
+	char scan[128] = "";
+	int ret, failed = 0;
+
+	if (mock_ctrl_start() < 0) {
+		printf("%s: start mock ctrl socket failed\n", __func__);
+		return;
+	}
+	RK_wifi_register_callback(NULL);
+	wpa_ctrl_mock_detach(mock_ctrl);
+	RK_wifi_set_ctrl_path(MOCK_CTRL_PATH);
+	if (wpa_ctrl_mock_wait_attached(mock_ctrl, 1000) < 0) {
+		printf("%s: monitor did not attach to the mock\n", __func__);
+		goto out;
+	}
+
+	/* the first association is what gets remembered */
+	RK_wifi_connect("mock", "12345678");
+	wpa_ctrl_mock_event(mock_ctrl, "<3>CTRL-EVENT-CONNECTED - Connection to 00:11:22:33:44:55 completed [id=0 id_str=]", 0);
+	usleep(200000);
+	if (RK_wifi_get_connect_time(&ct) == 0)
+		printf("connect: %d ms, fast: %d\n", ct.time_ms, ct.fast);
+	else
+		printf("connect: no association recorded\n");
+
+	wpa_ctrl_mock_clear_history(mock_ctrl);
+	start = now_us();
+	ret = RK_wifi_fast_reconnect();
+	if (wpa_ctrl_mock_last(mock_ctrl, "SCAN ", scan, sizeof(scan), &scan_us) == 0)
+		scan_us -= start;
+	printf("fast reconnect: ret %d, targeted scan after %lld us: \"%s\"\n", ret, scan_us, scan);
+	if (!strstr(scan, "freq=2412") || !strstr(scan, "bssid=00:11:22:33:44:55")) {
+		printf("FAIL: expected a scan of 2412 MHz for 00:11:22:33:44:55\n");
+		failed++;
+	}
+	wpa_ctrl_mock_event(mock_ctrl, "<3>CTRL-EVENT-CONNECTED - Connection to 00:11:22:33:44:55 completed [id=0 id_str=]", 0);
+	usleep(200000);
+
+	/* the supplicant scanning on its own: leave it be, don't abort it */
+	wpa_ctrl_mock_reply(mock_ctrl, "SCAN ", "FAIL-BUSY\n", 0);
+	wpa_ctrl_mock_clear_history(mock_ctrl);
+	ret = RK_wifi_fast_reconnect();
+	if (ret != -1 || wpa_ctrl_mock_last(mock_ctrl, "ABORT_SCAN", NULL, 0, NULL) == 0) {
+		printf("FAIL: busy supplicant, ret %d, its scan %s\n", ret,
+				ret == -1 ? "aborted" : "not left alone");
+		failed++;
+	}
+	wpa_ctrl_mock_reply(mock_ctrl, "SCAN ", "OK\n", 0);
+	wpa_ctrl_mock_event(mock_ctrl, "<3>CTRL-EVENT-CONNECTED - Connection to 00:11:22:33:44:55 completed [id=0 id_str=]", 0);
+	usleep(200000);
+
+	/*
+	 * Another network: DISABLE_NETWORK all drops the old link and its
+	 * DISCONNECTED must not send us back there, nor restart the clock.
+	 */
+	wpa_ctrl_mock_clear_history(mock_ctrl);
+	RK_wifi_connect("other", "12345678");
+	wpa_ctrl_mock_event(mock_ctrl, "<3>CTRL-EVENT-DISCONNECTED bssid=00:11:22:33:44:55 reason=3 locally_generated=1", 0);
+	usleep(300000);
+	scan[0] = '\0';
+	wpa_ctrl_mock_last(mock_ctrl, "SCAN ", scan, sizeof(scan), NULL);
+	if (strstr(scan, "bssid=00:11:22:33:44:55") ||
+			wpa_ctrl_mock_last(mock_ctrl, "ABORT_SCAN", NULL, 0, NULL) == 0) {
+		printf("FAIL: connecting elsewhere went back to the old AP: \"%s\"\n", scan);
+		failed++;
+	}
+	wpa_ctrl_mock_event(mock_ctrl, "<3>CTRL-EVENT-CONNECTED - Connection to 00:11:22:33:44:66 completed [id=1 id_str=]", 0);
+	usleep(200000);
+	if (RK_wifi_get_connect_time(&ct) < 0 || ct.fast || ct.time_ms < 300) {
+		printf("FAIL: switch timed from the disconnect, not the connect\n");
+		failed++;
+	}
+
+	printf("%s: %s (%d failures)\n", __func__, failed ? "FAIL" : "PASS", failed);
+
+out:
+	RK_wifi_set_ctrl_path(NULL);
+	RK_wifi_register_callback(rk_wifi_state_callback);
+}
+
+/*****************************************************************
+ *              wifi event to callback latency test              *
+ *****************************************************************/
+#define MOCK_EV_CONNECTED	"<3>CTRL-EVENT-CONNECTED - Connection to 00:11:22:33:44:55 completed [id=0 id_str=]"
+#define MOCK_EV_DISCONNECTED	"<3>CTRL-EVENT-DISCONNECTED bssid=00:11:22:33:44:55 reason=3 locally_generated=1"
+#define MOCK_EV_WRONG_KEY	"<3>CTRL-EVENT-SSID-TEMP-DISABLED id=0 ssid=\"mock\" auth_failures=1 duration=10 reason=WRONG_KEY"
+
+/* when each state was last reported */
+static volatile long long latency_cb_us[RK_WIFI_State_DHCP_OK + 1];
+
+static int rk_wifi_latency_callback(RK_WIFI_RUNNING_State_e state, RK_WIFI_INFO_Connection_s *info)
+{
+	if (state >= 0 && state <= RK_WIFI_State_DHCP_OK)
+		latency_cb_us[state] = now_us();
+
+	return 0;
+}
+
+/* us from since until state was reported, -1 if it wasn't within a second */
+static long long wait_state_cb(RK_WIFI_RUNNING_State_e state, long long since)
+{
+	for (int i = 0; i < 1000; i++) {
+		if (latency_cb_us[state] >= since)
+			return latency_cb_us[state] - since;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+//input count; events injected through the mock control socket
+void rk_wifi_event_latency(void *data)
+{
+	int count = 20, failed = 0;
+	long long start, *connected, *dhcp_ok, *disconnected;
+	RK_WIFI_RUNNING_State_e state;
+
+	if (data)
+		count = atoi(data);
+	if (count <= 0)
+		count = 20;
+
+	if (mock_ctrl_start() < 0) {
+		printf("%s: start mock ctrl socket failed\n", __func__);
+		return;
+	}
+	RK_wifi_register_callback(rk_wifi_latency_callback);
+	wpa_ctrl_mock_detach(mock_ctrl);
+	RK_wifi_set_ctrl_path(MOCK_CTRL_PATH);
+	if (wpa_ctrl_mock_wait_attached(mock_ctrl, 1000) < 0) {
+		printf("%s: monitor did not attach to the mock\n", __func__);
+		goto out;
+	}
+
+	connected = (long long *)malloc(count * sizeof(long long));
+	dhcp_ok = (long long *)malloc(count * sizeof(long long));
+	disconnected = (long long *)malloc(count * sizeof(long long));
+
+	for (int i = 0; i < count; i++) {
+		RK_wifi_connect("mock", "12345678");
+
+		start = now_us();
+		wpa_ctrl_mock_event(mock_ctrl, MOCK_EV_CONNECTED, 0);
+		connected[i] = wait_state_cb(RK_WIFI_State_CONNECTED, start);
+		dhcp_ok[i] = wait_state_cb(RK_WIFI_State_DHCP_OK, start);
+		RK_wifi_running_getState(&state);
+		if (connected[i] < 0 || dhcp_ok[i] < 0 || state != RK_WIFI_State_CONNECTED)
+			failed++;
+
+		start = now_us();
+		wpa_ctrl_mock_event(mock_ctrl, MOCK_EV_DISCONNECTED, 0);
+		disconnected[i] = wait_state_cb(RK_WIFI_State_DISCONNECTED, start);
+		if (disconnected[i] < 0)
+			failed++;
+	}
+
+	if (!failed) {
+		print_latency("CONNECTED callback", connected, count);
+		print_latency("DHCP_OK callback", dhcp_ok, count);
+		print_latency("DISCONNECTED callback", disconnected, count);
+	}
+
+	/* a wrong key ends the request, there is nothing left to cancel */
+	RK_wifi_connect("mock", "12345678");
+	start = now_us();
+	wpa_ctrl_mock_event(mock_ctrl, MOCK_EV_WRONG_KEY, 0);
+	printf("%-24s %lld us\n", "WRONG_KEY callback",
+			wait_state_cb(RK_WIFI_State_CONNECTFAILED_WRONG_KEY, start));
+	usleep(100000);
+	if (RK_wifi_cancel() == 0) {
+		printf("FAIL: request still pending after WRONG_KEY\n");
+		failed++;
+	}
+
+	/* cancel reports the failure right away instead of after the next poll */
+	RK_wifi_connect("mock", "12345678");
+	start = now_us();
+	if (RK_wifi_cancel() != 0) {
+		printf("FAIL: cancel refused while connecting\n");
+		failed++;
+	}
+	printf("%-24s %lld us\n", "cancel CONNECTFAILED", wait_state_cb(RK_WIFI_State_CONNECTFAILED, start));
+
+	printf("%s: %s (%d failures)\n", __func__, failed ? "FAIL" : "PASS", failed);
+
+	free(connected);
+	free(dhcp_ok);
+	free(disconnected);
+out:
+	RK_wifi_set_ctrl_path(NULL);
+	RK_wifi_register_callback(rk_wifi_state_callback);
+}
+
+/*****************************************************************
+ *                 softAP start and station latency              *
+ *****************************************************************/
+#define MOCK_AP_PATH	MOCK_CTRL_DIR "/wlan1"
+
+static wpa_ctrl_mock_t *mock_ap;
+
+static int mock_ap_start(void)
+{
+	if (mock_ap)
+		return 0;
+
+	mkdir(MOCK_CTRL_DIR, 0755);
+	mock_ap = wpa_ctrl_mock_start(MOCK_AP_PATH);
+	if (!mock_ap)
+		return -1;
+
+	/* up already; RELOAD, like hostapd's, sends no event, see mock_ap_expect() */
+	wpa_ctrl_mock_reply(mock_ap, "STATUS", "state=ENABLED\n", 0);
+
+	return 0;
+}
+
+static volatile long long ap_sta_cb_us;
+static volatile int ap_sta_cb_connected;
+
+static int rk_wifi_ap_sta_callback(const char *mac, int connected)
+{
+	ap_sta_cb_connected = connected;
+	ap_sta_cb_us = now_us();
+
+	return 0;
+}
+
+/* us from since until the station callback ran, -1 if not within a second */
+static long long wait_ap_sta_cb(int connected, long long since)
+{
+	for (int i = 0; i < 1000; i++) {
+		if (ap_sta_cb_us >= since && ap_sta_cb_connected == connected)
+			return ap_sta_cb_us - since;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+/*
+ * hostapd only beacons the new ssid after a RELOAD if it was SET first,
+ * RELOAD doesn't read the config file again
+ */
+static void mock_ap_expect(const char *ssid)
+{
+	char status[96];
+
+	snprintf(status, sizeof(status), "state=ENABLED\nssid[0]=%s\n", ssid);
+	wpa_ctrl_mock_reply_after(mock_ap, "RELOAD", "STATUS", status, 0);
+	wpa_ctrl_mock_clear_history(mock_ap);
+}
+
+/* what the last start sent: 0 SET ssid and psk, then RELOAD; 1 nothing; -1 neither */
+static int mock_ap_check(const char *ssid, const char *psk)
+{
+	char cmd[128], want[128];
+	long long set_us, psk_us, reload_us;
+
+	if (wpa_ctrl_mock_last(mock_ap, "RELOAD", cmd, sizeof(cmd), &reload_us) < 0)
+		return wpa_ctrl_mock_last(mock_ap, "SET ", cmd, sizeof(cmd), NULL) < 0 ? 1 : -1;
+
+	snprintf(want, sizeof(want), "SET ssid %s", ssid);
+	if (wpa_ctrl_mock_last(mock_ap, "SET ssid ", cmd, sizeof(cmd), &set_us) < 0 || strcmp(cmd, want))
+		return -1;
+	snprintf(want, sizeof(want), "SET wpa_passphrase %s", psk);
+	if (wpa_ctrl_mock_last(mock_ap, "SET wpa_passphrase ", cmd, sizeof(cmd), &psk_us) < 0 || strcmp(cmd, want))
+		return -1;
+
+	return set_us <= reload_us && psk_us <= reload_us ? 0 : -1;
+}
+
+//input count; a mock hostapd control socket stands in for the daemon
+void rk_wifi_ap_latency(void *data)
+{
+	static const char *how[] = { "started", "reloaded", "unchanged" };
+	int count = 20, failed = 0;
+	long long start, *joined, *left;
+	RK_WIFI_AP_TIME_s time;
+	char ssid[32];
+
+	if (data)
+		count = atoi(data);
+	if (count <= 0)
+		count = 20;
+
+	/* the config is still written where the real hostapd reads it */
+	mkdir("/userdata", 0755);
+	mkdir("/userdata/bin", 0755);
+
+	if (mock_ap_start() < 0) {
+		printf("%s: start mock hostapd failed\n", __func__);
+		return;
+	}
+	RK_wifi_set_ap_ctrl_dir(MOCK_CTRL_DIR);
+	RK_wifi_register_ap_callback(rk_wifi_ap_sta_callback);
+
+	/* a new ssid every run, so the first start always has a change to apply */
+	snprintf(ssid, sizeof(ssid), "rk_mock_ap_%ld", (long)now_us() % 100000);
+	for (int i = 0; i < 3; i++) {
+		if (i == 2)
+			strcat(ssid, "_2");
+		mock_ap_expect(ssid);
+		if (RK_wifi_enable_ap(ssid, "12345678", NULL) < 0 || RK_wifi_get_ap_start_time(&time) < 0) {
+			printf("FAIL: softap %s didn't come up\n", ssid);
+			failed++;
+			continue;
+		}
+		printf("softap %-24s %s, %d ms to up\n", ssid, how[time.how % 3], time.start_ms);
+		if (time.how != (i == 1 ? 2 : 1)) {
+			printf("FAIL: expected %s\n", how[i == 1 ? 2 : 1]);
+			failed++;
+		}
+		if (mock_ap_check(ssid, "12345678") != (i == 1 ? 1 : 0)) {
+			printf("FAIL: %s not pushed to hostapd before RELOAD\n", ssid);
+			failed++;
+		}
+	}
+
+	joined = (long long *)malloc(count * sizeof(long long));
+	left = (long long *)malloc(count * sizeof(long long));
+	for (int i = 0; i < count; i++) {
+		start = now_us();
+		wpa_ctrl_mock_event(mock_ap, "<3>AP-STA-CONNECTED 02:00:00:00:00:01", 0);
+		joined[i] = wait_ap_sta_cb(1, start);
+
+		start = now_us();
+		wpa_ctrl_mock_event(mock_ap, "<3>AP-STA-DISCONNECTED 02:00:00:00:00:01", 0);
+		left[i] = wait_ap_sta_cb(0, start);
+		if (joined[i] < 0 || left[i] < 0)
+			failed++;
+	}
+	if (!failed) {
+		print_latency("station join callback", joined, count);
+		print_latency("station leave callback", left, count);
+	}
+	printf("%s: %s (%d failures)\n", __func__, failed ? "FAIL" : "PASS", failed);
+
+	free(joined);
+	free(left);
+	RK_wifi_register_ap_callback(NULL);
+	RK_wifi_set_ap_ctrl_dir(NULL);
+}
@@ -21,6 +21,13 @@ void rk_wifi_cancel(void *data);
 void rk_wifi_forget_with_ssid(void *data);
 void rk_wifi_connect1(void *data);
 void rk_wifi_disconnect(void *data);
+void rk_wifi_scan_latency(void *data);
+void rk_wifi_ctrl_latency(void *data);
+void rk_wifi_scan_json_bench(void *data);
+void rk_wifi_fast_reconnect_test(void *data);
+void rk_wifi_bringup_time(void *data);
+void rk_wifi_event_latency(void *data);
+void rk_wifi_ap_latency(void *data);
 
 #ifdef __cplusplus
 }
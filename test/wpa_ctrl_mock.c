@@ -0,0 +1,553 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "wpa_ctrl_mock.h"
+
+#define MOCK_PENDING_MAX	256
+#define MOCK_HISTORY_MAX	32
+
+typedef struct {
+	char *prefix;
+	char *text;
+	int delay_ms;
+	int trigger;	/* text is an event for the monitor, not the reply */
+	char *after;	/* a reply that waits for a request matching this */
+} mock_rule_t;
+
+typedef struct {
+	long long due_us;
+	struct sockaddr_un to;
+	socklen_t tolen;
+	char *text;
+} mock_pending_t;
+
+typedef struct {
+	char cmd[128];
+	long long us;
+} mock_history_t;
+
+struct wpa_ctrl_mock {
+	char path[108];
+	int fd;
+	int wake[2];
+	int stopping;
+	pthread_t tid;
+	pthread_mutex_t lock;
+
+	mock_rule_t *rules;
+	int rule_count;
+	int latency_ms;
+
+	mock_pending_t pending[MOCK_PENDING_MAX];
+	int pending_count;
+
+	/* the client that sent ATTACH gets the events */
+	struct sockaddr_un mon;
+	socklen_t mon_len;
+
+	mock_history_t history[MOCK_HISTORY_MAX];
+	int history_next;
+};
+
+long long wpa_ctrl_mock_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * prefix matches whole words of the request: "SCAN" is SCAN and "SCAN
+ * freq=2412", not SCAN_RESULTS. A prefix ending in a space may be
+ * followed by anything.
+ */
+static int mock_match(const char *cmd, const char *prefix)
+{
+	size_t n = strlen(prefix);
+
+	if (strncmp(cmd, prefix, n))
+		return 0;
+
+	return n == 0 || cmd[n] == '\0' || cmd[n] == ' ' || prefix[n - 1] == ' ';
+}
+
+/* under lock */
+static int mock_send_locked(wpa_ctrl_mock_t *mock, const char *text,
+		const struct sockaddr_un *to, socklen_t tolen, int delay_ms)
+{
+	mock_pending_t *p;
+
+	if (delay_ms <= 0)
+		return sendto(mock->fd, text, strlen(text), 0, (const struct sockaddr *)to, tolen) < 0 ? -1 : 0;
+
+	if (mock->pending_count >= MOCK_PENDING_MAX)
+		return -1;
+
+	p = &mock->pending[mock->pending_count++];
+	p->due_us = wpa_ctrl_mock_now_us() + delay_ms * 1000LL;
+	p->to = *to;
+	p->tolen = tolen;
+	p->text = strdup(text);
+
+	/* the server may be sleeping past this one's due time */
+	write(mock->wake[1], "w", 1);
+	return 0;
+}
+
+/* under lock: send what is due, return ms until the next one or -1 */
+static int mock_flush_locked(wpa_ctrl_mock_t *mock)
+{
+	long long now = wpa_ctrl_mock_now_us(), next = -1;
+	int i = 0;
+
+	while (i < mock->pending_count) {
+		mock_pending_t *p = &mock->pending[i];
+
+		if (p->due_us > now) {
+			if (next < 0 || p->due_us < next)
+				next = p->due_us;
+			i++;
+			continue;
+		}
+
+		sendto(mock->fd, p->text, strlen(p->text), 0, (struct sockaddr *)&p->to, p->tolen);
+		free(p->text);
+		/* keep the order they were queued in */
+		memmove(p, p + 1, (mock->pending_count - i - 1) * sizeof(*p));
+		mock->pending_count--;
+	}
+
+	return next < 0 ? -1 : (int)((next - now + 999) / 1000);
+}
+
+/* rule i stops waiting: it replaces the reply for its prefix and wins from now on */
+static void mock_wake_locked(wpa_ctrl_mock_t *mock, int i)
+{
+	mock_rule_t r = mock->rules[i];
+
+	free(r.after);
+	r.after = NULL;
+	memmove(&mock->rules[i], &mock->rules[i + 1], (mock->rule_count - i - 1) * sizeof(r));
+	mock->rule_count--;
+
+	for (i = 0; i < mock->rule_count; i++) {
+		mock_rule_t *old = &mock->rules[i];
+
+		if (!old->trigger && !old->after && !strcmp(old->prefix, r.prefix)) {
+			free(old->prefix);
+			free(old->text);
+			memmove(old, old + 1, (mock->rule_count - i - 1) * sizeof(r));
+			mock->rule_count--;
+			break;
+		}
+	}
+	mock->rules[mock->rule_count++] = r;
+}
+
+static void mock_handle(wpa_ctrl_mock_t *mock, const char *cmd,
+		const struct sockaddr_un *from, socklen_t fromlen)
+{
+	const char *reply = "OK\n";
+	mock_history_t *h;
+	int delay = 0, i;
+
+	pthread_mutex_lock(&mock->lock);
+
+	h = &mock->history[mock->history_next];
+	mock->history_next = (mock->history_next + 1) % MOCK_HISTORY_MAX;
+	snprintf(h->cmd, sizeof(h->cmd), "%s", cmd);
+	h->us = wpa_ctrl_mock_now_us();
+
+	if (!strcmp(cmd, "ATTACH")) {
+		mock->mon = *from;
+		mock->mon_len = fromlen;
+	} else if (!strcmp(cmd, "DETACH")) {
+		mock->mon_len = 0;
+	} else {
+		for (i = mock->rule_count - 1; i >= 0; i--) {
+			mock_rule_t *r = &mock->rules[i];
+
+			if (!r->trigger && !r->after && mock_match(cmd, r->prefix)) {
+				reply = r->text;
+				delay = r->delay_ms;
+				break;
+			}
+		}
+	}
+	mock_send_locked(mock, reply, from, fromlen, delay + mock->latency_ms);
+
+	for (i = 0; i < mock->rule_count; i++) {
+		if (mock->rules[i].after && mock_match(cmd, mock->rules[i].after))
+			mock_wake_locked(mock, i--);
+	}
+
+	for (i = 0; i < mock->rule_count && mock->mon_len; i++) {
+		mock_rule_t *r = &mock->rules[i];
+
+		if (r->trigger && mock_match(cmd, r->prefix))
+			mock_send_locked(mock, r->text, &mock->mon, mock->mon_len, r->delay_ms);
+	}
+
+	pthread_mutex_unlock(&mock->lock);
+}
+
+static void *mock_thread(void *arg)
+{
+	wpa_ctrl_mock_t *mock = (wpa_ctrl_mock_t *)arg;
+	struct pollfd pfd[2];
+	struct sockaddr_un from;
+	socklen_t fromlen;
+	char buf[1024];
+	int timeout, len;
+
+	prctl(PR_SET_NAME, "wpa_ctrl_mock");
+
+	pfd[0].fd = mock->fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = mock->wake[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		pthread_mutex_lock(&mock->lock);
+		timeout = mock_flush_locked(mock);
+		pthread_mutex_unlock(&mock->lock);
+
+		if (poll(pfd, 2, timeout) < 0 && errno != EINTR)
+			break;
+
+		if (pfd[1].revents & POLLIN) {
+			read(mock->wake[0], buf, sizeof(buf));
+			if (mock->stopping)
+				break;
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			fromlen = sizeof(from);
+			len = recvfrom(mock->fd, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &fromlen);
+			if (len < 0)
+				continue;
+			buf[len] = '\0';
+			mock_handle(mock, buf, &from, fromlen);
+		}
+	}
+
+	return NULL;
+}
+
+static int mock_add_rule(wpa_ctrl_mock_t *mock, const char *prefix, const char *text,
+		int delay_ms, int trigger, const char *after)
+{
+	mock_rule_t *rules;
+	int i;
+
+	pthread_mutex_lock(&mock->lock);
+
+	/* a new reply for the same prefix replaces the old one */
+	for (i = 0; !trigger && !after && i < mock->rule_count; i++) {
+		mock_rule_t *r = &mock->rules[i];
+
+		if (!r->trigger && !r->after && !strcmp(r->prefix, prefix)) {
+			free(r->text);
+			r->text = strdup(text);
+			r->delay_ms = delay_ms;
+			/* and moves to the end, so it wins over shorter prefixes again */
+			if (i != mock->rule_count - 1) {
+				mock_rule_t tmp = *r;
+
+				memmove(r, r + 1, (mock->rule_count - i - 1) * sizeof(*r));
+				mock->rules[mock->rule_count - 1] = tmp;
+			}
+			pthread_mutex_unlock(&mock->lock);
+			return 0;
+		}
+	}
+
+	rules = (mock_rule_t *)realloc(mock->rules, (mock->rule_count + 1) * sizeof(*rules));
+	if (!rules) {
+		pthread_mutex_unlock(&mock->lock);
+		return -1;
+	}
+	mock->rules = rules;
+	rules[mock->rule_count].prefix = strdup(prefix);
+	rules[mock->rule_count].text = strdup(text);
+	rules[mock->rule_count].delay_ms = delay_ms;
+	rules[mock->rule_count].trigger = trigger;
+	rules[mock->rule_count].after = after ? strdup(after) : NULL;
+	mock->rule_count++;
+
+	pthread_mutex_unlock(&mock->lock);
+	return 0;
+}
+
+int wpa_ctrl_mock_reply(wpa_ctrl_mock_t *mock, const char *prefix, const char *reply, int delay_ms)
+{
+	return mock_add_rule(mock, prefix, reply, delay_ms, 0, NULL);
+}
+
+int wpa_ctrl_mock_trigger(wpa_ctrl_mock_t *mock, const char *prefix, const char *event, int delay_ms)
+{
+	return mock_add_rule(mock, prefix, event, delay_ms, 1, NULL);
+}
+
+int wpa_ctrl_mock_reply_after(wpa_ctrl_mock_t *mock, const char *after, const char *prefix,
+		const char *reply, int delay_ms)
+{
+	return mock_add_rule(mock, prefix, reply, delay_ms, 0, after);
+}
+
+int wpa_ctrl_mock_event(wpa_ctrl_mock_t *mock, const char *event, int delay_ms)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&mock->lock);
+	if (mock->mon_len)
+		ret = mock_send_locked(mock, event, &mock->mon, mock->mon_len, delay_ms);
+	pthread_mutex_unlock(&mock->lock);
+
+	return ret;
+}
+
+void wpa_ctrl_mock_set_latency(wpa_ctrl_mock_t *mock, int delay_ms)
+{
+	pthread_mutex_lock(&mock->lock);
+	mock->latency_ms = delay_ms;
+	pthread_mutex_unlock(&mock->lock);
+}
+
+#define MOCK_SCAN_HEADER	"bssid / frequency / signal level / flags / ssid\n"
+
+int wpa_ctrl_mock_scan_aps(wpa_ctrl_mock_t *mock, int aps)
+{
+	char *buf;
+	int len, size, ret;
+
+	if (aps <= 0)
+		return wpa_ctrl_mock_reply(mock, "SCAN_RESULTS", MOCK_SCAN_HEADER
+				"00:11:22:33:44:55\t2412\t-40\t[WPA2-PSK-CCMP][ESS]\tmock\n", 0);
+
+	size = sizeof(MOCK_SCAN_HEADER) + aps * 96;
+	buf = (char *)malloc(size);
+	if (!buf)
+		return -1;
+
+	len = snprintf(buf, size, MOCK_SCAN_HEADER);
+	for (int i = 0; i < aps && len < size; i++) {
+		/* mix in what the supplicant escapes: quotes and non-ascii (utf-8 "\xe6\xb5\x8b") */
+		len += snprintf(buf + len, size - len,
+				"02:00:00:00:%02x:%02x\t%d\t%d\t%s\t%s%03d\n",
+				(i >> 8) & 0xff, i & 0xff, i % 2 ? 5180 : 2437, -30 - i % 60,
+				i % 4 ? "[WPA2-PSK-CCMP][ESS]" : "[ESS]",
+				i % 3 ? "ap_" : (i % 2 ? "\\\"q\\\"_" : "\\xe6\\xb5\\x8b_"), i);
+	}
+
+	ret = wpa_ctrl_mock_reply(mock, "SCAN_RESULTS", buf, 0);
+	free(buf);
+	return ret;
+}
+
+void wpa_ctrl_mock_detach(wpa_ctrl_mock_t *mock)
+{
+	pthread_mutex_lock(&mock->lock);
+	mock->mon_len = 0;
+	pthread_mutex_unlock(&mock->lock);
+}
+
+int wpa_ctrl_mock_wait_attached(wpa_ctrl_mock_t *mock, int timeout_ms)
+{
+	socklen_t attached = 0;
+
+	for (int i = 0; i <= timeout_ms; i++) {
+		pthread_mutex_lock(&mock->lock);
+		attached = mock->mon_len;
+		pthread_mutex_unlock(&mock->lock);
+		if (attached)
+			return 0;
+		usleep(1000);
+	}
+
+	return -1;
+}
+
+int wpa_ctrl_mock_last(wpa_ctrl_mock_t *mock, const char *prefix, char *cmd, int len, long long *us)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&mock->lock);
+	for (int n = 1; n <= MOCK_HISTORY_MAX; n++) {
+		mock_history_t *h = &mock->history[(mock->history_next - n + MOCK_HISTORY_MAX) % MOCK_HISTORY_MAX];
+
+		if (h->us && mock_match(h->cmd, prefix)) {
+			if (cmd)
+				snprintf(cmd, len, "%s", h->cmd);
+			if (us)
+				*us = h->us;
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&mock->lock);
+
+	return ret;
+}
+
+void wpa_ctrl_mock_clear_history(wpa_ctrl_mock_t *mock)
+{
+	pthread_mutex_lock(&mock->lock);
+	memset(mock->history, 0, sizeof(mock->history));
+	pthread_mutex_unlock(&mock->lock);
+}
+
+/* \n, \t and \\ in script text */
+static void mock_unescape(char *s)
+{
+	char *out = s;
+
+	for (; *s; s++) {
+		if (*s == '\\' && s[1]) {
+			s++;
+			*out++ = *s == 'n' ? '\n' : *s == 't' ? '\t' : *s;
+		} else {
+			*out++ = *s;
+		}
+	}
+	*out = '\0';
+}
+
+int wpa_ctrl_mock_load(wpa_ctrl_mock_t *mock, const char *script)
+{
+	char line[4096], verb[16], prefix[128];
+	int delay, pos, count = 0, lineno = 0, ret = 0;
+	FILE *fp;
+
+	fp = fopen(script, "r");
+	if (!fp)
+		return -1;
+
+	while (ret == 0 && fgets(line, sizeof(line), fp)) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '#' || sscanf(line, "%15s", verb) != 1)
+			continue;
+
+		if (!strcmp(verb, "reply") || !strcmp(verb, "trigger")) {
+			if (sscanf(line, "%*s %d %127s %n", &delay, prefix, &pos) != 2) {
+				ret = -1;
+				break;
+			}
+			mock_unescape(line + pos);
+			ret = mock_add_rule(mock, prefix, line + pos, delay, verb[0] == 't', NULL);
+		} else if (!strcmp(verb, "event")) {
+			if (sscanf(line, "%*s %d %n", &delay, &pos) != 1) {
+				ret = -1;
+				break;
+			}
+			mock_unescape(line + pos);
+			wpa_ctrl_mock_event(mock, line + pos, delay);
+		} else if (!strcmp(verb, "latency") && sscanf(line, "%*s %d", &delay) == 1) {
+			wpa_ctrl_mock_set_latency(mock, delay);
+		} else if (!strcmp(verb, "scan_aps") && sscanf(line, "%*s %d", &delay) == 1) {
+			ret = wpa_ctrl_mock_scan_aps(mock, delay);
+		} else {
+			ret = -1;
+		}
+		count++;
+	}
+	fclose(fp);
+
+	if (ret < 0) {
+		printf("%s: %s:%d doesn't parse\n", __func__, script, lineno);
+		return -1;
+	}
+	return count;
+}
+
+wpa_ctrl_mock_t *wpa_ctrl_mock_start(const char *path)
+{
+	wpa_ctrl_mock_t *mock;
+	struct sockaddr_un addr;
+
+	mock = (wpa_ctrl_mock_t *)calloc(1, sizeof(*mock));
+	if (!mock)
+		return NULL;
+
+	snprintf(mock->path, sizeof(mock->path), "%s", path);
+	pthread_mutex_init(&mock->lock, NULL);
+	mock->wake[0] = mock->wake[1] = -1;
+
+	unlink(path);
+	mock->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (mock->fd < 0)
+		goto fail;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (bind(mock->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		printf("%s: bind %s failed: %s\n", __func__, path, strerror(errno));
+		goto fail;
+	}
+	if (pipe(mock->wake) < 0)
+		goto fail;
+
+	wpa_ctrl_mock_reply(mock, "PING", "PONG\n", 0);
+	wpa_ctrl_mock_reply(mock, "STATUS",
+			"bssid=00:11:22:33:44:55\nfreq=2412\nssid=mock\nid=0\nmode=station\n"
+			"pairwise_cipher=CCMP\ngroup_cipher=CCMP\nkey_mgmt=WPA2-PSK\n"
+			"wpa_state=COMPLETED\nip_address=192.168.100.2\naddress=66:77:88:99:aa:bb\n", 0);
+	wpa_ctrl_mock_reply(mock, "LIST_NETWORKS",
+			"network id / ssid / bssid / flags\n0\tmock\tany\t[CURRENT]\n1\tother\tany\t\n", 0);
+	wpa_ctrl_mock_reply(mock, "ADD_NETWORK", "2\n", 0);
+	wpa_ctrl_mock_scan_aps(mock, 0);
+
+	if (pthread_create(&mock->tid, NULL, mock_thread, mock) != 0)
+		goto fail;
+
+	return mock;
+
+fail:
+	if (mock->fd >= 0)
+		close(mock->fd);
+	if (mock->wake[0] >= 0) {
+		close(mock->wake[0]);
+		close(mock->wake[1]);
+	}
+	unlink(path);
+	free(mock);
+	return NULL;
+}
+
+void wpa_ctrl_mock_stop(wpa_ctrl_mock_t *mock)
+{
+	if (!mock)
+		return;
+
+	mock->stopping = 1;
+	write(mock->wake[1], "s", 1);
+	pthread_join(mock->tid, NULL);
+
+	close(mock->fd);
+	close(mock->wake[0]);
+	close(mock->wake[1]);
+	unlink(mock->path);
+
+	for (int i = 0; i < mock->rule_count; i++) {
+		free(mock->rules[i].prefix);
+		free(mock->rules[i].text);
+		free(mock->rules[i].after);
+	}
+	free(mock->rules);
+	for (int i = 0; i < mock->pending_count; i++)
+		free(mock->pending[i].text);
+	pthread_mutex_destroy(&mock->lock);
+	free(mock);
+}
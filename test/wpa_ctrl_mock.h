@@ -0,0 +1,82 @@
+#ifndef __WPA_CTRL_MOCK_H__
+#define __WPA_CTRL_MOCK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stand-in for a wpa_supplicant (or hostapd) control socket, for tests
+ * and benchmarks on machines without wifi. It answers requests on a unix
+ * datagram socket the way the daemon does, remembers the client that
+ * sent ATTACH and sends it events.
+ *
+ * Replies come from rules: the newest rule whose prefix matches the
+ * request wins, anything unmatched gets "OK". A prefix matches whole
+ * words, "SCAN" is not SCAN_RESULTS; one ending in a space ("SCAN ")
+ * matches whatever follows it. A new mock already knows
+ * PING, STATUS (associated to "mock" on 2412 MHz), LIST_NETWORKS,
+ * ADD_NETWORK and SCAN_RESULTS (one AP).
+ */
+typedef struct wpa_ctrl_mock wpa_ctrl_mock_t;
+
+/* serve at path (replacing whatever is there), NULL on failure */
+wpa_ctrl_mock_t *wpa_ctrl_mock_start(const char *path);
+void wpa_ctrl_mock_stop(wpa_ctrl_mock_t *mock);
+
+/* answer requests matching prefix with reply, delay_ms after they arrive */
+int wpa_ctrl_mock_reply(wpa_ctrl_mock_t *mock, const char *prefix, const char *reply, int delay_ms);
+
+/* after a request matching prefix, send event to the monitor delay_ms later */
+int wpa_ctrl_mock_trigger(wpa_ctrl_mock_t *mock, const char *prefix, const char *event, int delay_ms);
+
+/*
+ * Once a request matching after has been answered, answer prefix with
+ * reply instead of the rule it had, like a daemon whose state changed.
+ */
+int wpa_ctrl_mock_reply_after(wpa_ctrl_mock_t *mock, const char *after, const char *prefix,
+		const char *reply, int delay_ms);
+
+/* send event ("<3>CTRL-EVENT-...") to the monitor delay_ms from now, -1 if none attached */
+int wpa_ctrl_mock_event(wpa_ctrl_mock_t *mock, const char *event, int delay_ms);
+
+/* extra delay on every reply, like a busy daemon */
+void wpa_ctrl_mock_set_latency(wpa_ctrl_mock_t *mock, int delay_ms);
+
+/* SCAN_RESULTS lists aps synthetic APs, 0 restores the single default one */
+int wpa_ctrl_mock_scan_aps(wpa_ctrl_mock_t *mock, int aps);
+
+/* forget the monitor, e.g. before a client is expected to attach anew */
+void wpa_ctrl_mock_detach(wpa_ctrl_mock_t *mock);
+int wpa_ctrl_mock_wait_attached(wpa_ctrl_mock_t *mock, int timeout_ms);
+
+/*
+ * The last request matching prefix and when it arrived (us,
+ * CLOCK_MONOTONIC). Returns -1 if there was none since the last
+ * wpa_ctrl_mock_clear_history().
+ */
+int wpa_ctrl_mock_last(wpa_ctrl_mock_t *mock, const char *prefix, char *cmd, int len, long long *us);
+void wpa_ctrl_mock_clear_history(wpa_ctrl_mock_t *mock);
+
+/*
+ * Load rules from a script, one per line ('#' starts a comment, \n \t
+ * and \\ are unescaped in text):
+ *
+ *   reply <delay_ms> <prefix> <text>
+ *   trigger <delay_ms> <prefix> <event>
+ *   event <delay_ms> <event>
+ *   latency <delay_ms>
+ *   scan_aps <count>
+ *
+ * Returns the number of rules loaded, -1 if the file can't be read or a
+ * line doesn't parse.
+ */
+int wpa_ctrl_mock_load(wpa_ctrl_mock_t *mock, const char *script);
+
+long long wpa_ctrl_mock_now_us(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif